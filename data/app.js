@@ -1,5 +1,7 @@
 let latestState = null;
+let pollTimer = null;
 let settingsDirty = false;
+let mqttDirty = false;
 let firmwareReleases = [];
 
 const MOTION_NAMES = {
@@ -79,9 +81,15 @@ function renderState(state) {
   document.getElementById('chipA0').textContent = Number(state.a0Raw ?? 0).toFixed(0);
 
   document.getElementById('motionName').textContent = MOTION_NAMES[state.motion] || state.motion || '-';
-  document.getElementById('calibName').textContent = state.calibrated ? 'Выполнена' : 'Не выполнена';
+  const autoPhases = { seek_top: 'Авто: поиск верха', seek_bottom: 'Авто: поиск низа' };
+  document.getElementById('calibName').textContent =
+    autoPhases[state.autoCalibration] || (state.calibrated ? 'Выполнена' : 'Не выполнена');
   document.getElementById('posPercent').textContent = `${posPercent.toFixed(1)}%`;
   document.getElementById('targetPercentView').textContent = `${targetPercent.toFixed(1)}%`;
+  const queued = Number(state.queueDepth || 0);
+  document.getElementById('arrivalView').textContent = state.moving
+    ? `${(Number(state.arrivalMs || 0) / 1000).toFixed(1)} с${queued > 0 ? `, в очереди ${queued}` : ''}`
+    : '-';
   document.getElementById('stepsView').textContent = `${state.positionSteps} / ${state.travelSteps}`;
   document.getElementById('ipView').textContent = state.ip || '-';
   document.getElementById('rawState').textContent = JSON.stringify(state, null, 2);
@@ -89,14 +97,65 @@ function renderState(state) {
   setInputValue('travelSteps', state.travelSteps);
   setInputValue('maxSpeed', Number(state.maxSpeed || 0).toFixed(0));
   setInputValue('acceleration', Number(state.acceleration || 0).toFixed(0));
+  setInputValue('jerk', Number(state.jerk ?? 0).toFixed(0));
   setInputValue('coilHoldMs', state.coilHoldMs);
+  setInputValue('holdDutyPercent', state.holdDutyPercent ?? 100);
+  setInputValue('idleHoldDutyPercent', state.idleHoldDutyPercent ?? 0);
   setCheckboxValue('reverseDirection', state.reverseDirection);
   setCheckboxValue('wifiModemSleep', state.wifiModemSleep);
+  setCheckboxValue('wifiFastConnect', state.wifiFastConnect ?? true);
+  setTextValue('wifiStaticIp', state.wifiStaticIp || '');
+  setTextValue('wifiGateway', state.wifiGateway || '');
+  setCheckboxValue('idleLightSleep', state.idleLightSleep);
+  setInputValue('wakeLatencyMs', state.wakeLatencyMs ?? 300);
+  setCheckboxValue('stallDetection', state.stallDetection);
+  setInputValue('stallThresholdPercent', state.stallThresholdPercent ?? 40);
+  setTextValue('groups', groupsFromMask(state.groupMask || 0));
   setCheckboxValue('topOverdriveEnabled', state.topOverdriveEnabled);
   setInputValue('topOverdrivePercent', Number(state.topOverdrivePercent ?? 10).toFixed(0));
+  setCheckboxValue('driftAutoTune', state.driftAutoTune);
+  setInputValue('backlashSteps', state.backlashSteps ?? 0);
+  setInputValue('openStepScale', Number(state.openStepScale ?? 1).toFixed(4));
+  setInputValue('closeStepScale', Number(state.closeStepScale ?? 1).toFixed(4));
+  setInputValue('adcSampleIntervalMs', state.adcSampleIntervalMs ?? 50);
   setTextValue('fwRepo', state.firmwareRepo || '');
   setTextValue('fwAssetName', state.firmwareAssetName || 'firmware.bin');
   setTextValue('fwFsAssetName', state.firmwareFsAssetName || 'littlefs.bin');
+  renderMqttConfig(state);
+  renderOtaProgress(state);
+}
+
+const MQTT_STATE_NAMES = {
+  off: 'выключен',
+  waiting: 'ожидание переподключения',
+  connecting: 'подключение',
+  connected: 'подключён',
+};
+
+function renderMqttConfig(state) {
+  if (!mqttDirty) {
+    setCheckboxValue('mqttEnabled', state.mqttEnabled);
+    setCheckboxValue('mqttDiscovery', state.mqttDiscovery ?? true);
+    setTextValue('mqttHost', state.mqttHost || '');
+    setTextValue('mqttPort', state.mqttPort ?? 1883);
+    setTextValue('mqttUser', state.mqttUser || '');
+    setTextValue('mqttBaseTopic', state.mqttBaseTopic || '');
+  }
+  const status = document.getElementById('mqttStatusText');
+  if (!status) return;
+  const name = MQTT_STATE_NAMES[state.mqttState] || state.mqttState || '-';
+  const error = state.mqttLastError ? `, ошибка: ${state.mqttLastError}` : '';
+  status.textContent = `MQTT ${name} (подключений ${state.mqttConnects ?? 0}, публикаций ${state.mqttPublished ?? 0}, команд ${state.mqttCommands ?? 0}${error})`;
+}
+
+function renderOtaProgress(state) {
+  const fw = document.getElementById('fwStatusText');
+  if (!fw || !state.otaRunning) return;
+  const total = Number(state.otaTotalBytes || 0);
+  const done = Number(state.otaBytes || 0);
+  const percent = total > 0 ? ((done * 100) / total).toFixed(0) : '0';
+  const speed = (Number(state.otaBytesPerSec || 0) / 1024).toFixed(1);
+  fw.textContent = `OTA ${state.otaTarget || ''}: ${state.otaPhase}, ${percent}% (${speed} KB/s, попытка ${state.otaAttempt})`;
 }
 
 async function refresh() {
@@ -108,6 +167,39 @@ async function refresh() {
   }
 }
 
+function startPolling() {
+  if (pollTimer) return;
+  refresh();
+  pollTimer = setInterval(refresh, 800);
+}
+
+function stopPolling() {
+  if (!pollTimer) return;
+  clearInterval(pollTimer);
+  pollTimer = null;
+}
+
+// The device pushes a full "state" event on connect and "patch" events with changed fields.
+// EventSource reconnects by itself; polling covers the gap until the next "state" arrives.
+function connectEvents() {
+  if (!window.EventSource) {
+    startPolling();
+    return;
+  }
+  const source = new EventSource('/api/events');
+  source.addEventListener('state', (event) => {
+    stopPolling();
+    renderState(JSON.parse(event.data));
+  });
+  source.addEventListener('patch', (event) => {
+    if (!latestState) return;
+    renderState({ ...latestState, ...JSON.parse(event.data) });
+  });
+  source.onerror = () => {
+    startPolling();
+  };
+}
+
 async function moveAction(action, extra = {}) {
   try {
     const state = await req('/api/move', 'POST', { action, ...extra });
@@ -118,6 +210,32 @@ async function moveAction(action, extra = {}) {
   }
 }
 
+// groupMask bit g - 1 is group g; the form shows "1, 3".
+function groupsFromMask(mask) {
+  const groups = [];
+  for (let g = 1; g <= 16; g += 1) {
+    if (mask & (1 << (g - 1))) groups.push(g);
+  }
+  return groups.join(', ');
+}
+
+function maskFromGroups(text) {
+  return text.split(',').reduce((mask, part) => {
+    const g = parseInt(part, 10);
+    return g >= 1 && g <= 16 ? mask | (1 << (g - 1)) : mask;
+  }, 0);
+}
+
+async function groupMove(action) {
+  const group = parseInt(document.getElementById('groupNumber').value, 10);
+  try {
+    await req('/api/group/move', 'POST', { group, action });
+    setStatus(`Группа ${group}: ${action}`);
+  } catch (error) {
+    setStatus(`Ошибка группы: ${error.message}`, true);
+  }
+}
+
 function moveOpen() {
   moveAction('open');
 }
@@ -140,6 +258,15 @@ function moveToPercent() {
   moveAction('set', { percent });
 }
 
+function movePreset() {
+  const name = document.getElementById('presetName').value;
+  if (!name) {
+    setStatus('Пресеты не заданы', true);
+    return;
+  }
+  moveAction('preset', { name });
+}
+
 function jogUp() {
   const steps = Math.abs(parseInt(document.getElementById('jogSteps').value, 10) || 0);
   if (!steps) {
@@ -206,6 +333,16 @@ async function setBottom() {
   }
 }
 
+async function autoCalibrate() {
+  try {
+    const state = await req('/api/calibrate', 'POST', { action: 'auto' });
+    renderState(state);
+    setStatus('Автокалибровка: поиск верхнего упора');
+  } catch (error) {
+    setStatus(`Ошибка калибровки: ${error.message}`, true);
+  }
+}
+
 async function resetCalibration() {
   try {
     const state = await req('/api/calibrate', 'POST', { action: 'reset' });
@@ -220,12 +357,28 @@ async function saveSettings() {
   const payload = {
     reverseDirection: document.getElementById('reverseDirection').checked,
     wifiModemSleep: document.getElementById('wifiModemSleep').checked,
+    wifiFastConnect: document.getElementById('wifiFastConnect').checked,
+    wifiStaticIp: document.getElementById('wifiStaticIp').value.trim(),
+    wifiGateway: document.getElementById('wifiGateway').value.trim(),
+    idleLightSleep: document.getElementById('idleLightSleep').checked,
+    wakeLatencyMs: Number(document.getElementById('wakeLatencyMs').value),
+    stallDetection: document.getElementById('stallDetection').checked,
+    stallThresholdPercent: Number(document.getElementById('stallThresholdPercent').value),
     topOverdriveEnabled: document.getElementById('topOverdriveEnabled').checked,
     travelSteps: Number(document.getElementById('travelSteps').value),
     maxSpeed: Number(document.getElementById('maxSpeed').value),
     acceleration: Number(document.getElementById('acceleration').value),
+    jerk: Number(document.getElementById('jerk').value),
     coilHoldMs: Number(document.getElementById('coilHoldMs').value),
+    holdDutyPercent: Number(document.getElementById('holdDutyPercent').value),
+    idleHoldDutyPercent: Number(document.getElementById('idleHoldDutyPercent').value),
     topOverdrivePercent: Number(document.getElementById('topOverdrivePercent').value),
+    driftAutoTune: document.getElementById('driftAutoTune').checked,
+    backlashSteps: Number(document.getElementById('backlashSteps').value),
+    openStepScale: Number(document.getElementById('openStepScale').value),
+    closeStepScale: Number(document.getElementById('closeStepScale').value),
+    adcSampleIntervalMs: Number(document.getElementById('adcSampleIntervalMs').value),
+    groupMask: maskFromGroups(document.getElementById('groups').value),
   };
 
   try {
@@ -275,6 +428,120 @@ async function saveFirmwareConfig() {
   }
 }
 
+async function saveMqttConfig() {
+  const payload = {
+    mqttEnabled: document.getElementById('mqttEnabled').checked,
+    mqttDiscovery: document.getElementById('mqttDiscovery').checked,
+    mqttHost: document.getElementById('mqttHost').value.trim(),
+    mqttPort: Number(document.getElementById('mqttPort').value),
+    mqttUser: document.getElementById('mqttUser').value.trim(),
+    mqttBaseTopic: document.getElementById('mqttBaseTopic').value.trim(),
+  };
+  // Empty keeps the stored password.
+  const password = document.getElementById('mqttPassword').value;
+  if (password) payload.mqttPassword = password;
+
+  try {
+    await req('/api/mqtt/config', 'POST', payload);
+    mqttDirty = false;
+    document.getElementById('mqttPassword').value = '';
+    setStatus('MQTT конфиг сохранён');
+  } catch (error) {
+    setStatus(`Ошибка MQTT конфига: ${error.message}`, true);
+  }
+}
+
+function renderPresets(payload) {
+  const presets = payload.presets || [];
+  const select = document.getElementById('presetName');
+  const selected = select.value;
+  select.innerHTML = '';
+  presets.forEach((preset) => {
+    const option = document.createElement('option');
+    option.value = preset.name;
+    option.textContent = `${preset.name} (${preset.percent}%)`;
+    select.appendChild(option);
+  });
+  if (presets.some((preset) => preset.name === selected)) select.value = selected;
+  document.getElementById('presetList').value = presets.map((preset) => JSON.stringify(preset)).join(',\n');
+}
+
+async function loadPresets() {
+  try {
+    renderPresets(await req('/api/presets'));
+  } catch (error) {
+    setStatus(`Ошибка пресетов: ${error.message}`, true);
+  }
+}
+
+async function savePresets() {
+  let presets;
+  try {
+    presets = JSON.parse(`[${document.getElementById('presetList').value}]`.replace(/^\[\s*\[([\s\S]*)\]\s*\]$/, '[$1]'));
+  } catch (_) {
+    setStatus('Пресеты: неверный JSON', true);
+    return;
+  }
+  try {
+    renderPresets(await req('/api/presets', 'POST', { presets }));
+    setStatus('Пресеты сохранены');
+  } catch (error) {
+    setStatus(`Ошибка пресетов: ${error.message}`, true);
+  }
+}
+
+function renderSchedule(schedule) {
+  document.getElementById('scheduleEnabled').checked = Boolean(schedule.scheduleEnabled);
+  document.getElementById('scheduleTimezone').value = schedule.timezone || '';
+  document.getElementById('scheduleNtpServer').value = schedule.ntpServer || '';
+  document.getElementById('scheduleLatitude').value = schedule.located ? schedule.latitude : '';
+  document.getElementById('scheduleLongitude').value = schedule.located ? schedule.longitude : '';
+  document.getElementById('scheduleRules').value = (schedule.rules || []).map((rule) => JSON.stringify(rule)).join(',\n');
+  const clock = schedule.clockSynced ? `время ${schedule.localTime}` : 'время ещё не получено по NTP';
+  const sun = schedule.sunrise ? `, восход ${schedule.sunrise}, закат ${schedule.sunset}` : '';
+  document.getElementById('scheduleStatusText').textContent =
+    `${clock}${sun}; сработало правил: ${schedule.scheduleFired ?? 0}`;
+}
+
+async function loadSchedule() {
+  try {
+    renderSchedule(await req('/api/schedule'));
+  } catch (error) {
+    setStatus(`Ошибка расписания: ${error.message}`, true);
+  }
+}
+
+async function saveSchedule() {
+  let rules;
+  try {
+    rules = JSON.parse(`[${document.getElementById('scheduleRules').value}]`.replace(/^\[\s*\[([\s\S]*)\]\s*\]$/, '[$1]'));
+  } catch (_) {
+    setStatus('Правила: неверный JSON', true);
+    return;
+  }
+  const latitude = document.getElementById('scheduleLatitude').value.trim();
+  const longitude = document.getElementById('scheduleLongitude').value.trim();
+  const payload = {
+    scheduleEnabled: document.getElementById('scheduleEnabled').checked,
+    timezone: document.getElementById('scheduleTimezone').value.trim(),
+    ntpServer: document.getElementById('scheduleNtpServer').value.trim(),
+    rules,
+  };
+  if (latitude === '') {
+    payload.latitude = null;
+  } else {
+    payload.latitude = Number(latitude);
+    payload.longitude = Number(longitude);
+  }
+
+  try {
+    renderSchedule(await req('/api/schedule', 'POST', payload));
+    setStatus('Расписание сохранено');
+  } catch (error) {
+    setStatus(`Ошибка расписания: ${error.message}`, true);
+  }
+}
+
 async function updateFirmwareLatest() {
   if (!confirm('Обновить прошивку и LittleFS до последнего релиза?')) return;
   setFwStatus('Запуск OTA latest...');
@@ -404,12 +671,20 @@ async function updateFirmwareFromUrl() {
 
 showTab('control');
 
-['travelSteps', 'maxSpeed', 'acceleration', 'coilHoldMs', 'topOverdrivePercent', 'reverseDirection', 'wifiModemSleep', 'topOverdriveEnabled'].forEach((id) => {
+['travelSteps', 'maxSpeed', 'acceleration', 'jerk', 'coilHoldMs', 'holdDutyPercent', 'idleHoldDutyPercent', 'topOverdrivePercent', 'adcSampleIntervalMs', 'reverseDirection', 'wifiModemSleep', 'wifiFastConnect', 'wifiStaticIp', 'wifiGateway', 'idleLightSleep', 'wakeLatencyMs', 'stallDetection', 'stallThresholdPercent', 'groups', 'topOverdriveEnabled', 'driftAutoTune', 'backlashSteps', 'openStepScale', 'closeStepScale'].forEach((id) => {
   const el = document.getElementById(id);
   if (!el) return;
   el.addEventListener('input', () => { settingsDirty = true; });
   el.addEventListener('change', () => { settingsDirty = true; });
 });
 
-refresh();
-setInterval(refresh, 800);
+['mqttEnabled', 'mqttDiscovery', 'mqttHost', 'mqttPort', 'mqttUser', 'mqttBaseTopic'].forEach((id) => {
+  const el = document.getElementById(id);
+  if (!el) return;
+  el.addEventListener('input', () => { mqttDirty = true; });
+  el.addEventListener('change', () => { mqttDirty = true; });
+});
+
+connectEvents();
+loadPresets();
+loadSchedule();
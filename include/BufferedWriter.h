@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace shutter {
+namespace net {
+
+// Collects the small writes ArduinoJson emits (mostly single characters) into N-byte blocks
+// before passing them to Sink::write(const uint8_t*, size_t), so a socket sees a few
+// packet-sized writes instead of one per character. A short write from the sink latches
+// failed() and drops everything after it: a stream must never continue past a gap. The
+// caller owns the buffer, so a static one keeps it off a small stack.
+template <typename Sink, size_t N>
+class BufferedWriter {
+ public:
+  BufferedWriter(Sink& sink, uint8_t (&buffer)[N]) : sink_(sink), buffer_(buffer) {}
+  ~BufferedWriter() { flush(); }
+
+  BufferedWriter(const BufferedWriter&) = delete;
+  BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+  size_t write(uint8_t c) {
+    if (used_ == N) flush();
+    if (failed_) return 0;
+    buffer_[used_++] = c;
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) {
+    size_t accepted = 0;
+    while (accepted < size && !failed_) {
+      if (used_ == N) flush();
+      // Blocks at least as large as the buffer skip the copy.
+      if (used_ == 0 && size - accepted >= N) {
+        forward(data + accepted, size - accepted);
+        if (!failed_) accepted = size;
+        break;
+      }
+      size_t take = N - used_;
+      if (take > size - accepted) take = size - accepted;
+      memcpy(buffer_ + used_, data + accepted, take);
+      used_ += take;
+      accepted += take;
+    }
+    return accepted;
+  }
+
+  size_t print(const char* text) { return write(reinterpret_cast<const uint8_t*>(text), strlen(text)); }
+
+  bool flush() {
+    if (used_ > 0 && !failed_) forward(buffer_, used_);
+    used_ = 0;
+    return !failed_;
+  }
+
+  bool failed() const { return failed_; }
+  size_t written() const { return written_; }
+
+ private:
+  void forward(const uint8_t* data, size_t size) {
+    const size_t sent = sink_.write(data, size);
+    written_ += sent;
+    if (sent != size) failed_ = true;
+  }
+
+  Sink& sink_;
+  uint8_t* buffer_;
+  size_t used_ = 0;
+  size_t written_ = 0;
+  bool failed_ = false;
+};
+
+}  // namespace net
+}  // namespace shutter
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace shutter {
+namespace group {
+
+// Move commands for a group of shutters, one UDP multicast datagram for every node on the LAN.
+// A sender repeats each command a few times; every copy counts down to the same start, so the
+// nodes start together whichever copy reached them first.
+enum class Action : uint8_t {
+  Open = 1,
+  Close = 2,
+  Stop = 3,
+  Set = 4,
+};
+
+struct Command {
+  uint32_t sender = 0;     // chip id of the node that sent it
+  uint16_t sequence = 0;   // per sender; the repeats of one command share it
+  uint16_t groups = 0;     // bit g - 1 addresses group g
+  uint32_t startInUs = 0;  // from the moment this copy was sent to the shared start
+  Action action = Action::Stop;
+  uint16_t centiPercent = 0;  // Action::Set: 0 (open) .. 10000 (closed)
+};
+
+// "SG", version, action, sender, sequence, groups, startInUs, centiPercent; big-endian.
+constexpr uint8_t kVersion = 1;
+constexpr size_t kPacketSize = 18;
+constexpr uint8_t kGroupCount = 16;
+constexpr uint16_t kMaxCentiPercent = 10000;
+
+inline void putBigEndian(uint8_t* out, uint32_t value, uint8_t bytes) {
+  for (uint8_t i = 0; i < bytes; ++i) out[i] = static_cast<uint8_t>(value >> (8 * (bytes - 1 - i)));
+}
+
+inline uint32_t getBigEndian(const uint8_t* in, uint8_t bytes) {
+  uint32_t value = 0;
+  for (uint8_t i = 0; i < bytes; ++i) value = value << 8 | in[i];
+  return value;
+}
+
+// Returns kPacketSize, or 0 when |capacity| is too small.
+inline size_t encode(const Command& command, uint8_t* out, size_t capacity) {
+  if (capacity < kPacketSize) return 0;
+  out[0] = 'S';
+  out[1] = 'G';
+  out[2] = kVersion;
+  out[3] = static_cast<uint8_t>(command.action);
+  putBigEndian(out + 4, command.sender, 4);
+  putBigEndian(out + 8, command.sequence, 2);
+  putBigEndian(out + 10, command.groups, 2);
+  putBigEndian(out + 12, command.startInUs, 4);
+  putBigEndian(out + 16, command.centiPercent, 2);
+  return kPacketSize;
+}
+
+// False for anything but a well-formed command of this version addressed to some group.
+inline bool decode(const uint8_t* in, size_t length, Command* command) {
+  if (length != kPacketSize || in[0] != 'S' || in[1] != 'G' || in[2] != kVersion) return false;
+  if (in[3] < static_cast<uint8_t>(Action::Open) || in[3] > static_cast<uint8_t>(Action::Set)) return false;
+  command->action = static_cast<Action>(in[3]);
+  command->sender = getBigEndian(in + 4, 4);
+  command->sequence = static_cast<uint16_t>(getBigEndian(in + 8, 2));
+  command->groups = static_cast<uint16_t>(getBigEndian(in + 10, 2));
+  command->startInUs = getBigEndian(in + 12, 4);
+  command->centiPercent = static_cast<uint16_t>(getBigEndian(in + 16, 2));
+  if (command->groups == 0) return false;
+  if (command->action == Action::Set && command->centiPercent > kMaxCentiPercent) return false;
+  return true;
+}
+
+// The last sequence heard from each of the most recent senders, so the repeats of a command
+// act once. A sender not seen for |Capacity| other senders is forgotten.
+template <uint8_t Capacity>
+class RecentSenders {
+ public:
+  static_assert(Capacity > 0, "remember at least one sender");
+
+  // True the first time (sender, sequence) comes by.
+  bool accept(uint32_t sender, uint16_t sequence) {
+    for (uint8_t i = 0; i < size_; ++i) {
+      if (senders_[i] != sender) continue;
+      if (sequences_[i] == sequence) return false;
+      sequences_[i] = sequence;
+      return true;
+    }
+    const uint8_t slot = size_ < Capacity ? size_++ : next_;
+    next_ = static_cast<uint8_t>((slot + 1) % Capacity);
+    senders_[slot] = sender;
+    sequences_[slot] = sequence;
+    return true;
+  }
+
+ private:
+  uint32_t senders_[Capacity] = {};
+  uint16_t sequences_[Capacity] = {};
+  uint8_t size_ = 0;
+  uint8_t next_ = 0;
+};
+
+}  // namespace group
+}  // namespace shutter
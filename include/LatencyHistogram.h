@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "StepGenerator.h"
+
+namespace shutter {
+namespace metrics {
+
+// Bucket 0 holds 0 us, bucket b holds [2^(b-1), 2^b) us; the last one takes everything from
+// 2^22 us (about 4 s) up.
+constexpr uint8_t kLatencyBuckets = 24;
+
+struct LatencySummary {
+  uint32_t count = 0;
+  uint32_t minUs = 0;
+  uint32_t maxUs = 0;
+  uint32_t meanUs = 0;
+  uint32_t p50Us = 0;
+  uint32_t p90Us = 0;
+  uint32_t p99Us = 0;
+  uint64_t sumUs = 0;
+};
+
+// Log2 histogram of section durations. record() is a handful of instructions so it can run in
+// the step ISR; percentiles are interpolated inside their bucket and clamped to min/max, which
+// keeps them within a factor of two of the truth at about 120 bytes per section.
+class LatencyHistogram {
+ public:
+  void reset() {
+    for (uint8_t i = 0; i < kLatencyBuckets; ++i) buckets_[i] = 0;
+    count_ = 0;
+    sumUs_ = 0;
+    minUs_ = UINT32_MAX;
+    maxUs_ = 0;
+  }
+
+  SHUTTER_ISR_INLINE void record(uint32_t us) {
+    if (count_ == kHalveAt) halve();
+    uint8_t bucket = 0;
+    for (uint32_t v = us; v != 0 && bucket < kLatencyBuckets - 1; v >>= 1) ++bucket;
+    ++buckets_[bucket];
+    ++count_;
+    sumUs_ += us;
+    if (us < minUs_) minUs_ = us;
+    if (us > maxUs_) maxUs_ = us;
+  }
+
+  uint32_t count() const { return count_; }
+
+  // Smallest value at or below which |permille| / 1000 of the samples lie.
+  uint32_t percentileUs(uint16_t permille) const {
+    if (count_ == 0) return 0;
+    const uint64_t rank = (static_cast<uint64_t>(count_) * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (uint8_t b = 0; b < kLatencyBuckets; ++b) {
+      if (buckets_[b] == 0) continue;
+      if (seen + buckets_[b] < rank) {
+        seen += buckets_[b];
+        continue;
+      }
+      if (b == 0) return 0;
+      const uint32_t low = 1UL << (b - 1);
+      const uint32_t high = b == kLatencyBuckets - 1 ? maxUs_ : (1UL << b) - 1;
+      const uint32_t estimate =
+          low + static_cast<uint32_t>(static_cast<uint64_t>(high - low) * (rank - seen) / buckets_[b]);
+      if (estimate < minUs_) return minUs_;
+      return estimate > maxUs_ ? maxUs_ : estimate;
+    }
+    return maxUs_;
+  }
+
+  LatencySummary summarize() const {
+    LatencySummary out;
+    out.count = count_;
+    if (count_ == 0) return out;
+    out.minUs = minUs_;
+    out.maxUs = maxUs_;
+    out.sumUs = sumUs_;
+    out.meanUs = static_cast<uint32_t>(sumUs_ / count_);
+    out.p50Us = percentileUs(500);
+    out.p90Us = percentileUs(900);
+    out.p99Us = percentileUs(990);
+    return out;
+  }
+
+ private:
+  // A loop() pass is recorded thousands of times a second; halving the counts before they wrap
+  // keeps the percentiles meaningful over weeks of uptime.
+  static constexpr uint32_t kHalveAt = 1UL << 31;
+
+  void halve() {
+    count_ = 0;
+    for (uint8_t i = 0; i < kLatencyBuckets; ++i) {
+      buckets_[i] >>= 1;
+      count_ += buckets_[i];
+    }
+    sumUs_ >>= 1;
+  }
+
+  uint32_t buckets_[kLatencyBuckets] = {};
+  uint32_t count_ = 0;
+  uint64_t sumUs_ = 0;
+  uint32_t minUs_ = UINT32_MAX;
+  uint32_t maxUs_ = 0;
+};
+
+}  // namespace metrics
+}  // namespace shutter
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace shutter {
+namespace motion {
+
+// A move as the API asked for it, in logical steps; the raw target is worked out when the
+// move starts, so a queued move survives a re-anchored step counter.
+struct MotionCommand {
+  long target = 0;
+  bool open = false;  // may run into the top overdrive and re-anchor there
+  // A preset's ramp in steps/s and steps/s^2; 0 runs on the channel's settings.
+  uint16_t maxSpeed = 0;
+  uint16_t acceleration = 0;
+};
+
+// Moves waiting for a channel, oldest first. Fixed capacity; push() refuses once it is full.
+template <uint8_t Capacity>
+class MotionQueue {
+ public:
+  static_assert(Capacity > 0, "a motion queue needs room for one move");
+
+  uint8_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  bool full() const { return size_ == Capacity; }
+  void clear() { size_ = 0; }
+
+  const MotionCommand& front() const { return items_[head_]; }
+  const MotionCommand& back() const { return at(static_cast<uint8_t>(size_ - 1)); }
+  // i = 0 is the front.
+  const MotionCommand& at(uint8_t i) const { return items_[(head_ + i) % Capacity]; }
+
+  bool push(const MotionCommand& command) {
+    if (full()) return false;
+    items_[(head_ + size_) % Capacity] = command;
+    ++size_;
+    return true;
+  }
+
+  void pop() {
+    if (empty()) return;
+    head_ = static_cast<uint8_t>((head_ + 1) % Capacity);
+    --size_;
+  }
+
+ private:
+  MotionCommand items_[Capacity];
+  uint8_t head_ = 0;
+  uint8_t size_ = 0;
+};
+
+enum class Retarget : uint8_t {
+  Start,   // at rest (or not yet under way): plan a fresh move
+  Extend,  // reachable by braking normally: keep going without slowing down
+  Reverse, // behind or too close: brake to a stop at *stopAt first
+};
+
+// How a moving generator takes a new raw target. It is at |position| heading |direction| and
+// needs |stoppingSteps| to brake, so it can not stop before position + direction * stoppingSteps.
+inline Retarget classifyRetarget(long position, int direction, uint32_t stoppingSteps, long target, long* stopAt) {
+  if (stoppingSteps == 0) return Retarget::Start;
+  const long ahead = (target - position) * direction;
+  if (ahead >= static_cast<long>(stoppingSteps)) return Retarget::Extend;
+  *stopAt = position + direction * static_cast<long>(stoppingSteps);
+  return Retarget::Reverse;
+}
+
+}  // namespace motion
+}  // namespace shutter
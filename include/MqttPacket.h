@@ -0,0 +1,270 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+namespace shutter {
+namespace mqtt {
+
+// MQTT 3.1.1 packets a QoS 0 client needs: CONNECT, PUBLISH, SUBSCRIBE, PINGREQ and
+// DISCONNECT out; CONNACK, PUBLISH, SUBACK and PINGRESP in. Everything is encoded into and
+// parsed from caller-owned buffers, so a client never allocates.
+enum class PacketType : uint8_t {
+  Connect = 1,
+  Connack = 2,
+  Publish = 3,
+  Puback = 4,
+  Subscribe = 8,
+  Suback = 9,
+  Pingreq = 12,
+  Pingresp = 13,
+  Disconnect = 14,
+};
+
+struct ConnectOptions {
+  const char* clientId = "";
+  const char* username = nullptr;  // nullptr or "": none
+  const char* password = nullptr;
+  const char* willTopic = nullptr;  // retained last will, QoS 0
+  const char* willPayload = nullptr;
+  uint16_t keepAliveSec = 30;
+};
+
+// Appends to a fixed buffer; once something does not fit, ok() stays false.
+class PacketWriter {
+ public:
+  PacketWriter(uint8_t* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {}
+
+  bool ok() const { return ok_; }
+  size_t size() const { return ok_ ? size_ : 0; }
+
+  void byte(uint8_t value) {
+    if (size_ >= capacity_) {
+      ok_ = false;
+      return;
+    }
+    buffer_[size_++] = value;
+  }
+  void u16(uint16_t value) {
+    byte(static_cast<uint8_t>(value >> 8));
+    byte(static_cast<uint8_t>(value & 0xFF));
+  }
+  void bytes(const void* data, size_t length) {
+    if (length > capacity_ - size_ || size_ > capacity_) {
+      ok_ = false;
+      return;
+    }
+    memcpy(buffer_ + size_, data, length);
+    size_ += length;
+  }
+  // Length-prefixed UTF-8 string.
+  void str(const char* text) {
+    const size_t length = text ? strlen(text) : 0;
+    if (length > 0xFFFF) {
+      ok_ = false;
+      return;
+    }
+    u16(static_cast<uint16_t>(length));
+    bytes(text, length);
+  }
+  // Fixed header: type, flags and the variable-length "remaining length".
+  void header(PacketType type, uint8_t flags, size_t remaining) {
+    byte(static_cast<uint8_t>(static_cast<uint8_t>(type) << 4 | (flags & 0x0F)));
+    if (remaining > 268435455UL) {
+      ok_ = false;
+      return;
+    }
+    do {
+      uint8_t digit = static_cast<uint8_t>(remaining % 128);
+      remaining /= 128;
+      if (remaining > 0) digit |= 0x80;
+      byte(digit);
+    } while (remaining > 0);
+  }
+
+ private:
+  uint8_t* buffer_;
+  size_t capacity_;
+  size_t size_ = 0;
+  bool ok_ = true;
+};
+
+inline size_t stringSize(const char* text) { return 2 + (text ? strlen(text) : 0); }
+inline bool present(const char* text) { return text != nullptr && text[0] != '\0'; }
+
+// Each encoder returns the packet size, or 0 when it does not fit in |capacity|.
+inline size_t encodeConnect(uint8_t* out, size_t capacity, const ConnectOptions& options) {
+  const bool will = present(options.willTopic);
+  const bool user = present(options.username);
+  const bool password = user && present(options.password);
+  size_t remaining = 10 + stringSize(options.clientId);
+  if (will) remaining += stringSize(options.willTopic) + stringSize(options.willPayload);
+  if (user) remaining += stringSize(options.username);
+  if (password) remaining += stringSize(options.password);
+
+  uint8_t flags = 0x02;  // clean session
+  if (will) flags |= 0x04 | 0x20;  // will flag, will retain, QoS 0
+  if (user) flags |= 0x80;
+  if (password) flags |= 0x40;
+
+  PacketWriter w(out, capacity);
+  w.header(PacketType::Connect, 0, remaining);
+  w.str("MQTT");
+  w.byte(4);  // protocol level 3.1.1
+  w.byte(flags);
+  w.u16(options.keepAliveSec);
+  w.str(options.clientId);
+  if (will) {
+    w.str(options.willTopic);
+    w.str(options.willPayload);
+  }
+  if (user) w.str(options.username);
+  if (password) w.str(options.password);
+  return w.size();
+}
+
+// QoS 0, so no packet identifier.
+inline size_t encodePublish(uint8_t* out, size_t capacity, const char* topic, const void* payload, size_t length,
+                            bool retain) {
+  PacketWriter w(out, capacity);
+  w.header(PacketType::Publish, retain ? 0x01 : 0x00, stringSize(topic) + length);
+  w.str(topic);
+  w.bytes(payload, length);
+  return w.size();
+}
+
+inline size_t encodePublish(uint8_t* out, size_t capacity, const char* topic, const char* payload, bool retain) {
+  return encodePublish(out, capacity, topic, payload, strlen(payload), retain);
+}
+
+// One SUBSCRIBE for |count| topic filters, all at QoS 0.
+inline size_t encodeSubscribe(uint8_t* out, size_t capacity, uint16_t packetId, const char* const* filters,
+                              size_t count) {
+  size_t remaining = 2;
+  for (size_t i = 0; i < count; ++i) remaining += stringSize(filters[i]) + 1;
+  PacketWriter w(out, capacity);
+  w.header(PacketType::Subscribe, 0x02, remaining);
+  w.u16(packetId);
+  for (size_t i = 0; i < count; ++i) {
+    w.str(filters[i]);
+    w.byte(0);
+  }
+  return w.size();
+}
+
+inline size_t encodeEmpty(uint8_t* out, size_t capacity, PacketType type) {
+  PacketWriter w(out, capacity);
+  w.header(type, 0, 0);
+  return w.size();
+}
+
+// Reassembles incoming packets from a byte stream, a byte at a time so the caller can read
+// whatever the socket has without blocking. A packet whose body does not fit is skipped and
+// counted in dropped().
+template <size_t Capacity>
+class PacketReader {
+ public:
+  void reset() {
+    stage_ = Stage::Header;
+    length_ = 0;
+    received_ = 0;
+    multiplier_ = 1;
+  }
+
+  // True on the byte that completes a packet; type(), flags() and body() describe it until
+  // the next push().
+  bool push(uint8_t value) {
+    switch (stage_) {
+      case Stage::Header:
+        header_ = value;
+        length_ = 0;
+        received_ = 0;
+        multiplier_ = 1;
+        stage_ = Stage::Length;
+        return false;
+      case Stage::Length:
+        length_ += static_cast<size_t>(value & 0x7F) * multiplier_;
+        multiplier_ *= 128;
+        if (value & 0x80) {
+          // At most four length bytes; anything longer is a broken stream.
+          if (multiplier_ > 128UL * 128 * 128) {
+            ++dropped_;
+            reset();
+          }
+          return false;
+        }
+        stage_ = Stage::Body;
+        return finishIfComplete();
+      case Stage::Body:
+        if (received_ < Capacity) body_[received_] = value;
+        ++received_;
+        return finishIfComplete();
+    }
+    return false;
+  }
+
+  PacketType type() const { return static_cast<PacketType>(header_ >> 4); }
+  uint8_t flags() const { return header_ & 0x0F; }
+  const uint8_t* body() const { return body_; }
+  size_t length() const { return length_; }
+  uint32_t dropped() const { return dropped_; }
+
+ private:
+  enum class Stage : uint8_t { Header, Length, Body };
+
+  bool finishIfComplete() {
+    if (received_ < length_) return false;
+    stage_ = Stage::Header;
+    if (length_ > Capacity) {
+      ++dropped_;
+      return false;
+    }
+    return true;
+  }
+
+  uint8_t body_[Capacity];
+  uint8_t header_ = 0;
+  Stage stage_ = Stage::Header;
+  size_t length_ = 0;
+  size_t received_ = 0;
+  size_t multiplier_ = 1;
+  uint32_t dropped_ = 0;
+};
+
+// An incoming PUBLISH; the views point into the reader's body.
+struct Message {
+  const char* topic = nullptr;
+  size_t topicLength = 0;
+  const uint8_t* payload = nullptr;
+  size_t payloadLength = 0;
+  uint16_t packetId = 0;  // QoS 1 and 2 only
+
+  bool topicIs(const char* expected) const {
+    return strlen(expected) == topicLength && memcmp(topic, expected, topicLength) == 0;
+  }
+};
+
+inline bool parsePublish(uint8_t flags, const uint8_t* body, size_t length, Message* out) {
+  if (length < 2) return false;
+  const size_t topicLength = static_cast<size_t>(body[0]) << 8 | body[1];
+  size_t at = 2 + topicLength;
+  if (at > length) return false;
+  out->topic = reinterpret_cast<const char*>(body + 2);
+  out->topicLength = topicLength;
+  out->packetId = 0;
+  if ((flags >> 1 & 0x03) != 0) {
+    if (at + 2 > length) return false;
+    out->packetId = static_cast<uint16_t>(body[at] << 8 | body[at + 1]);
+    at += 2;
+  }
+  out->payload = body + at;
+  out->payloadLength = length - at;
+  return true;
+}
+
+// CONNACK return code: 0 accepted, 1..5 refused, -1 malformed.
+inline int connackCode(const uint8_t* body, size_t length) { return length == 2 ? body[1] : -1; }
+
+}  // namespace mqtt
+}  // namespace shutter
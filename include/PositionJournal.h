@@ -0,0 +1,132 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace shutter {
+namespace storage {
+
+// Pass the previous result as |hash| to continue over data that arrives in pieces.
+inline uint32_t fnv1a(const uint8_t* data, size_t length, uint32_t hash = 2166136261UL) {
+  for (size_t i = 0; i < length; ++i) {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+constexpr uint16_t kJournalMagic = 0x4A50;  // "PJ"
+
+// Records written before channels existed carry 0xFFFF here and belong to channel 0.
+constexpr uint16_t kJournalLegacyChannel = 0xFFFF;
+
+// One append-only position record. Erased flash reads as all ones, so a slot is free
+// until its first word is programmed; a torn write fails the checksum and is skipped.
+struct JournalRecord {
+  uint16_t magic;
+  uint16_t channel;
+  uint32_t sequence;
+  int32_t position;
+  uint32_t checksum;
+};
+
+static_assert(sizeof(JournalRecord) == 16, "journal records must stay word aligned");
+
+inline uint32_t journalRecordChecksum(const JournalRecord& record) {
+  return fnv1a(reinterpret_cast<const uint8_t*>(&record), offsetof(JournalRecord, checksum));
+}
+
+inline bool isErasedRecord(const JournalRecord& record) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&record);
+  for (size_t i = 0; i < sizeof(JournalRecord); ++i) {
+    if (bytes[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+inline bool isValidRecord(const JournalRecord& record) {
+  return record.magic == kJournalMagic && record.checksum == journalRecordChecksum(record);
+}
+
+// Log of position records over a pre-erased flash region, shared by |Channels| motors: the
+// newest record of each channel wins. Appends only program new slots; erasing the region is
+// the owner's job (see resetAfterErase()).
+// Flash must provide bool read(uint32_t offset, void* dst, size_t size) and
+// bool write(uint32_t offset, const void* src, size_t size) with word-aligned access.
+template <typename Flash, uint8_t Channels = 1>
+class PositionJournal {
+ public:
+  PositionJournal(Flash& flash, uint32_t regionOffset, uint16_t slots)
+      : flash_(flash), regionOffset_(regionOffset), slots_(slots) {}
+
+  // Scans the region for the newest valid record and the first slot after the last written one.
+  void mount() {
+    resetAfterErase();
+    JournalRecord record;
+    for (uint16_t slot = 0; slot < slots_; ++slot) {
+      if (!flash_.read(slotOffset(slot), &record, sizeof(record))) break;
+      if (isErasedRecord(record)) continue;
+      nextSlot_ = static_cast<uint16_t>(slot + 1);
+      if (!isValidRecord(record)) continue;
+      if (record.sequence > sequence_) sequence_ = record.sequence;
+      if (record.channel != kJournalLegacyChannel && record.channel >= Channels) continue;
+      const uint8_t channel = record.channel == kJournalLegacyChannel ? 0 : static_cast<uint8_t>(record.channel);
+      if (!hasPosition_[channel] || record.sequence > channelSequence_[channel]) {
+        hasPosition_[channel] = true;
+        channelSequence_[channel] = record.sequence;
+        position_[channel] = record.position;
+      }
+    }
+  }
+
+  // Call after the owner erased the region.
+  void resetAfterErase() {
+    nextSlot_ = 0;
+    for (uint8_t i = 0; i < Channels; ++i) hasPosition_[i] = false;
+  }
+
+  // Returns false when the region is full or the write failed; the caller then rewrites its
+  // base record (erasing the region) and calls resetAfterErase().
+  bool append(long position, uint8_t channel = 0) {
+    if (nextSlot_ >= slots_ || channel >= Channels) return false;
+    JournalRecord record;
+    record.magic = kJournalMagic;
+    record.channel = channel;
+    record.sequence = sequence_ + 1;
+    record.position = static_cast<int32_t>(position);
+    record.checksum = journalRecordChecksum(record);
+
+    const uint16_t slot = nextSlot_++;
+    ++appends_;
+    if (!flash_.write(slotOffset(slot), &record, sizeof(record))) return false;
+
+    hasPosition_[channel] = true;
+    sequence_ = record.sequence;
+    channelSequence_[channel] = record.sequence;
+    position_[channel] = position;
+    return true;
+  }
+
+  bool hasPosition(uint8_t channel = 0) const { return hasPosition_[channel]; }
+  long position(uint8_t channel = 0) const { return position_[channel]; }
+  uint32_t sequence() const { return sequence_; }
+  uint16_t slots() const { return slots_; }
+  uint16_t freeSlots() const { return static_cast<uint16_t>(slots_ - nextSlot_); }
+  uint32_t appends() const { return appends_; }
+
+ private:
+  uint32_t slotOffset(uint16_t slot) const { return regionOffset_ + static_cast<uint32_t>(slot) * sizeof(JournalRecord); }
+
+  Flash& flash_;
+  uint32_t regionOffset_;
+  uint16_t slots_;
+  uint16_t nextSlot_ = 0;
+  bool hasPosition_[Channels] = {};
+  uint32_t sequence_ = 0;
+  uint32_t channelSequence_[Channels] = {};
+  long position_[Channels] = {};
+  uint32_t appends_ = 0;
+};
+
+}  // namespace storage
+}  // namespace shutter
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace shutter {
+namespace power {
+
+// Nominal ESP8266EX figures at 3.3 V (datasheet, section 5) and one 28BYJ-48 at 5 V. The
+// estimate is for comparing settings, not a measurement.
+constexpr float kAwakeMa = 70.0f;         // CPU on, radio listening (WIFI_NONE_SLEEP)
+constexpr float kModemSleepMa = 15.0f;    // CPU on, radio off between beacons
+constexpr float kLightSleepMa = 0.9f;     // CPU and radio suspended
+constexpr float kBeaconWakeMa = 56.0f;    // receiving a beacon
+constexpr float kBeaconWakeMs = 3.0f;     // wake-up, beacon and settle per listen
+constexpr float kBeaconIntervalMs = 102.4f;
+constexpr float kCoilMa = 150.0f;         // half stepping holds 1.5 coils of ~50 ohm on average
+constexpr uint8_t kMaxListenInterval = 10;
+
+// Beacons slept through per wake-up that keep a request waiting at most |budgetMs|.
+inline uint8_t listenIntervalFor(uint16_t budgetMs) {
+  const uint32_t beacons = static_cast<uint32_t>(budgetMs / kBeaconIntervalMs);
+  if (beacons < 1) return 1;
+  return beacons > kMaxListenInterval ? kMaxListenInterval : static_cast<uint8_t>(beacons);
+}
+
+// Average light-sleep current: the sleep floor plus one beacon reception per listen interval.
+inline float lightSleepMa(uint8_t listenInterval) {
+  if (listenInterval == 0) listenInterval = 1;
+  return kLightSleepMa + kBeaconWakeMa * kBeaconWakeMs / (kBeaconIntervalMs * listenInterval);
+}
+
+enum class RadioMode : uint8_t { Awake, ModemSleep, LightSleep };
+
+// Time spent in each radio mode and with coils energized since reset(), and the average
+// current that implies.
+class PowerBudget {
+ public:
+  void reset() {
+    for (uint8_t i = 0; i < 3; ++i) modeUs_[i] = 0;
+    coilUs_ = 0;
+  }
+
+  void add(RadioMode mode, uint32_t us) { modeUs_[static_cast<uint8_t>(mode)] += us; }
+  // Once per energized motor; chopped coils count their duty-weighted (full-on) time.
+  void addCoils(uint32_t us) { coilUs_ += us; }
+
+  uint64_t totalUs() const { return modeUs_[0] + modeUs_[1] + modeUs_[2]; }
+
+  float dutyPercent(RadioMode mode) const {
+    const uint64_t total = totalUs();
+    return total == 0 ? 0.0f : 100.0f * static_cast<float>(modeUs_[static_cast<uint8_t>(mode)]) / total;
+  }
+
+  // Motor-equivalents energized on average, in percent (200 = two motors held all the time).
+  float coilDutyPercent() const {
+    const uint64_t total = totalUs();
+    return total == 0 ? 0.0f : 100.0f * static_cast<float>(coilUs_) / total;
+  }
+
+  float averageEspMa(uint8_t listenInterval) const {
+    return (dutyPercent(RadioMode::Awake) * kAwakeMa + dutyPercent(RadioMode::ModemSleep) * kModemSleepMa +
+            dutyPercent(RadioMode::LightSleep) * lightSleepMa(listenInterval)) /
+           100.0f;
+  }
+
+  float averageCoilMa() const { return coilDutyPercent() * kCoilMa / 100.0f; }
+
+ private:
+  uint64_t modeUs_[3] = {};
+  uint64_t coilUs_ = 0;
+};
+
+}  // namespace power
+}  // namespace shutter
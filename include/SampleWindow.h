@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace shutter {
+namespace sensing {
+
+// Fixed-size ring buffer of raw readings with O(1) mean and cached min/max.
+// min/max are rescanned only when the evicted sample was the current extreme.
+template <uint16_t N>
+class SampleWindow {
+ public:
+  void clear() {
+    head_ = 0;
+    count_ = 0;
+    sum_ = 0;
+    min_ = 0;
+    max_ = 0;
+  }
+
+  void push(uint16_t value) {
+    bool rescan = false;
+    if (count_ == N) {
+      const uint16_t evicted = values_[head_];
+      sum_ -= evicted;
+      rescan = evicted == min_ || evicted == max_;
+    } else {
+      ++count_;
+    }
+    values_[head_] = value;
+    head_ = static_cast<uint16_t>((head_ + 1) % N);
+    sum_ += value;
+
+    if (count_ == 1) {
+      min_ = value;
+      max_ = value;
+    } else if (rescan) {
+      rescanExtremes();
+    } else {
+      if (value < min_) min_ = value;
+      if (value > max_) max_ = value;
+    }
+  }
+
+  uint16_t size() const { return count_; }
+  uint16_t capacity() const { return N; }
+  uint16_t min() const { return min_; }
+  uint16_t max() const { return max_; }
+
+  uint16_t mean() const {
+    if (count_ == 0) return 0;
+    return static_cast<uint16_t>((sum_ + count_ / 2) / count_);
+  }
+
+  uint16_t latest() const { return count_ == 0 ? 0 : at(count_ - 1); }
+
+  // i = 0 is the oldest retained sample.
+  uint16_t at(uint16_t i) const { return values_[(head_ + N - count_ + i) % N]; }
+
+ private:
+  void rescanExtremes() {
+    min_ = at(0);
+    max_ = min_;
+    for (uint16_t i = 1; i < count_; ++i) {
+      const uint16_t v = at(i);
+      if (v < min_) min_ = v;
+      if (v > max_) max_ = v;
+    }
+  }
+
+  uint16_t values_[N] = {};
+  uint16_t head_ = 0;
+  uint16_t count_ = 0;
+  uint32_t sum_ = 0;
+  uint16_t min_ = 0;
+  uint16_t max_ = 0;
+};
+
+}  // namespace sensing
+}  // namespace shutter
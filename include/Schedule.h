@@ -0,0 +1,211 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+namespace shutter {
+namespace schedule {
+
+// On-device rules: "open at sunrise on weekdays", "set 60% at 22:30". Times are local minutes;
+// the sun is worked out once per day from the site, so the per-minute check is integer only.
+enum class Trigger : uint8_t {
+  Time = 0,
+  Sunrise = 1,
+  Sunset = 2,
+};
+
+enum class Action : uint8_t {
+  Open = 1,
+  Close = 2,
+  Set = 3,
+};
+
+// Stored as is in the settings record, so plain data: value-initialize it (Rule rule = {}).
+struct Rule {
+  uint8_t days;  // bit 0 Monday .. bit 6 Sunday; 0 disables the rule
+  Trigger trigger;
+  int16_t minute;         // Trigger::Time: minute of the day; sun: offset from the event
+  uint8_t channels;       // bit c: channel c
+  Action action;
+  uint16_t centiPercent;  // Action::Set: 0 (open) .. 10000 (closed)
+  uint8_t jitterMinutes;  // fires up to this much later, by a fixed amount per device
+  uint8_t reserved;
+};
+static_assert(sizeof(Rule) == 10, "Rule is persisted byte for byte");
+
+constexpr uint8_t kAllDays = 0x7F;
+constexpr uint16_t kMinutesPerDay = 1440;
+constexpr int16_t kMaxSunOffsetMinutes = 720;
+constexpr uint16_t kMaxCentiPercent = 10000;
+// A clock that jumps further than this (first sync, a long outage) does not replay rules.
+constexpr uint16_t kMaxCatchUpMinutes = 90;
+
+inline const char* actionName(Action action) {
+  switch (action) {
+    case Action::Open:
+      return "open";
+    case Action::Close:
+      return "close";
+    case Action::Set:
+      return "set";
+  }
+  return "open";
+}
+
+inline const char* triggerName(Trigger trigger) {
+  switch (trigger) {
+    case Trigger::Time:
+      return "time";
+    case Trigger::Sunrise:
+      return "sunrise";
+    case Trigger::Sunset:
+      return "sunset";
+  }
+  return "time";
+}
+
+// Days since 1970-01-01 of a proleptic Gregorian date (H. Hinnant's days_from_civil).
+inline int32_t daysFromCivil(int32_t year, uint8_t month, uint8_t day) {
+  year -= month <= 2 ? 1 : 0;
+  const int32_t era = (year >= 0 ? year : year - 399) / 400;
+  const uint32_t yearOfEra = static_cast<uint32_t>(year - era * 400);
+  const uint32_t dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + static_cast<int32_t>(dayOfEra) - 719468;
+}
+
+// 0 Monday .. 6 Sunday; 1970-01-01 was a Thursday.
+inline uint8_t weekday(int32_t days) {
+  const int32_t shifted = (days + 3) % 7;
+  return static_cast<uint8_t>(shifted < 0 ? shifted + 7 : shifted);
+}
+
+// Sunrise and sunset of UTC day |days| as minutes from its midnight UTC (the NOAA sunrise
+// equation, about a minute off at mid latitudes). False in polar day or night.
+inline bool sunEventsUtc(int32_t days, float latitude, float longitude, int16_t* sunrise, int16_t* sunset) {
+  constexpr float kDegToRad = 0.017453292f;
+  const float n = static_cast<float>(days - 10957) + 0.0008f - longitude / 360.0f;  // from J2000
+  const float meanAnomaly = fmodf(357.5291f + 0.98560028f * n, 360.0f) * kDegToRad;
+  const float center = 1.9148f * sinf(meanAnomaly) + 0.02f * sinf(2.0f * meanAnomaly) + 0.0003f * sinf(3.0f * meanAnomaly);
+  const float eclipticLongitude = fmodf(meanAnomaly / kDegToRad + center + 282.9372f, 360.0f) * kDegToRad;
+  const float transitDays = 0.0008f - longitude / 360.0f + 0.0053f * sinf(meanAnomaly) - 0.0069f * sinf(2.0f * eclipticLongitude);
+  const float sinDeclination = sinf(eclipticLongitude) * sinf(23.4397f * kDegToRad);
+  const float cosDeclination = sqrtf(1.0f - sinDeclination * sinDeclination);
+  const float phi = latitude * kDegToRad;
+  const float cosHourAngle = (sinf(-0.833f * kDegToRad) - sinf(phi) * sinDeclination) / (cosf(phi) * cosDeclination);
+  if (!(cosHourAngle > -1.0f && cosHourAngle < 1.0f)) return false;
+  const float halfDayMinutes = acosf(cosHourAngle) / kDegToRad / 360.0f * kMinutesPerDay;
+  const float transitMinutes = 720.0f + transitDays * kMinutesPerDay;
+  *sunrise = static_cast<int16_t>(lroundf(transitMinutes - halfDayMinutes));
+  *sunset = static_cast<int16_t>(lroundf(transitMinutes + halfDayMinutes));
+  return true;
+}
+
+struct Site {
+  bool located = false;  // without a location sun rules never fire
+  float latitude = 0.0f;
+  float longitude = 0.0f;
+};
+
+// What a local day needs for matching rules against its minutes.
+struct DayPlan {
+  int32_t day = INT32_MIN;  // local days since 1970-01-01
+  int16_t utcOffsetMinutes = 0;
+  uint8_t weekday = 0;
+  bool sunValid = false;
+  int16_t sunrise = 0;  // local minute of the day
+  int16_t sunset = 0;
+};
+
+inline int16_t wrapMinuteOfDay(int32_t minute) {
+  const int32_t wrapped = minute % kMinutesPerDay;
+  return static_cast<int16_t>(wrapped < 0 ? wrapped + kMinutesPerDay : wrapped);
+}
+
+inline DayPlan planDay(int32_t localDay, int16_t utcOffsetMinutes, const Site& site) {
+  DayPlan plan;
+  plan.day = localDay;
+  plan.utcOffsetMinutes = utcOffsetMinutes;
+  plan.weekday = weekday(localDay);
+  int16_t sunrise = 0;
+  int16_t sunset = 0;
+  if (site.located && sunEventsUtc(localDay, site.latitude, site.longitude, &sunrise, &sunset)) {
+    plan.sunValid = true;
+    plan.sunrise = wrapMinuteOfDay(sunrise + utcOffsetMinutes);
+    plan.sunset = wrapMinuteOfDay(sunset + utcOffsetMinutes);
+  }
+  return plan;
+}
+
+// The fixed delay of rule |index| on the device seeded |seed|, 0..rule.jitterMinutes. A fleet
+// sharing one schedule spreads out this way instead of hitting the supply at the same minute.
+inline uint8_t jitterFor(uint32_t seed, uint8_t index, uint8_t jitterMinutes) {
+  if (jitterMinutes == 0) return 0;
+  uint32_t hash = 2166136261u;
+  for (uint8_t i = 0; i < 4; ++i) hash = (hash ^ ((seed >> (8 * i)) & 0xFF)) * 16777619u;
+  hash = (hash ^ index) * 16777619u;
+  return static_cast<uint8_t>(hash % (static_cast<uint32_t>(jitterMinutes) + 1));
+}
+
+// Local minute of the day rule |index| fires on |plan|'s day, or -1 when it does not.
+inline int16_t fireMinute(const Rule& rule, uint8_t index, const DayPlan& plan, uint32_t seed) {
+  if ((rule.days & (1U << plan.weekday)) == 0 || rule.channels == 0) return -1;
+  int32_t minute = rule.minute;
+  if (rule.trigger != Trigger::Time) {
+    if (!plan.sunValid) return -1;
+    minute += rule.trigger == Trigger::Sunrise ? plan.sunrise : plan.sunset;
+  }
+  minute += jitterFor(seed, index, rule.jitterMinutes);
+  if (minute < 0) return 0;
+  if (minute >= kMinutesPerDay) return kMinutesPerDay - 1;
+  return static_cast<int16_t>(minute);
+}
+
+// Walks local time minute by minute and reports each rule as its minute comes by. Fed the
+// current local minute (minutes since 1970-01-01 in local time) whenever it may have changed.
+class Scheduler {
+ public:
+  // Calls fire(index) for every rule due in the minutes since the last call, this one included.
+  template <typename Fire>
+  void advance(int32_t localMinute, int16_t utcOffsetMinutes, const Rule* rules, uint8_t count, const Site& site,
+               uint32_t seed, Fire fire) {
+    int32_t from = localMinute;
+    if (started_) {
+      const int32_t gap = localMinute - lastMinute_;
+      if (gap <= 0 && gap >= -static_cast<int32_t>(kMaxCatchUpMinutes)) return;  // same minute, or set back a little
+      if (gap > 0 && gap <= kMaxCatchUpMinutes) from = lastMinute_ + 1;
+    }
+    started_ = true;
+    lastMinute_ = localMinute;
+    for (int32_t minute = from; minute <= localMinute; ++minute) {
+      const int32_t day = floorDiv(minute, kMinutesPerDay);
+      // A new day, or a daylight saving change moving the sun in local time.
+      if (day != plan_.day || utcOffsetMinutes != plan_.utcOffsetMinutes) plan_ = planDay(day, utcOffsetMinutes, site);
+      const int16_t minuteOfDay = static_cast<int16_t>(minute - day * kMinutesPerDay);
+      for (uint8_t i = 0; i < count; ++i) {
+        if (fireMinute(rules[i], i, plan_, seed) == minuteOfDay) fire(i);
+      }
+    }
+  }
+
+  // After a change of rules, site or time zone: the day is planned again, nothing replays.
+  void reset() {
+    started_ = false;
+    plan_ = DayPlan();
+  }
+
+  const DayPlan& today() const { return plan_; }
+
+ private:
+  static int32_t floorDiv(int32_t value, int32_t divisor) {
+    const int32_t quotient = value / divisor;
+    return (value % divisor != 0 && value < 0) ? quotient - 1 : quotient;
+  }
+
+  bool started_ = false;
+  int32_t lastMinute_ = 0;
+  DayPlan plan_;
+};
+
+}  // namespace schedule
+}  // namespace shutter
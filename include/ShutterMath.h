@@ -1,6 +1,7 @@
 #pragma once
 
 #include <math.h>
+#include <stdint.h>
 
 namespace shutter {
 namespace math {
@@ -17,16 +18,26 @@ inline float clampFloat(float value, float minValue, float maxValue) {
   return value;
 }
 
+// A reversed motor counts raw steps the other way. With the direction as a template
+// parameter a conversion compiles to a copy or a negation; the bool overloads below pick one
+// per call for the run-time setting.
+template <bool Reversed>
+struct Direction {
+  static constexpr int kSign = Reversed ? -1 : 1;
+  static constexpr long toRaw(long logicalPos) { return Reversed ? -logicalPos : logicalPos; }
+  static constexpr long toLogical(long rawPos) { return Reversed ? -rawPos : rawPos; }
+};
+
 inline int directionSign(bool reverseDirection) {
-  return reverseDirection ? -1 : 1;
+  return reverseDirection ? Direction<true>::kSign : Direction<false>::kSign;
 }
 
 inline long logicalToRaw(long logicalPos, bool reverseDirection) {
-  return logicalPos * directionSign(reverseDirection);
+  return reverseDirection ? Direction<true>::toRaw(logicalPos) : Direction<false>::toRaw(logicalPos);
 }
 
 inline long rawToLogical(long rawPos, bool reverseDirection) {
-  return rawPos * directionSign(reverseDirection);
+  return reverseDirection ? Direction<true>::toLogical(rawPos) : Direction<false>::toLogical(rawPos);
 }
 
 inline float stepsToPercent(long steps, long travelSteps) {
@@ -40,5 +51,65 @@ inline long percentToSteps(float percent, long travelSteps) {
   return lroundf((clamped / 100.0f) * static_cast<float>(travelSteps));
 }
 
+// Hundredths of a percent: the fixed-point unit of TravelScale.
+constexpr int32_t kCentiPercent = 10000;
+
+// Percent <-> steps for one travel without floating point (the ESP8266 has no FPU). Both
+// directions multiply by a Q32 reciprocal cached by setTravel(), so a conversion costs one
+// 64-bit multiply and no division. Results match the float functions above to within their
+// rounding.
+class TravelScale {
+ public:
+  TravelScale() = default;
+  explicit TravelScale(long travelSteps) { setTravel(travelSteps); }
+
+  void setTravel(long travelSteps) {
+    travel_ = travelSteps > 0 ? travelSteps : 0;
+    if (travel_ == 0) {
+      centiPerStepQ32_ = 0;
+      stepsPerCentiQ32_ = 0;
+      return;
+    }
+    // Rounded up, so a product never falls short of the exact value and exact halves round up.
+    const int64_t travel = travel_;
+    centiPerStepQ32_ = ((static_cast<int64_t>(kCentiPercent) << 32) + travel - 1) / travel;
+    stepsPerCentiQ32_ = ((travel << 32) + kCentiPercent - 1) / kCentiPercent;
+  }
+
+  long travel() const { return travel_; }
+
+  // Rounded to the nearest hundredth; positions past either end give values beyond 0..10000.
+  int32_t centiPercent(long steps) const {
+    const int64_t scaled = static_cast<int64_t>(steps) * centiPerStepQ32_;
+    return static_cast<int32_t>((scaled + (int64_t(1) << 31)) >> 32);
+  }
+
+  // Rounded to the nearest whole percent.
+  int32_t wholePercent(long steps) const {
+    const int32_t centi = centiPercent(steps);
+    return centi >= 0 ? (centi + 50) / 100 : -((-centi + 50) / 100);
+  }
+
+  // For JSON: the one float operation is the final scaling.
+  float percent(long steps) const { return static_cast<float>(centiPercent(steps)) * 0.01f; }
+
+  // Clamped to 0..100 %, so the result is always within the travel.
+  long stepsAtCentiPercent(int32_t centi) const {
+    if (centi <= 0) return 0;
+    if (centi >= kCentiPercent) return travel_;
+    const int64_t scaled = static_cast<int64_t>(centi) * stepsPerCentiQ32_;
+    return static_cast<long>((scaled + (int64_t(1) << 31)) >> 32);
+  }
+
+  long stepsAtPercent(float percent) const {
+    return stepsAtCentiPercent(static_cast<int32_t>(lroundf(clampFloat(percent, 0.0f, 100.0f) * 100.0f)));
+  }
+
+ private:
+  long travel_ = 0;
+  int64_t centiPerStepQ32_ = 0;
+  int64_t stepsPerCentiQ32_ = 0;
+};
+
 }  // namespace math
 }  // namespace shutter
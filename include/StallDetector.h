@@ -0,0 +1,85 @@
+#pragma once
+
+#include <stdint.h>
+
+namespace shutter {
+namespace sensing {
+
+// Stall detection from the motor supply current (a shunt on A0), sampled while a move
+// cruises. A stepper whose rotor stops loses its back-EMF, so the average current rises
+// above what the same move drew a moment ago. The detector keeps two filters in 1/16 counts:
+// a fast one for the current level and a slow baseline that follows drops quickly (the draw
+// falls while the motor speeds up) and rises only slowly, so a step change stands out.
+struct StallConfig {
+  uint16_t thresholdPercent = 40;  // level above baseline that counts as a stall
+  uint16_t minDelta = 8;           // ...and at least this many counts, so noise near 0 is ignored
+  uint8_t blankingSamples = 20;    // the baseline only learns after a reset
+  uint8_t confirmSamples = 3;      // consecutive samples over the threshold
+};
+
+class StallDetector {
+ public:
+  void configure(const StallConfig& config) { config_ = config; }
+  const StallConfig& config() const { return config_; }
+
+  void reset() {
+    level16_ = 0;
+    baseline16_ = 0;
+    samples_ = 0;
+    over_ = 0;
+    stalled_ = false;
+  }
+
+  // Feeds one reading. Returns true from the sample that confirms a stall until reset().
+  bool push(uint16_t raw) {
+    if (stalled_) return true;
+    const int32_t sample16 = static_cast<int32_t>(raw) << 4;
+    if (samples_ == 0) {
+      level16_ = sample16;
+      baseline16_ = sample16;
+    } else {
+      level16_ += (sample16 - level16_) / 4;
+    }
+    if (samples_ < config_.blankingSamples) {
+      ++samples_;
+      baseline16_ = level16_;
+      return false;
+    }
+
+    if (overThreshold()) {
+      if (++over_ >= config_.confirmSamples) stalled_ = true;
+      return stalled_;
+    }
+    over_ = 0;
+    const int32_t diff = level16_ - baseline16_;
+    baseline16_ += diff < 0 ? diff / 8 : diff / 64;
+    return false;
+  }
+
+  bool stalled() const { return stalled_; }
+  // Level more than a quarter of the threshold above the baseline: where the rise of a stall
+  // begins, a few samples before it is confirmed.
+  bool climbing() const {
+    return (level16_ - baseline16_) * 400 > baseline16_ * static_cast<int32_t>(config_.thresholdPercent);
+  }
+  bool learning() const { return samples_ < config_.blankingSamples; }
+  uint16_t level() const { return static_cast<uint16_t>((level16_ + 8) >> 4); }
+  uint16_t baseline() const { return static_cast<uint16_t>((baseline16_ + 8) >> 4); }
+
+ private:
+  bool overThreshold() const {
+    const int32_t delta16 = level16_ - baseline16_;
+    if (delta16 < static_cast<int32_t>(config_.minDelta) << 4) return false;
+    return delta16 * 100 > baseline16_ * static_cast<int32_t>(config_.thresholdPercent);
+  }
+
+  StallConfig config_;
+  int32_t level16_ = 0;
+  int32_t baseline16_ = 0;
+  uint8_t samples_ = 0;
+  uint8_t over_ = 0;
+  bool stalled_ = false;
+};
+
+}  // namespace sensing
+}  // namespace shutter
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "PositionJournal.h"
+
+namespace shutter {
+namespace storage {
+
+// Settings as one record of tagged fields: a header, then (tag, length, value) entries, then
+// a checksum. A reader skips tags it does not know and keeps its defaults for tags it does
+// not find, so fields come and go without a layout change; kRecordVersion only changes with
+// the framing itself. Values are in the byte order of the device (little-endian).
+constexpr uint32_t kRecordMagic = 0x56544853;  // "SHTV"
+constexpr uint8_t kRecordVersion = 1;
+constexpr size_t kRecordHeaderSize = 8;  // magic, version, area, payload length
+// The header names the flash area the record owns, in these units, so a reader still finds
+// what the writer kept behind it after the area changed size. 0: the writer did not say.
+constexpr size_t kRecordAreaUnit = 256;
+constexpr size_t kRecordChecksumSize = 4;
+constexpr size_t kRecordEntryOverhead = 2;  // tag, length
+constexpr size_t kMaxRecordValue = 255;
+
+// Record bytes for a payload of |payloadLength|, padded to whole flash words.
+constexpr size_t recordSize(size_t payloadLength) {
+  return (kRecordHeaderSize + payloadLength + kRecordChecksumSize + 3) & ~static_cast<size_t>(3);
+}
+
+class RecordWriter {
+ public:
+  RecordWriter(uint8_t* buffer, size_t capacity) : buffer_(buffer), capacity_(capacity) {
+    overflowed_ = capacity < recordSize(0);
+  }
+
+  // Size of the area the record is written to, a multiple of kRecordAreaUnit.
+  void setAreaSize(size_t bytes) { areaUnits_ = static_cast<uint8_t>(bytes / kRecordAreaUnit); }
+
+  // False once anything failed to fit; finish() then refuses the record.
+  bool put(uint8_t tag, const void* value, size_t length) {
+    if (length > kMaxRecordValue || payloadEnd() + kRecordEntryOverhead + length + kRecordChecksumSize > capacity_) {
+      overflowed_ = true;
+    }
+    if (overflowed_) return false;
+    uint8_t* out = buffer_ + payloadEnd();
+    out[0] = tag;
+    out[1] = static_cast<uint8_t>(length);
+    if (length > 0) memcpy(out + kRecordEntryOverhead, value, length);
+    payloadLength_ += kRecordEntryOverhead + length;
+    return true;
+  }
+
+  template <typename T>
+  bool putValue(uint8_t tag, const T& value) {
+    return put(tag, &value, sizeof(value));
+  }
+
+  // At most |maxLength| characters of |text|, without the terminator.
+  bool putString(uint8_t tag, const char* text, size_t maxLength) {
+    size_t length = 0;
+    while (length < maxLength && text[length] != '\0') ++length;
+    return put(tag, text, length);
+  }
+
+  // Writes header and checksum and pads with erased bytes. Returns the bytes to program, or 0
+  // when an entry did not fit.
+  size_t finish() {
+    if (overflowed_) return 0;
+    const size_t size = recordSize(payloadLength_);
+    const uint32_t magic = kRecordMagic;
+    const uint16_t length = static_cast<uint16_t>(payloadLength_);
+    memcpy(buffer_, &magic, sizeof(magic));
+    buffer_[4] = kRecordVersion;
+    buffer_[5] = areaUnits_;
+    memcpy(buffer_ + 6, &length, sizeof(length));
+    const uint32_t checksum = fnv1a(buffer_, payloadEnd());
+    memcpy(buffer_ + payloadEnd(), &checksum, sizeof(checksum));
+    memset(buffer_ + payloadEnd() + kRecordChecksumSize, 0xFF, size - payloadEnd() - kRecordChecksumSize);
+    return size;
+  }
+
+  size_t payloadLength() const { return payloadLength_; }
+  bool overflowed() const { return overflowed_; }
+
+ private:
+  size_t payloadEnd() const { return kRecordHeaderSize + payloadLength_; }
+
+  uint8_t* buffer_;
+  size_t capacity_;
+  size_t payloadLength_ = 0;
+  uint8_t areaUnits_ = 0;
+  bool overflowed_ = false;
+};
+
+struct RecordField {
+  uint8_t tag = 0;
+  uint8_t length = 0;
+  const uint8_t* value = nullptr;
+
+  // Exactly sizeof(T) bytes; anything else leaves |out| alone.
+  template <typename T>
+  bool read(T* out) const {
+    if (length != sizeof(T)) return false;
+    memcpy(out, value, sizeof(T));
+    return true;
+  }
+
+  // Plain structs that may grow at the end: a longer value is cut to what this build knows,
+  // a shorter one leaves the rest zero.
+  template <typename T>
+  void readPrefix(T* out) const {
+    memset(out, 0, sizeof(T));
+    memcpy(out, value, length < sizeof(T) ? length : sizeof(T));
+  }
+};
+
+// The payload of a well-formed record of this framing version at |data|, or nullptr.
+inline const uint8_t* checkRecord(const uint8_t* data, size_t size, size_t* payloadLength) {
+  if (size < recordSize(0)) return nullptr;
+  uint32_t magic = 0;
+  uint16_t length = 0;
+  memcpy(&magic, data, sizeof(magic));
+  memcpy(&length, data + 6, sizeof(length));
+  if (magic != kRecordMagic || data[4] != kRecordVersion) return nullptr;
+  if (kRecordHeaderSize + length + kRecordChecksumSize > size) return nullptr;
+  uint32_t checksum = 0;
+  memcpy(&checksum, data + kRecordHeaderSize + length, sizeof(checksum));
+  if (checksum != fnv1a(data, kRecordHeaderSize + length)) return nullptr;
+  *payloadLength = length;
+  return data + kRecordHeaderSize;
+}
+
+// The area a checked record at |data| was written to, or 0 when its writer did not say.
+inline size_t recordAreaSize(const uint8_t* data) { return data[5] * kRecordAreaUnit; }
+
+// Walks the entries of a checked payload in the order they were written.
+class RecordReader {
+ public:
+  RecordReader(const uint8_t* payload, size_t length) : payload_(payload), length_(length) {}
+
+  // False at the end, or at an entry running past it.
+  bool next(RecordField* field) {
+    if (offset_ + kRecordEntryOverhead > length_) return false;
+    const uint8_t* entry = payload_ + offset_;
+    if (offset_ + kRecordEntryOverhead + entry[1] > length_) return false;
+    field->tag = entry[0];
+    field->length = entry[1];
+    field->value = entry + kRecordEntryOverhead;
+    offset_ += kRecordEntryOverhead + entry[1];
+    return true;
+  }
+
+ private:
+  const uint8_t* payload_;
+  size_t length_;
+  size_t offset_ = 0;
+};
+
+}  // namespace storage
+}  // namespace shutter
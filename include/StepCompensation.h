@@ -0,0 +1,139 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace shutter {
+namespace math {
+
+// What the motor's step count misses about the shade: the gearbox backlash, turned through on
+// every reversal before the shade follows, and a different shade travel per motor step opening
+// (lifting) than closing (gravity helps). Scales are motor steps per logical step of that
+// direction; 0 backlash and both scales at 1 are the plain 1:1 mapping of logicalToRaw().
+struct CompensationParams {
+  uint16_t backlashSteps = 0;
+  float openScale = 1.0f;
+  float closeScale = 1.0f;
+};
+
+constexpr uint16_t kMaxBacklashSteps = 512;
+constexpr float kMinStepScale = 0.8f;
+constexpr float kMaxStepScale = 1.25f;
+
+// Follows the slack of the gear train from move to move. Directions are logical: +1 closes,
+// -1 opens. Moves are planned and measured from rest; settle() ends each one.
+class StepCompensation {
+ public:
+  void configure(const CompensationParams& params) {
+    params_ = params;
+    if (slack_ > params_.backlashSteps) slack_ = params_.backlashSteps;
+  }
+
+  const CompensationParams& params() const { return params_; }
+
+  float scale(int direction) const { return direction > 0 ? params_.closeScale : params_.openScale; }
+
+  // Motor steps the next move in |direction| turns before the shade follows. Until the first
+  // move after boot the gear is taken to push that way already.
+  long takeUpSteps(int direction) const {
+    if (loaded_ == 0) return 0;
+    return direction == loaded_ ? slack_ : static_cast<long>(params_.backlashSteps) - slack_;
+  }
+
+  // Motor steps that move the shade by |logicalDelta| from rest.
+  long motorSteps(long logicalDelta) const {
+    if (logicalDelta == 0) return 0;
+    const int direction = logicalDelta > 0 ? 1 : -1;
+    return takeUpSteps(direction) + lroundf(static_cast<float>(labs(logicalDelta)) * scale(direction));
+  }
+
+  // Shade travel once a move in |direction| from rest turned |motorSteps|.
+  long logicalSteps(long motorSteps, int direction) const {
+    const long moved = motorSteps - takeUpSteps(direction);
+    return moved > 0 ? lroundf(static_cast<float>(moved) / scale(direction)) : 0;
+  }
+
+  // A move in |direction| came to rest after |motorSteps|; a short one may leave slack.
+  void settle(int direction, long motorSteps) {
+    if (motorSteps <= 0) return;
+    const long takeUp = takeUpSteps(direction);
+    slack_ = motorSteps < takeUp ? takeUp - motorSteps : 0;
+    loaded_ = static_cast<int8_t>(direction);
+  }
+
+  // Pressed against an end stop: the gear pushes |direction| with no slack left.
+  void load(int direction) {
+    loaded_ = static_cast<int8_t>(direction);
+    slack_ = 0;
+  }
+
+  int loadedDirection() const { return loaded_; }
+
+ private:
+  CompensationParams params_;
+  int8_t loaded_ = 0;  // 0: not known
+  long slack_ = 0;     // motor steps still to turn in loaded_ before the shade follows
+};
+
+// Learns the open scale from top re-zeroes. Between two of them the shade opened exactly as far
+// as it closed, so where the model stands when an open meets the top stop (the residual; 0 is
+// a perfect model) is the error of the modelled opening travel. Backlash cancels over such a
+// cycle, every reversal one way being matched by one back, so it stays a setting.
+class DriftTuner {
+ public:
+  static constexpr float kGain = 0.5f;            // share of a cycle's error corrected at once
+  static constexpr uint8_t kSettleCycles = 3;     // cycles before the overdrive is trimmed
+  static constexpr long kOverdriveMargin = 64;    // steps for the stall to register past the stop
+
+  // A cycle ended at the top stop, met at logical |residual| after |openedSteps| of modelled
+  // opening travel since the last re-zero. Cycles that opened less than a quarter of the
+  // travel only feed the residual envelope. True when |params| changed.
+  bool learn(long residual, long openedSteps, long travelSteps, CompensationParams* params) {
+    lastResidual_ = residual;
+    const long magnitude = labs(residual);
+    envelope_ = magnitude > envelope_ / 2 ? magnitude : envelope_ / 2;
+    if (cycles_ < 255) ++cycles_;
+    if (openedSteps <= 0 || openedSteps < travelSteps / 4 || residual == 0) return false;
+    // A positive residual: the shade reached the top early, the open was over-scaled.
+    const float error = static_cast<float>(residual) / static_cast<float>(openedSteps);
+    float scale = params->openScale / (1.0f + kGain * error);
+    if (scale < kMinStepScale) scale = kMinStepScale;
+    if (scale > kMaxStepScale) scale = kMaxStepScale;
+    if (fabsf(scale - params->openScale) < 1e-5f) return false;
+    params->openScale = scale;
+    return true;
+  }
+
+  // An open ran its whole overdrive without meeting the stop: back to the configured one.
+  void missedWall() { cycles_ = 0; }
+
+  void reset() {
+    cycles_ = 0;
+    envelope_ = 0;
+    lastResidual_ = 0;
+  }
+
+  bool settled() const { return cycles_ >= kSettleCycles; }
+
+  // Steps an open runs past logical 0: |configured| until the model settled, then what the
+  // recent residuals call for. Stalls are only watched until braking starts, so the stop
+  // has to lie more than |brakingSteps| before the end of the move.
+  long overdriveSteps(long configured, long brakingSteps) const {
+    if (!settled()) return configured;
+    const long tuned = brakingSteps + kOverdriveMargin + 3 * envelope_;
+    return tuned < configured ? tuned : configured;
+  }
+
+  uint8_t cycles() const { return cycles_; }
+  long envelope() const { return envelope_; }
+  long lastResidual() const { return lastResidual_; }
+
+ private:
+  uint8_t cycles_ = 0;
+  long envelope_ = 0;  // recent largest |residual|, halving each cycle
+  long lastResidual_ = 0;
+};
+
+}  // namespace math
+}  // namespace shutter
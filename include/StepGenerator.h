@@ -0,0 +1,362 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+
+// Code reachable from the step timer ISR must end up in IRAM on the ESP8266, so the
+// generator is force-inlined into the IRAM_ATTR handler instead of being called.
+#ifndef SHUTTER_ISR_INLINE
+#define SHUTTER_ISR_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace shutter {
+namespace motion {
+
+// 28BYJ-48 half-step sequence; bit i drives coil input i (AccelStepper HALF4WIRE order).
+constexpr uint8_t kHalfStepMasks[8] = {0b0001, 0b0101, 0b0100, 0b0110, 0b0010, 0b1010, 0b1000, 0b1001};
+
+constexpr uint16_t kRampTableSize = 256;
+constexpr uint32_t kTimerTicksPerUs = 5;        // timer1 with TIM_DIV16 at 80 MHz
+constexpr uint32_t kMaxTimerTicks = 0x7FFFFF;   // timer1 is a 23-bit down counter
+
+inline uint8_t halfStepMask(long position) { return kHalfStepMasks[position & 7]; }
+
+// Step intervals for accelerating from rest to cruise speed. Entry k is the timer delay
+// after ramp step k; the last entry is the cruise interval. Long ramps are sampled every
+// |stride| steps so the table size stays fixed.
+struct RampTable {
+  uint32_t ticks[kRampTableSize];
+  uint16_t length = 0;
+  uint16_t stride = 1;
+};
+
+inline uint32_t secondsToTicks(float seconds) {
+  const float ticks = seconds * 1000000.0f * static_cast<float>(kTimerTicksPerUs);
+  if (ticks < 1.0f) return 1;
+  if (ticks > static_cast<float>(kMaxTimerTicks)) return kMaxTimerTicks;
+  return static_cast<uint32_t>(lroundf(ticks));
+}
+
+// Samples a ramp given timeAt(s): the time in seconds at which the ramp has covered s steps.
+// Entries are averaged over |stride| steps and never shorter than the cruise interval.
+template <typename TimeAt>
+inline void sampleRamp(long steps, float cruiseSec, TimeAt timeAt, RampTable* table) {
+  if (steps < 1) steps = 1;
+  long stride = (steps + kRampTableSize - 2) / (kRampTableSize - 1);
+  if (stride < 1) stride = 1;
+
+  uint16_t length = 0;
+  float t0 = timeAt(0.0f);
+  for (long n = 0; n < steps && length < kRampTableSize - 1; n += stride) {
+    const float t1 = timeAt(static_cast<float>(n + stride));
+    float interval = (t1 - t0) / static_cast<float>(stride);
+    if (interval < cruiseSec) interval = cruiseSec;
+    table->ticks[length++] = secondsToTicks(interval);
+    t0 = t1;
+  }
+  table->ticks[length++] = secondsToTicks(cruiseSec);
+  table->length = length;
+  table->stride = static_cast<uint16_t>(stride);
+}
+
+// Constant-acceleration ramp: step n of the ramp fires at t(n) = sqrt(2n / a).
+inline void buildTrapezoidRamp(float maxSpeed, float acceleration, RampTable* table) {
+  if (maxSpeed < 1.0f) maxSpeed = 1.0f;
+  if (acceleration < 1.0f) acceleration = 1.0f;
+
+  const long rampSteps = lroundf(ceilf((maxSpeed * maxSpeed) / (2.0f * acceleration)));
+  sampleRamp(rampSteps, 1.0f / maxSpeed,
+             [acceleration](float s) { return sqrtf(2.0f * s / acceleration); }, table);
+}
+
+// Jerk-limited acceleration from rest to |peakSpeed|: acceleration rises at |jerk| to at most
+// |acceleration|, holds, then falls back to zero as the peak is reached. The velocity curve is
+// point-symmetric about its midpoint, so the ramp covers peakSpeed * duration / 2 steps.
+struct SCurveRamp {
+  float peakSpeed;
+  float jerk;
+  float peakAccel;
+  float jerkSec;   // T1: duration of each jerk phase
+  float totalSec;  // T = 2 * T1 + constant-acceleration time
+  float jerkSteps; // s1: distance covered by the first jerk phase
+  float holdSteps; // s2: distance at the end of the constant-acceleration phase
+  float steps;     // S: whole ramp distance
+
+  SCurveRamp(float speed, float acceleration, float jerkLimit) {
+    peakSpeed = speed < 1.0f ? 1.0f : speed;
+    jerk = jerkLimit < 1.0f ? 1.0f : jerkLimit;
+    peakAccel = acceleration < 1.0f ? 1.0f : acceleration;
+    // Too little speed to reach full acceleration: the ramp is two jerk phases only.
+    if (peakSpeed * jerk < peakAccel * peakAccel) peakAccel = sqrtf(peakSpeed * jerk);
+    jerkSec = peakAccel / jerk;
+    const float jerkSpeed = 0.5f * peakAccel * jerkSec;
+    const float holdSec = (peakSpeed - 2.0f * jerkSpeed) / peakAccel;
+    totalSec = 2.0f * jerkSec + (holdSec > 0.0f ? holdSec : 0.0f);
+    jerkSteps = jerk * jerkSec * jerkSec * jerkSec / 6.0f;
+    holdSteps = jerkSteps + jerkSpeed * (totalSec - 2.0f * jerkSec) +
+                0.5f * peakAccel * (totalSec - 2.0f * jerkSec) * (totalSec - 2.0f * jerkSec);
+    steps = 0.5f * peakSpeed * totalSec;
+  }
+
+  // Inverse of the position curve, phase by phase.
+  float timeAt(float s) const {
+    if (s <= 0.0f) return 0.0f;
+    if (s >= steps) return totalSec + (s - steps) / peakSpeed;
+    if (s <= jerkSteps) return cbrtf(6.0f * s / jerk);
+    const float jerkSpeed = 0.5f * peakAccel * jerkSec;
+    if (s <= holdSteps) {
+      const float ds = s - jerkSteps;
+      return jerkSec + (sqrtf(jerkSpeed * jerkSpeed + 2.0f * peakAccel * ds) - jerkSpeed) / peakAccel;
+    }
+    // Last phase mirrored from the end: u before the end the ramp is V*u - J*u^3/6 short of S.
+    const float missing = steps - s;
+    float u = missing / peakSpeed;
+    for (int i = 0; i < 4; ++i) {
+      const float f = peakSpeed * u - jerk * u * u * u / 6.0f - missing;
+      u -= f / (peakSpeed - 0.5f * jerk * u * u);
+    }
+    if (u < 0.0f) u = 0.0f;
+    if (u > jerkSec) u = jerkSec;
+    return totalSec - u;
+  }
+};
+
+// Highest peak speed (up to maxSpeed) whose S-curve ramp fits in |rampBudget| steps, so a
+// short move accelerates and decelerates without cutting the jerk phases short.
+inline float sCurvePeakForDistance(float maxSpeed, float acceleration, float jerk, float rampBudget) {
+  if (SCurveRamp(maxSpeed, acceleration, jerk).steps <= rampBudget) return maxSpeed;
+  float low = 1.0f;
+  float high = maxSpeed;
+  for (int i = 0; i < 24; ++i) {
+    const float mid = 0.5f * (low + high);
+    if (SCurveRamp(mid, acceleration, jerk).steps <= rampBudget) {
+      low = mid;
+    } else {
+      high = mid;
+    }
+  }
+  return low;
+}
+
+// Jerk-limited ramp table. With moveSteps > 0 the peak speed is lowered so the ramp fits in
+// half of the move; the ISR still only reads integer ticks.
+inline void buildSCurveRamp(float maxSpeed, float acceleration, float jerk, long moveSteps, RampTable* table) {
+  if (maxSpeed < 1.0f) maxSpeed = 1.0f;
+  float peak = maxSpeed;
+  if (moveSteps > 0) peak = sCurvePeakForDistance(maxSpeed, acceleration, jerk, 0.5f * static_cast<float>(moveSteps));
+  const SCurveRamp ramp(peak, acceleration, jerk);
+  sampleRamp(lroundf(ceilf(ramp.steps)), 1.0f / ramp.peakSpeed, [&ramp](float s) { return ramp.timeAt(s); }, table);
+}
+
+// Sum of the intervals the generator uses from ramp position |from| up to |to| (exclusive).
+inline uint64_t rampSpanTicks(const RampTable& table, uint32_t from, uint32_t to) {
+  const uint32_t stride = table.stride;
+  const uint32_t lastLevel = table.length - 1U;
+  uint64_t sum = 0;
+  while (from < to) {
+    const uint32_t level = from / stride;
+    if (level >= lastLevel) return sum + static_cast<uint64_t>(to - from) * table.ticks[lastLevel];
+    const uint32_t levelEnd = (level + 1) * stride < to ? (level + 1) * stride : to;
+    sum += static_cast<uint64_t>(levelEnd - from) * table.ticks[level];
+    from = levelEnd;
+  }
+  return sum;
+}
+
+// Timer ticks a generator |rampSteps| into its ramp needs to cover |distance| steps and come
+// to rest: it accelerates while it can still brake in time, cruises, then brakes.
+inline uint64_t ticksToRest(const RampTable& table, uint32_t rampSteps, uint32_t distance) {
+  if (table.length == 0 || distance == 0) return 0;
+  if (distance <= rampSteps) return rampSpanTicks(table, rampSteps - distance, rampSteps);
+  const uint32_t peakSteps = static_cast<uint32_t>(table.length - 1U) * table.stride;
+  uint32_t top = (distance + rampSteps) / 2;
+  if (top > peakSteps) top = peakSteps;
+  if (top < rampSteps) top = rampSteps;
+  const uint32_t cruise = distance - (top - rampSteps) - top;
+  const uint32_t cruiseLevel = top / table.stride < table.length ? top / table.stride : table.length - 1U;
+  // The interval after a step belongs to the ramp position the step leads to; the last one
+  // is the step onto the target, which waits for nothing.
+  return rampSpanTicks(table, rampSteps + 1, top + 1) + static_cast<uint64_t>(cruise) * table.ticks[cruiseLevel] +
+         rampSpanTicks(table, 0, top) - (top > 0 ? table.ticks[0] : 0);
+}
+
+// Position/target bookkeeping and ramp tracking for one motor. step() is the whole ISR
+// workload: one table lookup, no floating point and no division.
+class StepGenerator {
+ public:
+  void setRampTable(const RampTable* table) { table_ = table; }
+
+  long currentPosition() const { return position_; }
+  long targetPosition() const { return target_; }
+  long distanceToGo() const { return target_ - position_; }
+  bool isRunning() const { return running_; }
+  uint32_t rampSteps() const { return level_ * stride() + sub_; }
+  int direction() const { return direction_; }
+
+  // Callers must keep the step ISR out while these run.
+  void moveTo(long target) {
+    target_ = target;
+    if (target_ != position_ || rampSteps() != 0) running_ = true;
+  }
+
+  // Switches to a faster table mid-move at the first of its levels that is no slower than
+  // the current interval, so the speed carries over and the ramp continues from there.
+  void rebaseRamp(const RampTable* table) {
+    if (!table_ || rampSteps() == 0) {
+      table_ = table;
+      return;
+    }
+    const uint16_t lastLevel = static_cast<uint16_t>(table_->length - 1);
+    const uint32_t ticks = table_->ticks[level_ < table_->length ? level_ : lastLevel];
+    uint16_t level = 0;
+    while (level + 1 < table->length && table->ticks[level] > ticks) ++level;
+    table_ = table;
+    level_ = level;
+    sub_ = 0;
+  }
+
+  void setCurrentPosition(long position) {
+    position_ = position;
+    target_ = position;
+    level_ = 0;
+    sub_ = 0;
+    running_ = false;
+  }
+
+  // Takes one step towards the target and returns the timer ticks until the next one, or 0
+  // once the motor has come to rest on the target.
+  SHUTTER_ISR_INLINE uint32_t step() {
+    long distance = target_ - position_;
+    if (level_ == 0 && sub_ == 0) {
+      if (distance == 0) {
+        running_ = false;
+        return 0;
+      }
+      direction_ = distance > 0 ? 1 : -1;
+    }
+
+    position_ += direction_;
+    distance -= direction_;
+
+    const long remaining = direction_ > 0 ? distance : -distance;
+    const uint16_t lastLevel = table_ ? static_cast<uint16_t>(table_->length - 1) : 0;
+    if (remaining <= static_cast<long>(rampSteps()) || level_ > lastLevel) {
+      decelerate();
+    } else if (level_ < lastLevel) {
+      accelerate();
+    }
+
+    if (distance == 0 && level_ == 0 && sub_ == 0) {
+      running_ = false;
+      return 0;
+    }
+    running_ = true;
+    if (!table_) return kMaxTimerTicks;
+    return table_->ticks[level_ < table_->length ? level_ : lastLevel];
+  }
+
+ private:
+  uint16_t stride() const { return table_ ? table_->stride : 1; }
+
+  SHUTTER_ISR_INLINE void accelerate() {
+    if (++sub_ >= stride()) {
+      sub_ = 0;
+      ++level_;
+    }
+  }
+
+  SHUTTER_ISR_INLINE void decelerate() {
+    if (sub_ > 0) {
+      --sub_;
+    } else if (level_ > 0) {
+      --level_;
+      sub_ = static_cast<uint16_t>(stride() - 1);
+    }
+  }
+
+  const RampTable* volatile table_ = nullptr;
+  volatile long position_ = 0;
+  volatile long target_ = 0;
+  volatile bool running_ = false;
+  int8_t direction_ = 1;
+  uint16_t level_ = 0;
+  uint16_t sub_ = 0;
+};
+
+struct StepTraceSummary {
+  uint32_t samples = 0;
+  uint32_t minUs = 0;
+  uint32_t maxUs = 0;
+  uint32_t meanUs = 0;
+  uint32_t maxJitterUs = 0;
+  uint32_t meanJitterUs = 0;
+};
+
+// Ring buffer of measured inter-step intervals (CPU cycles) next to the interval the
+// generator asked for (timer ticks), filled from the step ISR while enabled.
+template <uint16_t N>
+class StepTrace {
+ public:
+  volatile bool enabled = false;
+
+  void reset() {
+    head_ = 0;
+    count_ = 0;
+    lastCycles_ = 0;
+    pendingTicks_ = 0;
+  }
+
+  // |scheduledTicks| is the delay programmed after this step (0 when the motor stopped).
+  SHUTTER_ISR_INLINE void record(uint32_t nowCycles, uint32_t scheduledTicks) {
+    if (pendingTicks_ != 0) {
+      actualCycles_[head_] = nowCycles - lastCycles_;
+      expectedTicks_[head_] = pendingTicks_;
+      head_ = static_cast<uint16_t>((head_ + 1) % N);
+      if (count_ < N) ++count_;
+    }
+    lastCycles_ = nowCycles;
+    pendingTicks_ = scheduledTicks;
+  }
+
+  uint16_t size() const { return count_; }
+
+  // i = 0 is the oldest retained sample.
+  uint32_t intervalUs(uint16_t i, uint32_t cyclesPerUs) const {
+    return actualCycles_[index(i)] / cyclesPerUs;
+  }
+
+  StepTraceSummary summarize(uint32_t cyclesPerUs) const {
+    StepTraceSummary out;
+    out.samples = count_;
+    if (count_ == 0) return out;
+    uint64_t sum = 0;
+    uint64_t jitterSum = 0;
+    out.minUs = UINT32_MAX;
+    for (uint16_t i = 0; i < count_; ++i) {
+      const uint32_t actualUs = actualCycles_[index(i)] / cyclesPerUs;
+      const uint32_t expectedUs = expectedTicks_[index(i)] / kTimerTicksPerUs;
+      const uint32_t jitter = actualUs > expectedUs ? actualUs - expectedUs : expectedUs - actualUs;
+      if (actualUs < out.minUs) out.minUs = actualUs;
+      if (actualUs > out.maxUs) out.maxUs = actualUs;
+      if (jitter > out.maxJitterUs) out.maxJitterUs = jitter;
+      sum += actualUs;
+      jitterSum += jitter;
+    }
+    out.meanUs = static_cast<uint32_t>(sum / count_);
+    out.meanJitterUs = static_cast<uint32_t>(jitterSum / count_);
+    return out;
+  }
+
+ private:
+  uint16_t index(uint16_t i) const { return static_cast<uint16_t>((head_ + N - count_ + i) % N); }
+
+  uint32_t actualCycles_[N] = {};
+  uint32_t expectedTicks_[N] = {};
+  uint16_t head_ = 0;
+  uint16_t count_ = 0;
+  uint32_t lastCycles_ = 0;
+  uint32_t pendingTicks_ = 0;
+};
+
+}  // namespace motion
+}  // namespace shutter
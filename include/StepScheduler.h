@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "StepGenerator.h"
+
+namespace shutter {
+namespace motion {
+
+// Steps due this close to the expiring deadline are taken in the same interrupt (5 us).
+constexpr uint32_t kStepCoalesceTicks = 25;
+
+// Deadlines for up to N step generators sharing one one-shot timer. Each active channel keeps
+// the ticks left until its next step, counted from the moment the timer was last programmed;
+// the timer always runs to the nearest deadline.
+template <uint8_t N>
+class StepScheduler {
+ public:
+  static_assert(N >= 1 && N <= 8, "channel mask is one byte");
+
+  bool isActive(uint8_t channel) const { return (activeMask_ & (1U << channel)) != 0; }
+  bool anyActive() const { return activeMask_ != 0; }
+  // Delay the timer was last programmed with.
+  uint32_t programmedTicks() const { return programmed_; }
+
+  // Adds |channel| with its first step |kickTicks| from now. |remainingTicks| is what is left
+  // of the programmed delay. Returns the delay to program, or 0 to leave the timer alone: when
+  // the pending expiry is sooner than the kick, the channel simply joins it.
+  // Callers must keep the timer ISR out while this runs.
+  uint32_t start(uint8_t channel, uint32_t kickTicks, uint32_t remainingTicks) {
+    if (kickTicks == 0) kickTicks = 1;
+    if (activeMask_ == 0) {
+      activeMask_ = static_cast<uint8_t>(1U << channel);
+      due_[channel] = kickTicks;
+      programmed_ = kickTicks;
+      return kickTicks;
+    }
+    activeMask_ |= static_cast<uint8_t>(1U << channel);
+    if (remainingTicks > programmed_) remainingTicks = programmed_;
+    if (remainingTicks <= kickTicks) {
+      due_[channel] = programmed_;
+      return 0;
+    }
+    // Re-base every deadline on now; the others are all later than the kick.
+    const uint32_t elapsed = programmed_ - remainingTicks;
+    for (uint8_t i = 0; i < N; ++i) {
+      if (isActive(i)) due_[i] = due_[i] > elapsed ? due_[i] - elapsed : 0;
+    }
+    due_[channel] = kickTicks;
+    programmed_ = kickTicks;
+    return kickTicks;
+  }
+
+  // Timer expiry. Calls stepChannel(i) for every channel due now, which steps that generator
+  // and returns its next interval (0 once it rests). Returns the next timer delay, or 0 when
+  // no channel is left running.
+  template <typename StepFn>
+  SHUTTER_ISR_INLINE uint32_t run(StepFn stepChannel) {
+    const uint32_t elapsed = programmed_;
+    uint32_t next = 0;
+    for (uint8_t i = 0; i < N; ++i) {
+      if (!isActive(i)) continue;
+      uint32_t due = due_[i];
+      if (due <= elapsed + kStepCoalesceTicks) {
+        const uint32_t interval = stepChannel(i);
+        if (interval == 0) {
+          activeMask_ &= static_cast<uint8_t>(~(1U << i));
+          continue;
+        }
+        // The next step is timed from when this one was due, so coalescing does not drift.
+        const uint32_t at = due + interval;
+        due = at > elapsed ? at - elapsed : 1;
+      } else {
+        due -= elapsed;
+      }
+      due_[i] = due;
+      if (next == 0 || due < next) next = due;
+    }
+    programmed_ = next;
+    return next;
+  }
+
+ private:
+  uint32_t due_[N] = {};
+  uint32_t programmed_ = 0;
+  uint8_t activeMask_ = 0;
+};
+
+}  // namespace motion
+}  // namespace shutter
@@ -0,0 +1,55 @@
+"""Sends one group command to every controller on the LAN over UDP multicast, the same
+datagram POST /api/group/move sends (include/GroupCommand.h). For automations that would
+rather not go through one of the controllers.
+
+    python3 scripts/group_command.py <group 1..16> open|close|stop|set [percent] [--lead-ms 200]
+"""
+
+import argparse
+import random
+import socket
+import struct
+import time
+
+GROUP_ADDRESS = "239.255.83.72"
+GROUP_PORT = 4219
+VERSION = 1
+ACTIONS = {"open": 1, "close": 2, "stop": 3, "set": 4}
+COPIES = 3
+COPY_GAP_S = 0.04
+
+
+def packet(sender, sequence, groups, start_in_us, action, centi_percent):
+    return struct.pack(">2sBBIHHIH", b"SG", VERSION, action, sender, sequence, groups, start_in_us, centi_percent)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("group", type=int, choices=range(1, 17), metavar="group")
+    parser.add_argument("action", choices=sorted(ACTIONS))
+    parser.add_argument("percent", type=float, nargs="?", default=0.0)
+    parser.add_argument("--lead-ms", type=int, default=200)
+    args = parser.parse_args()
+    if args.action == "set" and not 0.0 <= args.percent <= 100.0:
+        parser.error("percent must be between 0 and 100")
+
+    sender = random.getrandbits(32)  # not a chip id, so it never collides with a controller's
+    sequence = random.getrandbits(16)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+
+    start_at = time.monotonic() + args.lead_ms / 1000.0
+    for _ in range(COPIES):
+        # Every copy counts down to the same start.
+        left_us = int((start_at - time.monotonic()) * 1e6)
+        if left_us <= 0:
+            break
+        data = packet(sender, sequence, 1 << (args.group - 1), left_us, ACTIONS[args.action],
+                      round(args.percent * 100) if args.action == "set" else 0)
+        sock.sendto(data, (GROUP_ADDRESS, GROUP_PORT))
+        time.sleep(COPY_GAP_S)
+    print(f"group {args.group}: {args.action} sent, sequence {sequence}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,70 @@
+"""Stages data/ for the LittleFS image: text assets are stored gzipped, and the asset URLs in
+HTML get a ?v=<content hash> suffix so browsers may cache them for good.
+
+PlatformIO runs it as a pre: script of the firmware env and builds the filesystem image from
+the staged copy. Standalone: python3 scripts/gzip_web_assets.py data out
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import shutil
+import sys
+
+GZIP_SUFFIXES = (".html", ".js", ".css", ".json", ".svg", ".txt")
+
+
+def content_version(data):
+    return hashlib.sha1(data).hexdigest()[:10]
+
+
+def stage(src_dir, out_dir):
+    if os.path.isdir(out_dir):
+        shutil.rmtree(out_dir)
+    os.makedirs(out_dir)
+
+    files = {}
+    for root, _, names in os.walk(src_dir):
+        for name in sorted(names):
+            path = os.path.join(root, name)
+            uri = "/" + os.path.relpath(path, src_dir).replace(os.sep, "/")
+            with open(path, "rb") as f:
+                files[uri] = f.read()
+
+    # "/app.js" -> "/app.js?v=..." inside href="..." and src="..." of every HTML file.
+    versions = {uri: content_version(data) for uri, data in files.items() if not uri.endswith(".html")}
+
+    def versioned(match):
+        uri = match.group(2)
+        if uri not in versions:
+            return match.group(0)
+        return '%s="%s?v=%s"' % (match.group(1), uri, versions[uri])
+
+    for uri, data in files.items():
+        if uri.endswith(".html"):
+            html = data.decode("utf-8")
+            data = re.sub(r'(href|src)="(/[^"?#]+)"', versioned, html).encode("utf-8")
+        out_path = os.path.join(out_dir, uri.lstrip("/"))
+        os.makedirs(os.path.dirname(out_path), exist_ok=True)
+        if uri.endswith(GZIP_SUFFIXES):
+            # mtime=0 keeps the image, and so the ETags, identical for identical sources.
+            with open(out_path + ".gz", "wb") as raw:
+                with gzip.GzipFile(filename="", mode="wb", fileobj=raw, compresslevel=9, mtime=0) as f:
+                    f.write(data)
+            print("web asset %s: %d -> %d bytes" % (uri, len(data), os.path.getsize(out_path + ".gz")))
+        else:
+            with open(out_path, "wb") as f:
+                f.write(data)
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("usage: gzip_web_assets.py <data dir> <out dir>")
+    stage(sys.argv[1], sys.argv[2])
+else:
+    Import("env")  # noqa: F821 (PlatformIO SCons environment)
+
+    staged = os.path.join(env.subst("$BUILD_DIR"), "data")  # noqa: F821
+    stage(env.subst("$PROJECT_DATA_DIR"), staged)  # noqa: F821
+    env.Replace(PROJECT_DATA_DIR=staged)  # noqa: F821
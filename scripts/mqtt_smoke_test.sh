@@ -0,0 +1,100 @@
+#!/usr/bin/env bash
+# MQTT check against a local broker: discovery, retained state and a position command.
+#   ./scripts/mqtt_smoke_test.sh <device ip> <broker ip>
+# Needs mosquitto_sub / mosquitto_pub (mosquitto-clients) and a broker that lets anyone in
+# (stored credentials are left as they are), e.g.
+#   mosquitto -c /dev/stdin <<< $'listener 1883\nallow_anonymous true'
+set -euo pipefail
+
+HOST="${1:-192.168.88.74}"
+BROKER="${2:?broker ip required}"
+BASE_URL="http://${HOST}"
+TOPIC="shutter-smoke"
+
+api_get() {
+  local path="$1"
+  curl -sS --fail --max-time 8 "${BASE_URL}${path}"
+}
+
+api_post() {
+  local path="$1"
+  local body="$2"
+  curl -sS --fail --max-time 8 \
+    -X POST "${BASE_URL}${path}" \
+    -H 'Content-Type: application/json' \
+    -d "${body}"
+}
+
+json_get() {
+  local json="$1"
+  local key="$2"
+  JSON_IN="${json}" KEY_IN="${key}" python3 - << 'PY'
+import json, os
+obj = json.loads(os.environ['JSON_IN'])
+key = os.environ['KEY_IN']
+val = obj[key]
+if isinstance(val, bool):
+    print('true' if val else 'false')
+else:
+    print(val)
+PY
+}
+
+assert_eq() {
+  local expected="$1"
+  local actual="$2"
+  local label="$3"
+  if [[ "${expected}" != "${actual}" ]]; then
+    echo "[FAIL] ${label}: expected=${expected}, actual=${actual}" >&2
+    exit 1
+  fi
+  echo "[OK] ${label}: ${actual}"
+}
+
+# First retained message on a topic.
+retained() {
+  mosquitto_sub -h "${BROKER}" -t "$1" -C 1 -W 5
+}
+
+wait_for() {
+  local key="$1"
+  local expected="$2"
+  for _ in $(seq 1 60); do
+    if [[ "$(json_get "$(api_get '/api/state')" "${key}")" == "${expected}" ]]; then
+      return 0
+    fi
+    sleep 0.5
+  done
+  echo "[FAIL] ${key} did not become ${expected}" >&2
+  exit 1
+}
+
+orig_config="$(api_get '/api/mqtt/config')"
+
+echo "[INFO] Pointing ${HOST} at broker ${BROKER}"
+api_post '/api/mqtt/config' "{\"mqttEnabled\":true,\"mqttHost\":\"${BROKER}\",\"mqttPort\":1883,\"mqttBaseTopic\":\"${TOPIC}\",\"mqttDiscovery\":true}" >/dev/null
+wait_for 'mqttState' 'connected'
+echo "[OK] mqttState: connected"
+
+assert_eq "online" "$(retained "${TOPIC}/availability")" "availability"
+discovery="$(mosquitto_sub -h "${BROKER}" -t 'homeassistant/cover/+/config' -C 1 -W 5)"
+assert_eq "${TOPIC}" "$(json_get "${discovery}" '~')" "discovery base topic"
+
+echo "[INFO] Commanding 50 % open over MQTT"
+mosquitto_pub -h "${BROKER}" -t "${TOPIC}/0/position/set" -m 50
+wait_for 'moving' 'true'
+wait_for 'moving' 'false'
+assert_eq "50" "$(retained "${TOPIC}/0/position")" "retained position"
+assert_eq "stopped" "$(retained "${TOPIC}/0/state")" "retained state"
+
+echo "[INFO] Opening over MQTT"
+mosquitto_pub -h "${BROKER}" -t "${TOPIC}/0/set" -m OPEN
+wait_for 'moving' 'true'
+wait_for 'moving' 'false'
+assert_eq "100" "$(retained "${TOPIC}/0/position")" "retained position after OPEN"
+
+echo "[INFO] Restoring MQTT config"
+restore_payload="$(JSON_IN="${orig_config}" python3 -c 'import json,os; c=json.loads(os.environ["JSON_IN"]); print(json.dumps({k: c[k] for k in ("mqttEnabled","mqttHost","mqttPort","mqttUser","mqttBaseTopic","mqttDiscovery")}))')"
+api_post '/api/mqtt/config' "${restore_payload}" >/dev/null
+
+echo "[PASS] MQTT smoke test completed"
@@ -0,0 +1,189 @@
+#pragma once
+
+// Host stand-in for the ESP8266 Arduino core. Time is simulated (see HostSim.h): millis()
+// and micros() read the simulated clock, delay() advances it, and timer1 fires its callback
+// when the clock passes the programmed deadline. The GPIO latch feeds the motor model.
+// With WIFI_LIGHT_SLEEP selected, delay() suspends the CPU like the SDK does: timer1 fires only
+// after it returns.
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+
+#include "WString.h"
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define PROGMEM
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+#define A0 17
+
+#define SPI_FLASH_SEC_SIZE 4096
+
+using std::max;
+using std::min;
+typedef uint8_t byte;
+typedef bool boolean;
+
+namespace hostsim {
+uint64_t nowNanos();
+void advanceNanos(uint64_t ns);
+void delayMillis(uint32_t ms);
+}  // namespace hostsim
+
+inline uint32_t millis() { return static_cast<uint32_t>(hostsim::nowNanos() / 1000000ULL); }
+inline uint32_t micros() { return static_cast<uint32_t>(hostsim::nowNanos() / 1000ULL); }
+inline void delay(uint32_t ms) { hostsim::delayMillis(ms); }
+inline void delayMicroseconds(uint32_t us) { hostsim::advanceNanos(static_cast<uint64_t>(us) * 1000ULL); }
+inline void yield() {}
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+template <typename T>
+T constrain(T value, T low, T high) {
+  return value < low ? low : (value > high ? high : value);
+}
+
+// Interrupts only run between simulated instructions of the harness, so masking is a no-op.
+#define noInterrupts()
+#define interrupts()
+
+// Output latch registers: writing a mask sets (GPOS) or clears (GPOC) those pins.
+struct GpioSetRegister {
+  GpioSetRegister& operator=(uint32_t mask);
+};
+struct GpioClearRegister {
+  GpioClearRegister& operator=(uint32_t mask);
+};
+extern GpioSetRegister GPOS;
+extern GpioClearRegister GPOC;
+
+// timer1 runs at 80 MHz / divider; TIM_DIV16 gives the 5 ticks/us the firmware assumes.
+#define TIM_DIV1 0
+#define TIM_DIV16 1
+#define TIM_DIV256 3
+#define TIM_EDGE 0
+#define TIM_LEVEL 1
+#define TIM_SINGLE 0
+#define TIM_LOOP 1
+typedef void (*timercallback)(void);
+void timer1_isr_init(void);
+void timer1_enable(uint8_t divider, uint8_t intType, uint8_t reload);
+void timer1_disable(void);
+void timer1_attachInterrupt(timercallback userFunc);
+void timer1_detachInterrupt(void);
+void timer1_write(uint32_t ticks);
+// Ticks left until the programmed expiry (the core reads the T1V register).
+uint32_t timer1_read(void);
+
+// SNTP with a POSIX TZ string such as "CET-1CEST,M3.5.0,M10.5.0/3"; time() follows the server.
+void configTime(const char* tz, const char* server1, const char* server2 = nullptr, const char* server3 = nullptr);
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && write(buffer[n]) == 1) ++n;
+    return n;
+  }
+  size_t write(const char* s) { return write(reinterpret_cast<const uint8_t*>(s), strlen(s)); }
+  size_t write(const char* buffer, size_t size) { return write(reinterpret_cast<const uint8_t*>(buffer), size); }
+  virtual void flush() {}
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(const String& s) { return write(s.c_str(), s.length()); }
+  size_t print(const __FlashStringHelper* s) { return write(reinterpret_cast<const char*>(s)); }
+  size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+  template <typename T>
+  size_t print(T value) {
+    return print(String(value));
+  }
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(T value) {
+    const size_t n = print(value);
+    return n + println();
+  }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+    char buffer[256];
+    va_list args;
+    va_start(args, format);
+    const int n = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (n <= 0) return 0;
+    return write(buffer, std::min(static_cast<size_t>(n), sizeof(buffer) - 1));
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual size_t readBytes(uint8_t* buffer, size_t size) {
+    size_t n = 0;
+    while (n < size && available() > 0) buffer[n++] = static_cast<uint8_t>(read());
+    return n;
+  }
+  size_t readBytes(char* buffer, size_t size) { return readBytes(reinterpret_cast<uint8_t*>(buffer), size); }
+  String readString() {
+    String text;
+    while (available() > 0) text += static_cast<char>(read());
+    return text;
+  }
+  void setTimeout(unsigned long timeoutMs) { timeoutMs_ = timeoutMs; }
+  unsigned long getTimeout() const { return timeoutMs_; }
+
+ protected:
+  unsigned long timeoutMs_ = 1000;
+};
+
+// Serial output is collected by the harness (hostsim::serialOutput()).
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long baud) { (void)baud; }
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int available() override { return 0; }
+  int read() override { return -1; }
+  int peek() override { return -1; }
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+ public:
+  // Does not return: throws hostsim::RestartRequested, which ends the simulated boot.
+  [[noreturn]] void restart();
+  uint32_t getFreeHeap();
+  uint32_t getMaxFreeBlockSize();
+  uint8_t getHeapFragmentation();
+  uint32_t getCycleCount();
+  uint8_t getCpuFreqMHz() { return 80; }
+  uint32_t getChipId() { return 0x00ABCDEF; }
+  uint32_t getFlashChipSize() { return 2 * 1024 * 1024; }
+  bool flashEraseSector(uint32_t sector);
+  bool flashRead(uint32_t address, uint32_t* data, size_t size);
+  bool flashWrite(uint32_t address, const uint32_t* data, size_t size);
+};
+extern EspClass ESP;
+
+// Linker symbol the core derives the EEPROM sector from; the host flash maps that sector.
+extern "C" uint32_t _EEPROM_start;
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+// RAM cache over the EEPROM flash sector, with the core's semantics: put() only dirties the
+// cache when bytes change, and commit() erases the whole sector before programming the cache.
+class EEPROMClass {
+ public:
+  void begin(size_t size);
+  bool commit();
+  bool end();
+
+  uint8_t read(int address) const { return inRange(address, 1) ? data_[address] : 0; }
+  void write(int address, uint8_t value) {
+    if (!inRange(address, 1) || data_[address] == value) return;
+    data_[address] = value;
+    dirty_ = true;
+  }
+  template <typename T>
+  T& get(int address, T& value) const {
+    if (inRange(address, sizeof(T))) memcpy(&value, data_.data() + address, sizeof(T));
+    return value;
+  }
+  template <typename T>
+  const T& put(int address, const T& value) {
+    if (inRange(address, sizeof(T)) && memcmp(data_.data() + address, &value, sizeof(T)) != 0) {
+      memcpy(data_.data() + address, &value, sizeof(T));
+      dirty_ = true;
+    }
+    return value;
+  }
+  uint8_t* getDataPtr() {
+    dirty_ = true;
+    return data_.data();
+  }
+  const uint8_t* getConstDataPtr() const { return data_.data(); }
+  size_t length() const { return data_.size(); }
+
+ private:
+  bool inRange(int address, size_t size) const {
+    return address >= 0 && static_cast<size_t>(address) + size <= data_.size();
+  }
+
+  std::vector<uint8_t> data_;
+  bool dirty_ = false;
+};
+extern EEPROMClass EEPROM;
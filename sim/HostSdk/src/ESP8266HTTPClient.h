@@ -0,0 +1,45 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+#include <utility>
+#include <vector>
+
+#define HTTPC_ERROR_CONNECTION_FAILED (-1)
+#define HTTPC_ERROR_NOT_CONNECTED (-4)
+#define HTTPC_ERROR_CONNECTION_LOST (-5)
+
+#define HTTP_CODE_OK 200
+#define HTTP_CODE_NOT_FOUND 404
+
+enum followRedirects_t {
+  HTTPC_DISABLE_FOLLOW_REDIRECTS,
+  HTTPC_STRICT_FOLLOW_REDIRECTS,
+  HTTPC_FORCE_FOLLOW_REDIRECTS
+};
+
+// GET against the downloads registered with hostsim::serveUrl(). The body streams into the
+// caller's client at the registered rate and the "server" closes after the last byte.
+class HTTPClient {
+ public:
+  bool begin(WiFiClient& client, const String& url);
+  void end();
+  void setFollowRedirects(followRedirects_t follow) { (void)follow; }
+  void setTimeout(uint16_t timeoutMs) { (void)timeoutMs; }
+  void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+
+  int GET();
+  int getSize() const { return size_; }
+  WiFiClient* getStreamPtr();
+  String header(const char* name) const;
+  bool connected();
+
+  static String errorToString(int error);
+
+ private:
+  WiFiClient* client_ = nullptr;
+  String url_;
+  int size_ = -1;
+  std::vector<String> wantedHeaders_;
+  std::vector<std::pair<String, String>> headers_;
+};
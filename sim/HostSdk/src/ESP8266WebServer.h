@@ -0,0 +1,122 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+#include <FS.h>
+#include <uri/Uri.h>
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+namespace hostsim {
+
+struct PendingRequest {
+  HTTPMethod method;
+  String uri;
+  String body;
+  std::vector<std::pair<String, String>> headers;
+  std::shared_ptr<Connection> connection;
+};
+
+}  // namespace hostsim
+
+// Request dispatch and response framing follow the core's ESP8266WebServer: handlers see the
+// same arg()/header()/client() surface and send() writes the status line, headers and body to
+// the connection. Requests come from hostsim::request() instead of a listening socket.
+class ESP8266WebServer {
+ public:
+  typedef std::function<void(void)> THandlerFunction;
+
+  explicit ESP8266WebServer(int port = 80);
+  ESP8266WebServer(const ESP8266WebServer&) = delete;
+  ESP8266WebServer& operator=(const ESP8266WebServer&) = delete;
+
+  void begin() { listening_ = true; }
+  void close() { listening_ = false; }
+  void stop() { close(); }
+  void handleClient();
+
+  void on(const Uri& uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+  void on(const Uri& uri, HTTPMethod method, THandlerFunction handler);
+  void onNotFound(THandlerFunction handler) { notFoundHandler_ = handler; }
+  void serveStatic(const char* uri, fs::FS& fs, const char* path, const char* cacheHeader = nullptr);
+
+  const String& uri() const { return request_.uri; }
+  HTTPMethod method() const { return request_.method; }
+  const String& arg(const String& name) const;
+  const String& arg(int index) const;
+  const String& argName(int index) const;
+  // Segment captured by the i-th {} of the matched UriBraces route.
+  const String& pathArg(unsigned int index) const;
+  int args() const { return static_cast<int>(args_.size()); }
+  bool hasArg(const String& name) const;
+  void collectHeaders(const char* headerKeys[], const size_t headerKeysCount);
+  const String& header(const String& name) const;
+  bool hasHeader(const String& name) const;
+  WiFiClient& client() { return client_; }
+
+  void send(int code, const char* contentType = nullptr, const String& content = String());
+  void send(int code, const String& contentType, const String& content) { send(code, contentType.c_str(), content); }
+  void send(int code, const char* contentType, const char* content) { send(code, contentType, content, strlen(content)); }
+  void send(int code, const char* contentType, const char* content, size_t contentLength);
+  void sendHeader(const String& name, const String& value, bool first = false);
+  void setContentLength(size_t contentLength) { contentLength_ = contentLength; }
+  void sendContent(const String& content) { sendContent(content.c_str(), content.length()); }
+  void sendContent(const char* content, size_t size);
+
+  template <typename T>
+  size_t streamFile(T& file, const String& contentType, HTTPMethod requestMethod = HTTP_GET) {
+    setContentLength(file.size());
+    const String name(file.name());
+    if (name.endsWith(".gz") && contentType != "application/x-gzip" && contentType != "application/octet-stream") {
+      sendHeader("Content-Encoding", "gzip");
+    }
+    send(200, contentType, String());
+    if (requestMethod != HTTP_GET) return 0;
+    uint8_t chunk[512];
+    size_t sent = 0;
+    int n;
+    while ((n = file.read(chunk, sizeof(chunk))) > 0) sent += client_.write(chunk, static_cast<size_t>(n));
+    return sent;
+  }
+
+  static String responseCodeToString(int code);
+  static String contentTypeFor(const String& path);
+
+ private:
+  // One list in registration order, like the core's handler chain; fs != nullptr marks a
+  // serveStatic() route.
+  struct Route {
+    std::shared_ptr<Uri> uri;
+    HTTPMethod method;
+    THandlerFunction handler;
+    fs::FS* fs;
+    String path;
+    String cacheHeader;
+  };
+
+  void dispatch(hostsim::PendingRequest& request);
+  bool serveStaticRoute(const Route& route);
+  void parseArgs(const String& query);
+  void writeHeader(int code, const char* contentType, size_t contentLength);
+
+  int port_;
+  bool listening_ = false;
+  std::vector<Route> routes_;
+  THandlerFunction notFoundHandler_;
+  std::vector<String> collectedHeaderNames_;
+
+  hostsim::PendingRequest request_;
+  std::vector<std::pair<String, String>> args_;
+  std::vector<String> pathArgs_;
+  WiFiClient client_;
+  String responseHeaders_;
+  size_t contentLength_ = CONTENT_LENGTH_NOT_SET;
+  bool chunked_ = false;
+};
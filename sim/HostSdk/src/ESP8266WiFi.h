@@ -0,0 +1,131 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+#include <string>
+
+#include "IPAddress.h"
+
+enum WiFiMode_t { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 };
+enum WiFiSleepType_t { WIFI_NONE_SLEEP = 0, WIFI_LIGHT_SLEEP = 1, WIFI_MODEM_SLEEP = 2 };
+enum wl_status_t {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6
+};
+
+namespace hostsim {
+
+// One TCP connection seen from the board. Inbound bytes become readable at bytesPerSec of
+// simulated time (0 = all at once); outbound bytes are whatever the board wrote. Copies of a
+// WiFiClient share the connection, like the core's refcounted ClientContext.
+struct Connection {
+  std::string inbound;
+  size_t inboundRead = 0;
+  uint64_t inboundStartNs = 0;
+  uint32_t bytesPerSec = 0;
+  std::string outbound;
+  size_t outboundLimit = static_cast<size_t>(-1);  // peer window; writes past it come back short
+  bool peerClosed = false;
+  bool localClosed = false;
+
+  size_t inboundArrived() const;
+};
+
+}  // namespace hostsim
+
+class WiFiClient : public Stream {
+ public:
+  WiFiClient() {}
+  explicit WiFiClient(std::shared_ptr<hostsim::Connection> connection) : connection_(std::move(connection)) {}
+  virtual ~WiFiClient() {}
+
+  virtual int connect(IPAddress ip, uint16_t port);
+  virtual int connect(const char* host, uint16_t port);
+  int connect(const String& host, uint16_t port) { return connect(host.c_str(), port); }
+  virtual uint8_t connected();
+  virtual void stop();
+  explicit operator bool() { return connected() != 0; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  int read(uint8_t* buffer, size_t size);
+  int peek() override;
+
+  void setNoDelay(bool noDelay) { (void)noDelay; }
+  IPAddress remoteIP() const { return IPAddress(192, 168, 88, 10); }
+
+  const std::shared_ptr<hostsim::Connection>& connection() const { return connection_; }
+  void attach(std::shared_ptr<hostsim::Connection> connection) { connection_ = std::move(connection); }
+
+ private:
+  std::shared_ptr<hostsim::Connection> connection_;
+};
+
+// Station only: begin() associates after the scan, auth and DHCP time of hostsim::setWiFiTiming();
+// a direct join (channel + BSSID) to anything but the simulated access point never completes.
+class ESP8266WiFiClass {
+ public:
+  bool mode(WiFiMode_t mode) {
+    mode_ = mode;
+    return true;
+  }
+  WiFiMode_t getMode() const { return mode_; }
+  bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0) {
+    sleepMode_ = type;
+    (void)listenInterval;
+    return true;
+  }
+  WiFiSleepType_t getSleepMode() const { return sleepMode_; }
+  void persistent(bool persistent) { (void)persistent; }
+  bool setAutoConnect(bool autoConnect) {
+    (void)autoConnect;
+    return true;
+  }
+  bool setAutoReconnect(bool autoReconnect) {
+    (void)autoReconnect;
+    return true;
+  }
+
+  wl_status_t begin(const char* ssid, const char* passphrase = nullptr, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true);
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(),
+              IPAddress dns2 = IPAddress());
+  bool disconnect(bool wifiOff = false);
+  wl_status_t status();
+  bool isConnected() { return status() == WL_CONNECTED; }
+
+  IPAddress localIP();
+  IPAddress gatewayIP();
+  IPAddress subnetMask();
+  IPAddress dnsIP(uint8_t index = 0);
+  String SSID() const { return ssid_; }
+  String psk() const { return psk_; }
+  uint8_t* BSSID();
+  String BSSIDstr();
+  int32_t RSSI();
+  int32_t channel();
+  String macAddress() const { return String("5C:CF:7F:AB:CD:EF"); }
+  int hostByName(const char* host, IPAddress& result);
+
+ private:
+  WiFiMode_t mode_ = WIFI_OFF;
+  WiFiSleepType_t sleepMode_ = WIFI_NONE_SLEEP;
+  String ssid_;
+  String psk_;
+  IPAddress staticIp_;
+  IPAddress gateway_;
+  IPAddress subnet_;
+  IPAddress dns_;
+  uint8_t bssid_[6] = {};
+  bool begun_ = false;
+  bool wrongAccessPoint_ = false;
+  uint64_t associatedAtNs_ = 0;
+};
+extern ESP8266WiFiClass WiFi;
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <memory>
+#include <string>
+
+namespace fs {
+
+struct FileData {
+  std::string bytes;
+};
+
+class File : public Stream {
+ public:
+  File() {}
+  File(std::shared_ptr<FileData> data, const std::string& path, bool writable)
+      : data_(std::move(data)), path_(path), writable_(writable) {}
+
+  explicit operator bool() const { return data_ != nullptr; }
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override {
+    if (!data_ || !writable_) return 0;
+    data_->bytes.replace(position_, std::min(size, data_->bytes.size() - position_),
+                         reinterpret_cast<const char*>(buffer), size);
+    position_ += size;
+    return size;
+  }
+  using Print::write;
+  int available() override { return data_ ? static_cast<int>(data_->bytes.size() - position_) : 0; }
+  int read() override { return available() > 0 ? static_cast<uint8_t>(data_->bytes[position_++]) : -1; }
+  int read(uint8_t* buffer, size_t size) { return static_cast<int>(readBytes(buffer, size)); }
+  int peek() override { return available() > 0 ? static_cast<uint8_t>(data_->bytes[position_]) : -1; }
+  size_t readBytes(uint8_t* buffer, size_t size) override {
+    const size_t n = std::min(size, static_cast<size_t>(available()));
+    if (n > 0) memcpy(buffer, data_->bytes.data() + position_, n);
+    position_ += n;
+    return n;
+  }
+  using Stream::readBytes;
+
+  bool seek(size_t position) {
+    if (!data_ || position > data_->bytes.size()) return false;
+    position_ = position;
+    return true;
+  }
+  size_t position() const { return position_; }
+  size_t size() const { return data_ ? data_->bytes.size() : 0; }
+  void close() { data_.reset(); }
+  // LittleFS reports the last path component.
+  const char* name() const {
+    const size_t slash = path_.rfind('/');
+    return path_.c_str() + (slash == std::string::npos ? 0 : slash + 1);
+  }
+  const char* fullName() const { return path_.c_str() + (path_.empty() || path_[0] != '/' ? 0 : 1); }
+  bool isDirectory() const { return false; }
+
+ private:
+  std::shared_ptr<FileData> data_;
+  std::string path_;
+  bool writable_ = false;
+  size_t position_ = 0;
+};
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+// Flat file table kept in the simulated flash, so it survives hostsim::boot().
+class FS {
+ public:
+  bool begin();
+  void end();
+  bool format();
+  bool info(FSInfo& info);
+
+  bool exists(const char* path);
+  bool exists(const String& path) { return exists(path.c_str()); }
+  File open(const char* path, const char* mode);
+  File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+  bool remove(const char* path);
+  bool remove(const String& path) { return remove(path.c_str()); }
+  bool rename(const char* from, const char* to);
+  bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+
+ private:
+  bool mounted_ = false;
+};
+
+}  // namespace fs
+
+using fs::File;
+using fs::FS;
+using fs::FSInfo;
@@ -0,0 +1,748 @@
+#include <ESP8266HTTPClient.h>
+#include <ESP8266WebServer.h>
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+
+#include <algorithm>
+
+#include "HostSim.h"
+#include "HostState.h"
+
+ESP8266WiFiClass WiFi;
+
+using hostsim::detail::board;
+
+namespace {
+
+const String kEmptyString;
+
+bool sameName(const String& a, const String& b) { return strcasecmp(a.c_str(), b.c_str()) == 0; }
+
+String urlDecode(const String& text) {
+  String decoded;
+  for (unsigned int i = 0; i < text.length(); ++i) {
+    const char c = text[i];
+    if (c == '+') {
+      decoded += ' ';
+    } else if (c == '%' && i + 2 < text.length()) {
+      const char hex[3] = {text[i + 1], text[i + 2], 0};
+      decoded += static_cast<char>(strtol(hex, nullptr, 16));
+      i += 2;
+    } else {
+      decoded += c;
+    }
+  }
+  return decoded;
+}
+
+HTTPMethod methodFromName(const std::string& name) {
+  if (name == "GET") return HTTP_GET;
+  if (name == "HEAD") return HTTP_HEAD;
+  if (name == "POST") return HTTP_POST;
+  if (name == "PUT") return HTTP_PUT;
+  if (name == "PATCH") return HTTP_PATCH;
+  if (name == "DELETE") return HTTP_DELETE;
+  if (name == "OPTIONS") return HTTP_OPTIONS;
+  return HTTP_ANY;
+}
+
+std::shared_ptr<hostsim::Connection> queueRequest(const std::string& method, const std::string& uri,
+                                                  const std::string& body,
+                                                  const std::vector<std::pair<std::string, std::string>>& headers) {
+  hostsim::PendingRequest request;
+  request.method = methodFromName(method);
+  request.uri = String(uri);
+  request.body = String(body);
+  for (const auto& header : headers) request.headers.emplace_back(String(header.first), String(header.second));
+  request.connection = std::make_shared<hostsim::Connection>();
+  board().pendingRequests.push_back(request);
+  return request.connection;
+}
+
+// Splits a raw response into status, headers and body; de-chunks chunked bodies.
+hostsim::Response parseResponse(const std::string& raw) {
+  hostsim::Response response;
+  const size_t headerEnd = raw.find("\r\n\r\n");
+  if (headerEnd == std::string::npos || sscanf(raw.c_str(), "HTTP/1.%*d %d", &response.status) != 1) return response;
+  for (size_t line = raw.find("\r\n") + 2; line < headerEnd;) {
+    const size_t next = raw.find("\r\n", line);
+    const size_t colon = raw.find(':', line);
+    if (colon < next) {
+      const size_t value = raw.find_first_not_of(' ', colon + 1);
+      response.headers.emplace_back(raw.substr(line, colon - line), raw.substr(value, next - value));
+    }
+    line = next + 2;
+  }
+
+  std::string body = raw.substr(headerEnd + 4);
+  if (response.header("Transfer-Encoding") == "chunked") {
+    std::string joined;
+    size_t at = 0;
+    while (at < body.size()) {
+      const size_t sizeEnd = body.find("\r\n", at);
+      if (sizeEnd == std::string::npos) break;
+      const size_t size = strtoul(body.c_str() + at, nullptr, 16);
+      if (size == 0) break;
+      joined.append(body, sizeEnd + 2, size);
+      at = sizeEnd + 2 + size + 2;
+    }
+    body = joined;
+  } else if (!response.header("Content-Length").empty()) {
+    body.resize(std::min<size_t>(body.size(), strtoul(response.header("Content-Length").c_str(), nullptr, 10)));
+  }
+  response.body = body;
+  return response;
+}
+
+}  // namespace
+
+namespace hostsim {
+
+size_t Connection::inboundArrived() const {
+  if (bytesPerSec == 0) return inbound.size();
+  const uint64_t elapsedNs = nowNanos() - inboundStartNs;
+  return static_cast<size_t>(std::min<uint64_t>(inbound.size(), elapsedNs * bytesPerSec / 1000000000ULL));
+}
+
+namespace detail {
+
+bool takeRequest(int port, PendingRequest* request) {
+  Board& b = board();
+  if (b.pendingRequests.empty() || port != 80) return false;
+  *request = b.pendingRequests.front();
+  b.pendingRequests.pop_front();
+  return true;
+}
+
+}  // namespace detail
+
+void setWiFiAvailable(bool available) { board().wifiAvailable = available; }
+
+void setWiFiTiming(uint32_t scanMs, uint32_t authMs, uint32_t dhcpMs) {
+  board().wifiScanMs = scanMs;
+  board().wifiAuthMs = authMs;
+  board().wifiDhcpMs = dhcpMs;
+}
+
+void setAccessPointChannel(uint8_t channel) { board().apChannel = channel; }
+
+void setDhcpAddress(uint8_t host) { board().dhcpHost = host; }
+
+void setInternetReachable(bool reachable) { board().internetReachable = reachable; }
+
+void setWallClock(uint64_t epochSeconds) {
+  board().wallClockOffsetNs = static_cast<int64_t>(epochSeconds * 1000000000ULL) - static_cast<int64_t>(nowNanos());
+  board().wallClockSet = true;
+}
+
+void serveUrl(const std::string& url, const std::string& body, uint32_t bytesPerSec,
+              const std::vector<std::pair<std::string, std::string>>& headers) {
+  board().downloads[url] = detail::Download{body, bytesPerSec, headers};
+}
+
+std::string Response::header(const std::string& name) const {
+  for (const auto& header : headers) {
+    if (strcasecmp(header.first.c_str(), name.c_str()) == 0) return header.second;
+  }
+  return std::string();
+}
+
+Response request(const std::string& method, const std::string& uri, const std::string& body,
+                 const std::vector<std::pair<std::string, std::string>>& headers) {
+  const std::shared_ptr<Connection> connection = queueRequest(method, uri, body, headers);
+  runLoop();
+  return parseResponse(connection->outbound);
+}
+
+EventStream openStream(const std::string& uri) {
+  EventStream stream(queueRequest("GET", uri, "", {}));
+  runLoop();
+  return stream;
+}
+
+std::string EventStream::take() {
+  if (!connection_) return std::string();
+  const std::string fresh = connection_->outbound.substr(taken_);
+  taken_ = connection_->outbound.size();
+  return fresh;
+}
+
+bool EventStream::open() const { return connection_ && !connection_->localClosed && !connection_->peerClosed; }
+
+void EventStream::close() {
+  if (connection_) connection_->peerClosed = true;
+}
+
+void EventStream::setWindow(size_t bytes) {
+  if (connection_) connection_->outboundLimit = connection_->outbound.size() + bytes;
+}
+
+std::string Peer::take() {
+  if (!connection_) return std::string();
+  const std::string fresh = connection_->outbound.substr(taken_);
+  taken_ = connection_->outbound.size();
+  return fresh;
+}
+
+void Peer::send(const std::string& bytes) {
+  if (connection_ && !connection_->peerClosed) connection_->inbound += bytes;
+}
+
+bool Peer::open() const { return connection_ && !connection_->localClosed && !connection_->peerClosed; }
+
+void Peer::close() {
+  if (connection_) connection_->peerClosed = true;
+}
+
+void listen(const std::string& ip, uint16_t port, bool listening) {
+  board().listeners[ip + ":" + std::to_string(port)].listening = listening;
+}
+
+Peer accept(const std::string& ip, uint16_t port) {
+  const auto found = board().listeners.find(ip + ":" + std::to_string(port));
+  if (found == board().listeners.end() || found->second.pending.empty()) return Peer();
+  Peer peer(found->second.pending.front());
+  found->second.pending.pop_front();
+  return peer;
+}
+
+const std::vector<Datagram>& multicastLog() { return detail::world().multicastLog; }
+
+void clearMulticastLog() { detail::world().multicastLog.clear(); }
+
+void multicast(const std::string& group, uint16_t port, const std::string& bytes) {
+  Datagram datagram;
+  datagram.group = group;
+  datagram.port = port;
+  datagram.sentNs = nowNanos();
+  datagram.bytes = bytes;
+  board().multicastInbound.push_back(datagram);
+}
+
+}  // namespace hostsim
+
+// ---- WiFiUDP ------------------------------------------------------------------------------
+
+uint8_t WiFiUDP::beginMulticast(IPAddress interfaceAddr, IPAddress multicast, uint16_t port) {
+  (void)interfaceAddr;
+  group_ = multicast.toString().c_str();
+  port_ = port;
+  return 1;
+}
+
+void WiFiUDP::stop() {
+  group_.clear();
+  port_ = 0;
+  rx_.clear();
+  rxRead_ = 0;
+}
+
+int WiFiUDP::beginPacketMulticast(IPAddress multicastAddress, uint16_t port, IPAddress interfaceAddress, int ttl) {
+  (void)interfaceAddress;
+  (void)ttl;
+  txGroup_ = multicastAddress.toString().c_str();
+  txPort_ = port;
+  tx_.clear();
+  sending_ = true;
+  return 1;
+}
+
+int WiFiUDP::endPacket() {
+  if (!sending_) return 0;
+  sending_ = false;
+  if (WiFi.status() != WL_CONNECTED) return 0;
+  hostsim::Datagram datagram;
+  datagram.group = txGroup_;
+  datagram.port = txPort_;
+  datagram.sentNs = hostsim::nowNanos();
+  datagram.bytes = tx_;
+  hostsim::detail::world().multicastLog.push_back(datagram);
+  return 1;
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+  if (!sending_) return 0;
+  tx_.append(reinterpret_cast<const char*>(buffer), size);
+  return size;
+}
+
+int WiFiUDP::parsePacket() {
+  rx_.clear();
+  rxRead_ = 0;
+  if (port_ == 0) return 0;
+  auto& inbound = board().multicastInbound;
+  for (auto it = inbound.begin(); it != inbound.end(); ++it) {
+    if (it->group != group_ || it->port != port_) continue;
+    rx_ = it->bytes;
+    inbound.erase(it);
+    return static_cast<int>(rx_.size());
+  }
+  return 0;
+}
+
+int WiFiUDP::available() { return static_cast<int>(rx_.size() - rxRead_); }
+
+int WiFiUDP::read() { return rxRead_ < rx_.size() ? static_cast<uint8_t>(rx_[rxRead_++]) : -1; }
+
+int WiFiUDP::read(uint8_t* buffer, size_t len) {
+  const size_t n = std::min(len, rx_.size() - rxRead_);
+  memcpy(buffer, rx_.data() + rxRead_, n);
+  rxRead_ += n;
+  return static_cast<int>(n);
+}
+
+int WiFiUDP::peek() { return rxRead_ < rx_.size() ? static_cast<uint8_t>(rx_[rxRead_]) : -1; }
+
+// ---- WiFiClient ---------------------------------------------------------------------------
+
+int WiFiClient::connect(IPAddress ip, uint16_t port) {
+  if (WiFi.status() != WL_CONNECTED) return 0;
+  const auto listener = board().listeners.find(std::string(ip.toString().c_str()) + ":" + std::to_string(port));
+  if (listener == board().listeners.end() && !board().internetReachable) return 0;
+  if (listener != board().listeners.end() && !listener->second.listening) return 0;
+  connection_ = std::make_shared<hostsim::Connection>();
+  connection_->inboundStartNs = hostsim::nowNanos();
+  if (listener != board().listeners.end()) listener->second.pending.push_back(connection_);
+  return 1;
+}
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  IPAddress ip;
+  return WiFi.hostByName(host, ip) ? connect(ip, port) : 0;
+}
+
+uint8_t WiFiClient::connected() {
+  if (!connection_ || connection_->localClosed) return 0;
+  return !connection_->peerClosed || connection_->inboundRead < connection_->inbound.size();
+}
+
+void WiFiClient::stop() {
+  if (connection_) connection_->localClosed = true;
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+  hostsim::Connection* c = connection_.get();
+  if (c == nullptr || c->localClosed || c->peerClosed) return 0;
+  const size_t room = c->outboundLimit > c->outbound.size() ? c->outboundLimit - c->outbound.size() : 0;
+  const size_t accepted = std::min(size, room);
+  c->outbound.append(reinterpret_cast<const char*>(buffer), accepted);
+  return accepted;
+}
+
+int WiFiClient::available() {
+  if (!connection_ || connection_->localClosed) return 0;
+  return static_cast<int>(connection_->inboundArrived() - connection_->inboundRead);
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+  const size_t n = std::min(size, static_cast<size_t>(available()));
+  if (n > 0) memcpy(buffer, connection_->inbound.data() + connection_->inboundRead, n);
+  if (connection_) connection_->inboundRead += n;
+  return static_cast<int>(n);
+}
+
+int WiFiClient::peek() {
+  return available() > 0 ? static_cast<uint8_t>(connection_->inbound[connection_->inboundRead]) : -1;
+}
+
+// ---- ESP8266WiFiClass ---------------------------------------------------------------------
+
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel, const uint8_t* bssid,
+                                    bool connect) {
+  const auto& b = board();
+  ssid_ = ssid;
+  psk_ = passphrase ? passphrase : "";
+  begun_ = connect;
+  // A direct join only probes the given channel for the given BSSID.
+  const bool direct = channel != 0 && bssid != nullptr;
+  wrongAccessPoint_ = direct && (channel != b.apChannel || memcmp(bssid, b.apBssid, sizeof(b.apBssid)) != 0);
+  uint32_t joinMs = b.wifiAuthMs;
+  if (!direct) joinMs += b.wifiScanMs;
+  if (!staticIp_.isSet()) joinMs += b.wifiDhcpMs;
+  associatedAtNs_ = hostsim::nowNanos() + static_cast<uint64_t>(joinMs) * 1000000ULL;
+  return status();
+}
+
+bool ESP8266WiFiClass::config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  (void)dns2;
+  // All zeros switches back to DHCP, as on the device.
+  staticIp_ = local;
+  gateway_ = gateway;
+  subnet_ = subnet;
+  dns_ = dns1;
+  return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifiOff) {
+  (void)wifiOff;
+  begun_ = false;
+  return true;
+}
+
+wl_status_t ESP8266WiFiClass::status() {
+  if (!begun_) return WL_IDLE_STATUS;
+  if (!board().wifiAvailable || wrongAccessPoint_) return WL_NO_SSID_AVAIL;
+  return hostsim::nowNanos() >= associatedAtNs_ ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+IPAddress ESP8266WiFiClass::localIP() {
+  if (status() != WL_CONNECTED) return IPAddress();
+  return staticIp_.isSet() ? staticIp_ : IPAddress(192, 168, 88, board().dhcpHost);
+}
+
+IPAddress ESP8266WiFiClass::gatewayIP() {
+  if (status() != WL_CONNECTED) return IPAddress();
+  return staticIp_.isSet() ? gateway_ : IPAddress(192, 168, 88, 1);
+}
+
+IPAddress ESP8266WiFiClass::subnetMask() {
+  if (status() != WL_CONNECTED) return IPAddress();
+  return staticIp_.isSet() ? subnet_ : IPAddress(255, 255, 255, 0);
+}
+
+IPAddress ESP8266WiFiClass::dnsIP(uint8_t index) {
+  if (status() != WL_CONNECTED || index != 0) return IPAddress();
+  return staticIp_.isSet() ? dns_ : IPAddress(192, 168, 88, 1);
+}
+
+uint8_t* ESP8266WiFiClass::BSSID() {
+  if (status() == WL_CONNECTED) {
+    memcpy(bssid_, board().apBssid, sizeof(bssid_));
+  } else {
+    memset(bssid_, 0, sizeof(bssid_));
+  }
+  return bssid_;
+}
+
+String ESP8266WiFiClass::BSSIDstr() {
+  const uint8_t* bssid = BSSID();
+  char text[18];
+  snprintf(text, sizeof(text), "%02X:%02X:%02X:%02X:%02X:%02X", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4],
+           bssid[5]);
+  return String(text);
+}
+
+int32_t ESP8266WiFiClass::channel() { return status() == WL_CONNECTED ? board().apChannel : 0; }
+
+int32_t ESP8266WiFiClass::RSSI() { return status() == WL_CONNECTED ? -61 : 31; }
+
+int ESP8266WiFiClass::hostByName(const char* host, IPAddress& result) {
+  // Like the core, an address literal needs no DNS.
+  if (result.fromString(host)) return status() == WL_CONNECTED;
+  if (!board().internetReachable || status() != WL_CONNECTED) return 0;
+  result = IPAddress(140, 82, 121, 4);
+  return 1;
+}
+
+// ---- SNTP ---------------------------------------------------------------------------------
+
+void configTime(const char* tz, const char* server1, const char* server2, const char* server3) {
+  (void)server2;
+  (void)server3;
+  board().sntpServer = server1 ? server1 : "";
+  // newlib on the ESP reads TZ the same way; localtime_r() follows it.
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+// Replaces libc's time() for the sketch. Until the first SNTP answer it counts seconds from
+// boot, like the SDK; the answer comes as soon as Wi-Fi and the internet are up.
+extern "C" time_t time(time_t* out) noexcept {
+  hostsim::detail::Board& b = board();
+  if (!b.sntpSynced && !b.sntpServer.empty() && b.wallClockSet && b.internetReachable && WiFi.status() == WL_CONNECTED) {
+    b.sntpSynced = true;
+  }
+  const int64_t nowNs = static_cast<int64_t>(hostsim::nowNanos());
+  const time_t seconds = static_cast<time_t>((b.sntpSynced ? b.wallClockOffsetNs + nowNs : nowNs) / 1000000000LL);
+  if (out != nullptr) *out = seconds;
+  return seconds;
+}
+
+// ---- HTTPClient ---------------------------------------------------------------------------
+
+bool HTTPClient::begin(WiFiClient& client, const String& url) {
+  client_ = &client;
+  url_ = url;
+  size_ = -1;
+  headers_.clear();
+  return url.startsWith("http://") || url.startsWith("https://");
+}
+
+void HTTPClient::end() {
+  if (client_) client_->stop();
+  client_ = nullptr;
+}
+
+void HTTPClient::collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+  wantedHeaders_.clear();
+  for (size_t i = 0; i < headerKeysCount; ++i) wantedHeaders_.push_back(String(headerKeys[i]));
+}
+
+int HTTPClient::GET() {
+  if (client_ == nullptr) return HTTPC_ERROR_NOT_CONNECTED;
+  if (WiFi.status() != WL_CONNECTED) return HTTPC_ERROR_CONNECTION_FAILED;
+  const auto& downloads = board().downloads;
+  const auto found = downloads.find(url_.c_str());
+  if (found == downloads.end()) return board().internetReachable ? HTTP_CODE_NOT_FOUND : HTTPC_ERROR_CONNECTION_FAILED;
+
+  const hostsim::detail::Download& download = found->second;
+  auto connection = std::make_shared<hostsim::Connection>();
+  connection->inbound = download.body;
+  connection->bytesPerSec = download.bytesPerSec;
+  connection->inboundStartNs = hostsim::nowNanos();
+  connection->peerClosed = true;  // the server closes after the body
+  client_->attach(connection);
+  for (const auto& header : download.headers) {
+    for (const String& wanted : wantedHeaders_) {
+      if (sameName(wanted, String(header.first))) headers_.emplace_back(wanted, String(header.second));
+    }
+  }
+  size_ = static_cast<int>(download.body.size());
+  return HTTP_CODE_OK;
+}
+
+WiFiClient* HTTPClient::getStreamPtr() { return connected() ? client_ : nullptr; }
+
+bool HTTPClient::connected() { return client_ && client_->connected(); }
+
+String HTTPClient::header(const char* name) const {
+  for (const auto& header : headers_) {
+    if (sameName(header.first, String(name))) return header.second;
+  }
+  return String();
+}
+
+String HTTPClient::errorToString(int error) {
+  switch (error) {
+    case HTTPC_ERROR_CONNECTION_FAILED:
+      return String("connection failed");
+    case HTTPC_ERROR_NOT_CONNECTED:
+      return String("not connected");
+    case HTTPC_ERROR_CONNECTION_LOST:
+      return String("connection lost");
+    default:
+      return String();
+  }
+}
+
+// ---- ESP8266WebServer ---------------------------------------------------------------------
+
+ESP8266WebServer::ESP8266WebServer(int port) : port_(port) {}
+
+void ESP8266WebServer::handleClient() {
+  if (!listening_) return;
+  hostsim::PendingRequest request;
+  if (hostsim::detail::takeRequest(port_, &request)) dispatch(request);
+}
+
+void ESP8266WebServer::on(const Uri& uri, HTTPMethod method, THandlerFunction handler) {
+  routes_.push_back(Route{std::shared_ptr<Uri>(uri.clone()), method, handler, nullptr, String(), String()});
+}
+
+void ESP8266WebServer::serveStatic(const char* uri, fs::FS& fs, const char* path, const char* cacheHeader) {
+  routes_.push_back(Route{std::make_shared<Uri>(uri), HTTP_GET, nullptr, &fs, String(path), String(cacheHeader)});
+}
+
+void ESP8266WebServer::dispatch(hostsim::PendingRequest& request) {
+  request_ = request;
+  args_.clear();
+  pathArgs_.clear();
+  responseHeaders_ = String();
+  contentLength_ = CONTENT_LENGTH_NOT_SET;
+  chunked_ = false;
+  client_ = WiFiClient(request.connection);
+
+  const int query = request_.uri.indexOf('?');
+  if (query >= 0) {
+    parseArgs(request_.uri.substring(query + 1));
+    request_.uri = request_.uri.substring(0, query);
+  }
+  if (request_.body.length() > 0) {
+    const String type = header("Content-Type");
+    if (type.startsWith("application/x-www-form-urlencoded")) {
+      parseArgs(request_.body);
+    } else {
+      args_.emplace_back(String("plain"), request_.body);
+    }
+  }
+
+  bool handled = false;
+  for (const Route& route : routes_) {
+    if (!route.uri->canHandle(request_.uri, pathArgs_)) continue;
+    if (route.fs != nullptr) {
+      handled = (request_.method == HTTP_GET || request_.method == HTTP_HEAD) && serveStaticRoute(route);
+    } else if (route.method == HTTP_ANY || route.method == request_.method) {
+      route.handler();
+      handled = true;
+    }
+    if (handled) break;
+  }
+  if (!handled) {
+    if (notFoundHandler_) {
+      notFoundHandler_();
+    } else {
+      send(404, "text/plain", String("Not found: ") + request_.uri);
+    }
+  }
+  // Handlers that keep a copy of client() (event streams) keep the connection alive.
+  client_ = WiFiClient();
+}
+
+bool ESP8266WebServer::serveStaticRoute(const Route& route) {
+  String path = route.path;
+  if (!path.endsWith(".gz") && !route.fs->exists(path) && route.fs->exists(path + ".gz")) path += ".gz";
+  File file = route.fs->open(path, "r");
+  if (!file) return false;
+  if (route.cacheHeader.length() > 0) sendHeader("Cache-Control", route.cacheHeader);
+  streamFile(file, contentTypeFor(route.path), request_.method);
+  return true;
+}
+
+void ESP8266WebServer::parseArgs(const String& query) {
+  for (int start = 0; start < static_cast<int>(query.length());) {
+    int end = query.indexOf('&', start);
+    if (end < 0) end = query.length();
+    const String pair = query.substring(start, end);
+    const int equals = pair.indexOf('=');
+    if (equals < 0) {
+      args_.emplace_back(urlDecode(pair), String());
+    } else {
+      args_.emplace_back(urlDecode(pair.substring(0, equals)), urlDecode(pair.substring(equals + 1)));
+    }
+    start = end + 1;
+  }
+}
+
+const String& ESP8266WebServer::arg(const String& name) const {
+  for (const auto& a : args_) {
+    if (a.first == name) return a.second;
+  }
+  return kEmptyString;
+}
+
+const String& ESP8266WebServer::arg(int index) const {
+  return index >= 0 && index < args() ? args_[index].second : kEmptyString;
+}
+
+const String& ESP8266WebServer::argName(int index) const {
+  return index >= 0 && index < args() ? args_[index].first : kEmptyString;
+}
+
+const String& ESP8266WebServer::pathArg(unsigned int index) const {
+  return index < pathArgs_.size() ? pathArgs_[index] : kEmptyString;
+}
+
+bool ESP8266WebServer::hasArg(const String& name) const {
+  for (const auto& a : args_) {
+    if (a.first == name) return true;
+  }
+  return false;
+}
+
+void ESP8266WebServer::collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
+  collectedHeaderNames_.clear();
+  for (size_t i = 0; i < headerKeysCount; ++i) collectedHeaderNames_.push_back(String(headerKeys[i]));
+}
+
+// Like the core, only headers named in collectHeaders() (and Content-Type) are kept.
+const String& ESP8266WebServer::header(const String& name) const {
+  const bool collected = sameName(name, String("Content-Type")) ||
+                         std::any_of(collectedHeaderNames_.begin(), collectedHeaderNames_.end(),
+                                     [&](const String& wanted) { return sameName(wanted, name); });
+  if (!collected) return kEmptyString;
+  for (const auto& h : request_.headers) {
+    if (sameName(h.first, name)) return h.second;
+  }
+  return kEmptyString;
+}
+
+bool ESP8266WebServer::hasHeader(const String& name) const { return header(name).length() > 0; }
+
+void ESP8266WebServer::sendHeader(const String& name, const String& value, bool first) {
+  const String line = name + ": " + value + "\r\n";
+  responseHeaders_ = first ? line + responseHeaders_ : responseHeaders_ + line;
+}
+
+void ESP8266WebServer::writeHeader(int code, const char* contentType, size_t contentLength) {
+  sendHeader("Content-Type", contentType ? contentType : "text/html", true);
+  if (contentLength_ == CONTENT_LENGTH_NOT_SET) {
+    sendHeader("Content-Length", String(static_cast<unsigned long>(contentLength)));
+  } else if (contentLength_ != CONTENT_LENGTH_UNKNOWN) {
+    sendHeader("Content-Length", String(static_cast<unsigned long>(contentLength_)));
+  } else {
+    chunked_ = true;
+    sendHeader("Accept-Ranges", "none");
+    sendHeader("Transfer-Encoding", "chunked");
+  }
+  sendHeader("Connection", "close");
+  const String head = String("HTTP/1.1 ") + code + " " + responseCodeToString(code) + "\r\n" + responseHeaders_ + "\r\n";
+  responseHeaders_ = String();
+  client_.write(head.c_str(), head.length());
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const String& content) {
+  writeHeader(code, contentType, content.length());
+  if (content.length() > 0) sendContent(content);
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const char* content, size_t contentLength) {
+  writeHeader(code, contentType, contentLength);
+  if (contentLength > 0) sendContent(content, contentLength);
+}
+
+void ESP8266WebServer::sendContent(const char* content, size_t size) {
+  if (chunked_) {
+    char chunkSize[12];
+    snprintf(chunkSize, sizeof(chunkSize), "%zx\r\n", size);
+    client_.write(chunkSize);
+  }
+  client_.write(content, size);
+  if (chunked_) {
+    client_.write("\r\n");
+    if (size == 0) chunked_ = false;
+  }
+}
+
+String ESP8266WebServer::responseCodeToString(int code) {
+  switch (code) {
+    case 200:
+      return String("OK");
+    case 202:
+      return String("Accepted");
+    case 204:
+      return String("No Content");
+    case 304:
+      return String("Not Modified");
+    case 400:
+      return String("Bad Request");
+    case 404:
+      return String("Not Found");
+    case 409:
+      return String("Conflict");
+    case 500:
+      return String("Internal Server Error");
+    case 502:
+      return String("Bad Gateway");
+    case 503:
+      return String("Service Unavailable");
+    default:
+      return String();
+  }
+}
+
+String ESP8266WebServer::contentTypeFor(const String& path) {
+  static const char* const kTypes[][2] = {
+      {".html", "text/html"},        {".htm", "text/html"},      {".css", "text/css"},
+      {".js", "application/javascript"}, {".json", "application/json"}, {".png", "image/png"},
+      {".ico", "image/x-icon"},      {".svg", "image/svg+xml"},  {".gz", "application/x-gzip"},
+  };
+  for (const auto& type : kTypes) {
+    if (path.endsWith(type[0])) return String(type[1]);
+  }
+  return String("application/octet-stream");
+}
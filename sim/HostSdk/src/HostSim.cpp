@@ -0,0 +1,453 @@
+#include "HostSim.h"
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "HostState.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+GpioSetRegister GPOS;
+GpioClearRegister GPOC;
+
+namespace hostsim {
+namespace detail {
+
+World& world() {
+  static World* instance = [] {
+    World* w = new World();
+    memset(w->eepromSector, 0xFF, sizeof(w->eepromSector));
+    return w;
+  }();
+  return *instance;
+}
+
+Board& board() {
+  static Board* instance = new Board();
+  return *instance;
+}
+
+namespace {
+
+// Half-step patterns in coil order, bit 0 = IN1 ... bit 3 = IN4.
+constexpr uint8_t kHalfStepCoils[8] = {0x1, 0x3, 0x2, 0x6, 0x4, 0xC, 0x8, 0x9};
+
+// Pipe end a boot child reports the world through; -1 in the test process.
+int bootPipe = -1;
+
+uint64_t timerTickNanos(uint32_t ticks) {
+  static const uint32_t kDividers[] = {1, 16, 16, 256};
+  const uint64_t ticksAtDivider = static_cast<uint64_t>(ticks == 0 ? 1 : ticks) * kDividers[board().timerDivider & 3];
+  return ticksAtDivider * 1000ULL / 80ULL;
+}
+
+void moveShaft(int direction) {
+  Board& b = board();
+  Motor& motor = world().motor;
+  const long next = motor.position + direction;
+  if (next < motor.stopMin || next > motor.stopMax) {
+    ++motor.blockedSteps;
+    motor.stalled = true;
+    return;
+  }
+  motor.stalled = false;
+  motor.position = next;
+  ++motor.steps;
+  if (b.lastStepNs != 0) {
+    const uint64_t interval = b.nowNs - b.lastStepNs;
+    if (motor.minStepIntervalNs == 0 || interval < motor.minStepIntervalNs) motor.minStepIntervalNs = interval;
+    if (b.recordIntervals) b.stepIntervals.push_back(static_cast<uint32_t>(interval));
+  }
+  b.lastStepNs = b.nowNs;
+}
+
+template <typename T>
+void appendPod(std::string* out, const T& value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void appendBytes(std::string* out, const std::string& bytes) {
+  appendPod(out, static_cast<uint32_t>(bytes.size()));
+  out->append(bytes);
+}
+
+template <typename T>
+bool takePod(const std::string& in, size_t* at, T* value) {
+  if (in.size() - *at < sizeof(T)) return false;
+  memcpy(value, in.data() + *at, sizeof(T));
+  *at += sizeof(T);
+  return true;
+}
+
+bool takeBytes(const std::string& in, size_t* at, std::string* bytes) {
+  uint32_t size;
+  if (!takePod(in, at, &size) || in.size() - *at < size) return false;
+  bytes->assign(in, *at, size);
+  *at += size;
+  return true;
+}
+
+std::string saveWorld() {
+  const World& w = world();
+  std::string out(reinterpret_cast<const char*>(w.eepromSector), sizeof(w.eepromSector));
+  appendPod(&out, static_cast<uint32_t>(w.files.size()));
+  for (const auto& file : w.files) {
+    appendBytes(&out, file.first);
+    appendBytes(&out, file.second->bytes);
+  }
+  appendPod(&out, w.motor);
+  appendPod(&out, w.motorPhase);
+  appendPod(&out, w.installed);
+  appendPod(&out, static_cast<uint32_t>(w.multicastLog.size()));
+  for (const Datagram& datagram : w.multicastLog) {
+    appendBytes(&out, datagram.group);
+    appendPod(&out, datagram.port);
+    appendPod(&out, datagram.sentNs);
+    appendBytes(&out, datagram.bytes);
+  }
+  return out;
+}
+
+bool loadWorld(const std::string& in) {
+  World loaded;
+  size_t at = sizeof(loaded.eepromSector);
+  uint32_t fileCount;
+  if (in.size() < at || !takePod(in, &at, &fileCount)) return false;
+  memcpy(loaded.eepromSector, in.data(), sizeof(loaded.eepromSector));
+  for (uint32_t i = 0; i < fileCount; ++i) {
+    std::string path;
+    auto data = std::make_shared<fs::FileData>();
+    if (!takeBytes(in, &at, &path) || !takeBytes(in, &at, &data->bytes)) return false;
+    loaded.files[path] = data;
+  }
+  if (!takePod(in, &at, &loaded.motor) || !takePod(in, &at, &loaded.motorPhase) ||
+      !takePod(in, &at, &loaded.installed)) {
+    return false;
+  }
+  uint32_t datagramCount;
+  if (!takePod(in, &at, &datagramCount)) return false;
+  for (uint32_t i = 0; i < datagramCount; ++i) {
+    Datagram datagram;
+    if (!takeBytes(in, &at, &datagram.group) || !takePod(in, &at, &datagram.port) ||
+        !takePod(in, &at, &datagram.sentNs) || !takeBytes(in, &at, &datagram.bytes)) {
+      return false;
+    }
+    loaded.multicastLog.push_back(datagram);
+  }
+  world() = loaded;
+  return true;
+}
+
+[[noreturn]] void endChild(bool ok) {
+  if (ok) {
+    const std::string state = saveWorld();
+    for (size_t sent = 0; sent < state.size();) {
+      const ssize_t n = ::write(bootPipe, state.data() + sent, state.size() - sent);
+      if (n <= 0) break;
+      sent += static_cast<size_t>(n);
+    }
+  }
+  fflush(stdout);
+  fflush(stderr);
+  _exit(ok ? 0 : 1);
+}
+
+}  // namespace
+
+void outputsChanged() {
+  Board& b = board();
+  if (!b.motorAttached) return;
+  uint8_t coils = 0;
+  for (uint8_t i = 0; i < 4; ++i) {
+    if (b.outputLatch & (1UL << b.motorPins[i])) coils |= static_cast<uint8_t>(1 << i);
+  }
+
+  World& w = world();
+  if (w.motor.energized) w.motor.energizedNs += b.nowNs - b.motorEnergizedSinceNs;
+  b.motorEnergizedSinceNs = b.nowNs;
+  w.motor.energized = coils != 0;
+  if (coils == 0) return;  // the rotor rests in its detent
+  int8_t phase = -1;
+  for (int8_t p = 0; p < 8; ++p) {
+    if (kHalfStepCoils[p] == coils) phase = p;
+  }
+  if (phase < 0) {
+    ++w.motor.missedSteps;
+    return;
+  }
+  if (w.motorPhase >= 0) {
+    const int delta = (phase - w.motorPhase + 8) % 8;
+    if (delta == 1) {
+      moveShaft(1);
+    } else if (delta == 7) {
+      moveShaft(-1);
+    } else if (delta != 0) {
+      ++w.motor.missedSteps;
+    }
+  }
+  w.motorPhase = phase;
+}
+
+}  // namespace detail
+
+using detail::Board;
+using detail::board;
+using detail::World;
+using detail::world;
+
+uint64_t nowNanos() { return board().nowNs; }
+
+void advanceNanos(uint64_t ns) {
+  Board& b = board();
+  const uint64_t until = b.nowNs + ns;
+  while (b.timerEnabled && b.timerArmed && b.timerDueNs <= until) {
+    b.nowNs = b.timerDueNs;
+    b.timerArmed = false;  // TIM_SINGLE: the callback re-arms with timer1_write()
+    if (b.timerCallback) b.timerCallback();
+  }
+  b.nowNs = until;
+}
+
+void delayMillis(uint32_t ms) {
+  const uint64_t ns = static_cast<uint64_t>(ms) * 1000000ULL;
+  if (WiFi.getSleepMode() != WIFI_LIGHT_SLEEP) {
+    advanceNanos(ns);
+    return;
+  }
+  board().nowNs += ns;
+  ++board().lightSleeps;
+  advanceNanos(0);  // whatever came due while asleep runs late
+}
+
+void setLoopCostMicros(uint32_t us) { board().loopCostUs = us; }
+
+bool runSetup() {
+  if (board().restarted) return false;
+  try {
+    setup();
+  } catch (const RestartRequested&) {
+    board().restarted = true;
+    return false;
+  }
+  return true;
+}
+
+bool runLoop() {
+  if (board().restarted) return false;
+  try {
+    loop();
+  } catch (const RestartRequested&) {
+    board().restarted = true;
+    return false;
+  }
+  advanceNanos(static_cast<uint64_t>(board().loopCostUs) * 1000ULL);
+  return true;
+}
+
+bool runFor(uint32_t ms) {
+  const uint64_t until = nowNanos() + static_cast<uint64_t>(ms) * 1000000ULL;
+  while (nowNanos() < until) {
+    if (!runLoop()) return false;
+  }
+  return true;
+}
+
+bool runUntil(const std::function<bool()>& done, uint32_t timeoutMs) {
+  const uint64_t until = nowNanos() + static_cast<uint64_t>(timeoutMs) * 1000000ULL;
+  while (!done()) {
+    if (nowNanos() >= until) return false;
+    if (!runLoop()) return done();
+  }
+  return true;
+}
+
+bool restarted() { return board().restarted; }
+
+uint32_t lightSleepCount() { return board().lightSleeps; }
+
+bool boot(const std::function<bool()>& body) {
+  int fds[2];
+  if (pipe(fds) != 0) return false;
+  fflush(stdout);
+  fflush(stderr);
+  const pid_t pid = fork();
+  if (pid < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    detail::bootPipe = fds[1];
+    bool ok = false;
+    try {
+      ok = body();
+    } catch (...) {
+      ok = false;
+    }
+    detail::endChild(ok);
+  }
+
+  close(fds[1]);
+  std::string state;
+  char chunk[4096];
+  for (ssize_t n; (n = read(fds[0], chunk, sizeof(chunk))) > 0;) state.append(chunk, static_cast<size_t>(n));
+  close(fds[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  const bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  if (ok && !detail::loadWorld(state)) return false;
+  return ok;
+}
+
+void abandonBoot() {
+  if (detail::bootPipe >= 0) detail::endChild(false);
+}
+
+void eraseFlash() {
+  World& w = world();
+  memset(w.eepromSector, 0xFF, sizeof(w.eepromSector));
+  w.files.clear();
+  w.installed = InstalledImages();
+}
+
+void attachMotor(uint8_t in1, uint8_t in2, uint8_t in3, uint8_t in4) {
+  Board& b = board();
+  b.motorAttached = true;
+  b.motorPins[0] = in1;
+  b.motorPins[1] = in2;
+  b.motorPins[2] = in3;
+  b.motorPins[3] = in4;
+  world().motor = Motor();
+  world().motorPhase = -1;
+}
+
+void setMotorStops(long minPosition, long maxPosition) {
+  world().motor.stopMin = minPosition;
+  world().motor.stopMax = maxPosition;
+}
+
+void slipShaft(long steps) { world().motor.position += steps; }
+
+const Motor& motor() {
+  Board& b = board();
+  Motor& m = world().motor;
+  if (m.energized) m.energizedNs += b.nowNs - b.motorEnergizedSinceNs;
+  b.motorEnergizedSinceNs = b.nowNs;
+  return m;
+}
+
+void recordStepIntervals(bool enabled) {
+  board().recordIntervals = enabled;
+  board().stepIntervals.clear();
+}
+
+const std::vector<uint32_t>& stepIntervalsNs() { return board().stepIntervals; }
+
+void setAnalogInput(uint16_t raw) {
+  board().analogValue = raw;
+  board().analogSource = nullptr;
+}
+
+void setAnalogSource(const std::function<uint16_t()>& source) { board().analogSource = source; }
+
+void setHeap(uint32_t freeBytes, uint32_t maxFreeBlock) {
+  board().freeHeap = freeBytes;
+  board().maxFreeBlock = maxFreeBlock;
+}
+
+const std::string& serialOutput() { return board().serial; }
+
+const InstalledImages& installedImages() { return world().installed; }
+
+}  // namespace hostsim
+
+using hostsim::detail::board;
+
+GpioSetRegister& GpioSetRegister::operator=(uint32_t mask) {
+  board().outputLatch |= mask;
+  hostsim::detail::outputsChanged();
+  return *this;
+}
+
+GpioClearRegister& GpioClearRegister::operator=(uint32_t mask) {
+  board().outputLatch &= ~mask;
+  hostsim::detail::outputsChanged();
+  return *this;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (pin >= 16) return;
+  if (value) {
+    GPOS = 1UL << pin;
+  } else {
+    GPOC = 1UL << pin;
+  }
+}
+
+int digitalRead(uint8_t pin) { return pin < 16 && (board().outputLatch & (1UL << pin)) ? HIGH : LOW; }
+
+int analogRead(uint8_t pin) {
+  if (pin != A0) return 0;
+  const hostsim::detail::Board& b = board();
+  return b.analogSource ? b.analogSource() : b.analogValue;
+}
+
+void timer1_isr_init(void) {}
+
+void timer1_enable(uint8_t divider, uint8_t intType, uint8_t reload) {
+  (void)intType;
+  (void)reload;  // only TIM_SINGLE is modelled
+  board().timerDivider = divider;
+  board().timerEnabled = true;
+}
+
+void timer1_disable(void) {
+  board().timerEnabled = false;
+  board().timerArmed = false;
+}
+
+void timer1_attachInterrupt(timercallback userFunc) { board().timerCallback = userFunc; }
+
+void timer1_detachInterrupt(void) { board().timerCallback = nullptr; }
+
+void timer1_write(uint32_t ticks) {
+  hostsim::detail::Board& b = board();
+  b.timerDueNs = b.nowNs + hostsim::detail::timerTickNanos(ticks);
+  b.timerArmed = true;
+}
+
+uint32_t timer1_read(void) {
+  const hostsim::detail::Board& b = board();
+  if (!b.timerArmed || b.timerDueNs <= b.nowNs) return 0;
+  static const uint32_t kDividers[] = {1, 16, 16, 256};
+  return static_cast<uint32_t>((b.timerDueNs - b.nowNs) * 80ULL / 1000ULL / kDividers[b.timerDivider & 3]);
+}
+
+size_t HardwareSerial::write(uint8_t c) { return write(&c, 1); }
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  board().serial.append(reinterpret_cast<const char*>(buffer), size);
+  if (getenv("HOSTSIM_SERIAL")) fwrite(buffer, 1, size, stdout);
+  return size;
+}
+
+void EspClass::restart() { throw hostsim::RestartRequested(); }
+
+uint32_t EspClass::getFreeHeap() { return board().freeHeap; }
+
+uint32_t EspClass::getMaxFreeBlockSize() { return board().maxFreeBlock; }
+
+uint8_t EspClass::getHeapFragmentation() {
+  const hostsim::detail::Board& b = board();
+  return b.freeHeap == 0 ? 0 : static_cast<uint8_t>(100 - (100ULL * b.maxFreeBlock) / b.freeHeap);
+}
+
+uint32_t EspClass::getCycleCount() { return static_cast<uint32_t>(board().nowNs * 80ULL / 1000ULL); }
@@ -0,0 +1,193 @@
+#pragma once
+
+// Test-side control of the host simulation. The sketch's own setup() and loop() run against
+// the SDK stand-ins in this library; these functions drive them on the simulated clock and
+// expose the simulated board: motor shaft, A0, flash, Wi-Fi and the HTTP peers.
+
+#include <limits.h>
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+void setup();
+void loop();
+
+namespace hostsim {
+
+struct Connection;
+
+// Thrown by ESP.restart(). The drive functions catch it; the boot is over after that.
+struct RestartRequested {};
+
+// ---- Clock and sketch driving -----------------------------------------------------------
+
+uint64_t nowNanos();
+// Moves the clock forward, firing timer1 at each programmed deadline on the way.
+void advanceNanos(uint64_t ns);
+// delay() without interrupts, taken while WIFI_LIGHT_SLEEP was selected.
+uint32_t lightSleepCount();
+
+// Simulated time one loop() pass takes (Wi-Fi stack and yield() included). Default 500 us.
+void setLoopCostMicros(uint32_t us);
+// These return false once the sketch called ESP.restart().
+bool runSetup();
+bool runLoop();
+bool runFor(uint32_t ms);
+// Runs loop() until done() holds; false on timeout or when a restart ends the boot first.
+bool runUntil(const std::function<bool()>& done, uint32_t timeoutMs);
+bool restarted();
+
+// ---- Boots --------------------------------------------------------------------------------
+
+// Runs body in a forked child: the sketch starts from fresh globals as after a power cycle,
+// while flash, LittleFS, the motor shaft and installed images carry over to the next boot.
+// Returns true when body returned true and the child exited cleanly.
+bool boot(const std::function<bool()>& body);
+// From a test's tearDown(): ends a child whose body was abandoned by a failed assertion.
+// No-op outside a boot.
+void abandonBoot();
+// Blank flash: erased EEPROM sector, empty filesystem, no installed images.
+void eraseFlash();
+// Programs |bytes| into the EEPROM sector at |offset|, as an older firmware left them there.
+void writeEepromSector(size_t offset, const std::string& bytes);
+
+// ---- Board ----------------------------------------------------------------------------------
+
+// 28BYJ-48 behind a ULN2003: coil pins IN1..IN4, energized in the half-step order
+// IN1, IN1+IN2, IN2, ... IN4+IN1. A phase change of one half step moves the shaft; anything
+// else (a skipped or repeated pattern) counts as a missed step. A step into an end stop is
+// blocked: the phase advances, the shaft does not.
+struct Motor {
+  long position = 0;
+  uint32_t steps = 0;
+  uint32_t missedSteps = 0;
+  uint32_t blockedSteps = 0;
+  bool stalled = false;  // the last phase change was blocked
+  long stopMin = LONG_MIN;
+  long stopMax = LONG_MAX;
+  bool energized = false;
+  uint64_t energizedNs = 0;  // with any coil on, up to the last motor() call
+  uint64_t minStepIntervalNs = 0;
+};
+void attachMotor(uint8_t in1, uint8_t in2, uint8_t in3, uint8_t in4);
+const Motor& motor();
+// Mechanical end stops of the shaft (the blind's top and bottom); persists across boots.
+void setMotorStops(long minPosition, long maxPosition);
+// Turns the shaft by |steps| without the coils, like a released blind sliding.
+void slipShaft(long steps);
+// Intervals between consecutive shaft steps of the current boot, when recording is on.
+void recordStepIntervals(bool enabled);
+const std::vector<uint32_t>& stepIntervalsNs();
+
+void setAnalogInput(uint16_t raw);
+void setAnalogSource(const std::function<uint16_t()>& source);
+void setHeap(uint32_t freeBytes, uint32_t maxFreeBlock);
+const std::string& serialOutput();
+
+// ---- Network --------------------------------------------------------------------------------
+
+void setWiFiAvailable(bool available);
+void setWiFiTiming(uint32_t scanMs, uint32_t authMs, uint32_t dhcpMs);
+// Moves the access point to another channel, as a router with automatic channel selection does.
+void setAccessPointChannel(uint8_t channel);
+// The address DHCP hands out from now on, 192.168.88.<host>: the router gave the old lease to
+// someone else.
+void setDhcpAddress(uint8_t host);
+// DNS and TCP to anything beyond the LAN (the GitHub probe).
+void setInternetReachable(bool reachable);
+// What SNTP servers answer: UTC |epochSeconds| now, running on with the simulated clock. The
+// sketch's time() follows once it called configTime() with Wi-Fi and the internet up; a later
+// call steps the clock like a resync.
+void setWallClock(uint64_t epochSeconds);
+
+// Registers a download for HTTPClient::GET(). bytesPerSec = 0 delivers the body at once.
+void serveUrl(const std::string& url, const std::string& body, uint32_t bytesPerSec = 0,
+              const std::vector<std::pair<std::string, std::string>>& headers = {});
+
+struct InstalledImages {
+  uint32_t firmwareBytes = 0;
+  uint32_t filesystemBytes = 0;
+  uint32_t firmwareUpdates = 0;
+  uint32_t filesystemUpdates = 0;
+};
+const InstalledImages& installedImages();
+
+// ---- HTTP clients ---------------------------------------------------------------------------
+
+struct Response {
+  int status = 0;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+
+  std::string header(const std::string& name) const;
+};
+
+// Sends one request to the sketch's web server and runs a single loop() pass to serve it.
+Response request(const std::string& method, const std::string& uri, const std::string& body = "",
+                 const std::vector<std::pair<std::string, std::string>>& headers = {});
+
+// A response the sketch keeps open (Server-Sent Events). take() returns what arrived since the
+// last call; close() hangs up like a browser leaving the page.
+class EventStream {
+ public:
+  EventStream() {}
+  explicit EventStream(std::shared_ptr<Connection> connection) : connection_(std::move(connection)) {}
+  std::string take();
+  bool open() const;
+  void close();
+  // Caps the bytes the sketch may still write before its writes come back short.
+  void setWindow(size_t bytes);
+
+ private:
+  std::shared_ptr<Connection> connection_;
+  size_t taken_ = 0;
+};
+EventStream openStream(const std::string& uri);
+
+// A TCP server on the LAN, such as an MQTT broker, played by the test. WiFiClient::connect()
+// to |ip|:|port| succeeds while it listens and is refused after listen(..., false).
+class Peer {
+ public:
+  Peer() {}
+  explicit Peer(std::shared_ptr<Connection> connection) : connection_(std::move(connection)) {}
+  bool valid() const { return connection_ != nullptr; }
+  // Bytes the sketch wrote since the last call.
+  std::string take();
+  void send(const std::string& bytes);
+  // Neither side has closed.
+  bool open() const;
+  void close();
+
+ private:
+  std::shared_ptr<Connection> connection_;
+  size_t taken_ = 0;
+};
+void listen(const std::string& ip, uint16_t port, bool listening = true);
+// The oldest connection to |ip|:|port| not accepted yet; an invalid Peer when there is none.
+Peer accept(const std::string& ip, uint16_t port);
+
+// ---- UDP multicast --------------------------------------------------------------------------
+
+struct Datagram {
+  std::string group;  // "239.255.83.72"
+  uint16_t port = 0;
+  uint64_t sentNs = 0;  // simulated time it went on the air
+  std::string bytes;
+};
+// What sketches multicast, oldest first. Like flash it carries over to the next boot, so that
+// boot can play another node on the same LAN hearing the datagrams.
+const std::vector<Datagram>& multicastLog();
+void clearMulticastLog();
+// A datagram from another node; sockets joined to group:port read it on their next parsePacket().
+void multicast(const std::string& group, uint16_t port, const std::string& bytes);
+
+// ---- Files ----------------------------------------------------------------------------------
+
+void writeFile(const std::string& path, const std::string& contents);
+bool readFile(const std::string& path, std::string* contents);
+
+}  // namespace hostsim
@@ -0,0 +1,102 @@
+#pragma once
+
+// State shared by the HostSdk translation units; not part of the test-facing API.
+
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+#include <FS.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "HostSim.h"
+
+namespace hostsim {
+namespace detail {
+
+// What a reboot keeps: flash contents and the physical motor.
+struct World {
+  uint8_t eepromSector[SPI_FLASH_SEC_SIZE];
+  std::map<std::string, std::shared_ptr<fs::FileData>> files;
+  Motor motor;
+  int8_t motorPhase = -1;
+  InstalledImages installed;
+  std::vector<Datagram> multicastLog;
+};
+
+struct Download {
+  std::string body;
+  uint32_t bytesPerSec;
+  std::vector<std::pair<std::string, std::string>> headers;
+};
+
+// Everything else. A boot starts from the copy the test process configured.
+struct Board {
+  uint64_t nowNs = 0;
+  uint32_t loopCostUs = 500;
+  uint32_t lightSleeps = 0;
+  bool restarted = false;
+
+  timercallback timerCallback = nullptr;
+  bool timerEnabled = false;
+  bool timerArmed = false;
+  uint8_t timerDivider = TIM_DIV16;
+  uint64_t timerDueNs = 0;
+
+  uint32_t outputLatch = 0;
+  bool motorAttached = false;
+  uint8_t motorPins[4] = {0, 0, 0, 0};
+  uint64_t motorEnergizedSinceNs = 0;
+  uint64_t lastStepNs = 0;
+  bool recordIntervals = false;
+  std::vector<uint32_t> stepIntervals;
+
+  uint16_t analogValue = 0;
+  std::function<uint16_t()> analogSource;
+  uint32_t freeHeap = 38000;
+  uint32_t maxFreeBlock = 30000;
+  std::string serial;
+
+  bool wifiAvailable = true;
+  // A join costs scan + auth + DHCP; begin() with the right channel and BSSID skips the scan,
+  // a static address skips DHCP.
+  uint32_t wifiScanMs = 700;
+  uint32_t wifiAuthMs = 200;
+  uint32_t wifiDhcpMs = 300;
+  uint8_t apChannel = 6;
+  uint8_t dhcpHost = 74;  // DHCP hands out 192.168.88.<dhcpHost>
+  uint8_t apBssid[6] = {0x74, 0x4D, 0x28, 0x5A, 0x10, 0x01};
+  bool internetReachable = true;
+  // SNTP: UTC is nowNs + wallClockOffsetNs once the sketch's configTime() got an answer.
+  bool wallClockSet = false;
+  int64_t wallClockOffsetNs = 0;
+  std::string sntpServer;
+  bool sntpSynced = false;
+  std::map<std::string, Download> downloads;
+
+  std::deque<PendingRequest> pendingRequests;
+  // "ip:port" of LAN servers; connections wait in the queue for accept().
+  struct Listener {
+    bool listening = true;
+    std::deque<std::shared_ptr<Connection>> pending;
+  };
+  std::map<std::string, Listener> listeners;
+  std::deque<Datagram> multicastInbound;
+};
+
+World& world();
+Board& board();
+
+// Called after every change of the output latch; steps the motor model.
+void outputsChanged();
+uint32_t eepromSectorAddress();
+// Requests from hostsim::request() go to the server on port 80.
+bool takeRequest(int port, PendingRequest* request);
+
+}  // namespace detail
+}  // namespace hostsim
@@ -0,0 +1,260 @@
+#include <EEPROM.h>
+#include <LittleFS.h>
+#include <Updater.h>
+
+#include "HostSim.h"
+#include "HostState.h"
+
+extern "C" {
+uint32_t _EEPROM_start = 0;
+}
+
+EEPROMClass EEPROM;
+fs::FS LittleFS;
+UpdaterClass Update;
+
+using hostsim::detail::world;
+
+namespace {
+
+constexpr size_t kFilesystemBytes = 128 * 1024;   // eagle.flash.2m128.ld
+constexpr size_t kSketchSpaceBytes = 1000 * 1024;  // free space for a staged firmware image
+
+// Maps a flash address onto the EEPROM sector, the only region the firmware touches directly.
+uint8_t* sectorBytes(uint32_t address, size_t size) {
+  const uint32_t base = hostsim::detail::eepromSectorAddress();
+  if (address < base || address - base + size > SPI_FLASH_SEC_SIZE) return nullptr;
+  return world().eepromSector + (address - base);
+}
+
+}  // namespace
+
+namespace hostsim {
+namespace detail {
+
+uint32_t eepromSectorAddress() {
+  const uint32_t mapped = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&_EEPROM_start));
+  return ((mapped - 0x40200000UL) / SPI_FLASH_SEC_SIZE) * SPI_FLASH_SEC_SIZE;
+}
+
+}  // namespace detail
+
+void writeFile(const std::string& path, const std::string& contents) {
+  auto data = std::make_shared<fs::FileData>();
+  data->bytes = contents;
+  world().files[path] = data;
+}
+
+void writeEepromSector(size_t offset, const std::string& bytes) {
+  if (offset + bytes.size() > SPI_FLASH_SEC_SIZE) return;
+  memcpy(world().eepromSector + offset, bytes.data(), bytes.size());
+}
+
+bool readFile(const std::string& path, std::string* contents) {
+  const auto found = world().files.find(path);
+  if (found == world().files.end()) return false;
+  *contents = found->second->bytes;
+  return true;
+}
+
+}  // namespace hostsim
+
+// ---- Raw flash ----------------------------------------------------------------------------
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+  uint8_t* bytes = sectorBytes(sector * SPI_FLASH_SEC_SIZE, SPI_FLASH_SEC_SIZE);
+  if (bytes == nullptr) return false;
+  memset(bytes, 0xFF, SPI_FLASH_SEC_SIZE);
+  return true;
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t* data, size_t size) {
+  const uint8_t* bytes = sectorBytes(address, size);
+  if (bytes == nullptr || (address & 3) != 0) return false;
+  memcpy(data, bytes, size);
+  return true;
+}
+
+// NOR semantics: programming can only clear bits, so writing over data ANDs into it.
+bool EspClass::flashWrite(uint32_t address, const uint32_t* data, size_t size) {
+  uint8_t* bytes = sectorBytes(address, size);
+  if (bytes == nullptr || (address & 3) != 0 || (size & 3) != 0) return false;
+  const uint8_t* in = reinterpret_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) bytes[i] &= in[i];
+  return true;
+}
+
+// ---- EEPROM -------------------------------------------------------------------------------
+
+void EEPROMClass::begin(size_t size) {
+  size = (size + 3) & ~static_cast<size_t>(3);
+  if (size == 0 || size > SPI_FLASH_SEC_SIZE) return;
+  data_.assign(size, 0);
+  ESP.flashRead(hostsim::detail::eepromSectorAddress(), reinterpret_cast<uint32_t*>(data_.data()), size);
+  dirty_ = false;
+}
+
+bool EEPROMClass::commit() {
+  if (data_.empty()) return false;
+  if (!dirty_) return true;
+  const uint32_t address = hostsim::detail::eepromSectorAddress();
+  if (!ESP.flashEraseSector(address / SPI_FLASH_SEC_SIZE)) return false;
+  if (!ESP.flashWrite(address, reinterpret_cast<const uint32_t*>(data_.data()), data_.size())) return false;
+  dirty_ = false;
+  return true;
+}
+
+bool EEPROMClass::end() {
+  const bool ok = commit();
+  data_.clear();
+  return ok;
+}
+
+// ---- LittleFS -----------------------------------------------------------------------------
+
+namespace fs {
+
+bool FS::begin() {
+  mounted_ = true;
+  return true;
+}
+
+void FS::end() { mounted_ = false; }
+
+bool FS::format() {
+  world().files.clear();
+  return true;
+}
+
+bool FS::info(FSInfo& info) {
+  if (!mounted_) return false;
+  info = FSInfo{kFilesystemBytes, 0, 4096, 256, 5, 32};
+  for (const auto& file : world().files) info.usedBytes += (file.second->bytes.size() + 4095) / 4096 * 4096;
+  return true;
+}
+
+bool FS::exists(const char* path) { return mounted_ && world().files.count(path) > 0; }
+
+File FS::open(const char* path, const char* mode) {
+  if (!mounted_ || mode == nullptr) return File();
+  auto& files = world().files;
+  auto found = files.find(path);
+  const bool plus = mode[1] == '+';
+  if (mode[0] == 'r') {
+    if (found == files.end()) return File();
+    return File(found->second, path, plus);
+  }
+  if (mode[0] != 'w' && mode[0] != 'a') return File();
+  if (found == files.end() || mode[0] == 'w') {
+    files[path] = std::make_shared<FileData>();
+    found = files.find(path);
+  }
+  File file(found->second, path, true);
+  if (mode[0] == 'a') file.seek(file.size());
+  return file;
+}
+
+bool FS::remove(const char* path) { return mounted_ && world().files.erase(path) > 0; }
+
+bool FS::rename(const char* from, const char* to) {
+  if (!mounted_) return false;
+  auto& files = world().files;
+  const auto found = files.find(from);
+  if (found == files.end()) return false;
+  const std::shared_ptr<FileData> data = found->second;
+  files.erase(found);
+  files[to] = data;
+  return true;
+}
+
+}  // namespace fs
+
+// ---- Updater ------------------------------------------------------------------------------
+
+void UpdaterClass::reset() {
+  size_ = 0;
+  image_.clear();
+  expectedMd5_.clear();
+}
+
+bool UpdaterClass::begin(size_t size, int command) {
+  reset();
+  error_ = UPDATE_ERROR_OK;
+  if (size == 0) {
+    error_ = UPDATE_ERROR_SIZE;
+    return false;
+  }
+  if (size > (command == U_FS ? kFilesystemBytes : kSketchSpaceBytes)) {
+    error_ = UPDATE_ERROR_SPACE;
+    return false;
+  }
+  size_ = size;
+  command_ = command;
+  image_.reserve(size);
+  return true;
+}
+
+bool UpdaterClass::setMD5(const char* expectedMd5) {
+  if (expectedMd5 == nullptr || strlen(expectedMd5) != 32) return false;
+  expectedMd5_ = expectedMd5;
+  return true;
+}
+
+size_t UpdaterClass::write(uint8_t* data, size_t length) {
+  if (!isRunning() || error_ != UPDATE_ERROR_OK) return 0;
+  if (length > remaining()) {
+    error_ = UPDATE_ERROR_SPACE;
+    return 0;
+  }
+  if (image_.empty() && length > 0 && command_ == U_FLASH && data[0] != 0xE9) {
+    error_ = UPDATE_ERROR_MAGIC_BYTE;
+    return 0;
+  }
+  image_.append(reinterpret_cast<const char*>(data), length);
+  return length;
+}
+
+bool UpdaterClass::end(bool evenIfRemaining) {
+  if (!isRunning()) return false;
+  if (!isFinished() && !evenIfRemaining) {
+    // The core drops an unfinished image without arming the bootloader.
+    reset();
+    return false;
+  }
+  if (image_.empty()) {
+    error_ = UPDATE_ERROR_NO_DATA;
+    reset();
+    return false;
+  }
+  hostsim::InstalledImages& installed = world().installed;
+  if (command_ == U_FS) {
+    installed.filesystemBytes = static_cast<uint32_t>(image_.size());
+    ++installed.filesystemUpdates;
+  } else {
+    installed.firmwareBytes = static_cast<uint32_t>(image_.size());
+    ++installed.firmwareUpdates;
+  }
+  reset();
+  return true;
+}
+
+String UpdaterClass::getErrorString() const {
+  switch (error_) {
+    case UPDATE_ERROR_OK:
+      return String("No Error");
+    case UPDATE_ERROR_WRITE:
+      return String("Flash Write Failed");
+    case UPDATE_ERROR_SPACE:
+      return String("Not Enough Space");
+    case UPDATE_ERROR_SIZE:
+      return String("Bad Size Given");
+    case UPDATE_ERROR_MD5:
+      return String("MD5 Check Failed");
+    case UPDATE_ERROR_MAGIC_BYTE:
+      return String("Magic byte is wrong, not 0xE9");
+    case UPDATE_ERROR_NO_DATA:
+      return String("No data supplied");
+    default:
+      return String("UNKNOWN");
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "WString.h"
+
+class IPAddress {
+ public:
+  IPAddress() {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets_{a, b, c, d} {}
+  explicit IPAddress(uint32_t address) { memcpy(octets_, &address, sizeof(octets_)); }
+
+  operator uint32_t() const {
+    uint32_t address;
+    memcpy(&address, octets_, sizeof(address));
+    return address;
+  }
+  uint32_t v4() const { return static_cast<uint32_t>(*this); }
+  bool isSet() const { return v4() != 0; }
+  uint8_t operator[](int index) const { return octets_[index]; }
+  uint8_t& operator[](int index) { return octets_[index]; }
+  bool operator==(const IPAddress& other) const { return v4() == other.v4(); }
+  bool operator!=(const IPAddress& other) const { return v4() != other.v4(); }
+
+  bool fromString(const char* text) {
+    unsigned a, b, c, d;
+    char tail;
+    if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) return false;
+    if (a > 255 || b > 255 || c > 255 || d > 255) return false;
+    *this = IPAddress(a, b, c, d);
+    return true;
+  }
+  bool fromString(const String& text) { return fromString(text.c_str()); }
+  String toString() const {
+    char text[16];
+    snprintf(text, sizeof(text), "%u.%u.%u.%u", octets_[0], octets_[1], octets_[2], octets_[3]);
+    return String(text);
+  }
+
+ private:
+  uint8_t octets_[4] = {0, 0, 0, 0};
+};
+
+#define INADDR_NONE IPAddress(0, 0, 0, 0)
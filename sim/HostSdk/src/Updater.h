@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <string>
+
+#define U_FLASH 0
+#define U_FS 100
+
+#define UPDATE_ERROR_OK (0)
+#define UPDATE_ERROR_WRITE (1)
+#define UPDATE_ERROR_SPACE (4)
+#define UPDATE_ERROR_SIZE (5)
+#define UPDATE_ERROR_MD5 (7)
+#define UPDATE_ERROR_MAGIC_BYTE (10)
+#define UPDATE_ERROR_NO_DATA (13)
+
+// Collects the image in RAM and checks what the core checks before arming the bootloader:
+// the partition size, the 0xE9 magic byte of firmware images and the length. MD5 is recorded
+// but not computed. A completed image is reported through hostsim::installedImages().
+class UpdaterClass {
+ public:
+  bool begin(size_t size, int command = U_FLASH);
+  size_t write(uint8_t* data, size_t length);
+  bool end(bool evenIfRemaining = false);
+  bool setMD5(const char* expectedMd5);
+
+  bool isRunning() const { return size_ > 0; }
+  bool isFinished() const { return size_ > 0 && image_.size() == size_; }
+  size_t size() const { return size_; }
+  size_t progress() const { return image_.size(); }
+  size_t remaining() const { return size_ - image_.size(); }
+  uint8_t getError() const { return error_; }
+  String getErrorString() const;
+  void clearError() { error_ = UPDATE_ERROR_OK; }
+
+ private:
+  void reset();
+
+  size_t size_ = 0;
+  int command_ = U_FLASH;
+  uint8_t error_ = UPDATE_ERROR_OK;
+  std::string image_;
+  std::string expectedMd5_;
+};
+extern UpdaterClass Update;
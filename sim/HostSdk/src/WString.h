@@ -0,0 +1,213 @@
+#pragma once
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <string>
+#include <utility>
+
+// Host String: the subset of the core's WString API the firmware and ArduinoJson use,
+// backed by std::string. Null C strings read as empty, like the core.
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define PSTR(s) (s)
+
+class String {
+ public:
+  String() {}
+  String(const char* s) : s_(s ? s : "") {}
+  String(const char* s, unsigned int length) : s_(s, length) {}
+  String(const __FlashStringHelper* s) : String(reinterpret_cast<const char*>(s)) {}
+  String(const std::string& s) : s_(s) {}
+  explicit String(char c) : s_(1, c) {}
+  explicit String(unsigned char v, unsigned char base = 10) { formatUnsigned(v, base); }
+  explicit String(int v, unsigned char base = 10) { formatSigned(v, base); }
+  explicit String(unsigned int v, unsigned char base = 10) { formatUnsigned(v, base); }
+  explicit String(long v, unsigned char base = 10) { formatSigned(v, base); }
+  explicit String(unsigned long v, unsigned char base = 10) { formatUnsigned(v, base); }
+  explicit String(long long v, unsigned char base = 10) { formatSigned(v, base); }
+  explicit String(unsigned long long v, unsigned char base = 10) { formatUnsigned(v, base); }
+  explicit String(float v, unsigned char decimals = 2) { formatFloat(v, decimals); }
+  explicit String(double v, unsigned char decimals = 2) { formatFloat(v, decimals); }
+
+  String& operator=(const char* s) {
+    s_ = s ? s : "";
+    return *this;
+  }
+
+  unsigned int length() const { return static_cast<unsigned int>(s_.size()); }
+  const char* c_str() const { return s_.c_str(); }
+  bool reserve(unsigned int size) {
+    s_.reserve(size);
+    return true;
+  }
+  void clear() { s_.clear(); }
+  bool isEmpty() const { return s_.empty(); }
+  explicit operator bool() const { return true; }
+
+  char charAt(unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+  char& operator[](unsigned int i) { return s_[i]; }
+  char* begin() { return &s_[0]; }
+  char* end() { return &s_[0] + s_.size(); }
+  const char* begin() const { return s_.c_str(); }
+  const char* end() const { return s_.c_str() + s_.size(); }
+
+  bool concat(const String& s) {
+    s_ += s.s_;
+    return true;
+  }
+  bool concat(const char* s) {
+    if (s) s_ += s;
+    return true;
+  }
+  bool concat(const char* s, unsigned int length) {
+    if (s) s_.append(s, length);
+    return true;
+  }
+  bool concat(char c) {
+    s_ += c;
+    return true;
+  }
+  template <typename T>
+  bool concat(T v) {
+    return concat(String(v));
+  }
+  template <typename T>
+  String& operator+=(const T& v) {
+    concat(v);
+    return *this;
+  }
+
+  bool equals(const String& s) const { return s_ == s.s_; }
+  bool equalsIgnoreCase(const String& s) const { return strcasecmp(c_str(), s.c_str()) == 0; }
+  bool operator==(const String& s) const { return s_ == s.s_; }
+  bool operator==(const char* s) const { return s_ == (s ? s : ""); }
+  bool operator!=(const String& s) const { return !(*this == s); }
+  bool operator!=(const char* s) const { return !(*this == s); }
+  bool operator<(const String& s) const { return s_ < s.s_; }
+  bool startsWith(const String& prefix) const { return s_.compare(0, prefix.s_.size(), prefix.s_) == 0; }
+  bool endsWith(const String& suffix) const {
+    return s_.size() >= suffix.s_.size() && s_.compare(s_.size() - suffix.s_.size(), suffix.s_.size(), suffix.s_) == 0;
+  }
+
+  int indexOf(char c, unsigned int from = 0) const { return position(s_.find(c, from)); }
+  int indexOf(const String& s, unsigned int from = 0) const { return position(s_.find(s.s_, from)); }
+  int lastIndexOf(char c) const { return position(s_.rfind(c)); }
+  int lastIndexOf(const String& s) const { return position(s_.rfind(s.s_)); }
+  String substring(unsigned int from) const { return from < s_.size() ? String(s_.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    if (from > to) std::swap(from, to);
+    if (from >= s_.size()) return String();
+    return String(s_.substr(from, to - from));
+  }
+
+  void trim() {
+    size_t first = 0;
+    size_t last = s_.size();
+    while (first < last && isspace(static_cast<unsigned char>(s_[first]))) ++first;
+    while (last > first && isspace(static_cast<unsigned char>(s_[last - 1]))) --last;
+    s_ = s_.substr(first, last - first);
+  }
+  void toLowerCase() {
+    for (char& c : s_) c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+  }
+  void toUpperCase() {
+    for (char& c : s_) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+  }
+  void replace(const String& find, const String& with) {
+    if (find.s_.empty()) return;
+    for (size_t at = s_.find(find.s_); at != std::string::npos; at = s_.find(find.s_, at + with.s_.size())) {
+      s_.replace(at, find.s_.size(), with.s_);
+    }
+  }
+  void remove(unsigned int index) {
+    if (index < s_.size()) s_.erase(index);
+  }
+  void remove(unsigned int index, unsigned int count) {
+    if (index < s_.size()) s_.erase(index, count);
+  }
+
+  void toCharArray(char* buffer, unsigned int size, unsigned int index = 0) const {
+    if (size == 0) return;
+    size_t n = index < s_.size() ? s_.size() - index : 0;
+    if (n > size - 1) n = size - 1;
+    memcpy(buffer, s_.data() + index, n);
+    buffer[n] = 0;
+  }
+  void getBytes(unsigned char* buffer, unsigned int size, unsigned int index = 0) const {
+    toCharArray(reinterpret_cast<char*>(buffer), size, index);
+  }
+  long toInt() const { return atol(c_str()); }
+  float toFloat() const { return static_cast<float>(atof(c_str())); }
+  double toDouble() const { return atof(c_str()); }
+
+ private:
+  static int position(size_t at) { return at == std::string::npos ? -1 : static_cast<int>(at); }
+
+  void formatSigned(long long v, unsigned char base) {
+    if (v < 0 && base == 10) {
+      formatUnsigned(0ULL - static_cast<unsigned long long>(v), base);
+      s_.insert(s_.begin(), '-');
+      return;
+    }
+    formatUnsigned(static_cast<unsigned long long>(v), base);
+  }
+  void formatUnsigned(unsigned long long v, unsigned char base) {
+    static const char kDigits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+    if (base < 2 || base > 36) base = 10;
+    char buffer[65];
+    char* p = buffer + sizeof(buffer);
+    *--p = 0;
+    do {
+      *--p = kDigits[v % base];
+      v /= base;
+    } while (v != 0);
+    s_ = p;
+  }
+  void formatFloat(double v, unsigned char decimals) {
+    char buffer[48];
+    snprintf(buffer, sizeof(buffer), "%.*f", decimals, v);
+    s_ = buffer;
+  }
+
+  std::string s_;
+};
+
+// The core returns this from operator+; ArduinoJson treats it as a string type.
+class StringSumHelper : public String {
+ public:
+  StringSumHelper(const String& s) : String(s) {}
+  StringSumHelper(const char* s) : String(s) {}
+};
+
+inline StringSumHelper operator+(const String& a, const String& b) {
+  StringSumHelper sum(a);
+  sum.concat(b);
+  return sum;
+}
+inline StringSumHelper operator+(const String& a, const char* b) {
+  StringSumHelper sum(a);
+  sum.concat(b);
+  return sum;
+}
+inline StringSumHelper operator+(const char* a, const String& b) {
+  StringSumHelper sum(a);
+  sum.concat(b);
+  return sum;
+}
+inline StringSumHelper operator+(const String& a, char b) {
+  StringSumHelper sum(a);
+  sum.concat(b);
+  return sum;
+}
+template <typename T>
+inline StringSumHelper operator+(const String& a, T b) {
+  StringSumHelper sum(a);
+  sum.concat(String(b));
+  return sum;
+}
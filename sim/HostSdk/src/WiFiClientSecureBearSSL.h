@@ -0,0 +1,17 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+namespace BearSSL {
+
+// TLS is not modelled: a secure client carries plain bytes like WiFiClient.
+class WiFiClientSecure : public WiFiClient {
+ public:
+  void setInsecure() {}
+  void setBufferSizes(int receive, int transmit) {
+    (void)receive;
+    (void)transmit;
+  }
+};
+
+}  // namespace BearSSL
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <ESP8266WiFi.h>
+
+// The captive portal never gets a visitor on the host: autoConnect() succeeds only when the
+// station is already associated, otherwise it waits out the portal timeout and fails.
+class WiFiManager {
+ public:
+  void setConfigPortalTimeout(unsigned long seconds) { portalTimeoutSec_ = seconds; }
+  bool autoConnect(const char* apName, const char* apPassword = nullptr) {
+    (void)apName;
+    (void)apPassword;
+    if (WiFi.status() == WL_CONNECTED) return true;
+    delay(static_cast<uint32_t>(portalTimeoutSec_ * 1000UL));
+    return WiFi.status() == WL_CONNECTED;
+  }
+  void resetSettings() {}
+
+ private:
+  unsigned long portalTimeoutSec_ = 180;
+};
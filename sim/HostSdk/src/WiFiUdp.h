@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <string>
+
+#include "IPAddress.h"
+
+// Multicast only, which is all the sketch uses: a socket joined to group:port reads what
+// hostsim::multicast() puts on the air, and what it sends goes to hostsim::multicastLog().
+// A node does not hear its own datagrams (lwIP's default).
+class WiFiUDP : public Stream {
+ public:
+  uint8_t beginMulticast(IPAddress interfaceAddr, IPAddress multicast, uint16_t port);
+  void stop();
+
+  int beginPacketMulticast(IPAddress multicastAddress, uint16_t port, IPAddress interfaceAddress, int ttl = 1);
+  int endPacket();
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t* buffer, size_t size) override;
+  using Print::write;
+
+  // Size of the next datagram for this socket, 0 when none waits.
+  int parsePacket();
+  int available() override;
+  int read() override;
+  int read(uint8_t* buffer, size_t len);
+  int read(char* buffer, size_t len) { return read(reinterpret_cast<uint8_t*>(buffer), len); }
+  int peek() override;
+
+ private:
+  std::string group_;
+  uint16_t port_ = 0;
+  std::string txGroup_;
+  uint16_t txPort_ = 0;
+  std::string tx_;
+  std::string rx_;
+  size_t rxRead_ = 0;
+  bool sending_ = false;
+};
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include <vector>
+
+// Route pattern as in the core's uri/Uri.h: the base class matches the path exactly.
+class Uri {
+ public:
+  Uri(const char* uri) : uri_(uri) {}
+  Uri(const String& uri) : uri_(uri) {}
+  virtual ~Uri() {}
+
+  virtual Uri* clone() const { return new Uri(uri_); }
+  // Fills pathArgs with the captured segments on a match.
+  virtual bool canHandle(const String& requestUri, std::vector<String>& pathArgs) {
+    (void)pathArgs;
+    return uri_ == requestUri;
+  }
+
+ protected:
+  const String uri_;
+};
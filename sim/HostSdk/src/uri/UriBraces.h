@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Uri.h"
+
+// "/api/things/{}/move": each {} captures one path segment, read back with pathArg(i).
+class UriBraces : public Uri {
+ public:
+  explicit UriBraces(const char* uri) : Uri(uri) {}
+  explicit UriBraces(const String& uri) : Uri(uri) {}
+
+  Uri* clone() const override { return new UriBraces(uri_); }
+
+  bool canHandle(const String& requestUri, std::vector<String>& pathArgs) override {
+    pathArgs.clear();
+    const char* pattern = uri_.c_str();
+    const char* path = requestUri.c_str();
+    while (*pattern != '\0') {
+      if (pattern[0] == '{' && pattern[1] == '}') {
+        const char* end = path;
+        while (*end != '\0' && *end != '/') ++end;
+        if (end == path) return false;
+        pathArgs.push_back(requestUri.substring(static_cast<unsigned>(path - requestUri.c_str()),
+                                                static_cast<unsigned>(end - requestUri.c_str())));
+        path = end;
+        pattern += 2;
+        continue;
+      }
+      if (*pattern != *path) return false;
+      ++pattern;
+      ++path;
+    }
+    return *path == '\0';
+  }
+};
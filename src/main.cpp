@@ -1,8 +1,6 @@
 #include <Arduino.h>
-#include <AccelStepper.h>
 #include <ArduinoJson.h>
 #include <ESP8266HTTPClient.h>
-#include <ESP8266httpUpdate.h>
 #include <ESP8266WebServer.h>
 #include <ESP8266WiFi.h>
 #include <Updater.h>
@@ -10,9 +8,32 @@
 #include <LittleFS.h>
 #include <EEPROM.h>
 #include <WiFiManager.h>
+#include <WiFiUdp.h>
 #include <memory>
-
+#include <time.h>
+#include <uri/UriBraces.h>
+
+#include "BufferedWriter.h"
+#include "GroupCommand.h"
+#include "LatencyHistogram.h"
+#include "MotionQueue.h"
+#include "MqttPacket.h"
+#include "PositionJournal.h"
+#include "PowerBudget.h"
+#include "SampleWindow.h"
+#include "Schedule.h"
 #include "ShutterMath.h"
+#include "StallDetector.h"
+#include "StateRecord.h"
+#include "StepCompensation.h"
+#include "StepGenerator.h"
+#include "StepScheduler.h"
+
+// Number of shutters driven by this board: channel 0 on the on-board GPIOs, the rest on a
+// chain of 74HC595 shift registers.
+#ifndef SHUTTER_CHANNEL_COUNT
+#define SHUTTER_CHANNEL_COUNT 1
+#endif
 
 namespace cfg {
 constexpr char kFirmwareVersion[] = "0.1.10-esp8266";
@@ -22,6 +43,13 @@ constexpr uint16_t kApPortalTimeoutSec = 180;
 constexpr char kDefaultWifiSsid[] = "nh";
 constexpr char kDefaultWifiPass[] = "Fx110011";
 constexpr uint16_t kDefaultWifiConnectTimeoutMs = 12000;
+// A direct join to the cached BSSID normally completes in well under a second.
+constexpr uint16_t kFastWifiConnectTimeoutMs = 3000;
+// A fast join runs on the cached lease as a static address. This long after boot (the first
+// requests answered) the station goes back to DHCP; the lease is cached again once DHCP had
+// kWifiDhcpSettleMs to finish.
+constexpr uint16_t kWifiLeaseRenewDelayMs = 5000;
+constexpr uint16_t kWifiDhcpSettleMs = 10000;
 constexpr char kDefaultFirmwareRepo[] = "dslimp/shutter";
 constexpr char kDefaultFirmwareAssetName[] = "firmware.bin";
 constexpr char kDefaultFirmwareFsAssetName[] = "littlefs.bin";
@@ -29,39 +57,261 @@ constexpr uint8_t kOtaMaxAttempts = 4;
 constexpr uint16_t kOtaClientTimeoutMs = 20000;
 constexpr uint16_t kOtaRetryDelayMs = 2500;
 constexpr uint16_t kOtaQueueStartDelayMs = 400;
-constexpr char kStateFile[] = "/state.json";
-constexpr uint16_t kEepromSize = 512;
-constexpr uint32_t kStateMagic = 0x53485452;  // "SHTR"
-constexpr uint16_t kStateSchemaVersion = 1;
+constexpr uint16_t kOtaChunkBytes = 1024;
+constexpr uint16_t kOtaRebootDelayMs = 1000;
+constexpr char kStateFile[] = "/state.json";  // JSON mirror of old builds, imported once
+// The settings record owns the first kSettingsAreaSize bytes of the EEPROM flash sector; the
+// rest of the sector is a position journal written with raw flash programming (no erase per
+// save). The record header names the area size, so after a change the first boot still reads
+// the journal where the old build kept it and commits again in the new layout.
+constexpr uint16_t kSettingsAreaSize = 1536;
+// Records of the first tagged-record builds did not name their area; it was this size.
+constexpr uint16_t kUnnamedSettingsAreaSize = 1280;
+static_assert(kSettingsAreaSize % shutter::storage::kRecordAreaUnit == 0, "the record header names whole units");
+constexpr uint16_t kJournalSlots = (SPI_FLASH_SEC_SIZE - kSettingsAreaSize) / sizeof(shutter::storage::JournalRecord);
+// Builds before the tagged record kept a fixed-layout blob (schemas 1..12) in the first 1 KB
+// and the journal right behind it. Read once on the first boot of this build.
+constexpr uint16_t kLegacyBlobAreaSize = 1024;
+constexpr uint16_t kLegacyJournalSlots =
+    (SPI_FLASH_SEC_SIZE - kLegacyBlobAreaSize) / sizeof(shutter::storage::JournalRecord);
+constexpr uint32_t kLegacyBlobMagic = 0x53485452;  // "SHTR"
+constexpr uint16_t kLastLegacyBlobSchema = 12;
+constexpr uint16_t kLegacyBlobV1Size = 168;  // schema 1 ended with firmwareFsAssetName + checksum
+// Longest strings the settings keep, in bytes.
+constexpr size_t kMaxFirmwareRepoLength = 63;
+constexpr size_t kMaxAssetNameLength = 31;
+constexpr size_t kMaxMqttHostLength = 63;
+constexpr size_t kMaxMqttUserLength = 31;
+constexpr size_t kMaxMqttPasswordLength = 63;
+constexpr size_t kMaxMqttBaseTopicLength = 31;
+constexpr size_t kMaxTimezoneLength = 47;
+constexpr size_t kMaxNtpServerLength = 47;
 constexpr uint32_t kSaveIntervalMs = 5000;
+// Settings changes are committed this long after the last one of a burst, but no later than
+// kMaxSettingsCommitDelayMs after the first; a failed commit is retried after the short delay.
+constexpr uint32_t kSettingsCommitDelayMs = 1000;
+constexpr uint32_t kMaxSettingsCommitDelayMs = 5000;
 constexpr long kMinTravelSteps = 100;
 constexpr long kMaxTravelSteps = 300000;
 constexpr float kMinSpeed = 80.0f;
 constexpr float kMaxSpeed = 2500.0f;
 constexpr float kMinAccel = 40.0f;
 constexpr float kMaxAccel = 6000.0f;
+constexpr float kMinJerk = 100.0f;  // 0 selects the constant-acceleration (trapezoid) ramp
+constexpr float kMaxJerk = 200000.0f;
 constexpr uint16_t kMaxCoilHoldMs = 10000;
+// Stopped coils are chopped at this period by the hold chopper; the ULN2003 has no current
+// control, so duty is the only way to lower the holding current.
+constexpr uint32_t kHoldChopPeriodUs = 1000;
+constexpr uint8_t kMinHoldDutyPercent = 10;
+constexpr uint8_t kMaxIdleHoldDutyPercent = 50;  // an indefinite hold must not cook the motor
 constexpr float kMinTopOverdrivePercent = 0.0f;
 constexpr float kMaxTopOverdrivePercent = 50.0f;
+constexpr uint32_t kStepKickTicks = 50;  // first step of a move fires 10 us after the command
+constexpr uint8_t kMotionQueueDepth = 4;  // moves a channel holds behind the running one
+constexpr uint16_t kStepTraceSamples = 256;
+constexpr uint16_t kMinAdcSampleIntervalMs = 10;
+constexpr uint16_t kMaxAdcSampleIntervalMs = 60000;
+// Idle light sleep: a request waits at most about wakeLatencyMs for the radio to wake.
+constexpr uint16_t kMinWakeLatencyMs = 100;
+constexpr uint16_t kMaxWakeLatencyMs = 1100;
+constexpr uint16_t kLightSleepIdleDelayMs = 50;  // loop() yields this long so the SDK can sleep
+// Stall detection: A0 carries the motor supply current through a shunt. It is read this often
+// while a single channel cruises; reading it much faster starves the Wi-Fi stack.
+constexpr uint16_t kStallSampleIntervalMs = 5;
+constexpr uint8_t kMinStallThresholdPercent = 10;
+constexpr uint8_t kMaxStallThresholdPercent = 200;
+constexpr float kStallEndZonePercent = 15.0f;  // a stall this close to an end is its end stop
+constexpr uint16_t kMinSenseCurrentRaw = 16;   // a cruising motor reads at least this with a shunt
+constexpr uint16_t kAdcWindowSize = 32;
+constexpr uint32_t kAdcTrendIntervalMs = 60000;
+constexpr uint16_t kAdcTrendSize = 60;
+constexpr uint8_t kStepTraceRecentCount = 32;
+constexpr uint32_t kStepDeadlineSlackUs = 50;  // a step later than this counts as missed
+constexpr uint8_t kMaxEventSubscribers = 3;
+constexpr uint16_t kEventCheckIntervalMs = 50;
+constexpr uint16_t kEventMotionIntervalMs = 250;
+constexpr uint32_t kEventA0IntervalMs = 5000;
+constexpr uint16_t kEventA0Deadband = 8;
+constexpr uint16_t kEventWriteTimeoutMs = 250;
+constexpr uint16_t kEventRetryMs = 3000;
+constexpr uint8_t kChannelCount = SHUTTER_CHANNEL_COUNT;
+constexpr uint8_t kMaxChannels = 5;  // the settings area has room for this many
+static_assert(kChannelCount >= 1 && kChannelCount <= kMaxChannels, "SHUTTER_CHANNEL_COUNT must be 1..5");
+// ~110 state fields at 16 bytes per slot plus copied strings (ssid, addresses, repo, OTA
+// error), and a short summary per channel. Too big for the 4 KB loop stack: built in
+// apiDocument.
+constexpr size_t kStateJsonCapacity = 2832 + 128 * kChannelCount;
+constexpr size_t kChannelJsonCapacity = 704;
+// The settings form posts every field (about 25 keys, strings copied): built in apiDocument.
+constexpr size_t kSettingsJsonCapacity = 1280;
+// Documents built on the loop stack stay below this, leaving room for the frames above the
+// handler; anything larger goes to apiDocument.
+constexpr size_t kMaxStackJsonCapacity = 1536;
+// /api/state/lite: an array of up to 8 members per channel, names and values uncopied.
+constexpr size_t kLiteStateJsonCapacity = 16 + 160 * kChannelCount;
+// Responses are streamed into the socket in blocks of this size (one static buffer); no
+// String per response.
+constexpr size_t kHttpWriteBufferSize = 512;
+// Web UI files named with ?v=<content hash> by scripts/gzip_web_assets.py never change.
+constexpr char kVersionedAssetCacheControl[] = "public, max-age=31536000, immutable";
+constexpr uint32_t kHeapSampleIntervalMs = 1000;
+constexpr uint16_t kEventOtaIntervalMs = 1000;
+constexpr size_t kEventPatchCapacity = 448 + 192 * (kChannelCount - 1);
+static_assert(kChannelJsonCapacity <= kMaxStackJsonCapacity && kLiteStateJsonCapacity <= kMaxStackJsonCapacity &&
+                  kEventPatchCapacity <= kMaxStackJsonCapacity,
+              "a JSON document built on the loop stack outgrew kMaxStackJsonCapacity");
+// MQTT (QoS 0) with Home Assistant discovery. The core's connect() waits for the handshake,
+// so a (re)connect is only tried while every motor rests, and never for longer than this.
+constexpr uint16_t kDefaultMqttPort = 1883;
+constexpr char kMqttDiscoveryPrefix[] = "homeassistant";
+constexpr uint16_t kMqttSocketTimeoutMs = 250;
+constexpr uint16_t kMqttConnackTimeoutMs = 3000;
+constexpr uint16_t kMqttKeepAliveSec = 30;
+constexpr uint32_t kMqttMinBackoffMs = 1000;
+constexpr uint32_t kMqttMaxBackoffMs = 60000;
+constexpr uint16_t kMqttCheckIntervalMs = 50;
+constexpr uint16_t kMqttPositionIntervalMs = 1000;  // position updates while a move runs
+constexpr size_t kMqttTopicCapacity = 96;
+constexpr size_t kMqttPacketCapacity = 768;   // a discovery config is the largest packet
+constexpr size_t kMqttInboundCapacity = 128;  // commands are short; anything longer is skipped
+// Group control: UDP multicast to every node on the LAN (include/GroupCommand.h). A command
+// goes out kGroupCopies times, kGroupCopyGapMs apart; members start together the lead after
+// the first copy.
+constexpr uint8_t kGroupMulticastIp[4] = {239, 255, 83, 72};
+constexpr uint16_t kGroupPort = 4219;
+constexpr uint8_t kGroupCopies = 3;
+constexpr uint16_t kGroupCopyGapMs = 40;
+constexpr uint16_t kDefaultGroupStartLeadMs = 200;
+constexpr uint16_t kMaxGroupStartLeadMs = 5000;
+constexpr uint8_t kGroupSendersRemembered = 8;
+// On-device schedule (include/Schedule.h). Local time comes from SNTP and the POSIX TZ
+// string; until the first answer no rule fires.
+constexpr uint8_t kMaxScheduleRules = 12;
+constexpr uint8_t kMaxScheduleJitterMinutes = 60;
+constexpr char kDefaultTimezone[] = "UTC0";
+constexpr char kDefaultNtpServer[] = "pool.ntp.org";
+constexpr uint16_t kScheduleCheckIntervalMs = 1000;
+constexpr time_t kMinValidEpoch = 1700000000;  // earlier readings are uptime, not SNTP
+constexpr size_t kScheduleJsonCapacity = 384 + 192 * kMaxScheduleRules;  // built in apiDocument
+// Named moves recalled with {"action":"preset"}; kept with the settings, recalling one
+// writes nothing.
+constexpr uint8_t kMaxMovePresets = 8;
+constexpr size_t kPresetJsonCapacity = 256 + 128 * kMaxMovePresets;  // built in apiDocument
+// The one static document (apiDocument) holds the largest of the documents above that do not
+// fit the loop stack.
+constexpr size_t kApiJsonCapacity = std::max({kStateJsonCapacity, kSettingsJsonCapacity, kScheduleJsonCapacity, kPresetJsonCapacity});
 
 // 28BYJ-48 + ULN2003 for Wemos ESP-WROOM-02 board
 constexpr uint8_t kPinIn1 = 5;   // GPIO5
 constexpr uint8_t kPinIn2 = 4;   // GPIO4
 constexpr uint8_t kPinIn3 = 14;  // GPIO14
 constexpr uint8_t kPinIn4 = 12;  // GPIO12
+// Channels 1.. : 74HC595 chain, two ULN2003 boards per register (Q0..Q3 = IN1..IN4 of the
+// first, Q4..Q7 of the second). OE is tied low; outputs are cleared in setup().
+constexpr uint8_t kShiftRegisterCount = kChannelCount / 2;
+constexpr uint8_t kPinShiftData = 13;   // GPIO13 -> DS
+constexpr uint8_t kPinShiftClock = 15;  // GPIO15 -> SH_CP
+constexpr uint8_t kPinShiftLatch = 2;   // GPIO2 -> ST_CP
 }  // namespace cfg
 
-struct ControllerState {
+// Settings and calibration of one shutter.
+struct ChannelSettings {
   long travelSteps = 12000;
   long currentPosition = 0;
   bool calibrated = false;
   bool reverseDirection = false;
-  bool wifiModemSleep = false;
   bool topOverdriveEnabled = true;
   float maxSpeed = 700.0f;
   float acceleration = 350.0f;
+  float jerk = 2500.0f;
   float topOverdrivePercent = 10.0f;
   uint16_t coilHoldMs = 500;
+  uint8_t holdDutyPercent = 100;     // during coilHoldMs; below 100 the coils are chopped
+  uint8_t idleHoldDutyPercent = 0;   // after coilHoldMs; 0 releases the coils
+  uint16_t groupMask = 0;            // bit g - 1: member of multicast group g
+  // Gear slack and motor steps per shade step each way; see include/StepCompensation.h.
+  uint16_t backlashSteps = 0;
+  float openStepScale = 1.0f;
+  float closeStepScale = 1.0f;
+  bool driftAutoTune = false;        // learn openStepScale at the top stop, trim the overdrive
+};
+
+struct ControllerState {
+  bool wifiModemSleep = false;
+  uint16_t adcSampleIntervalMs = 50;
+  bool wifiFastConnect = true;
+  bool idleLightSleep = false;
+  uint16_t wakeLatencyMs = 300;
+  bool stallDetection = false;
+  uint8_t stallThresholdPercent = 40;
+};
+
+// Broker settings. An empty baseTopic publishes under the node id, shutter_<chip id>.
+struct MqttConfig {
+  bool enabled = false;
+  bool discovery = true;
+  uint16_t port = cfg::kDefaultMqttPort;
+  String host;
+  String user;
+  String password;
+  String baseTopic;
+};
+
+// Rules of the on-device schedule and where the device is; see include/Schedule.h.
+struct ScheduleConfig {
+  bool enabled = true;
+  String timezone = cfg::kDefaultTimezone;  // POSIX TZ, e.g. "MSK-3" or "CET-1CEST,M3.5.0,M10.5.0/3"
+  String ntpServer = cfg::kDefaultNtpServer;
+  shutter::schedule::Site site;
+  shutter::schedule::Rule rules[cfg::kMaxScheduleRules] = {};
+  uint8_t ruleCount = 0;
+};
+
+// A named move: where to go and, optionally, how fast. Stored as is in the settings record, so
+// plain data: value-initialize it (MovePreset preset = {}).
+struct MovePreset {
+  char name[16];          // NUL-terminated, unique
+  uint16_t centiPercent;  // 0 (open) .. 10000 (closed)
+  uint16_t maxSpeed;      // steps/s; 0 keeps the channel's
+  uint16_t acceleration;  // steps/s^2; 0 keeps the channel's
+  uint8_t topOverdrive;   // at 0%: run into the top overdrive like "open" does
+  uint8_t reserved;
+};
+static_assert(sizeof(MovePreset) == 24, "MovePreset is persisted byte for byte");
+
+// IPv4 addressing of the station interface; ip == 0 means none (DHCP).
+struct WifiAddress {
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+// The access point and DHCP lease of the last connection. A power cycle joins it directly by
+// BSSID and channel (no scan) and reuses the lease (no DHCP round trip).
+struct WifiLinkCache {
+  uint8_t bssid[6] = {};
+  uint8_t channel = 0;  // 0: nothing cached
+  WifiAddress lease = {};
+};
+
+// The fixed-layout settings blob of schemas 1..12. Only read, to import it into the record.
+struct PersistedChannelBlob {
+  int32_t travelSteps;
+  int32_t currentPosition;
+  uint8_t calibrated;
+  uint8_t reverseDirection;
+  uint8_t topOverdriveEnabled;
+  uint8_t reserved;
+  float maxSpeed;
+  float acceleration;
+  float jerk;
+  float topOverdrivePercent;
+  uint16_t coilHoldMs;
+  // Schema 7+.
+  uint8_t holdDutyPercent;
+  uint8_t idleHoldDutyPercent;
 };
 
 struct PersistedStateBlob {
@@ -81,27 +331,356 @@ struct PersistedStateBlob {
   char firmwareRepo[64];
   char firmwareAssetName[32];
   char firmwareFsAssetName[32];
+  // Schema 2+ fields; older blobs are accepted and leave these at their defaults.
+  uint16_t adcSampleIntervalMs;
+  // Schema 3+.
+  float jerk;
+  // Schema 4+: channels 1.. ; channel 0 is the top-level fields above.
+  PersistedChannelBlob extraChannels[cfg::kMaxChannels - 1];
+  // Schema 5+.
+  uint8_t wifiFastConnect;
+  uint8_t wifiChannel;
+  uint8_t wifiBssid[6];
+  WifiAddress wifiLease;
+  WifiAddress wifiStaticAddress;
+  // Schema 6+.
+  uint8_t idleLightSleep;
+  uint8_t reserved;
+  uint16_t wakeLatencyMs;
+  // Schema 7+.
+  uint8_t holdDutyPercent;
+  uint8_t idleHoldDutyPercent;
+  // Schema 8+.
+  uint8_t stallDetection;
+  uint8_t stallThresholdPercent;
+  // Schema 9+.
+  uint8_t mqttEnabled;
+  uint8_t mqttDiscovery;
+  uint16_t mqttPort;
+  char mqttHost[64];
+  char mqttUser[32];
+  char mqttPassword[64];
+  char mqttBaseTopic[32];
+  // Schema 10+.
+  uint16_t groupMasks[cfg::kMaxChannels];
+  // Schema 11+.
+  uint8_t scheduleEnabled;
+  uint8_t scheduleRuleCount;
+  uint8_t scheduleLocated;
+  uint8_t scheduleReserved;
+  float latitude;
+  float longitude;
+  char timezone[48];
+  char ntpServer[48];
+  shutter::schedule::Rule scheduleRules[cfg::kMaxScheduleRules];
+  // Schema 12+.
+  uint8_t movePresetCount;
+  uint8_t movePresetReserved[3];
+  MovePreset movePresets[cfg::kMaxMovePresets];
   uint32_t checksum;
 };
+static_assert(sizeof(PersistedStateBlob) <= cfg::kLegacyBlobAreaSize, "the legacy blob layout is frozen");
+
+// Fields of the settings record (include/StateRecord.h). A number is never reused: a record
+// written by an older or newer build may still carry it. Channel fields follow a Channel entry
+// and belong to that channel; repeated tags (rules, presets) keep their order. Values are
+// scalars or structs without padding, so equal settings always encode to equal bytes.
+enum class StateTag : uint8_t {
+  WifiModemSleep = 1,
+  WifiFastConnect = 2,
+  IdleLightSleep = 3,
+  WakeLatencyMs = 4,
+  StallDetection = 5,
+  StallThresholdPercent = 6,
+  AdcSampleIntervalMs = 7,
+  WifiBssid = 8,
+  WifiChannel = 9,
+  WifiLease = 10,
+  WifiStaticAddress = 11,
+  FirmwareRepo = 12,
+  FirmwareAssetName = 13,
+  FirmwareFsAssetName = 14,
+  MqttEnabled = 15,
+  MqttDiscovery = 16,
+  MqttPort = 17,
+  MqttHost = 18,
+  MqttUser = 19,
+  MqttPassword = 20,
+  MqttBaseTopic = 21,
+  ScheduleEnabled = 22,
+  ScheduleLocated = 23,
+  Latitude = 24,
+  Longitude = 25,
+  Timezone = 26,
+  NtpServer = 27,
+  ScheduleRule = 28,
+  MovePreset = 29,
+  Channel = 64,
+  TravelSteps = 65,
+  Position = 66,
+  Calibrated = 67,
+  ReverseDirection = 68,
+  TopOverdriveEnabled = 69,
+  MaxSpeed = 70,
+  Acceleration = 71,
+  Jerk = 72,
+  TopOverdrivePercent = 73,
+  CoilHoldMs = 74,
+  HoldDutyPercent = 75,
+  IdleHoldDutyPercent = 76,
+  GroupMask = 77,
+  BacklashSteps = 78,
+  OpenStepScale = 79,
+  CloseStepScale = 80,
+  DriftAutoTune = 81,
+};
+
+// Largest record encodeStateRecord() can produce; keep it in step with the fields written there.
+constexpr size_t kStateFlagEntry = shutter::storage::kRecordEntryOverhead + sizeof(uint8_t);
+constexpr size_t kStateWordEntry = shutter::storage::kRecordEntryOverhead + sizeof(uint16_t);
+constexpr size_t kStateLongEntry = shutter::storage::kRecordEntryOverhead + sizeof(uint32_t);
+constexpr size_t kStateTextEntries = 8 * shutter::storage::kRecordEntryOverhead + cfg::kMaxFirmwareRepoLength +
+                                     2 * cfg::kMaxAssetNameLength + cfg::kMaxMqttHostLength + cfg::kMaxMqttUserLength +
+                                     cfg::kMaxMqttPasswordLength + cfg::kMaxMqttBaseTopicLength +
+                                     cfg::kMaxTimezoneLength + cfg::kMaxNtpServerLength;
+constexpr size_t kStateChannelEntries = 7 * kStateFlagEntry + 8 * kStateLongEntry + 3 * kStateWordEntry;
+constexpr size_t kMaxStateRecordSize = shutter::storage::recordSize(
+    10 * kStateFlagEntry + 3 * kStateWordEntry + 2 * kStateLongEntry + 3 * shutter::storage::kRecordEntryOverhead +
+    sizeof(WifiLinkCache::bssid) + 2 * sizeof(WifiAddress) + kStateTextEntries +
+    cfg::kMaxScheduleRules * (shutter::storage::kRecordEntryOverhead + sizeof(shutter::schedule::Rule)) +
+    cfg::kMaxMovePresets * (shutter::storage::kRecordEntryOverhead + sizeof(MovePreset)) +
+    cfg::kMaxChannels * kStateChannelEntries);
+static_assert(kMaxStateRecordSize <= cfg::kSettingsAreaSize, "the settings record outgrew its area");
 
 ESP8266WebServer server(80);
 WiFiManager wifiManager;
-AccelStepper stepper(AccelStepper::HALF4WIRE, cfg::kPinIn1, cfg::kPinIn3, cfg::kPinIn2, cfg::kPinIn4);
+
+// One shutter: its settings, its step generator and the motion bookkeeping loop() keeps.
+struct ShutterChannel {
+  uint8_t id = 0;
+  ChannelSettings settings;
+  shutter::motion::StepGenerator stepper;
+  shutter::motion::RampTable rampTables[2];
+  uint8_t activeRampTable = 0;
+  shutter::math::TravelScale travelScale;  // fixed-point percent of settings.travelSteps
+  long targetPosition = 0;  // where the last queued move ends
+  // The ramp the move under way was planned on: the settings, or a preset's.
+  float moveMaxSpeed = 0.0f;
+  float moveAcceleration = 0.0f;
+  // Moves waiting for the channel to come to rest: a reversal's new target while it brakes,
+  // or moves appended with "queue": true.
+  shutter::motion::MotionQueue<cfg::kMotionQueueDepth> motionQueue;
+  // Coil drive: 100 full on (moving or a full hold), 1..99 chopped, 0 released.
+  uint8_t coilDuty = 100;
+  uint64_t coilOnUs = 0;  // energized time weighted by duty, since boot
+  bool motionActive = false;
+  bool resetTopReferenceWhenStopped = false;
+  shutter::math::StepCompensation compensation;
+  shutter::math::DriftTuner driftTuner;
+  // The raw count that reads as logical 0. Re-anchoring the position moves this, never the
+  // counter, so the coil phase the next move starts from matches the rotor.
+  long rawOrigin = 0;
+  // The move under way, from where it left rest; its position is modelled from there.
+  long moveStartRaw = 0;
+  long moveStartLogical = 0;
+  int8_t moveDirection = 0;  // 1 closing, -1 opening, 0 at rest
+  // A planned move that ends on plannedRaw reads as plannedLogical, free of rounding.
+  long plannedRaw = 0;
+  long plannedLogical = 0;
+  bool planned = false;
+  // Modelled opening travel since the last top re-zero; topReferenced once one happened.
+  long openedSinceTop = 0;
+  bool topReferenced = false;
+  long lastSavedPosition = -1;
+  uint32_t motionStoppedAtMs = 0;
+};
+
+// Steps are generated from the timer1 ISR so HTTP, OTA and flash work in loop() cannot
+// stretch step intervals. All channels share the timer through the scheduler, which always
+// programs the nearest step deadline. Coil order matches the former AccelStepper HALF4WIRE
+// wiring. The slot after the channels belongs to the hold chopper.
+constexpr uint8_t kCoilPins[4] = {cfg::kPinIn1, cfg::kPinIn3, cfg::kPinIn2, cfg::kPinIn4};
+constexpr uint8_t kHoldChopperSlot = cfg::kChannelCount;
+constexpr uint32_t kHoldChopPeriodTicks = cfg::kHoldChopPeriodUs * shutter::motion::kTimerTicksPerUs;
+ShutterChannel channels[cfg::kChannelCount];
+shutter::motion::StepScheduler<cfg::kChannelCount + 1> stepScheduler;
+uint32_t holdChopPositionTicks = 0;  // where in the chop period the chopper's deadline falls
+shutter::motion::StepTrace<cfg::kStepTraceSamples> stepTrace;  // channel 0
+uint32_t coilSetMasks[8] = {};
+uint32_t coilAllMask = 0;
+// Shift register image: bit 8 * r + q is output Qq of register r, counted from the ESP.
+// Channel c (c >= 1) owns the nibble at bit 4 * (c - 1), IN1 in its lowest bit.
+uint8_t shiftPhaseNibbles[8] = {};
+uint32_t shiftImage = 0;
+bool shiftImageDirty = false;
+#if defined(SHUTTER_STEP_ENGINE_POLLED)
+uint32_t polledStepDueUs = 0;
+uint32_t polledStepLastUs = 0;
+#endif
 
 ControllerState state;
-long targetPosition = 0;
+WifiAddress wifiStaticAddress = {};
+WifiLinkCache wifiLink;
+// How setupWiFi() got online ("fast", "full", "portal") and how long it took.
+const char* wifiConnectPath = "none";
+// Going back to DHCP after a fast join on the cached lease; see serviceWiFiLease().
+enum class LeaseRenewal : uint8_t { Idle, Pending, Renewing };
+LeaseRenewal wifiLeaseRenewal = LeaseRenewal::Idle;
+uint32_t wifiLeaseRenewalDueMs = 0;
+uint32_t wifiConnectMs = 0;
+uint32_t firstResponseMs = 0;
+
+// Radio power mode and the time spent in each, for the current estimate in /api/state. Light
+// sleep is only entered while every channel rests with its coils released: timer1 stops while
+// the CPU sleeps.
+shutter::power::PowerBudget powerBudget;
+shutter::power::RadioMode radioMode = shutter::power::RadioMode::Awake;
+bool lightSleepActive = false;
+uint32_t lastPowerSampleUs = 0;
+uint32_t powerBudgetResetMs = 0;
 bool settingsDirty = false;
-bool outputsReleased = false;
-long lastSavedPosition = -1;
 uint32_t lastSaveMs = 0;
-uint32_t motionStoppedAtMs = 0;
-bool resetTopReferenceWhenStopped = false;
+// Write-behind settings: handlers answer at once and the commit follows in loop().
+bool settingsCommitPending = false;
+uint32_t settingsCommitFirstMs = 0;
+uint32_t settingsCommitDueMs = 0;
+uint32_t settingsCommitsCoalesced = 0;  // changes folded into a commit already pending
+uint32_t settingsCommitFailures = 0;
 String firmwareRepo = cfg::kDefaultFirmwareRepo;
 String firmwareAssetName = cfg::kDefaultFirmwareAssetName;
 String firmwareFsAssetName = cfg::kDefaultFirmwareFsAssetName;
-bool eepromReady = false;
+MqttConfig mqttConfig;
+ScheduleConfig scheduleConfig;
+MovePreset movePresets[cfg::kMaxMovePresets] = {};
+uint8_t movePresetCount = 0;
+
+struct EepromSectorFlash {
+  static uint32_t sectorAddress() {
+    const uint32_t mapped = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&_EEPROM_start));
+    return ((mapped - 0x40200000UL) / SPI_FLASH_SEC_SIZE) * SPI_FLASH_SEC_SIZE;
+  }
+  bool read(uint32_t offset, void* dst, size_t size) {
+    return ESP.flashRead(sectorAddress() + offset, static_cast<uint32_t*>(dst), size);
+  }
+  bool write(uint32_t offset, const void* src, size_t size) {
+    return ESP.flashWrite(sectorAddress() + offset, static_cast<const uint32_t*>(src), size);
+  }
+  bool erase() { return ESP.flashEraseSector(sectorAddress() / SPI_FLASH_SEC_SIZE); }
+};
+
+// The settings area as read or programmed in one piece: word aligned for raw flash access.
+union SettingsArea {
+  uint8_t bytes[cfg::kSettingsAreaSize];
+  uint32_t words[cfg::kSettingsAreaSize / 4];
+  PersistedStateBlob legacy;
+};
+
+EepromSectorFlash eepromSectorFlash;
+shutter::storage::PositionJournal<EepromSectorFlash, cfg::kChannelCount> positionJournal(eepromSectorFlash, cfg::kSettingsAreaSize, cfg::kJournalSlots);
+// Scratch for reading, encoding and hashing the settings record, one at a time: 1.5 KB is
+// too much for the loop stack.
+SettingsArea settingsScratch;
+uint32_t committedSettingsFingerprint = 0;
+uint32_t cachedSettingsFingerprint = 0;
+bool settingsFingerprintStale = true;  // set by markDirty()
+uint32_t stateCommitCount = 0;
+uint16_t lastCommitBytes = 0;  // size of the last settings record programmed
+uint32_t lastSaveDurationUs = 0;
+uint32_t maxSaveDurationUs = 0;
+
+// A0 is sampled from loop() at adcSampleIntervalMs; /api/state only reads the cached window.
+shutter::sensing::SampleWindow<cfg::kAdcWindowSize> adcWindow;
+shutter::sensing::SampleWindow<cfg::kAdcTrendSize> adcTrend;
+uint32_t lastAdcSampleMs = 0;
+uint32_t lastAdcTrendMs = 0;
+
+// Stall detection follows the one channel that is moving: the shunt is common to all motors.
+shutter::sensing::StallDetector stallDetector;
+int8_t stallChannel = -1;  // -1: not following any
+long stallCalmRaw = 0;     // raw position at the last sample below the threshold
+uint32_t lastStallSampleMs = 0;
+uint32_t stallCount = 0;
+const char* lastStallKind = "";  // "top", "bottom" or "obstruction"
+int8_t lastStallChannel = -1;
+long lastStallPosition = 0;
+
+// One-shot calibration of one channel from stall to stall: up to the top stop, then down to
+// the bottom stop, which measures travelSteps.
+enum class AutoCalibrationPhase : uint8_t { Idle, SeekTop, SeekBottom, Done, Failed };
+struct AutoCalibration {
+  AutoCalibrationPhase phase = AutoCalibrationPhase::Idle;
+  int8_t channel = -1;
+  const char* error = "";
+};
+AutoCalibration autoCalibration;
+
+const char* autoCalibrationPhaseName() {
+  switch (autoCalibration.phase) {
+    case AutoCalibrationPhase::SeekTop:
+      return "seek_top";
+    case AutoCalibrationPhase::SeekBottom:
+      return "seek_bottom";
+    case AutoCalibrationPhase::Done:
+      return "done";
+    case AutoCalibrationPhase::Failed:
+      return "failed";
+    default:
+      return "idle";
+  }
+}
+
+// Heap low-water marks, sampled from loop(); maxFreeBlock shrinking while freeHeap holds
+// steady is fragmentation.
+uint32_t minFreeHeap = UINT32_MAX;
+uint32_t minMaxFreeBlock = UINT32_MAX;
+uint32_t lastHeapSampleMs = 0;
+
+// Hot-path timing for /api/metrics, measured with the CPU cycle counter. Step lateness is how
+// long after its deadline the step interrupt (or the polled engine) actually ran.
+enum class MetricSection : uint8_t { Loop, HandleClient, SaveState, FillStateJson, StepTick, Count };
+constexpr uint8_t kMetricSectionCount = static_cast<uint8_t>(MetricSection::Count);
+constexpr const char* kMetricSectionNames[kMetricSectionCount] = {"loop", "handleClient", "saveState", "fillStateJson",
+                                                                  "stepTick"};
+shutter::metrics::LatencyHistogram sectionLatency[kMetricSectionCount];
+shutter::metrics::LatencyHistogram stepLateness;
+uint32_t missedStepDeadlines = 0;
+uint32_t stepTimerArmedCycles = 0;
+uint32_t metricsCyclesPerUs = 80;
+uint32_t metricsResetAtMs = 0;
+
+// /api/events subscribers hold their own WiFiClient reference, so the socket outlives the
+// request. The snapshot is what was last broadcast; patches carry only fields that differ.
+struct EventSubscriber {
+  WiFiClient client;
+  bool active = false;
+  uint32_t connectedAtMs = 0;
+};
+
+struct EventSnapshot {
+  long positionSteps[cfg::kChannelCount] = {};
+  long targetSteps[cfg::kChannelCount] = {};
+  bool moving[cfg::kChannelCount] = {};
+  uint16_t a0Raw = 0;
+  uint32_t settingsFingerprint = 0;
+  bool otaPending = false;
+  bool otaRunning = false;
+  String otaPhase;
+  String otaLastError;
+  uint32_t otaBytes = 0;
+};
+
+EventSubscriber eventSubscribers[cfg::kMaxEventSubscribers];
+EventSnapshot lastEventSnapshot;
+uint32_t lastEventCheckMs = 0;
+uint32_t lastMotionEventMs = 0;
+uint32_t lastA0EventMs = 0;
+uint32_t lastOtaEventMs = 0;
+
+// The OTA job advances one step per loop() pass; only connecting (DNS, TLS, headers) blocks.
+enum class OtaStage : uint8_t { Idle, Connect, Download, RetryWait, Reboot };
 
 struct OtaJobState {
+  OtaStage stage = OtaStage::Idle;
   bool pending = false;
   bool running = false;
   bool rebootScheduled = false;
@@ -114,9 +693,94 @@ struct OtaJobState {
   String lastError;
   uint32_t queuedAtMs = 0;
   uint32_t startedAtMs = 0;
+  bool filesystemStep = false;  // current download is the LittleFS image
+  uint8_t attempt = 0;
+  uint32_t bytesDone = 0;
+  uint32_t totalBytes = 0;
+  uint32_t downloadStartedMs = 0;
+  uint32_t lastByteMs = 0;
+  uint32_t stageDueMs = 0;  // retry or reboot time
 };
 
 OtaJobState otaJob;
+HTTPClient otaHttp;
+std::unique_ptr<WiFiClient> otaClient;
+std::unique_ptr<uint8_t[]> otaChunk;
+
+// Off -> Waiting (backoff) -> AwaitConnack -> Online; any failure goes back to Waiting.
+enum class MqttStage : uint8_t { Off, Waiting, AwaitConnack, Online };
+
+struct MqttLink {
+  MqttStage stage = MqttStage::Off;
+  WiFiClient client;
+  shutter::mqtt::PacketReader<cfg::kMqttInboundCapacity> reader;
+  char nodeId[24] = {};
+  char baseTopic[40] = {};
+  uint32_t dueMs = 0;  // next attempt while Waiting, CONNACK deadline while AwaitConnack
+  IPAddress brokerIp;  // mqttConfig.host, once brokerResolved
+  bool brokerResolved = false;
+  uint32_t backoffMs = cfg::kMqttMinBackoffMs;
+  uint32_t lastSentMs = 0;
+  uint32_t pingSentMs = 0;
+  bool pingOutstanding = false;
+  uint32_t lastCheckMs = 0;
+  uint32_t connects = 0;
+  uint32_t published = 0;
+  uint32_t commands = 0;
+  const char* lastError = "";
+  // What the broker last got per channel; -1 / nullptr force the next publish.
+  int8_t publishedPercent[cfg::kChannelCount];
+  const char* publishedState[cfg::kChannelCount];
+  uint32_t positionPublishedMs[cfg::kChannelCount];
+};
+
+MqttLink mqttLink;
+uint8_t mqttTx[cfg::kMqttPacketCapacity];
+
+// Group commands heard or sent. One waits in |pending| for its shared start; the node that
+// sent a command repeats it from |outgoing| until the copies run out or the start passes.
+struct GroupLink {
+  WiFiUDP udp;
+  bool joined = false;
+  uint16_t nextSequence = 0;
+  shutter::group::RecentSenders<cfg::kGroupSendersRemembered> recent;
+  shutter::group::Command pending;
+  bool pendingArmed = false;
+  uint32_t pendingStartUs = 0;
+  shutter::group::Command outgoing;
+  uint32_t outgoingStartUs = 0;
+  uint8_t copiesLeft = 0;
+  uint32_t nextCopyMs = 0;
+  uint32_t sent = 0;
+  uint32_t heard = 0;
+  uint32_t started = 0;
+};
+
+GroupLink groupLink;
+
+struct ScheduleRun {
+  shutter::schedule::Scheduler scheduler;
+  uint32_t lastCheckMs = 0;
+  int32_t lastUtcMinute = -1;
+  uint32_t fired = 0;
+  int8_t lastRule = -1;
+  time_t lastFiredAt = 0;
+};
+
+ScheduleRun scheduleRun;
+
+const char* mqttStageName() {
+  switch (mqttLink.stage) {
+    case MqttStage::Waiting:
+      return "waiting";
+    case MqttStage::AwaitConnack:
+      return "connecting";
+    case MqttStage::Online:
+      return "connected";
+    default:
+      return "off";
+  }
+}
 
 #if defined(OTA_FW_PAD_BYTES) && (OTA_FW_PAD_BYTES > 0)
 __attribute__((used)) const uint8_t kOtaFirmwarePad[OTA_FW_PAD_BYTES] PROGMEM = {0xA5};
@@ -139,12 +803,7 @@ void normalizeFirmwareConfig() {
 }
 
 uint32_t computeChecksum(const uint8_t* data, size_t length) {
-  uint32_t hash = 2166136261UL;
-  for (size_t i = 0; i < length; ++i) {
-    hash ^= data[i];
-    hash *= 16777619UL;
-  }
-  return hash;
+  return shutter::storage::fnv1a(data, length);
 }
 
 void copyStringField(char* dst, size_t dstSize, const String& src) {
@@ -159,562 +818,3554 @@ String parseStringField(const char* src, size_t srcSize) {
   return String(src).substring(0, len);
 }
 
-void fillPersistedBlob(PersistedStateBlob* blob, long pos) {
-  memset(blob, 0, sizeof(PersistedStateBlob));
-  blob->magic = cfg::kStateMagic;
-  blob->schemaVersion = cfg::kStateSchemaVersion;
-  blob->structSize = sizeof(PersistedStateBlob);
-  blob->travelSteps = static_cast<int32_t>(state.travelSteps);
-  blob->currentPosition = static_cast<int32_t>(pos);
-  blob->calibrated = state.calibrated ? 1 : 0;
-  blob->reverseDirection = state.reverseDirection ? 1 : 0;
-  blob->wifiModemSleep = state.wifiModemSleep ? 1 : 0;
-  blob->topOverdriveEnabled = state.topOverdriveEnabled ? 1 : 0;
-  blob->maxSpeed = state.maxSpeed;
-  blob->acceleration = state.acceleration;
-  blob->topOverdrivePercent = state.topOverdrivePercent;
-  blob->coilHoldMs = state.coilHoldMs;
-  copyStringField(blob->firmwareRepo, sizeof(blob->firmwareRepo), firmwareRepo);
-  copyStringField(blob->firmwareAssetName, sizeof(blob->firmwareAssetName), firmwareAssetName);
-  copyStringField(blob->firmwareFsAssetName, sizeof(blob->firmwareFsAssetName), firmwareFsAssetName);
-  blob->checksum = computeChecksum(reinterpret_cast<const uint8_t*>(blob), sizeof(PersistedStateBlob) - sizeof(uint32_t));
+template <typename T>
+void putStateField(shutter::storage::RecordWriter& record, StateTag tag, const T& value) {
+  record.putValue(static_cast<uint8_t>(tag), value);
+}
+
+void putStateFlag(shutter::storage::RecordWriter& record, StateTag tag, bool value) {
+  putStateField<uint8_t>(record, tag, value ? 1 : 0);
+}
+
+void putStateText(shutter::storage::RecordWriter& record, StateTag tag, const String& value, size_t maxLength) {
+  record.putString(static_cast<uint8_t>(tag), value.c_str(), maxLength);
+}
+
+void putChannelRecord(shutter::storage::RecordWriter& record, uint8_t id, const ChannelSettings& settings, long pos) {
+  putStateField<uint8_t>(record, StateTag::Channel, id);
+  putStateField<int32_t>(record, StateTag::TravelSteps, settings.travelSteps);
+  putStateField<int32_t>(record, StateTag::Position, pos);
+  putStateFlag(record, StateTag::Calibrated, settings.calibrated);
+  putStateFlag(record, StateTag::ReverseDirection, settings.reverseDirection);
+  putStateFlag(record, StateTag::TopOverdriveEnabled, settings.topOverdriveEnabled);
+  putStateField(record, StateTag::MaxSpeed, settings.maxSpeed);
+  putStateField(record, StateTag::Acceleration, settings.acceleration);
+  putStateField(record, StateTag::Jerk, settings.jerk);
+  putStateField(record, StateTag::TopOverdrivePercent, settings.topOverdrivePercent);
+  putStateField(record, StateTag::CoilHoldMs, settings.coilHoldMs);
+  putStateField(record, StateTag::HoldDutyPercent, settings.holdDutyPercent);
+  putStateField(record, StateTag::IdleHoldDutyPercent, settings.idleHoldDutyPercent);
+  putStateField(record, StateTag::GroupMask, settings.groupMask);
+  putStateField(record, StateTag::BacklashSteps, settings.backlashSteps);
+  putStateField(record, StateTag::OpenStepScale, settings.openStepScale);
+  putStateField(record, StateTag::CloseStepScale, settings.closeStepScale);
+  putStateFlag(record, StateTag::DriftAutoTune, settings.driftAutoTune);
+}
+
+// Encodes everything persisted into |buffer|; returns the bytes to program (0 if it did not
+// fit). |positions| holds one logical position per channel; nullptr stores zeros (fingerprints).
+size_t encodeStateRecord(uint8_t* buffer, size_t capacity, const long* positions) {
+  shutter::storage::RecordWriter record(buffer, capacity);
+  record.setAreaSize(cfg::kSettingsAreaSize);
+  putStateFlag(record, StateTag::WifiModemSleep, state.wifiModemSleep);
+  putStateFlag(record, StateTag::WifiFastConnect, state.wifiFastConnect);
+  putStateFlag(record, StateTag::IdleLightSleep, state.idleLightSleep);
+  putStateField(record, StateTag::WakeLatencyMs, state.wakeLatencyMs);
+  putStateFlag(record, StateTag::StallDetection, state.stallDetection);
+  putStateField(record, StateTag::StallThresholdPercent, state.stallThresholdPercent);
+  putStateField(record, StateTag::AdcSampleIntervalMs, state.adcSampleIntervalMs);
+  putStateField(record, StateTag::WifiBssid, wifiLink.bssid);
+  putStateField(record, StateTag::WifiChannel, wifiLink.channel);
+  putStateField(record, StateTag::WifiLease, wifiLink.lease);
+  putStateField(record, StateTag::WifiStaticAddress, wifiStaticAddress);
+  putStateText(record, StateTag::FirmwareRepo, firmwareRepo, cfg::kMaxFirmwareRepoLength);
+  putStateText(record, StateTag::FirmwareAssetName, firmwareAssetName, cfg::kMaxAssetNameLength);
+  putStateText(record, StateTag::FirmwareFsAssetName, firmwareFsAssetName, cfg::kMaxAssetNameLength);
+  putStateFlag(record, StateTag::MqttEnabled, mqttConfig.enabled);
+  putStateFlag(record, StateTag::MqttDiscovery, mqttConfig.discovery);
+  putStateField(record, StateTag::MqttPort, mqttConfig.port);
+  putStateText(record, StateTag::MqttHost, mqttConfig.host, cfg::kMaxMqttHostLength);
+  putStateText(record, StateTag::MqttUser, mqttConfig.user, cfg::kMaxMqttUserLength);
+  putStateText(record, StateTag::MqttPassword, mqttConfig.password, cfg::kMaxMqttPasswordLength);
+  putStateText(record, StateTag::MqttBaseTopic, mqttConfig.baseTopic, cfg::kMaxMqttBaseTopicLength);
+  putStateFlag(record, StateTag::ScheduleEnabled, scheduleConfig.enabled);
+  putStateFlag(record, StateTag::ScheduleLocated, scheduleConfig.site.located);
+  putStateField(record, StateTag::Latitude, scheduleConfig.site.latitude);
+  putStateField(record, StateTag::Longitude, scheduleConfig.site.longitude);
+  putStateText(record, StateTag::Timezone, scheduleConfig.timezone, cfg::kMaxTimezoneLength);
+  putStateText(record, StateTag::NtpServer, scheduleConfig.ntpServer, cfg::kMaxNtpServerLength);
+  for (uint8_t i = 0; i < scheduleConfig.ruleCount; ++i) putStateField(record, StateTag::ScheduleRule, scheduleConfig.rules[i]);
+  for (uint8_t i = 0; i < movePresetCount; ++i) putStateField(record, StateTag::MovePreset, movePresets[i]);
+  for (const ShutterChannel& ch : channels) {
+    putChannelRecord(record, ch.id, ch.settings, positions ? positions[ch.id] : 0);
+  }
+  return record.finish();
+}
+
+uint16_t clampWakeLatency(long ms) {
+  return static_cast<uint16_t>(shutter::math::clampLong(ms, cfg::kMinWakeLatencyMs, cfg::kMaxWakeLatencyMs));
+}
+
+uint8_t clampHoldDuty(long percent) {
+  return static_cast<uint8_t>(shutter::math::clampLong(percent, cfg::kMinHoldDutyPercent, 100));
+}
+
+uint8_t clampIdleHoldDuty(long percent) {
+  return static_cast<uint8_t>(shutter::math::clampLong(percent, 0, cfg::kMaxIdleHoldDutyPercent));
+}
+
+uint16_t clampBacklash(long steps) {
+  return static_cast<uint16_t>(shutter::math::clampLong(steps, 0, shutter::math::kMaxBacklashSteps));
+}
+
+float clampStepScale(float scale) {
+  return shutter::math::clampFloat(scale, shutter::math::kMinStepScale, shutter::math::kMaxStepScale);
+}
+
+uint8_t clampStallThreshold(long percent) {
+  return static_cast<uint8_t>(
+      shutter::math::clampLong(percent, cfg::kMinStallThresholdPercent, cfg::kMaxStallThresholdPercent));
+}
+
+float clampJerk(float jerk) {
+  if (!(jerk > 0.0f)) return 0.0f;
+  return shutter::math::clampFloat(jerk, cfg::kMinJerk, cfg::kMaxJerk);
+}
+
+void applyChannelBlob(const PersistedChannelBlob& blob, uint16_t schemaVersion, ChannelSettings* settings) {
+  // A slot written by a build with fewer channels is all zeros; keep the defaults.
+  if (blob.travelSteps == 0) return;
+  settings->travelSteps = shutter::math::clampLong(blob.travelSteps, cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+  settings->currentPosition = shutter::math::clampLong(blob.currentPosition, 0, settings->travelSteps);
+  settings->calibrated = blob.calibrated != 0;
+  settings->reverseDirection = blob.reverseDirection != 0;
+  settings->topOverdriveEnabled = blob.topOverdriveEnabled != 0;
+  settings->maxSpeed = shutter::math::clampFloat(blob.maxSpeed, cfg::kMinSpeed, cfg::kMaxSpeed);
+  settings->acceleration = shutter::math::clampFloat(blob.acceleration, cfg::kMinAccel, cfg::kMaxAccel);
+  settings->jerk = clampJerk(blob.jerk);
+  settings->topOverdrivePercent =
+      shutter::math::clampFloat(blob.topOverdrivePercent, cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
+  settings->coilHoldMs = static_cast<uint16_t>(shutter::math::clampLong(blob.coilHoldMs, 0, cfg::kMaxCoilHoldMs));
+  if (schemaVersion >= 7) {
+    settings->holdDutyPercent = clampHoldDuty(blob.holdDutyPercent);
+    settings->idleHoldDutyPercent = clampIdleHoldDuty(blob.idleHoldDutyPercent);
+  }
 }
 
 bool applyPersistedBlob(const PersistedStateBlob& blob) {
-  if (blob.magic != cfg::kStateMagic) return false;
-  if (blob.schemaVersion != cfg::kStateSchemaVersion) return false;
-  if (blob.structSize != sizeof(PersistedStateBlob)) return false;
-  const uint32_t expected = computeChecksum(reinterpret_cast<const uint8_t*>(&blob), sizeof(PersistedStateBlob) - sizeof(uint32_t));
-  if (blob.checksum != expected) return false;
-
-  state.travelSteps = shutter::math::clampLong(blob.travelSteps, cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
-  state.currentPosition = shutter::math::clampLong(blob.currentPosition, 0, state.travelSteps);
-  state.calibrated = blob.calibrated != 0;
-  state.reverseDirection = blob.reverseDirection != 0;
+  if (blob.magic != cfg::kLegacyBlobMagic) return false;
+  if (blob.schemaVersion < 1 || blob.schemaVersion > cfg::kLastLegacyBlobSchema) return false;
+  if (blob.structSize < cfg::kLegacyBlobV1Size || blob.structSize > sizeof(PersistedStateBlob)) return false;
+  // The checksum is always the last field of the layout the blob was written with.
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&blob);
+  const size_t checksumOffset = blob.structSize - sizeof(uint32_t);
+  uint32_t storedChecksum = 0;
+  memcpy(&storedChecksum, bytes + checksumOffset, sizeof(storedChecksum));
+  if (storedChecksum != computeChecksum(bytes, checksumOffset)) return false;
+
+  ChannelSettings& first = channels[0].settings;
+  first.travelSteps = shutter::math::clampLong(blob.travelSteps, cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+  first.currentPosition = shutter::math::clampLong(blob.currentPosition, 0, first.travelSteps);
+  first.calibrated = blob.calibrated != 0;
+  first.reverseDirection = blob.reverseDirection != 0;
   state.wifiModemSleep = blob.wifiModemSleep != 0;
-  state.topOverdriveEnabled = blob.topOverdriveEnabled != 0;
-  state.maxSpeed = shutter::math::clampFloat(blob.maxSpeed, cfg::kMinSpeed, cfg::kMaxSpeed);
-  state.acceleration = shutter::math::clampFloat(blob.acceleration, cfg::kMinAccel, cfg::kMaxAccel);
-  state.topOverdrivePercent =
+  first.topOverdriveEnabled = blob.topOverdriveEnabled != 0;
+  first.maxSpeed = shutter::math::clampFloat(blob.maxSpeed, cfg::kMinSpeed, cfg::kMaxSpeed);
+  first.acceleration = shutter::math::clampFloat(blob.acceleration, cfg::kMinAccel, cfg::kMaxAccel);
+  first.topOverdrivePercent =
       shutter::math::clampFloat(blob.topOverdrivePercent, cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
-  state.coilHoldMs = static_cast<uint16_t>(shutter::math::clampLong(blob.coilHoldMs, 0, cfg::kMaxCoilHoldMs));
+  first.coilHoldMs = static_cast<uint16_t>(shutter::math::clampLong(blob.coilHoldMs, 0, cfg::kMaxCoilHoldMs));
   firmwareRepo = parseStringField(blob.firmwareRepo, sizeof(blob.firmwareRepo));
   firmwareAssetName = parseStringField(blob.firmwareAssetName, sizeof(blob.firmwareAssetName));
   firmwareFsAssetName = parseStringField(blob.firmwareFsAssetName, sizeof(blob.firmwareFsAssetName));
   normalizeFirmwareConfig();
+  if (blob.schemaVersion >= 2) {
+    state.adcSampleIntervalMs = static_cast<uint16_t>(
+        shutter::math::clampLong(blob.adcSampleIntervalMs, cfg::kMinAdcSampleIntervalMs, cfg::kMaxAdcSampleIntervalMs));
+  }
+  if (blob.schemaVersion >= 3) {
+    first.jerk = clampJerk(blob.jerk);
+  }
+  if (blob.schemaVersion >= 4) {
+    for (uint8_t i = 1; i < cfg::kChannelCount; ++i) applyChannelBlob(blob.extraChannels[i - 1], blob.schemaVersion, &channels[i].settings);
+  }
+  if (blob.schemaVersion >= 5) {
+    state.wifiFastConnect = blob.wifiFastConnect != 0;
+    wifiLink.channel = blob.wifiChannel;
+    memcpy(wifiLink.bssid, blob.wifiBssid, sizeof(wifiLink.bssid));
+    wifiLink.lease = blob.wifiLease;
+    wifiStaticAddress = blob.wifiStaticAddress;
+  }
+  if (blob.schemaVersion >= 6) {
+    state.idleLightSleep = blob.idleLightSleep != 0;
+    state.wakeLatencyMs = clampWakeLatency(blob.wakeLatencyMs);
+  }
+  if (blob.schemaVersion >= 7) {
+    first.holdDutyPercent = clampHoldDuty(blob.holdDutyPercent);
+    first.idleHoldDutyPercent = clampIdleHoldDuty(blob.idleHoldDutyPercent);
+  }
+  if (blob.schemaVersion >= 8) {
+    state.stallDetection = blob.stallDetection != 0;
+    state.stallThresholdPercent = clampStallThreshold(blob.stallThresholdPercent);
+  }
+  if (blob.schemaVersion >= 9) {
+    mqttConfig.enabled = blob.mqttEnabled != 0;
+    mqttConfig.discovery = blob.mqttDiscovery != 0;
+    mqttConfig.port = blob.mqttPort != 0 ? blob.mqttPort : cfg::kDefaultMqttPort;
+    mqttConfig.host = parseStringField(blob.mqttHost, sizeof(blob.mqttHost));
+    mqttConfig.user = parseStringField(blob.mqttUser, sizeof(blob.mqttUser));
+    mqttConfig.password = parseStringField(blob.mqttPassword, sizeof(blob.mqttPassword));
+    mqttConfig.baseTopic = parseStringField(blob.mqttBaseTopic, sizeof(blob.mqttBaseTopic));
+  }
+  if (blob.schemaVersion >= 10) {
+    for (uint8_t i = 0; i < cfg::kChannelCount; ++i) channels[i].settings.groupMask = blob.groupMasks[i];
+  }
+  if (blob.schemaVersion >= 11) {
+    scheduleConfig.enabled = blob.scheduleEnabled != 0;
+    scheduleConfig.ruleCount = blob.scheduleRuleCount <= cfg::kMaxScheduleRules ? blob.scheduleRuleCount : 0;
+    scheduleConfig.site.located = blob.scheduleLocated != 0;
+    scheduleConfig.site.latitude = shutter::math::clampFloat(blob.latitude, -90.0f, 90.0f);
+    scheduleConfig.site.longitude = shutter::math::clampFloat(blob.longitude, -180.0f, 180.0f);
+    scheduleConfig.timezone = parseStringField(blob.timezone, sizeof(blob.timezone));
+    scheduleConfig.ntpServer = parseStringField(blob.ntpServer, sizeof(blob.ntpServer));
+    if (scheduleConfig.timezone.length() == 0) scheduleConfig.timezone = cfg::kDefaultTimezone;
+    if (scheduleConfig.ntpServer.length() == 0) scheduleConfig.ntpServer = cfg::kDefaultNtpServer;
+    memcpy(scheduleConfig.rules, blob.scheduleRules, sizeof(scheduleConfig.rules));
+  }
+  if (blob.schemaVersion >= 12) {
+    movePresetCount = blob.movePresetCount <= cfg::kMaxMovePresets ? blob.movePresetCount : 0;
+    memcpy(movePresets, blob.movePresets, sizeof(movePresets));
+    for (MovePreset& preset : movePresets) preset.name[sizeof(preset.name) - 1] = '\0';
+  }
   return true;
 }
 
-int directionSign() { return shutter::math::directionSign(state.reverseDirection); }
+bool stateFlag(const shutter::storage::RecordField& field, bool fallback) {
+  uint8_t value = 0;
+  return field.read(&value) ? value != 0 : fallback;
+}
 
-long logicalToRaw(long logicalPos) {
-  return shutter::math::logicalToRaw(logicalPos, state.reverseDirection);
+template <typename T>
+T stateValue(const shutter::storage::RecordField& field, T fallback) {
+  T value;
+  return field.read(&value) ? value : fallback;
 }
 
-long rawToLogical(long rawPos) {
-  return shutter::math::rawToLogical(rawPos, state.reverseDirection);
+String stateText(const shutter::storage::RecordField& field) {
+  char text[shutter::storage::kMaxRecordValue + 1];
+  memcpy(text, field.value, field.length);
+  text[field.length] = '\0';
+  return String(text);
 }
 
-long clampLogicalPosition(long pos) {
-  return shutter::math::clampLong(pos, 0, state.travelSteps);
+// Applies a checked record on top of the defaults. Tags this build does not know are skipped,
+// fields the record lacks keep their defaults.
+void applyStateRecord(const uint8_t* payload, size_t length) {
+  using shutter::math::clampFloat;
+  using shutter::math::clampLong;
+  shutter::storage::RecordReader reader(payload, length);
+  shutter::storage::RecordField field;
+  ChannelSettings* settings = nullptr;  // channel of the fields that follow; nullptr skips them
+  uint8_t ruleCount = 0;
+  uint8_t presetCount = 0;
+  while (reader.next(&field)) {
+    const StateTag tag = static_cast<StateTag>(field.tag);
+    if (tag == StateTag::Channel) {
+      const uint8_t id = stateValue<uint8_t>(field, cfg::kMaxChannels);
+      settings = id < cfg::kChannelCount ? &channels[id].settings : nullptr;
+      continue;
+    }
+    if (field.tag > static_cast<uint8_t>(StateTag::Channel)) {
+      if (settings == nullptr) continue;
+      switch (tag) {
+        case StateTag::TravelSteps:
+          settings->travelSteps =
+              clampLong(stateValue<int32_t>(field, settings->travelSteps), cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+          break;
+        case StateTag::Position:
+          settings->currentPosition = stateValue<int32_t>(field, settings->currentPosition);
+          break;
+        case StateTag::Calibrated:
+          settings->calibrated = stateFlag(field, settings->calibrated);
+          break;
+        case StateTag::ReverseDirection:
+          settings->reverseDirection = stateFlag(field, settings->reverseDirection);
+          break;
+        case StateTag::TopOverdriveEnabled:
+          settings->topOverdriveEnabled = stateFlag(field, settings->topOverdriveEnabled);
+          break;
+        case StateTag::MaxSpeed:
+          settings->maxSpeed = clampFloat(stateValue(field, settings->maxSpeed), cfg::kMinSpeed, cfg::kMaxSpeed);
+          break;
+        case StateTag::Acceleration:
+          settings->acceleration = clampFloat(stateValue(field, settings->acceleration), cfg::kMinAccel, cfg::kMaxAccel);
+          break;
+        case StateTag::Jerk:
+          settings->jerk = clampJerk(stateValue(field, settings->jerk));
+          break;
+        case StateTag::TopOverdrivePercent:
+          settings->topOverdrivePercent = clampFloat(stateValue(field, settings->topOverdrivePercent),
+                                                     cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
+          break;
+        case StateTag::CoilHoldMs:
+          settings->coilHoldMs =
+              static_cast<uint16_t>(clampLong(stateValue(field, settings->coilHoldMs), 0, cfg::kMaxCoilHoldMs));
+          break;
+        case StateTag::HoldDutyPercent:
+          settings->holdDutyPercent = clampHoldDuty(stateValue(field, settings->holdDutyPercent));
+          break;
+        case StateTag::IdleHoldDutyPercent:
+          settings->idleHoldDutyPercent = clampIdleHoldDuty(stateValue(field, settings->idleHoldDutyPercent));
+          break;
+        case StateTag::GroupMask:
+          settings->groupMask = stateValue(field, settings->groupMask);
+          break;
+        case StateTag::BacklashSteps:
+          settings->backlashSteps = clampBacklash(stateValue(field, settings->backlashSteps));
+          break;
+        case StateTag::OpenStepScale:
+          settings->openStepScale = clampStepScale(stateValue(field, settings->openStepScale));
+          break;
+        case StateTag::CloseStepScale:
+          settings->closeStepScale = clampStepScale(stateValue(field, settings->closeStepScale));
+          break;
+        case StateTag::DriftAutoTune:
+          settings->driftAutoTune = stateFlag(field, settings->driftAutoTune);
+          break;
+        default:
+          break;  // written by a newer build
+      }
+      continue;
+    }
+    switch (tag) {
+      case StateTag::WifiModemSleep:
+        state.wifiModemSleep = stateFlag(field, state.wifiModemSleep);
+        break;
+      case StateTag::WifiFastConnect:
+        state.wifiFastConnect = stateFlag(field, state.wifiFastConnect);
+        break;
+      case StateTag::IdleLightSleep:
+        state.idleLightSleep = stateFlag(field, state.idleLightSleep);
+        break;
+      case StateTag::WakeLatencyMs:
+        state.wakeLatencyMs = clampWakeLatency(stateValue(field, state.wakeLatencyMs));
+        break;
+      case StateTag::StallDetection:
+        state.stallDetection = stateFlag(field, state.stallDetection);
+        break;
+      case StateTag::StallThresholdPercent:
+        state.stallThresholdPercent = clampStallThreshold(stateValue(field, state.stallThresholdPercent));
+        break;
+      case StateTag::AdcSampleIntervalMs:
+        state.adcSampleIntervalMs = static_cast<uint16_t>(clampLong(
+            stateValue(field, state.adcSampleIntervalMs), cfg::kMinAdcSampleIntervalMs, cfg::kMaxAdcSampleIntervalMs));
+        break;
+      case StateTag::WifiBssid:
+        field.read(&wifiLink.bssid);
+        break;
+      case StateTag::WifiChannel:
+        wifiLink.channel = stateValue(field, wifiLink.channel);
+        break;
+      case StateTag::WifiLease:
+        field.read(&wifiLink.lease);
+        break;
+      case StateTag::WifiStaticAddress:
+        field.read(&wifiStaticAddress);
+        break;
+      case StateTag::FirmwareRepo:
+        firmwareRepo = stateText(field);
+        break;
+      case StateTag::FirmwareAssetName:
+        firmwareAssetName = stateText(field);
+        break;
+      case StateTag::FirmwareFsAssetName:
+        firmwareFsAssetName = stateText(field);
+        break;
+      case StateTag::MqttEnabled:
+        mqttConfig.enabled = stateFlag(field, mqttConfig.enabled);
+        break;
+      case StateTag::MqttDiscovery:
+        mqttConfig.discovery = stateFlag(field, mqttConfig.discovery);
+        break;
+      case StateTag::MqttPort:
+        mqttConfig.port = stateValue<uint16_t>(field, 0);
+        if (mqttConfig.port == 0) mqttConfig.port = cfg::kDefaultMqttPort;
+        break;
+      case StateTag::MqttHost:
+        mqttConfig.host = stateText(field);
+        break;
+      case StateTag::MqttUser:
+        mqttConfig.user = stateText(field);
+        break;
+      case StateTag::MqttPassword:
+        mqttConfig.password = stateText(field);
+        break;
+      case StateTag::MqttBaseTopic:
+        mqttConfig.baseTopic = stateText(field);
+        break;
+      case StateTag::ScheduleEnabled:
+        scheduleConfig.enabled = stateFlag(field, scheduleConfig.enabled);
+        break;
+      case StateTag::ScheduleLocated:
+        scheduleConfig.site.located = stateFlag(field, scheduleConfig.site.located);
+        break;
+      case StateTag::Latitude:
+        scheduleConfig.site.latitude = clampFloat(stateValue(field, scheduleConfig.site.latitude), -90.0f, 90.0f);
+        break;
+      case StateTag::Longitude:
+        scheduleConfig.site.longitude = clampFloat(stateValue(field, scheduleConfig.site.longitude), -180.0f, 180.0f);
+        break;
+      case StateTag::Timezone:
+        scheduleConfig.timezone = stateText(field);
+        break;
+      case StateTag::NtpServer:
+        scheduleConfig.ntpServer = stateText(field);
+        break;
+      case StateTag::ScheduleRule:
+        if (ruleCount < cfg::kMaxScheduleRules) field.readPrefix(&scheduleConfig.rules[ruleCount++]);
+        break;
+      case StateTag::MovePreset:
+        if (presetCount < cfg::kMaxMovePresets) {
+          MovePreset& preset = movePresets[presetCount++];
+          field.readPrefix(&preset);
+          preset.name[sizeof(preset.name) - 1] = '\0';
+        }
+        break;
+      default:
+        break;  // written by a newer build
+    }
+  }
+  scheduleConfig.ruleCount = ruleCount;
+  movePresetCount = presetCount;
+  normalizeFirmwareConfig();
+  if (scheduleConfig.timezone.length() == 0) scheduleConfig.timezone = cfg::kDefaultTimezone;
+  if (scheduleConfig.ntpServer.length() == 0) scheduleConfig.ntpServer = cfg::kDefaultNtpServer;
+  for (ShutterChannel& ch : channels) {
+    ch.settings.currentPosition = clampLong(ch.settings.currentPosition, 0, ch.settings.travelSteps);
+  }
 }
 
-long currentLogicalPosition() {
-  return clampLogicalPosition(rawToLogical(stepper.currentPosition()));
+int directionSign(const ShutterChannel& ch) { return shutter::math::directionSign(ch.settings.reverseDirection); }
+
+// Positions at rest, through the channel's origin. Deltas map with shutter::math directly.
+long logicalToRaw(const ShutterChannel& ch, long logicalPos) {
+  return ch.rawOrigin + shutter::math::logicalToRaw(logicalPos, ch.settings.reverseDirection);
 }
 
-void applyStepperSettings() {
-  stepper.setMaxSpeed(state.maxSpeed);
-  stepper.setAcceleration(state.acceleration);
+long rawToLogical(const ShutterChannel& ch, long rawPos) {
+  return shutter::math::rawToLogical(rawPos - ch.rawOrigin, ch.settings.reverseDirection);
 }
 
-void applyWiFiPowerMode() {
-  WiFi.setSleepMode(state.wifiModemSleep ? WIFI_MODEM_SLEEP : WIFI_NONE_SLEEP);
+// Where the shade stands with the counter at |rawPos|: while a move is under way, what its
+// motor steps so far moved the shade through the backlash and step scale.
+long logicalAtRaw(const ShutterChannel& ch, long rawPos) {
+  if (ch.moveDirection == 0) return rawToLogical(ch, rawPos);
+  const long turned =
+      ch.moveDirection * shutter::math::rawToLogical(rawPos - ch.moveStartRaw, ch.settings.reverseDirection);
+  return ch.moveStartLogical + ch.moveDirection * ch.compensation.logicalSteps(turned, ch.moveDirection);
 }
 
-void markDirty() { settingsDirty = true; }
+long clampLogicalPosition(const ShutterChannel& ch, long pos) {
+  return shutter::math::clampLong(pos, 0, ch.settings.travelSteps);
+}
 
-bool parseJsonBody(JsonDocument& doc) {
-  if (!server.hasArg("plain")) return false;
-  DeserializationError err = deserializeJson(doc, server.arg("plain"));
-  return !err;
+long currentLogicalPosition(const ShutterChannel& ch) {
+  return clampLogicalPosition(ch, logicalAtRaw(ch, ch.stepper.currentPosition()));
 }
 
-void sendJsonDocument(int code, const JsonDocument& doc) {
-  String payload;
-  serializeJson(doc, payload);
-  server.send(code, "application/json", payload);
+void IRAM_ATTR flushShiftImage() {
+  if (!shiftImageDirty) return;
+  shiftImageDirty = false;
+  // The first bit clocked in travels furthest: start with the last register's Q7.
+  for (int8_t bit = cfg::kShiftRegisterCount * 8 - 1; bit >= 0; --bit) {
+    if (shiftImage & (1UL << bit)) {
+      GPOS = 1UL << cfg::kPinShiftData;
+    } else {
+      GPOC = 1UL << cfg::kPinShiftData;
+    }
+    GPOS = 1UL << cfg::kPinShiftClock;
+    GPOC = 1UL << cfg::kPinShiftClock;
+  }
+  GPOS = 1UL << cfg::kPinShiftLatch;
+  GPOC = 1UL << cfg::kPinShiftLatch;
 }
 
-void sendError(const char* message, int code = 400) {
-  StaticJsonDocument<192> doc;
-  doc["ok"] = false;
-  doc["error"] = message;
-  sendJsonDocument(code, doc);
+void IRAM_ATTR setShiftNibble(uint8_t channelId, uint8_t nibble) {
+  const uint8_t shift = static_cast<uint8_t>(4 * (channelId - 1));
+  shiftImage = (shiftImage & ~(0xFUL << shift)) | (static_cast<uint32_t>(nibble) << shift);
+  shiftImageDirty = true;
 }
 
-void fillStateJson(JsonObject root) {
-  const long pos = currentLogicalPosition();
-  const long tgt = clampLogicalPosition(targetPosition);
-  const bool moving = stepper.distanceToGo() != 0;
-  const uint32_t nowMs = millis();
-  uint32_t adcSum = 0;
-  for (uint8_t i = 0; i < 8; ++i) {
-    adcSum += analogRead(A0);
-    delay(1);
+// Shift register channels only update the image; flushShiftImage() sends it.
+void IRAM_ATTR writeCoilPhase(const ShutterChannel& ch, long rawPosition) {
+  if (ch.id != 0) {
+    setShiftNibble(ch.id, shiftPhaseNibbles[rawPosition & 7]);
+    return;
   }
-  const uint16_t a0Raw = static_cast<uint16_t>(adcSum / 8);
-
-  const float posPercent = shutter::math::stepsToPercent(pos, state.travelSteps);
-  const float tgtPercent = shutter::math::stepsToPercent(tgt, state.travelSteps);
+  const uint32_t setMask = coilSetMasks[rawPosition & 7];
+  GPOC = coilAllMask & ~setMask;
+  GPOS = setMask;
+}
 
-  const long logicalDistanceToGo = rawToLogical(stepper.distanceToGo());
-  const char* motion = "idle";
-  if (moving) {
-    motion = logicalDistanceToGo > 0 ? "closing" : "opening";
+void IRAM_ATTR writeCoilsOff(const ShutterChannel& ch) {
+  if (ch.id != 0) {
+    setShiftNibble(ch.id, 0);
+    return;
   }
+  GPOC = coilAllMask;
+}
 
-  root["ok"] = true;
-  root["version"] = cfg::kFirmwareVersion;
-  root["ip"] = WiFi.isConnected() ? WiFi.localIP().toString() : String("0.0.0.0");
-  root["ssid"] = WiFi.SSID();
-  root["rssi"] = WiFi.RSSI();
-  root["a0Raw"] = a0Raw;
-  root["uptimeSec"] = millis() / 1000;
-  root["motion"] = motion;
-  root["moving"] = moving;
-  root["calibrated"] = state.calibrated;
-  root["positionSteps"] = pos;
-  root["targetSteps"] = tgt;
-  root["travelSteps"] = state.travelSteps;
-  root["positionPercent"] = posPercent;
-  root["targetPercent"] = tgtPercent;
-  root["reverseDirection"] = state.reverseDirection;
-  root["wifiModemSleep"] = state.wifiModemSleep;
-  root["topOverdriveEnabled"] = state.topOverdriveEnabled;
-  root["topOverdrivePercent"] = state.topOverdrivePercent;
-  root["maxSpeed"] = state.maxSpeed;
-  root["acceleration"] = state.acceleration;
-  root["coilHoldMs"] = state.coilHoldMs;
-  root["rawPosition"] = stepper.currentPosition();
-  root["firmwareRepo"] = firmwareRepo;
-  root["firmwareAssetName"] = firmwareAssetName;
-  root["firmwareFsAssetName"] = firmwareFsAssetName;
-  root["otaPending"] = otaJob.pending;
-  root["otaRunning"] = otaJob.running;
-  root["otaSource"] = otaJob.source;
-  root["otaTag"] = otaJob.tag;
-  root["otaPhase"] = otaJob.phase;
-  root["otaLastError"] = otaJob.lastError;
-  root["otaQueuedSec"] = otaJob.queuedAtMs > 0 ? (nowMs - otaJob.queuedAtMs) / 1000 : 0;
-  root["otaRunningSec"] = otaJob.startedAtMs > 0 ? (nowMs - otaJob.startedAtMs) / 1000 : 0;
+void IRAM_ATTR recordSection(MetricSection section, uint32_t startCycles) {
+  sectionLatency[static_cast<uint8_t>(section)].record((ESP.getCycleCount() - startCycles) / metricsCyclesPerUs);
 }
 
-bool loadStateFromLegacyFs() {
-  if (!LittleFS.exists(cfg::kStateFile)) return false;
+void IRAM_ATTR recordStepLateness(uint32_t waitedUs, uint32_t dueUs) {
+  const uint32_t lateUs = waitedUs > dueUs ? waitedUs - dueUs : 0;
+  stepLateness.record(lateUs);
+  if (lateUs > cfg::kStepDeadlineSlackUs) ++missedStepDeadlines;
+}
 
-  File file = LittleFS.open(cfg::kStateFile, "r");
-  if (!file) return false;
+// One step of a channel's generator plus coil output; returns the delay to its next step in
+// timer ticks.
+uint32_t IRAM_ATTR runChannelStep(uint8_t index) {
+  ShutterChannel& ch = channels[index];
+  const long rawBefore = ch.stepper.currentPosition();
+  const uint32_t nextTicks = ch.stepper.step();
+  const long rawAfter = ch.stepper.currentPosition();
+  if (rawAfter != rawBefore) {
+    writeCoilPhase(ch, rawAfter);
+    if (index == 0 && stepTrace.enabled) stepTrace.record(ESP.getCycleCount(), nextTicks);
+  }
+  return nextTicks;
+}
 
-  StaticJsonDocument<1024> doc;
-  const DeserializationError err = deserializeJson(doc, file);
-  file.close();
-  if (err) return false;
+// Chops the coils of every channel holding at a duty below 100: all of them switch on at the
+// start of the period and each switches off at its own duty. Returns the delay to the next
+// edge, or 0 once no channel is chopped.
+uint32_t IRAM_ATTR runHoldChopper() {
+  const uint32_t at = holdChopPositionTicks;
+  uint32_t next = kHoldChopPeriodTicks - at;
+  bool chopping = false;
+  for (const ShutterChannel& ch : channels) {
+    if (ch.coilDuty == 0 || ch.coilDuty >= 100) continue;
+    chopping = true;
+    const uint32_t onTicks = kHoldChopPeriodTicks / 100 * ch.coilDuty;
+    if (at < onTicks) {
+      writeCoilPhase(ch, ch.stepper.currentPosition());
+      if (onTicks - at < next) next = onTicks - at;
+    } else {
+      writeCoilsOff(ch);
+    }
+  }
+  if (!chopping) return 0;
+  holdChopPositionTicks = at + next == kHoldChopPeriodTicks ? 0 : at + next;
+  return next;
+}
 
-  state.travelSteps = shutter::math::clampLong(doc["travelSteps"] | state.travelSteps, cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
-  state.currentPosition = shutter::math::clampLong(doc["currentPosition"] | state.currentPosition, 0, state.travelSteps);
-  state.calibrated = doc["calibrated"] | state.calibrated;
-  state.reverseDirection = doc["reverseDirection"] | state.reverseDirection;
-  state.wifiModemSleep = doc["wifiModemSleep"] | state.wifiModemSleep;
-  state.topOverdriveEnabled = doc["topOverdriveEnabled"] | state.topOverdriveEnabled;
-  state.maxSpeed = shutter::math::clampFloat(doc["maxSpeed"] | state.maxSpeed, cfg::kMinSpeed, cfg::kMaxSpeed);
-  state.acceleration = shutter::math::clampFloat(doc["acceleration"] | state.acceleration, cfg::kMinAccel, cfg::kMaxAccel);
-  state.topOverdrivePercent = shutter::math::clampFloat(
-      doc["topOverdrivePercent"] | state.topOverdrivePercent, cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
-  state.coilHoldMs = static_cast<uint16_t>(shutter::math::clampLong(doc["coilHoldMs"] | state.coilHoldMs, 0, cfg::kMaxCoilHoldMs));
-  firmwareRepo = String(static_cast<const char*>(doc["firmwareRepo"] | firmwareRepo.c_str()));
-  firmwareAssetName = String(static_cast<const char*>(doc["firmwareAssetName"] | firmwareAssetName.c_str()));
-  firmwareFsAssetName = String(static_cast<const char*>(doc["firmwareFsAssetName"] | firmwareFsAssetName.c_str()));
-  normalizeFirmwareConfig();
-  return true;
+// Steps every channel that is due; returns the delay to the next deadline (0: all at rest).
+uint32_t IRAM_ATTR runStepTick() {
+  const uint32_t nextTicks = stepScheduler.run(
+      [](uint8_t index) { return index == kHoldChopperSlot ? runHoldChopper() : runChannelStep(index); });
+  flushShiftImage();
+  return nextTicks;
 }
 
-bool loadStateFromEeprom() {
-  if (!eepromReady) return false;
-  PersistedStateBlob blob;
-  EEPROM.get(0, blob);
-  return applyPersistedBlob(blob);
+void IRAM_ATTR armStepTimer(uint32_t ticks) {
+  stepTimerArmedCycles = ESP.getCycleCount();
+  timer1_write(ticks);
 }
 
-bool saveStateToEeprom(long pos) {
-  if (!eepromReady) return false;
-  PersistedStateBlob blob;
-  fillPersistedBlob(&blob, pos);
-  EEPROM.put(0, blob);
-  return EEPROM.commit();
+void IRAM_ATTR onStepTimer() {
+  const uint32_t entryCycles = ESP.getCycleCount();
+  recordStepLateness((entryCycles - stepTimerArmedCycles) / metricsCyclesPerUs,
+                     stepScheduler.programmedTicks() / shutter::motion::kTimerTicksPerUs);
+  const uint32_t nextTicks = runStepTick();
+  if (nextTicks != 0) armStepTimer(nextTicks);
+  recordSection(MetricSection::StepTick, entryCycles);
 }
 
-bool saveStateToLegacyFs(long pos) {
-  StaticJsonDocument<1024> doc;
-  doc["travelSteps"] = state.travelSteps;
-  doc["currentPosition"] = pos;
-  doc["calibrated"] = state.calibrated;
-  doc["reverseDirection"] = state.reverseDirection;
-  doc["wifiModemSleep"] = state.wifiModemSleep;
-  doc["topOverdriveEnabled"] = state.topOverdriveEnabled;
-  doc["maxSpeed"] = state.maxSpeed;
-  doc["acceleration"] = state.acceleration;
-  doc["topOverdrivePercent"] = state.topOverdrivePercent;
-  doc["coilHoldMs"] = state.coilHoldMs;
-  doc["firmwareRepo"] = firmwareRepo;
-  doc["firmwareAssetName"] = firmwareAssetName;
-  doc["firmwareFsAssetName"] = firmwareFsAssetName;
-
-  File file = LittleFS.open(cfg::kStateFile, "w");
-  if (!file) return false;
-  if (serializeJson(doc, file) == 0) {
-    file.close();
-    return false;
+#if defined(SHUTTER_STEP_ENGINE_POLLED)
+// Reference mode for jitter comparisons: the same scheduler, clocked from loop() via micros().
+void pollStepEngine() {
+  if (!stepScheduler.anyActive()) return;
+  const uint32_t nowUs = micros();
+  if (nowUs - polledStepLastUs < polledStepDueUs) return;
+  const uint32_t startCycles = ESP.getCycleCount();
+  recordStepLateness(nowUs - polledStepLastUs, polledStepDueUs);
+  polledStepLastUs = nowUs;
+  polledStepDueUs = runStepTick() / shutter::motion::kTimerTicksPerUs;
+  recordSection(MetricSection::StepTick, startCycles);
+}
+#endif
+
+// Adds a channel (or the hold chopper) to the step schedule; its first step fires
+// kStepKickTicks from now. Interrupts must be off.
+void startChannelSteps(uint8_t index) {
+#if defined(SHUTTER_STEP_ENGINE_POLLED)
+  const uint32_t elapsedTicks = (micros() - polledStepLastUs) * shutter::motion::kTimerTicksPerUs;
+  const uint32_t programmed = stepScheduler.programmedTicks();
+  const uint32_t remaining = stepScheduler.anyActive() && elapsedTicks < programmed ? programmed - elapsedTicks : 0;
+  const uint32_t ticks = stepScheduler.start(index, cfg::kStepKickTicks, remaining);
+  if (ticks == 0) return;
+  polledStepLastUs = micros();
+  polledStepDueUs = ticks / shutter::motion::kTimerTicksPerUs;
+#else
+  const uint32_t remaining = stepScheduler.anyActive() ? timer1_read() : 0;
+  const uint32_t ticks = stepScheduler.start(index, cfg::kStepKickTicks, remaining);
+  if (ticks != 0) armStepTimer(ticks);
+#endif
+}
+
+// Builds the ramp into the idle half of the channel's tables and swaps it in. moveSteps > 0
+// lets the S-curve lower its peak so short moves keep whole jerk phases; 0 plans the full
+// profile.
+void planRampTable(ShutterChannel& ch, long moveSteps) {
+  const uint8_t next = ch.activeRampTable ^ 1;
+  if (ch.settings.jerk > 0.0f) {
+    shutter::motion::buildSCurveRamp(ch.moveMaxSpeed, ch.moveAcceleration, ch.settings.jerk, moveSteps,
+                                     &ch.rampTables[next]);
+  } else {
+    shutter::motion::buildTrapezoidRamp(ch.moveMaxSpeed, ch.moveAcceleration, &ch.rampTables[next]);
   }
-  file.close();
-  return true;
+  ch.stepper.setRampTable(&ch.rampTables[next]);
+  ch.activeRampTable = next;
 }
 
-bool loadState() {
-  if (loadStateFromEeprom()) return true;
-  if (!loadStateFromLegacyFs()) return false;
-  const long pos = shutter::math::clampLong(state.currentPosition, 0, state.travelSteps);
-  saveStateToEeprom(pos);
-  return true;
+// The ramp later moves plan on: a preset's where it has one (non-zero), the settings elsewhere.
+void selectMoveRamp(ShutterChannel& ch, uint16_t maxSpeed, uint16_t acceleration) {
+  ch.moveMaxSpeed = maxSpeed != 0 ? static_cast<float>(maxSpeed) : ch.settings.maxSpeed;
+  ch.moveAcceleration = acceleration != 0 ? static_cast<float>(acceleration) : ch.settings.acceleration;
 }
 
-bool saveState(bool force = false) {
-  const long pos = currentLogicalPosition();
-  const uint32_t now = millis();
+bool stepperMoving(const ShutterChannel& ch) { return ch.stepper.isRunning() || ch.stepper.distanceToGo() != 0; }
 
-  if (!force) {
-    if (!settingsDirty && pos == lastSavedPosition) return true;
-    if (now - lastSaveMs < cfg::kSaveIntervalMs) return true;
-  }
+// What the API reports as moving: a channel resting only to start its next queued move has
+// not arrived yet.
+bool channelMoving(const ShutterChannel& ch) { return stepperMoving(ch) || !ch.motionQueue.empty(); }
 
-  if (!saveStateToEeprom(pos)) return false;
-  saveStateToLegacyFs(pos);
-  lastSavedPosition = pos;
-  lastSaveMs = now;
-  settingsDirty = false;
-  return true;
+bool anyChannelMoving() {
+  for (const ShutterChannel& ch : channels) {
+    if (stepperMoving(ch)) return true;
+  }
+  return false;
 }
 
-void enableMotorOutputs() {
-  if (!outputsReleased) return;
-  stepper.enableOutputs();
-  outputsReleased = false;
+// Ends the modelled move once the channel rests (or is halted): the gear keeps the slack it
+// left, and the counter reads as where the model put the shade from here on.
+void settleMove(ShutterChannel& ch) {
+  if (ch.moveDirection == 0) return;
+  const long raw = ch.stepper.currentPosition();
+  const long logical = ch.planned && raw == ch.plannedRaw ? ch.plannedLogical : logicalAtRaw(ch, raw);
+  const long turned =
+      ch.moveDirection * shutter::math::rawToLogical(raw - ch.moveStartRaw, ch.settings.reverseDirection);
+  if (ch.moveDirection < 0) ch.openedSinceTop += ch.moveStartLogical - logical;
+  ch.compensation.settle(ch.moveDirection, turned);
+  ch.rawOrigin = raw - shutter::math::logicalToRaw(logical, ch.settings.reverseDirection);
+  ch.moveDirection = 0;
+  ch.planned = false;
 }
 
-void disableMotorOutputs() {
-  if (outputsReleased) return;
-  stepper.disableOutputs();
-  outputsReleased = true;
+void moveStepperTo(ShutterChannel& ch, long rawTarget) {
+  // From rest the ramp is planned for this move; a retarget mid-move keeps the running table.
+  if (!stepperMoving(ch)) {
+    settleMove(ch);
+    const long raw = ch.stepper.currentPosition();
+    const long ahead = shutter::math::rawToLogical(rawTarget - raw, ch.settings.reverseDirection);
+    ch.moveStartRaw = raw;
+    ch.moveStartLogical = rawToLogical(ch, raw);
+    ch.moveDirection = static_cast<int8_t>(ahead > 0 ? 1 : (ahead < 0 ? -1 : 0));
+    planRampTable(ch, labs(rawTarget - raw));
+  }
+  noInterrupts();
+  ch.stepper.moveTo(rawTarget);
+  if (ch.stepper.isRunning()) {
+    ch.motionActive = true;
+    if (!stepScheduler.isActive(ch.id)) startChannelSteps(ch.id);
+  }
+  interrupts();
 }
 
-void setTargetPosition(long logicalTarget) {
-  resetTopReferenceWhenStopped = false;
-  targetPosition = clampLogicalPosition(logicalTarget);
-  enableMotorOutputs();
-  stepper.moveTo(logicalToRaw(targetPosition));
-  markDirty();
+// Lifts the peak of a running S-curve move whose ramp was planned for a shorter move, once
+// the new target leaves room for it; the speed carries over into the new table.
+void replanRunningRamp(ShutterChannel& ch, long rawTarget) {
+  if (ch.settings.jerk <= 0.0f) return;  // the trapezoid ramp does not depend on the move
+  const shutter::motion::RampTable& active = ch.rampTables[ch.activeRampTable];
+  const uint8_t next = ch.activeRampTable ^ 1;
+  shutter::motion::RampTable& table = ch.rampTables[next];
+  // Accelerating on from rampSteps into the ramp and braking again must fit before the target.
+  const long budget = labs(rawTarget - ch.stepper.currentPosition()) + static_cast<long>(ch.stepper.rampSteps());
+  shutter::motion::buildSCurveRamp(ch.moveMaxSpeed, ch.moveAcceleration, ch.settings.jerk, budget, &table);
+  if (table.ticks[table.length - 1] >= active.ticks[active.length - 1]) return;
+  noInterrupts();
+  ch.stepper.rebaseRamp(&table);
+  interrupts();
+  ch.activeRampTable = next;
 }
 
-void setTargetRawWithLogical(long rawTarget, long logicalTarget) {
-  targetPosition = clampLogicalPosition(logicalTarget);
-  enableMotorOutputs();
-  stepper.moveTo(rawTarget);
-  markDirty();
+// Retargets a channel without braking where it can: from rest the move simply starts, and a
+// target the running move can still brake for extends it. Anything behind or closer than
+// the braking distance makes the channel brake to a stop first; then this returns false and
+// the caller starts the move from there.
+bool blendStepperTo(ShutterChannel& ch, long rawTarget) {
+  long stopAt = 0;
+  noInterrupts();
+  const shutter::motion::Retarget retarget = shutter::motion::classifyRetarget(
+      ch.stepper.currentPosition(), ch.stepper.direction(), ch.stepper.rampSteps(), rawTarget, &stopAt);
+  if (retarget == shutter::motion::Retarget::Reverse) ch.stepper.moveTo(stopAt);
+  interrupts();
+  if (retarget == shutter::motion::Retarget::Reverse) return false;
+  if (retarget == shutter::motion::Retarget::Extend) replanRunningRamp(ch, rawTarget);
+  moveStepperTo(ch, rawTarget);
+  return true;
 }
 
-void startOpenMotion() {
-  if (!state.topOverdriveEnabled || state.topOverdrivePercent <= 0.0f) {
-    setTargetPosition(0);
-    return;
-  }
+// Brakes a running move to rest on its own ramp.
+void brakeStepper(ShutterChannel& ch) {
+  noInterrupts();
+  const long stoppingSteps = static_cast<long>(ch.stepper.rampSteps());
+  ch.stepper.moveTo(ch.stepper.currentPosition() + ch.stepper.direction() * stoppingSteps);
+  interrupts();
+}
 
+// Raw steps an open runs past the top to press against the stop; 0 when that is off.
+long topOverdriveSteps(const ShutterChannel& ch) {
+  const ChannelSettings& settings = ch.settings;
+  if (!settings.topOverdriveEnabled || settings.topOverdrivePercent <= 0.0f) return 0;
   const float clampedPercent =
-      shutter::math::clampFloat(state.topOverdrivePercent, cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
-  const long extraSteps = static_cast<long>(lroundf((clampedPercent / 100.0f) * static_cast<float>(state.travelSteps)));
-  if (extraSteps <= 0) {
-    setTargetPosition(0);
-    return;
-  }
-
-  resetTopReferenceWhenStopped = true;
-  const long rawTarget = logicalToRaw(-extraSteps);
-  setTargetRawWithLogical(rawTarget, 0);
+      shutter::math::clampFloat(settings.topOverdrivePercent, cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
+  const long extraSteps = static_cast<long>(lroundf((clampedPercent / 100.0f) * static_cast<float>(settings.travelSteps)));
+  if (extraSteps <= 0) return 0;
+  // With the drift tuned and the stall detector meeting the stop, only what it needs to.
+  if (!settings.driftAutoTune || !state.stallDetection) return extraSteps;
+  float brakingSteps = settings.maxSpeed * settings.maxSpeed / (2.0f * settings.acceleration);
+  if (settings.jerk > 0.0f) brakingSteps += settings.maxSpeed * settings.acceleration / (2.0f * settings.jerk);
+  return ch.driftTuner.overdriveSteps(extraSteps, lroundf(brakingSteps));
 }
 
-void stopMotor() {
-  resetTopReferenceWhenStopped = false;
-  const long rawNow = stepper.currentPosition();
-  stepper.setCurrentPosition(rawNow);
-  stepper.moveTo(rawNow);
-  targetPosition = clampLogicalPosition(rawToLogical(rawNow));
-  motionStoppedAtMs = millis();
-  markDirty();
+// Where |command| takes the shade; an open with the overdrive runs past the top.
+long commandLogicalTarget(const ShutterChannel& ch, const shutter::motion::MotionCommand& command) {
+  const long overdrive = command.open ? topOverdriveSteps(ch) : 0;
+  return overdrive > 0 ? -overdrive : clampLogicalPosition(ch, command.target);
 }
 
-void calibrateSetTop() {
-  resetTopReferenceWhenStopped = false;
-  stepper.setCurrentPosition(logicalToRaw(0));
-  targetPosition = 0;
-  stepper.moveTo(logicalToRaw(targetPosition));
-  state.currentPosition = 0;
-  markDirty();
+// Uncompensated, for estimates.
+long commandRawTarget(const ShutterChannel& ch, const shutter::motion::MotionCommand& command) {
+  return logicalToRaw(ch, commandLogicalTarget(ch, command));
 }
 
-bool calibrateSetBottom() {
-  resetTopReferenceWhenStopped = false;
-  long measured = rawToLogical(stepper.currentPosition());
-  if (measured < 0) measured = -measured;
-  measured = shutter::math::clampLong(measured, cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+// The raw target that brings the shade to |logicalTarget|, taking up the backlash and scaling
+// the motor steps for the direction. Moves are planned from where they left rest, so one
+// extended mid-move is planned from its start; a target behind a running move maps plainly,
+// as it only makes the channel brake, and is planned again once it rests.
+long plannedRawTarget(ShutterChannel& ch, long logicalTarget) {
+  const bool moving = stepperMoving(ch) && ch.moveDirection != 0;
+  if (!moving) settleMove(ch);
+  const long fromRaw = moving ? ch.moveStartRaw : ch.stepper.currentPosition();
+  const long fromLogical = moving ? ch.moveStartLogical : rawToLogical(ch, fromRaw);
+  const long delta = logicalTarget - fromLogical;
+  const int direction = delta > 0 ? 1 : -1;
+  if (delta == 0 || (moving && direction != ch.moveDirection)) return logicalToRaw(ch, logicalTarget);
+  const long rawTarget = fromRaw + directionSign(ch) * direction * ch.compensation.motorSteps(delta);
+  ch.plannedRaw = rawTarget;
+  ch.plannedLogical = logicalTarget;
+  ch.planned = true;
+  return rawTarget;
+}
 
-  if (measured < cfg::kMinTravelSteps) return false;
+// Planned time until the channel rests at the end of its last queued move. Queued moves are
+// timed on the running ramp table as well.
+uint32_t plannedArrivalMs(const ShutterChannel& ch) {
+  const shutter::motion::RampTable& table = ch.rampTables[ch.activeRampTable];
+  noInterrupts();
+  const long position = ch.stepper.currentPosition();
+  const long target = ch.stepper.targetPosition();
+  const uint32_t rampSteps = ch.stepper.rampSteps();
+  interrupts();
+  uint64_t ticks = shutter::motion::ticksToRest(table, rampSteps, static_cast<uint32_t>(labs(target - position)));
+  long from = target;
+  for (uint8_t i = 0; i < ch.motionQueue.size(); ++i) {
+    const long to = commandRawTarget(ch, ch.motionQueue.at(i));
+    ticks += shutter::motion::ticksToRest(table, 0, static_cast<uint32_t>(labs(to - from)));
+    from = to;
+  }
+  return static_cast<uint32_t>(ticks / (shutter::motion::kTimerTicksPerUs * 1000UL));
+}
 
-  state.travelSteps = measured;
-  stepper.setCurrentPosition(logicalToRaw(state.travelSteps));
-  targetPosition = state.travelSteps;
-  stepper.moveTo(logicalToRaw(targetPosition));
-  state.currentPosition = state.travelSteps;
-  state.calibrated = true;
-  markDirty();
-  return true;
+// Halts immediately (no deceleration ramp) and re-anchors the raw step counter.
+void resetStepperPosition(ShutterChannel& ch, long rawPosition) {
+  noInterrupts();
+  ch.stepper.setCurrentPosition(rawPosition);
+  interrupts();
 }
 
-void calibrateJog(long logicalDelta) {
-  if (logicalDelta == 0) return;
-  resetTopReferenceWhenStopped = false;
-  const long rawDelta = logicalDelta * directionSign();
-  const long rawTarget = stepper.currentPosition() + rawDelta;
-  enableMotorOutputs();
-  stepper.moveTo(rawTarget);
-  markDirty();
+// Halts the channel where it is and makes that read as |logicalPos|. The counter keeps its
+// count; only the origin moves.
+void anchorLogicalPosition(ShutterChannel& ch, long logicalPos) {
+  resetStepperPosition(ch, ch.stepper.currentPosition());
+  settleMove(ch);
+  ch.rawOrigin = ch.stepper.currentPosition() - shutter::math::logicalToRaw(logicalPos, ch.settings.reverseDirection);
 }
 
-void handleApiState() {
-  StaticJsonDocument<1024> doc;
-  fillStateJson(doc.to<JsonObject>());
-  sendJsonDocument(200, doc);
+// Recomputes what a channel derives from its settings: the full ramp, the percent scale and
+// the step compensation.
+void applyStepperSettings(ShutterChannel& ch) {
+  selectMoveRamp(ch, 0, 0);
+  planRampTable(ch, 0);
+  ch.travelScale.setTravel(ch.settings.travelSteps);
+  shutter::math::CompensationParams compensation;
+  compensation.backlashSteps = ch.settings.backlashSteps;
+  compensation.openScale = ch.settings.openStepScale;
+  compensation.closeScale = ch.settings.closeStepScale;
+  ch.compensation.configure(compensation);
 }
 
-void handleApiMove() {
-  StaticJsonDocument<384> body;
-  if (!parseJsonBody(body)) {
-    sendError("invalid json");
-    return;
+void setupStepEngine() {
+  for (uint8_t i = 0; i < 4; ++i) {
+    pinMode(kCoilPins[i], OUTPUT);
+    digitalWrite(kCoilPins[i], LOW);
+    coilAllMask |= 1UL << kCoilPins[i];
   }
-
-  const char* action = body["action"] | "";
-
-  if (strcmp(action, "open") == 0) {
-    startOpenMotion();
-  } else if (strcmp(action, "close") == 0) {
-    setTargetPosition(state.travelSteps);
-  } else if (strcmp(action, "stop") == 0) {
-    stopMotor();
-  } else if (strcmp(action, "set") == 0) {
-    const float percent = body["percent"] | -1.0f;
-    if (percent < 0.0f || percent > 100.0f) {
-      sendError("percent must be between 0 and 100");
-      return;
+  // IN1..IN4 of a shift register channel are nibble bits 0..3; mask bit i drives kCoilPins[i].
+  constexpr uint8_t kCoilInput[4] = {0, 2, 1, 3};
+  for (uint8_t phase = 0; phase < 8; ++phase) {
+    uint32_t mask = 0;
+    uint8_t nibble = 0;
+    for (uint8_t i = 0; i < 4; ++i) {
+      if (shutter::motion::kHalfStepMasks[phase] & (1 << i)) {
+        mask |= 1UL << kCoilPins[i];
+        nibble |= static_cast<uint8_t>(1 << kCoilInput[i]);
+      }
     }
-    const long tgt = shutter::math::percentToSteps(percent, state.travelSteps);
-    setTargetPosition(tgt);
-  } else if (strcmp(action, "jog") == 0) {
-    const long delta = body["steps"] | 0;
-    if (delta == 0) {
-      sendError("steps must be non-zero");
-      return;
+    coilSetMasks[phase] = mask;
+    shiftPhaseNibbles[phase] = nibble;
+  }
+  if (cfg::kShiftRegisterCount > 0) {
+    const uint8_t shiftPins[3] = {cfg::kPinShiftData, cfg::kPinShiftClock, cfg::kPinShiftLatch};
+    for (uint8_t pin : shiftPins) {
+      pinMode(pin, OUTPUT);
+      digitalWrite(pin, LOW);
     }
-    setTargetPosition(currentLogicalPosition() + delta);
+    shiftImage = 0;
+    shiftImageDirty = true;
+    flushShiftImage();
+  }
+  for (ShutterChannel& ch : channels) applyStepperSettings(ch);
+#if !defined(SHUTTER_STEP_ENGINE_POLLED)
+  timer1_isr_init();
+  timer1_attachInterrupt(onStepTimer);
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
+#endif
+}
+
+void applyWiFiPowerMode() {
+  using shutter::power::RadioMode;
+  // Sleep stretches every receive window, so a running download keeps the radio awake.
+  if (otaJob.running) {
+    radioMode = RadioMode::Awake;
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
+  } else if (lightSleepActive) {
+    radioMode = RadioMode::LightSleep;
+    WiFi.setSleepMode(WIFI_LIGHT_SLEEP, shutter::power::listenIntervalFor(state.wakeLatencyMs));
+  } else if (state.wifiModemSleep) {
+    radioMode = RadioMode::ModemSleep;
+    WiFi.setSleepMode(WIFI_MODEM_SLEEP);
   } else {
-    sendError("unknown action");
-    return;
+    radioMode = RadioMode::Awake;
+    WiFi.setSleepMode(WIFI_NONE_SLEEP);
   }
+}
 
-  handleApiState();
+void resetPowerBudget() {
+  powerBudget.reset();
+  lastPowerSampleUs = micros();
+  powerBudgetResetMs = millis();
 }
 
-void handleApiCalibrate() {
-  StaticJsonDocument<256> body;
-  if (!parseJsonBody(body)) {
-    sendError("invalid json");
+// Charges the time since the last call to the current radio mode. In light-sleep mode only
+// |idleUs|, the yield at the end of loop(), sleeps; the rest of the pass is awake. Coil time
+// is weighted by each channel's drive duty.
+void samplePowerBudget(uint32_t idleUs) {
+  using shutter::power::RadioMode;
+  const uint32_t nowUs = micros();
+  const uint32_t elapsedUs = nowUs - lastPowerSampleUs;
+  lastPowerSampleUs = nowUs;
+  if (radioMode == RadioMode::LightSleep) {
+    const uint32_t sleptUs = idleUs < elapsedUs ? idleUs : elapsedUs;
+    powerBudget.add(RadioMode::LightSleep, sleptUs);
+    powerBudget.add(RadioMode::Awake, elapsedUs - sleptUs);
+  } else {
+    powerBudget.add(radioMode, elapsedUs);
+  }
+  for (ShutterChannel& ch : channels) {
+    const uint32_t coilUs = static_cast<uint32_t>(static_cast<uint64_t>(elapsedUs) * ch.coilDuty / 100);
+    ch.coilOnUs += coilUs;
+    powerBudget.addCoils(coilUs);
+  }
+}
+
+// Called at the end of loop(): enters light sleep once everything rests and leaves it as soon
+// as anything needs the timer or the radio. Returns how long it yielded.
+uint32_t servicePowerMode() {
+  bool idle = state.idleLightSleep && !otaJob.running;
+  for (const ShutterChannel& ch : channels) {
+    if (stepperMoving(ch) || ch.coilDuty != 0) idle = false;
+  }
+  // A light-sleep delay would overrun a group start that is due shortly.
+  if (groupLink.pendingArmed || groupLink.copiesLeft > 0) idle = false;
+  if (idle != lightSleepActive) {
+    lightSleepActive = idle;
+    applyWiFiPowerMode();
+  }
+  if (!lightSleepActive) return 0;
+  const uint32_t startUs = micros();
+  delay(cfg::kLightSleepIdleDelayMs);
+  return micros() - startUs;
+}
+
+// Something persisted changed. The settings fingerprint is recomputed on its next use.
+void markDirty() {
+  settingsDirty = true;
+  settingsFingerprintStale = true;
+}
+
+void markFirstResponse() {
+  if (firstResponseMs == 0) firstResponseMs = millis();
+}
+
+// Web UI files. The filesystem image stores them gzipped (path + ".gz"); a plain file is
+// served as-is. The ETag hashes the stored bytes once per mount, so it changes exactly when
+// a new LittleFS image is flashed.
+struct StaticAsset {
+  const char* uri;
+  const char* path;
+  const char* contentType;
+  String storedPath;  // empty when neither form exists
+  String etag;
+};
+
+StaticAsset staticAssets[] = {
+    {"/", "/index.html", "text/html", String(), String()},
+    {"/app.js", "/app.js", "application/javascript", String(), String()},
+    {"/styles.css", "/styles.css", "text/css", String(), String()},
+};
+
+void loadStaticAssets() {
+  uint8_t chunk[256];
+  for (StaticAsset& asset : staticAssets) {
+    asset.storedPath = String(asset.path) + ".gz";
+    if (!LittleFS.exists(asset.storedPath)) asset.storedPath = asset.path;
+    File file = LittleFS.open(asset.storedPath, "r");
+    if (!file) {
+      asset.storedPath = String();
+      asset.etag = String();
+      continue;
+    }
+    uint32_t hash = 2166136261UL;
+    int n;
+    while ((n = file.read(chunk, sizeof(chunk))) > 0) hash = shutter::storage::fnv1a(chunk, static_cast<size_t>(n), hash);
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%08lx-%lx\"", static_cast<unsigned long>(hash), static_cast<unsigned long>(file.size()));
+    asset.etag = etag;
+    file.close();
+  }
+}
+
+// Full responses and 304s carry the same validators. The page itself is always revalidated;
+// the files it links are versioned by URL and cached for good.
+void serveStaticAsset(const StaticAsset& asset) {
+  markFirstResponse();
+  if (asset.storedPath.length() == 0) {
+    server.send(404, "text/plain", String(asset.path) + " missing");
+    return;
+  }
+  server.sendHeader("Cache-Control", server.hasArg("v") ? cfg::kVersionedAssetCacheControl : "no-cache");
+  server.sendHeader("ETag", asset.etag);
+  if (server.header("If-None-Match").indexOf(asset.etag) >= 0) {
+    server.send(304);
+    return;
+  }
+  File file = LittleFS.open(asset.storedPath, "r");
+  server.streamFile(file, asset.contentType);  // adds Content-Encoding: gzip for a .gz file
+  file.close();
+}
+
+const char* radioModeName(shutter::power::RadioMode mode) {
+  switch (mode) {
+    case shutter::power::RadioMode::ModemSleep:
+      return "modem_sleep";
+    case shutter::power::RadioMode::LightSleep:
+      return "light_sleep";
+    default:
+      return "awake";
+  }
+}
+
+String addressString(uint32_t ip) { return ip != 0 ? IPAddress(ip).toString() : String(""); }
+
+bool parseJsonBody(JsonDocument& doc) {
+  if (!server.hasArg("plain")) return false;
+  // arg() hands out the server's stored body by reference; parse it where it is.
+  const String& body = server.arg("plain");
+  DeserializationError err = deserializeJson(doc, body.c_str(), body.length());
+  return !err;
+}
+
+using ClientWriter = shutter::net::BufferedWriter<WiFiClient, cfg::kHttpWriteBufferSize>;
+// Shared by every ClientWriter: responses and event frames are written one at a time.
+uint8_t httpWriteBuffer[cfg::kHttpWriteBufferSize];
+// Every request body and reply too big for the loop stack: the full state (/api/state and the
+// event stream), the settings body, the schedule, the presets and the legacy import at boot. Handlers run one at a time from
+// loop(), and a handler copies its request body out before it builds the reply in the same
+// document, so no two users are ever live together.
+StaticJsonDocument<cfg::kApiJsonCapacity> apiDocument;
+
+// Content-Length comes from measureJson(), then the document is serialized straight into the
+// socket, so a response costs no heap allocation regardless of its size.
+void sendJsonDocument(int code, const JsonDocument& doc) {
+  markFirstResponse();
+  server.setContentLength(measureJson(doc));
+  server.send(code, "application/json", "");
+  WiFiClient client = server.client();
+  ClientWriter writer(client, httpWriteBuffer);
+  serializeJson(doc, writer);
+  writer.flush();
+}
+
+// The same for a MessagePack body; the document is built exactly as for JSON.
+void sendMsgPackDocument(int code, const JsonDocument& doc) {
+  markFirstResponse();
+  server.setContentLength(measureMsgPack(doc));
+  server.send(code, "application/msgpack", "");
+  WiFiClient client = server.client();
+  ClientWriter writer(client, httpWriteBuffer);
+  serializeMsgPack(doc, writer);
+  writer.flush();
+}
+
+void sendError(const char* message, int code = 400) {
+  StaticJsonDocument<192> doc;
+  doc["ok"] = false;
+  doc["error"] = message;
+  sendJsonDocument(code, doc);
+}
+
+uint32_t otaBytesPerSec() {
+  if (otaJob.stage != OtaStage::Download) return 0;
+  const uint32_t elapsedMs = millis() - otaJob.downloadStartedMs;
+  if (elapsedMs == 0) return 0;
+  return static_cast<uint32_t>((static_cast<uint64_t>(otaJob.bytesDone) * 1000ULL) / elapsedMs);
+}
+
+const char* motionName(const ShutterChannel& ch, bool moving) {
+  if (!moving) return "idle";
+  // Resting between a reversal's stop and the move back, the stepper has nothing left to go.
+  const long rawToGo = ch.stepper.distanceToGo();
+  const long ahead = rawToGo != 0 ? shutter::math::rawToLogical(rawToGo, ch.settings.reverseDirection)
+                                  : ch.targetPosition - currentLogicalPosition(ch);
+  return ahead > 0 ? "closing" : "opening";
+}
+
+// Motion, calibration and motor settings of one channel. /api/state carries channel 0's at
+// the top level.
+void fillChannelJson(JsonObject root, const ShutterChannel& ch) {
+  const ChannelSettings& settings = ch.settings;
+  const long pos = currentLogicalPosition(ch);
+  const long tgt = clampLogicalPosition(ch, ch.targetPosition);
+  const bool moving = channelMoving(ch);
+
+  root["motion"] = motionName(ch, moving);
+  root["moving"] = moving;
+  root["queueDepth"] = ch.motionQueue.size();
+  root["arrivalMs"] = moving ? plannedArrivalMs(ch) : 0;
+  root["calibrated"] = settings.calibrated;
+  root["positionSteps"] = pos;
+  root["targetSteps"] = tgt;
+  root["travelSteps"] = settings.travelSteps;
+  root["positionPercent"] = ch.travelScale.percent(pos);
+  root["targetPercent"] = ch.travelScale.percent(tgt);
+  root["reverseDirection"] = settings.reverseDirection;
+  root["topOverdriveEnabled"] = settings.topOverdriveEnabled;
+  root["topOverdrivePercent"] = settings.topOverdrivePercent;
+  root["maxSpeed"] = settings.maxSpeed;
+  root["acceleration"] = settings.acceleration;
+  root["jerk"] = settings.jerk;
+  root["coilHoldMs"] = settings.coilHoldMs;
+  root["holdDutyPercent"] = settings.holdDutyPercent;
+  root["idleHoldDutyPercent"] = settings.idleHoldDutyPercent;
+  root["groupMask"] = settings.groupMask;
+  root["backlashSteps"] = settings.backlashSteps;
+  root["openStepScale"] = settings.openStepScale;
+  root["closeStepScale"] = settings.closeStepScale;
+  root["driftAutoTune"] = settings.driftAutoTune;
+  root["driftCycles"] = ch.driftTuner.cycles();
+  root["driftResidualSteps"] = ch.driftTuner.lastResidual();
+  root["topOverdriveSteps"] = topOverdriveSteps(ch);
+  root["coilDutyPercent"] = ch.coilDuty;
+  root["coilOnMs"] = ch.coilOnUs / 1000;
+  root["rawPosition"] = ch.stepper.currentPosition();
+}
+
+void fillChannelSummaryJson(JsonObject root, const ShutterChannel& ch) {
+  const long pos = currentLogicalPosition(ch);
+  root["id"] = ch.id;
+  root["moving"] = channelMoving(ch);
+  root["calibrated"] = ch.settings.calibrated;
+  root["positionSteps"] = pos;
+  root["targetSteps"] = clampLogicalPosition(ch, ch.targetPosition);
+  root["positionPercent"] = ch.travelScale.percent(pos);
+}
+
+void fillStateJson(JsonObject root) {
+  const uint32_t startCycles = ESP.getCycleCount();
+  const uint32_t nowMs = millis();
+
+  root["ok"] = true;
+  root["version"] = cfg::kFirmwareVersion;
+  root["ip"] = WiFi.isConnected() ? WiFi.localIP().toString() : String("0.0.0.0");
+  root["ssid"] = WiFi.SSID();
+  root["rssi"] = WiFi.RSSI();
+  root["a0Raw"] = adcWindow.mean();
+  root["a0Min"] = adcWindow.min();
+  root["a0Max"] = adcWindow.max();
+  root["uptimeSec"] = millis() / 1000;
+  fillChannelJson(root, channels[0]);
+  root["wifiModemSleep"] = state.wifiModemSleep;
+  root["wifiFastConnect"] = state.wifiFastConnect;
+  root["wifiStaticIp"] = addressString(wifiStaticAddress.ip);
+  root["wifiGateway"] = addressString(wifiStaticAddress.gateway);
+  root["wifiSubnet"] = addressString(wifiStaticAddress.subnet);
+  root["wifiDns"] = addressString(wifiStaticAddress.dns);
+  root["wifiChannel"] = WiFi.channel();
+  root["idleLightSleep"] = state.idleLightSleep;
+  root["wakeLatencyMs"] = state.wakeLatencyMs;
+  root["listenInterval"] = shutter::power::listenIntervalFor(state.wakeLatencyMs);
+  root["powerMode"] = radioModeName(radioMode);
+  root["powerWindowSec"] = (nowMs - powerBudgetResetMs) / 1000;
+  root["awakePercent"] = powerBudget.dutyPercent(shutter::power::RadioMode::Awake);
+  root["modemSleepPercent"] = powerBudget.dutyPercent(shutter::power::RadioMode::ModemSleep);
+  root["lightSleepPercent"] = powerBudget.dutyPercent(shutter::power::RadioMode::LightSleep);
+  root["coilPercent"] = powerBudget.coilDutyPercent();
+  root["estimatedCurrentMa"] = powerBudget.averageEspMa(shutter::power::listenIntervalFor(state.wakeLatencyMs));
+  root["estimatedCoilCurrentMa"] = powerBudget.averageCoilMa();
+  root["stallDetection"] = state.stallDetection;
+  root["stallThresholdPercent"] = state.stallThresholdPercent;
+  root["senseCurrentRaw"] = stallDetector.level();
+  root["senseBaselineRaw"] = stallDetector.baseline();
+  root["stallCount"] = stallCount;
+  root["lastStall"] = lastStallKind;
+  root["lastStallChannel"] = lastStallChannel;
+  root["lastStallPositionSteps"] = lastStallPosition;
+  root["autoCalibration"] = autoCalibrationPhaseName();
+  root["autoCalibrationChannel"] = autoCalibration.channel;
+  root["autoCalibrationError"] = autoCalibration.error;
+  root["wifiConnectPath"] = wifiConnectPath;
+  root["wifiConnectMs"] = wifiConnectMs;
+  // The response being built is the first one until sendJsonDocument() records it.
+  root["bootToFirstResponseMs"] = firstResponseMs != 0 ? firstResponseMs : millis();
+  root["adcSampleIntervalMs"] = state.adcSampleIntervalMs;
+  root["channelCount"] = cfg::kChannelCount;
+  JsonArray summaries = root.createNestedArray("channels");
+  for (const ShutterChannel& ch : channels) fillChannelSummaryJson(summaries.createNestedObject(), ch);
+  root["journalFreeSlots"] = positionJournal.freeSlots();
+  root["journalAppends"] = positionJournal.appends();
+  root["stateCommits"] = stateCommitCount;
+  root["stateRecordBytes"] = lastCommitBytes;
+  root["settingsCommitPending"] = settingsCommitPending;
+  const int32_t commitInMs = static_cast<int32_t>(settingsCommitDueMs - millis());
+  root["settingsCommitInMs"] = settingsCommitPending && commitInMs > 0 ? commitInMs : 0;
+  root["settingsCommitsCoalesced"] = settingsCommitsCoalesced;
+  root["settingsCommitFailures"] = settingsCommitFailures;
+  root["lastSaveUs"] = lastSaveDurationUs;
+  root["maxSaveUs"] = maxSaveDurationUs;
+  root["firmwareRepo"] = firmwareRepo;
+  root["firmwareAssetName"] = firmwareAssetName;
+  root["firmwareFsAssetName"] = firmwareFsAssetName;
+  root["mqttEnabled"] = mqttConfig.enabled;
+  root["mqttHost"] = mqttConfig.host.c_str();
+  root["mqttPort"] = mqttConfig.port;
+  root["mqttUser"] = mqttConfig.user.c_str();
+  root["mqttBaseTopic"] = mqttConfig.baseTopic.c_str();
+  root["mqttDiscovery"] = mqttConfig.discovery;
+  root["mqttState"] = mqttStageName();
+  root["mqttConnects"] = mqttLink.connects;
+  root["mqttPublished"] = mqttLink.published;
+  root["mqttCommands"] = mqttLink.commands;
+  root["mqttLastError"] = mqttLink.lastError;
+  root["groupSent"] = groupLink.sent;
+  root["groupHeard"] = groupLink.heard;
+  root["groupStarted"] = groupLink.started;
+  root["clockSynced"] = time(nullptr) >= cfg::kMinValidEpoch;
+  root["scheduleFired"] = scheduleRun.fired;
+  root["otaPending"] = otaJob.pending;
+  root["otaRunning"] = otaJob.running;
+  root["otaSource"] = otaJob.source;
+  root["otaTag"] = otaJob.tag;
+  root["otaPhase"] = otaJob.phase;
+  root["otaLastError"] = otaJob.lastError;
+  root["otaQueuedSec"] = otaJob.queuedAtMs > 0 ? (nowMs - otaJob.queuedAtMs) / 1000 : 0;
+  root["otaRunningSec"] = otaJob.startedAtMs > 0 ? (nowMs - otaJob.startedAtMs) / 1000 : 0;
+  root["otaTarget"] = otaJob.running ? (otaJob.filesystemStep ? "filesystem" : "firmware") : "";
+  root["otaAttempt"] = otaJob.attempt;
+  root["otaBytes"] = otaJob.bytesDone;
+  root["otaTotalBytes"] = otaJob.totalBytes;
+  root["otaBytesPerSec"] = otaBytesPerSec();
+  root["freeHeap"] = ESP.getFreeHeap();
+  root["maxFreeBlock"] = ESP.getMaxFreeBlockSize();
+  root["heapFragmentation"] = ESP.getHeapFragmentation();
+  root["minFreeHeap"] = minFreeHeap;
+  root["minMaxFreeBlock"] = minMaxFreeBlock;
+  recordSection(MetricSection::FillStateJson, startCycles);
+}
+
+void readChannelSettingsJson(JsonObjectConst src, ChannelSettings* settings) {
+  settings->travelSteps =
+      shutter::math::clampLong(src["travelSteps"] | settings->travelSteps, cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+  settings->currentPosition = shutter::math::clampLong(src["currentPosition"] | settings->currentPosition, 0, settings->travelSteps);
+  settings->calibrated = src["calibrated"] | settings->calibrated;
+  settings->reverseDirection = src["reverseDirection"] | settings->reverseDirection;
+  settings->topOverdriveEnabled = src["topOverdriveEnabled"] | settings->topOverdriveEnabled;
+  settings->maxSpeed = shutter::math::clampFloat(src["maxSpeed"] | settings->maxSpeed, cfg::kMinSpeed, cfg::kMaxSpeed);
+  settings->acceleration = shutter::math::clampFloat(src["acceleration"] | settings->acceleration, cfg::kMinAccel, cfg::kMaxAccel);
+  settings->jerk = clampJerk(src["jerk"] | settings->jerk);
+  settings->topOverdrivePercent = shutter::math::clampFloat(
+      src["topOverdrivePercent"] | settings->topOverdrivePercent, cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
+  settings->coilHoldMs =
+      static_cast<uint16_t>(shutter::math::clampLong(src["coilHoldMs"] | settings->coilHoldMs, 0, cfg::kMaxCoilHoldMs));
+  settings->holdDutyPercent = clampHoldDuty(src["holdDutyPercent"] | settings->holdDutyPercent);
+  settings->idleHoldDutyPercent = clampIdleHoldDuty(src["idleHoldDutyPercent"] | settings->idleHoldDutyPercent);
+  settings->groupMask = src["groupMask"] | settings->groupMask;
+}
+
+// Channel 0 is the top level of the mirror, channels 1.. are entries of "channels". The import
+// runs once at boot, before anything serves the state, so it parses into apiDocument.
+constexpr size_t kLegacyStateJsonCapacity = 1408 + 256 * (cfg::kChannelCount - 1);
+static_assert(kLegacyStateJsonCapacity <= cfg::kApiJsonCapacity, "the legacy state mirror outgrew apiDocument");
+
+bool loadStateFromLegacyFs() {
+  if (!LittleFS.exists(cfg::kStateFile)) return false;
+
+  File file = LittleFS.open(cfg::kStateFile, "r");
+  if (!file) return false;
+
+  JsonDocument& doc = apiDocument;
+  const DeserializationError err = deserializeJson(doc, file);
+  file.close();
+  if (err) return false;
+
+  readChannelSettingsJson(doc.as<JsonObjectConst>(), &channels[0].settings);
+  JsonArrayConst extra = doc["channels"].as<JsonArrayConst>();
+  for (uint8_t i = 1; i < cfg::kChannelCount && static_cast<size_t>(i) <= extra.size(); ++i) {
+    readChannelSettingsJson(extra[i - 1].as<JsonObjectConst>(), &channels[i].settings);
+  }
+  state.wifiModemSleep = doc["wifiModemSleep"] | state.wifiModemSleep;
+  state.wifiFastConnect = doc["wifiFastConnect"] | state.wifiFastConnect;
+  state.idleLightSleep = doc["idleLightSleep"] | state.idleLightSleep;
+  state.wakeLatencyMs = clampWakeLatency(doc["wakeLatencyMs"] | state.wakeLatencyMs);
+  state.stallDetection = doc["stallDetection"] | state.stallDetection;
+  state.stallThresholdPercent = clampStallThreshold(doc["stallThresholdPercent"] | state.stallThresholdPercent);
+  state.adcSampleIntervalMs = static_cast<uint16_t>(shutter::math::clampLong(
+      doc["adcSampleIntervalMs"] | state.adcSampleIntervalMs, cfg::kMinAdcSampleIntervalMs, cfg::kMaxAdcSampleIntervalMs));
+  firmwareRepo = String(static_cast<const char*>(doc["firmwareRepo"] | firmwareRepo.c_str()));
+  firmwareAssetName = String(static_cast<const char*>(doc["firmwareAssetName"] | firmwareAssetName.c_str()));
+  firmwareFsAssetName = String(static_cast<const char*>(doc["firmwareFsAssetName"] | firmwareFsAssetName.c_str()));
+  normalizeFirmwareConfig();
+  mqttConfig.enabled = doc["mqttEnabled"] | mqttConfig.enabled;
+  mqttConfig.discovery = doc["mqttDiscovery"] | mqttConfig.discovery;
+  mqttConfig.port = doc["mqttPort"] | mqttConfig.port;
+  mqttConfig.host = String(static_cast<const char*>(doc["mqttHost"] | mqttConfig.host.c_str()));
+  mqttConfig.user = String(static_cast<const char*>(doc["mqttUser"] | mqttConfig.user.c_str()));
+  mqttConfig.password = String(static_cast<const char*>(doc["mqttPassword"] | mqttConfig.password.c_str()));
+  mqttConfig.baseTopic = String(static_cast<const char*>(doc["mqttBaseTopic"] | mqttConfig.baseTopic.c_str()));
+  return true;
+}
+
+// Checksum of everything persisted except the positions, used to skip record commits when
+// only positions changed and to notice settings changes for the event stream. Cached until
+// markDirty(); encodes into settingsScratch, so nothing else may be using it.
+uint32_t settingsFingerprint() {
+  if (!settingsFingerprintStale) return cachedSettingsFingerprint;
+  const size_t size = encodeStateRecord(settingsScratch.bytes, sizeof(settingsScratch.bytes), nullptr);
+  cachedSettingsFingerprint = shutter::storage::fnv1a(settingsScratch.bytes, size);
+  settingsFingerprintStale = false;
+  return cachedSettingsFingerprint;
+}
+
+// Full commit: erases the sector (the position journal with it) and programs the record.
+bool commitState(const long* positions, uint32_t fingerprint) {
+  SettingsArea& area = settingsScratch;
+  const size_t size = encodeStateRecord(area.bytes, sizeof(area.bytes), positions);
+  if (size == 0) return false;
+  if (!eepromSectorFlash.erase() || !eepromSectorFlash.write(0, area.bytes, size)) return false;
+  positionJournal.resetAfterErase();
+  ++stateCommitCount;
+  lastCommitBytes = static_cast<uint16_t>(size);
+  committedSettingsFingerprint = fingerprint;
+  return true;
+}
+
+// Settings of an older build: the fixed-layout blob with the journal behind it, or else the
+// LittleFS JSON mirror. Either is replaced by a record right away; |area| (the scratch) is
+// done with before the record is encoded over it.
+bool importLegacyState(const SettingsArea& area) {
+  if (applyPersistedBlob(area.legacy)) {
+    shutter::storage::PositionJournal<EepromSectorFlash, cfg::kChannelCount> legacyJournal(
+        eepromSectorFlash, cfg::kLegacyBlobAreaSize, cfg::kLegacyJournalSlots);
+    legacyJournal.mount();
+    for (ShutterChannel& ch : channels) {
+      if (legacyJournal.hasPosition(ch.id)) ch.settings.currentPosition = legacyJournal.position(ch.id);
+    }
+  } else if (!loadStateFromLegacyFs()) {
+    return false;
+  }
+  long positions[cfg::kChannelCount];
+  for (ShutterChannel& ch : channels) {
+    ch.settings.currentPosition = shutter::math::clampLong(ch.settings.currentPosition, 0, ch.settings.travelSteps);
+    positions[ch.id] = ch.settings.currentPosition;
+    ch.lastSavedPosition = positions[ch.id];
+  }
+  if (commitState(positions, settingsFingerprint())) LittleFS.remove(cfg::kStateFile);
+  return true;
+}
+
+// Takes the newest journaled position of each channel over the one in the record.
+void applyJournalPositions(shutter::storage::PositionJournal<EepromSectorFlash, cfg::kChannelCount>& journal) {
+  journal.mount();
+  for (ShutterChannel& ch : channels) {
+    ChannelSettings& settings = ch.settings;
+    if (journal.hasPosition(ch.id)) {
+      settings.currentPosition = shutter::math::clampLong(journal.position(ch.id), 0, settings.travelSteps);
+    }
+    ch.lastSavedPosition = settings.currentPosition;
+  }
+}
+
+bool loadState() {
+  SettingsArea& area = settingsScratch;
+  if (!eepromSectorFlash.read(0, area.bytes, sizeof(area.bytes))) return false;
+  size_t length = 0;
+  const uint8_t* payload = shutter::storage::checkRecord(area.bytes, sizeof(area.bytes), &length);
+  if (payload == nullptr) return importLegacyState(area);
+  size_t areaSize = shutter::storage::recordAreaSize(area.bytes);
+  if (areaSize == 0) areaSize = cfg::kUnnamedSettingsAreaSize;
+  applyStateRecord(payload, length);
+  committedSettingsFingerprint = settingsFingerprint();
+  if (areaSize == cfg::kSettingsAreaSize || areaSize >= SPI_FLASH_SEC_SIZE) {
+    applyJournalPositions(positionJournal);
+    return true;
+  }
+
+  // Written by a build with another area size: its journal starts elsewhere. Commit at once,
+  // which erases it and lays the sector out for this build.
+  shutter::storage::PositionJournal<EepromSectorFlash, cfg::kChannelCount> movedJournal(
+      eepromSectorFlash, areaSize, (SPI_FLASH_SEC_SIZE - areaSize) / sizeof(shutter::storage::JournalRecord));
+  applyJournalPositions(movedJournal);
+  long positions[cfg::kChannelCount];
+  for (const ShutterChannel& ch : channels) positions[ch.id] = ch.settings.currentPosition;
+  if (!commitState(positions, committedSettingsFingerprint)) positionJournal.mount();
+  return true;
+}
+
+bool saveState(bool force = false) {
+  long positions[cfg::kChannelCount];
+  bool moved = false;
+  for (const ShutterChannel& ch : channels) {
+    positions[ch.id] = currentLogicalPosition(ch);
+    if (positions[ch.id] != ch.lastSavedPosition) moved = true;
+  }
+  const uint32_t now = millis();
+
+  if (!force) {
+    if (!settingsDirty && !moved) return true;
+    if (now - lastSaveMs < cfg::kSaveIntervalMs) return true;
+    if (settingsCommitPending) return true;  // serviceSettingsCommit() saves it all when due
+  }
+
+  const uint32_t startCycles = ESP.getCycleCount();
+  const uint32_t startUs = micros();
+  // A save hashes afresh rather than trust every change to have gone through markDirty().
+  settingsFingerprintStale = true;
+  const uint32_t fingerprint = settingsFingerprint();
+  bool commit = fingerprint != committedSettingsFingerprint;
+  for (uint8_t i = 0; i < cfg::kChannelCount && !commit; ++i) {
+    // Journal full (or a slot failed to program): fold the positions into the blob.
+    if (positions[i] != channels[i].lastSavedPosition && !positionJournal.append(positions[i], i)) commit = true;
+  }
+  if (commit && !commitState(positions, fingerprint)) return false;
+  lastSaveDurationUs = micros() - startUs;
+  if (lastSaveDurationUs > maxSaveDurationUs) maxSaveDurationUs = lastSaveDurationUs;
+  recordSection(MetricSection::SaveState, startCycles);
+
+  for (ShutterChannel& ch : channels) ch.lastSavedPosition = positions[ch.id];
+  lastSaveMs = now;
+  settingsDirty = false;
+  settingsCommitPending = false;
+  return true;
+}
+
+// Persists a settings change without waiting for flash: a burst of changes (the UI saving a
+// form field by field) ends up in one commit.
+void requestSettingsCommit() {
+  markDirty();
+  const uint32_t now = millis();
+  if (settingsCommitPending) {
+    ++settingsCommitsCoalesced;
+  } else {
+    settingsCommitPending = true;
+    settingsCommitFirstMs = now;
+  }
+  const uint32_t latest = settingsCommitFirstMs + cfg::kMaxSettingsCommitDelayMs;
+  settingsCommitDueMs = static_cast<int32_t>(latest - (now + cfg::kSettingsCommitDelayMs)) < 0
+                            ? latest
+                            : now + cfg::kSettingsCommitDelayMs;
+}
+
+void serviceSettingsCommit() {
+  if (!settingsCommitPending || static_cast<int32_t>(millis() - settingsCommitDueMs) < 0) return;
+  if (saveState(true)) return;
+  ++settingsCommitFailures;
+  settingsCommitDueMs = millis() + cfg::kSettingsCommitDelayMs;
+}
+
+// Before a restart: nothing acknowledged may be lost with the RAM.
+void flushSettingsCommit() {
+  if (settingsCommitPending) saveState(true);
+}
+
+// Drives the coils of a channel at |duty| percent: 100 full on, 1..99 chopped by the hold
+// chopper, 0 released. Moves always start from full on.
+void setCoilDuty(ShutterChannel& ch, uint8_t duty) {
+  if (duty == ch.coilDuty) return;
+  noInterrupts();
+  ch.coilDuty = duty;
+  if (duty == 0) {
+    writeCoilsOff(ch);
+  } else {
+    writeCoilPhase(ch, ch.stepper.currentPosition());
+  }
+  flushShiftImage();
+  if (duty < 100 && duty > 0 && !stepScheduler.isActive(kHoldChopperSlot)) {
+    holdChopPositionTicks = 0;
+    startChannelSteps(kHoldChopperSlot);
+  }
+  interrupts();
+}
+
+void enableMotorOutputs(ShutterChannel& ch) { setCoilDuty(ch, 100); }
+
+void disableMotorOutputs(ShutterChannel& ch) { setCoilDuty(ch, 0); }
+
+// Starts |command| on the channel, blending it into a running move; when the channel has to
+// brake for it first, the command waits at the front of the queue until it rests.
+// A command on another ramp than the running move's brakes first as well: the running table
+// can not be swapped for a slower one mid-move.
+void dispatchMotion(ShutterChannel& ch, const shutter::motion::MotionCommand& command) {
+  const long rawTarget = plannedRawTarget(ch, commandLogicalTarget(ch, command));
+  enableMotorOutputs(ch);
+  const float maxSpeed = command.maxSpeed != 0 ? static_cast<float>(command.maxSpeed) : ch.settings.maxSpeed;
+  const float acceleration =
+      command.acceleration != 0 ? static_cast<float>(command.acceleration) : ch.settings.acceleration;
+  const bool sameRamp = maxSpeed == ch.moveMaxSpeed && acceleration == ch.moveAcceleration;
+  if (!stepperMoving(ch)) selectMoveRamp(ch, command.maxSpeed, command.acceleration);
+  if ((sameRamp || !stepperMoving(ch)) && blendStepperTo(ch, rawTarget)) {
+    ch.resetTopReferenceWhenStopped = command.open && topOverdriveSteps(ch) > 0;
+  } else {
+    if (stepperMoving(ch) && !sameRamp) brakeStepper(ch);
+    ch.resetTopReferenceWhenStopped = false;
+    ch.motionQueue.push(command);
+  }
+  markDirty();
+}
+
+// A move from the API or MQTT. It replaces whatever was queued, so a burst of targets only
+// ever steers one move; with |append| it waits until the moves already planned are done.
+// False when the queue is full.
+bool commandMotion(ShutterChannel& ch, const shutter::motion::MotionCommand& command, bool append) {
+  if (append && channelMoving(ch)) {
+    if (!ch.motionQueue.push(command)) return false;
+  } else {
+    ch.motionQueue.clear();
+    dispatchMotion(ch, command);
+  }
+  ch.targetPosition = clampLogicalPosition(ch, command.target);
+  markDirty();
+  return true;
+}
+
+void stopMotor(ShutterChannel& ch) {
+  ch.resetTopReferenceWhenStopped = false;
+  ch.motionQueue.clear();
+  resetStepperPosition(ch, ch.stepper.currentPosition());
+  settleMove(ch);
+  ch.targetPosition = currentLogicalPosition(ch);
+  ch.motionStoppedAtMs = millis();
+  markDirty();
+}
+
+// The top is where the drift cycles of the step compensation start and end.
+void markTopReference(ShutterChannel& ch) {
+  ch.openedSinceTop = 0;
+  ch.topReferenced = true;
+}
+
+void calibrateSetTop(ShutterChannel& ch) {
+  ch.resetTopReferenceWhenStopped = false;
+  ch.motionQueue.clear();
+  anchorLogicalPosition(ch, 0);
+  markTopReference(ch);
+  ch.targetPosition = 0;
+  ch.settings.currentPosition = 0;
+  markDirty();
+}
+
+bool calibrateSetBottom(ShutterChannel& ch) {
+  ChannelSettings& settings = ch.settings;
+  ch.resetTopReferenceWhenStopped = false;
+  ch.motionQueue.clear();
+  long measured = logicalAtRaw(ch, ch.stepper.currentPosition());
+  if (measured < 0) measured = -measured;
+  measured = shutter::math::clampLong(measured, cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+
+  if (measured < cfg::kMinTravelSteps) return false;
+
+  settings.travelSteps = measured;
+  ch.travelScale.setTravel(measured);
+  anchorLogicalPosition(ch, settings.travelSteps);
+  ch.targetPosition = settings.travelSteps;
+  settings.currentPosition = settings.travelSteps;
+  settings.calibrated = true;
+  markDirty();
+  return true;
+}
+
+void calibrateJog(ShutterChannel& ch, long logicalDelta) {
+  if (logicalDelta == 0) return;
+  ch.resetTopReferenceWhenStopped = false;
+  ch.motionQueue.clear();
+  const long rawDelta = logicalDelta * directionSign(ch);
+  // Jogs are counted in motor steps; one against a running move halts it first.
+  if (stepperMoving(ch) && (rawDelta > 0 ? 1 : -1) != ch.stepper.direction()) stopMotor(ch);
+  ch.planned = false;
+  const long rawTarget = ch.stepper.currentPosition() + rawDelta;
+  enableMotorOutputs(ch);
+  if (!stepperMoving(ch)) selectMoveRamp(ch, 0, 0);
+  moveStepperTo(ch, rawTarget);
+  markDirty();
+}
+
+bool autoCalibrating(const ShutterChannel& ch) {
+  return autoCalibration.channel == ch.id && (autoCalibration.phase == AutoCalibrationPhase::SeekTop ||
+                                               autoCalibration.phase == AutoCalibrationPhase::SeekBottom);
+}
+
+void failAutoCalibration(ShutterChannel& ch, const char* error) {
+  autoCalibration.phase = AutoCalibrationPhase::Failed;
+  autoCalibration.error = error;
+  if (stepperMoving(ch)) stopMotor(ch);
+}
+
+// Travels are not known yet, so both searches are no-limits jogs over the longest travel.
+void startAutoCalibration(ShutterChannel& ch) {
+  autoCalibration.channel = static_cast<int8_t>(ch.id);
+  autoCalibration.phase = AutoCalibrationPhase::SeekTop;
+  autoCalibration.error = "";
+  calibrateJog(ch, -cfg::kMaxTravelSteps);
+}
+
+// A stall of the calibrating channel; |wallRaw| is where its rotor stopped.
+void advanceAutoCalibration(ShutterChannel& ch, long wallRaw) {
+  if (autoCalibration.phase == AutoCalibrationPhase::SeekTop) {
+    calibrateSetTop(ch);
+    autoCalibration.phase = AutoCalibrationPhase::SeekBottom;
+    calibrateJog(ch, cfg::kMaxTravelSteps);
+    return;
+  }
+  const long measured = rawToLogical(ch, wallRaw);
+  if (measured < cfg::kMinTravelSteps || measured > cfg::kMaxTravelSteps) {
+    failAutoCalibration(ch, "travel out of range");
+    return;
+  }
+  ChannelSettings& settings = ch.settings;
+  settings.travelSteps = measured;
+  anchorLogicalPosition(ch, measured);
+  ch.targetPosition = measured;
+  settings.currentPosition = measured;
+  settings.calibrated = true;
+  applyStepperSettings(ch);
+  autoCalibration.phase = AutoCalibrationPhase::Done;
+  requestSettingsCommit();
+}
+
+// A top stall with the drift tuned closes a cycle of it: |wallLogical| is where the model put
+// the shade when it met the stop.
+void learnFromTopStall(ShutterChannel& ch, long wallLogical) {
+  if (!ch.settings.driftAutoTune || !ch.topReferenced) return;
+  shutter::math::CompensationParams params = ch.compensation.params();
+  if (!ch.driftTuner.learn(wallLogical, ch.openedSinceTop, ch.settings.travelSteps, &params)) return;
+  ch.settings.openStepScale = params.openScale;
+  ch.compensation.configure(params);
+  requestSettingsCommit();
+}
+
+// Stops a stalled channel. A stall near either end is that end stop and re-anchors the
+// position there, which undoes any step loss; anywhere else it is an obstruction.
+void handleStall(ShutterChannel& ch) {
+  const bool opening = shutter::math::rawToLogical(ch.stepper.distanceToGo(), ch.settings.reverseDirection) < 0;
+  // The rotor stopped at the wall; the counter ran on while the current rose. Setting it back
+  // keeps the coil phase in step with the rotor.
+  const long wallRaw = stallCalmRaw;
+  const long wallLogical = logicalAtRaw(ch, wallRaw);
+  resetStepperPosition(ch, wallRaw);
+  stopMotor(ch);
+  ch.compensation.load(opening ? -1 : 1);  // pressed against the wall, no slack left
+  stallDetector.reset();
+  stallChannel = -1;
+  ++stallCount;
+  lastStallChannel = static_cast<int8_t>(ch.id);
+  lastStallPosition = wallLogical;
+
+  if (autoCalibrating(ch)) {
+    lastStallKind = autoCalibration.phase == AutoCalibrationPhase::SeekTop ? "top" : "bottom";
+    advanceAutoCalibration(ch, wallRaw);
+    return;
+  }
+
+  const long travel = ch.settings.travelSteps;
+  const long zone = lroundf(cfg::kStallEndZonePercent / 100.0f * static_cast<float>(travel));
+  if (opening && wallLogical <= zone) {
+    lastStallKind = "top";
+    learnFromTopStall(ch, wallLogical);
+    calibrateSetTop(ch);
+  } else if (!opening && ch.settings.calibrated && wallLogical >= travel - zone) {
+    lastStallKind = "bottom";
+    anchorLogicalPosition(ch, travel);
+    ch.targetPosition = travel;
+    ch.settings.currentPosition = travel;
+  } else {
+    lastStallKind = "obstruction";
+    ch.targetPosition = clampLogicalPosition(ch, wallLogical);
+  }
+  markDirty();
+}
+
+// The channel stall detection can follow: the only one moving.
+ShutterChannel* stallCandidate() {
+  ShutterChannel* moving = nullptr;
+  for (ShutterChannel& ch : channels) {
+    if (!stepperMoving(ch)) continue;
+    if (moving) return nullptr;  // the shunt cannot tell two motors apart
+    moving = &ch;
+  }
+  return moving;
+}
+
+void serviceStallDetection() {
+  if (!state.stallDetection) return;
+  ShutterChannel* ch = stallCandidate();
+  if (!ch || ch->id != stallChannel) {
+    shutter::sensing::StallConfig config;
+    config.thresholdPercent = state.stallThresholdPercent;
+    stallDetector.configure(config);
+    stallDetector.reset();
+    stallChannel = ch ? static_cast<int8_t>(ch->id) : -1;
+    if (!ch) return;
+    stallCalmRaw = ch->stepper.currentPosition();
+  }
+  // Slowing down into the target draws more current as well; only the rest of a move is watched.
+  if (labs(ch->stepper.distanceToGo()) <= static_cast<long>(ch->stepper.rampSteps())) return;
+  const uint32_t nowMs = millis();
+  if (nowMs - lastStallSampleMs < cfg::kStallSampleIntervalMs) return;
+  lastStallSampleMs = nowMs;
+  const bool stalled = stallDetector.push(static_cast<uint16_t>(analogRead(A0)));
+  if (stalled) {
+    handleStall(*ch);
+  } else if (!stallDetector.climbing()) {
+    stallCalmRaw = ch->stepper.currentPosition();
+  }
+}
+
+// Ends an auto-calibration whose search cannot finish: the move ended without a stall, the
+// detection was switched off or sees no current, or another motor shares the shunt.
+void serviceAutoCalibration() {
+  if (autoCalibration.phase != AutoCalibrationPhase::SeekTop && autoCalibration.phase != AutoCalibrationPhase::SeekBottom) {
+    return;
+  }
+  ShutterChannel& ch = channels[autoCalibration.channel];
+  if (!state.stallDetection) {
+    failAutoCalibration(ch, "stall detection is off");
+  } else if (!stepperMoving(ch)) {
+    failAutoCalibration(ch, "no end stop found");
+  } else if (stallCandidate() != &ch) {
+    failAutoCalibration(ch, "another channel moved");
+  } else if (stallChannel == ch.id && !stallDetector.learning() && stallDetector.baseline() < cfg::kMinSenseCurrentRaw) {
+    failAutoCalibration(ch, "no motor current on A0");
+  }
+}
+
+void serviceAdcSampler() {
+  const uint32_t nowMs = millis();
+  if (adcWindow.size() > 0 && nowMs - lastAdcSampleMs < state.adcSampleIntervalMs) return;
+  lastAdcSampleMs = nowMs;
+  adcWindow.push(static_cast<uint16_t>(analogRead(A0)));
+
+  if (adcTrend.size() == 0 || nowMs - lastAdcTrendMs >= cfg::kAdcTrendIntervalMs) {
+    lastAdcTrendMs = nowMs;
+    adcTrend.push(adcWindow.mean());
+  }
+}
+
+void serviceHeapStats() {
+  const uint32_t nowMs = millis();
+  if (minFreeHeap != UINT32_MAX && nowMs - lastHeapSampleMs < cfg::kHeapSampleIntervalMs) return;
+  lastHeapSampleMs = nowMs;
+  const uint32_t freeHeap = ESP.getFreeHeap();
+  const uint32_t maxBlock = ESP.getMaxFreeBlockSize();
+  if (freeHeap < minFreeHeap) minFreeHeap = freeHeap;
+  if (maxBlock < minMaxFreeBlock) minMaxFreeBlock = maxBlock;
+}
+
+void handleApiAdc() {
+  StaticJsonDocument<1536> doc;
+  doc["ok"] = true;
+  doc["intervalMs"] = state.adcSampleIntervalMs;
+  doc["samples"] = adcWindow.size();
+  doc["latest"] = adcWindow.latest();
+  doc["mean"] = adcWindow.mean();
+  doc["min"] = adcWindow.min();
+  doc["max"] = adcWindow.max();
+  doc["trendIntervalSec"] = cfg::kAdcTrendIntervalMs / 1000;
+  JsonArray trend = doc.createNestedArray("trend");
+  for (uint16_t i = 0; i < adcTrend.size(); ++i) {
+    trend.add(adcTrend.at(i));
+  }
+  sendJsonDocument(200, doc);
+}
+
+void handleApiState() {
+  fillStateJson(apiDocument.to<JsonObject>());
+  sendJsonDocument(200, apiDocument);
+}
+
+// /api/state/lite returns only what changes while a shutter moves, one object per channel.
+// ?fields= picks a subset, ?format=msgpack answers in MessagePack, and the ETag covers just the
+// selected values, so a poller whose fields have not changed gets a 304 with no body built.
+enum LiteField : uint16_t {
+  kLitePositionSteps = 1 << 0,
+  kLiteTargetSteps = 1 << 1,
+  kLitePositionPercent = 1 << 2,
+  kLiteTargetPercent = 1 << 3,
+  kLiteMoving = 1 << 4,
+  kLiteMotion = 1 << 5,
+  kLiteQueueDepth = 1 << 6,
+  kLiteArrivalMs = 1 << 7,
+};
+constexpr uint16_t kLiteAllFields = 0xff;
+
+struct LiteFieldName {
+  const char* name;
+  uint16_t bit;
+};
+
+const LiteFieldName liteFieldNames[] = {
+    {"positionSteps", kLitePositionSteps},     {"targetSteps", kLiteTargetSteps},
+    {"positionPercent", kLitePositionPercent}, {"targetPercent", kLiteTargetPercent},
+    {"moving", kLiteMoving},                   {"motion", kLiteMotion},
+    {"queueDepth", kLiteQueueDepth},           {"arrivalMs", kLiteArrivalMs},
+};
+
+// One channel's values, read once so the ETag and the body describe the same instant.
+struct LiteSnapshot {
+  long pos;
+  long tgt;
+  long travel;
+  uint32_t arrivalMs;
+  const char* motion;
+  uint8_t queueDepth;
+  bool moving;
+};
+
+// A comma-separated list of liteFieldNames; empty means all of them.
+bool parseLiteFields(const String& list, uint16_t* fields) {
+  if (list.length() == 0) {
+    *fields = kLiteAllFields;
+    return true;
+  }
+  *fields = 0;
+  const char* item = list.c_str();
+  while (*item != '\0') {
+    const char* comma = strchr(item, ',');
+    const size_t length = comma != nullptr ? static_cast<size_t>(comma - item) : strlen(item);
+    if (length > 0) {
+      uint16_t bit = 0;
+      for (const LiteFieldName& field : liteFieldNames) {
+        if (strlen(field.name) == length && strncmp(field.name, item, length) == 0) bit = field.bit;
+      }
+      if (bit == 0) return false;
+      *fields |= bit;
+    }
+    item += comma != nullptr ? length + 1 : length;
+  }
+  return *fields != 0;
+}
+
+LiteSnapshot takeLiteSnapshot(const ShutterChannel& ch, uint16_t fields) {
+  LiteSnapshot snap;
+  snap.pos = currentLogicalPosition(ch);
+  snap.tgt = clampLogicalPosition(ch, ch.targetPosition);
+  snap.travel = ch.travelScale.travel();
+  snap.moving = channelMoving(ch);
+  snap.motion = motionName(ch, snap.moving);
+  snap.queueDepth = ch.motionQueue.size();
+  snap.arrivalMs = snap.moving && (fields & kLiteArrivalMs) != 0 ? plannedArrivalMs(ch) : 0;
+  return snap;
+}
+
+template <typename T>
+uint32_t hashLiteValue(const T& value, uint32_t hash) {
+  return shutter::storage::fnv1a(reinterpret_cast<const uint8_t*>(&value), sizeof(value), hash);
+}
+
+uint32_t liteStateHash(const LiteSnapshot* snaps, uint16_t fields, bool msgpack) {
+  uint32_t hash = hashLiteValue(fields, 2166136261UL);
+  hash = hashLiteValue(msgpack, hash);
+  for (uint8_t i = 0; i < cfg::kChannelCount; ++i) {
+    const LiteSnapshot& snap = snaps[i];
+    if ((fields & (kLitePositionSteps | kLitePositionPercent)) != 0) hash = hashLiteValue(snap.pos, hash);
+    if ((fields & (kLiteTargetSteps | kLiteTargetPercent)) != 0) hash = hashLiteValue(snap.tgt, hash);
+    if ((fields & (kLitePositionPercent | kLiteTargetPercent)) != 0) hash = hashLiteValue(snap.travel, hash);
+    if ((fields & kLiteMoving) != 0) hash = hashLiteValue(snap.moving, hash);
+    if ((fields & kLiteMotion) != 0) hash = shutter::storage::fnv1a(reinterpret_cast<const uint8_t*>(snap.motion), strlen(snap.motion), hash);
+    if ((fields & kLiteQueueDepth) != 0) hash = hashLiteValue(snap.queueDepth, hash);
+    if ((fields & kLiteArrivalMs) != 0) hash = hashLiteValue(snap.arrivalMs, hash);
+  }
+  return hash;
+}
+
+void fillLiteJson(JsonObject root, const ShutterChannel& ch, const LiteSnapshot& snap, uint16_t fields) {
+  if ((fields & kLitePositionSteps) != 0) root["positionSteps"] = snap.pos;
+  if ((fields & kLiteTargetSteps) != 0) root["targetSteps"] = snap.tgt;
+  if ((fields & kLitePositionPercent) != 0) root["positionPercent"] = ch.travelScale.percent(snap.pos);
+  if ((fields & kLiteTargetPercent) != 0) root["targetPercent"] = ch.travelScale.percent(snap.tgt);
+  if ((fields & kLiteMoving) != 0) root["moving"] = snap.moving;
+  if ((fields & kLiteMotion) != 0) root["motion"] = snap.motion;
+  if ((fields & kLiteQueueDepth) != 0) root["queueDepth"] = snap.queueDepth;
+  if ((fields & kLiteArrivalMs) != 0) root["arrivalMs"] = snap.arrivalMs;
+}
+
+void handleApiStateLite() {
+  uint16_t fields = 0;
+  if (!parseLiteFields(server.arg("fields"), &fields)) {
+    sendError("unknown field");
+    return;
+  }
+  const bool msgpack = server.arg("format") == "msgpack";
+
+  LiteSnapshot snaps[cfg::kChannelCount];
+  for (uint8_t i = 0; i < cfg::kChannelCount; ++i) snaps[i] = takeLiteSnapshot(channels[i], fields);
+  char etag[16];
+  snprintf(etag, sizeof(etag), "\"%08lx\"", static_cast<unsigned long>(liteStateHash(snaps, fields, msgpack)));
+
+  markFirstResponse();
+  server.sendHeader("Cache-Control", "no-cache");
+  server.sendHeader("ETag", etag);
+  if (server.header("If-None-Match").indexOf(etag) >= 0) {
+    server.send(304);
+    return;
+  }
+  StaticJsonDocument<cfg::kLiteStateJsonCapacity> doc;
+  JsonArray entries = doc.to<JsonArray>();
+  for (uint8_t i = 0; i < cfg::kChannelCount; ++i) fillLiteJson(entries.createNestedObject(), channels[i], snaps[i], fields);
+  if (msgpack) {
+    sendMsgPackDocument(200, doc);
+  } else {
+    sendJsonDocument(200, doc);
+  }
+}
+
+void writeEvent(EventSubscriber& sub, const char* event, const JsonDocument& doc) {
+  ClientWriter writer(sub.client, httpWriteBuffer);
+  writer.print("event: ");
+  writer.print(event);
+  writer.print("\ndata: ");
+  serializeJson(doc, writer);
+  writer.print("\n\n");
+  // A partial frame would corrupt the stream, so a short write drops the subscriber.
+  if (!writer.flush()) {
+    sub.client.stop();
+    sub.active = false;
+  }
+}
+
+uint8_t pruneEventSubscribers() {
+  uint8_t count = 0;
+  for (EventSubscriber& sub : eventSubscribers) {
+    if (!sub.active) continue;
+    if (!sub.client.connected()) {
+      sub.client.stop();
+      sub.active = false;
+      continue;
+    }
+    ++count;
+  }
+  return count;
+}
+
+void broadcastEvent(const char* event, const JsonDocument& doc) {
+  for (EventSubscriber& sub : eventSubscribers) {
+    if (sub.active) writeEvent(sub, event, doc);
+  }
+}
+
+void captureEventSnapshot(uint32_t fingerprint) {
+  for (const ShutterChannel& ch : channels) {
+    lastEventSnapshot.positionSteps[ch.id] = currentLogicalPosition(ch);
+    lastEventSnapshot.targetSteps[ch.id] = clampLogicalPosition(ch, ch.targetPosition);
+    lastEventSnapshot.moving[ch.id] = channelMoving(ch);
+  }
+  lastEventSnapshot.a0Raw = adcWindow.mean();
+  lastEventSnapshot.settingsFingerprint = fingerprint;
+  lastEventSnapshot.otaPending = otaJob.pending;
+  lastEventSnapshot.otaRunning = otaJob.running;
+  lastEventSnapshot.otaPhase = otaJob.phase;
+  lastEventSnapshot.otaLastError = otaJob.lastError;
+  lastEventSnapshot.otaBytes = otaJob.bytesDone;
+}
+
+void handleApiEvents() {
+  EventSubscriber* slot = nullptr;
+  const uint32_t nowMs = millis();
+  const bool firstSubscriber = pruneEventSubscribers() == 0;
+  for (EventSubscriber& sub : eventSubscribers) {
+    if (!sub.active) {
+      slot = &sub;
+      break;
+    }
+    // A sleeping phone never closes its socket; the oldest stream makes room.
+    if (slot == nullptr || nowMs - sub.connectedAtMs > nowMs - slot->connectedAtMs) slot = &sub;
+  }
+  if (slot->active) slot->client.stop();
+
+  slot->client = server.client();
+  slot->client.setTimeout(cfg::kEventWriteTimeoutMs);
+  slot->active = true;
+  slot->connectedAtMs = nowMs;
+  slot->client.print(F("HTTP/1.1 200 OK\r\n"
+                       "Content-Type: text/event-stream\r\n"
+                       "Cache-Control: no-cache\r\n"
+                       "Connection: keep-alive\r\n\r\n"));
+  char retry[24];
+  snprintf(retry, sizeof(retry), "retry: %u\n\n", static_cast<unsigned>(cfg::kEventRetryMs));
+  slot->client.print(retry);
+
+  // The snapshot first: the fingerprint is not built while the state document is.
+  if (firstSubscriber) {
+    captureEventSnapshot(settingsFingerprint());
+    lastMotionEventMs = nowMs;
+    lastA0EventMs = nowMs;
+  }
+  fillStateJson(apiDocument.to<JsonObject>());
+  writeEvent(*slot, "state", apiDocument);
+}
+
+void fillMotionPatch(JsonObject entry, const ShutterChannel& ch, long pos, long tgt, bool moving) {
+  entry["motion"] = motionName(ch, moving);
+  entry["moving"] = moving;
+  entry["positionSteps"] = pos;
+  entry["targetSteps"] = tgt;
+  entry["positionPercent"] = ch.travelScale.percent(pos);
+  entry["targetPercent"] = ch.travelScale.percent(tgt);
+  entry["queueDepth"] = ch.motionQueue.size();
+  entry["arrivalMs"] = moving ? plannedArrivalMs(ch) : 0;
+}
+
+// Called from loop(). Settings, calibration and OTA changes resend the full state; motion and
+// A0 go out as patches, rate limited while moving. Nothing is written while idle.
+void serviceEventStreams() {
+  const uint32_t nowMs = millis();
+  if (nowMs - lastEventCheckMs < cfg::kEventCheckIntervalMs) return;
+  lastEventCheckMs = nowMs;
+  if (pruneEventSubscribers() == 0) return;
+
+  EventSnapshot& last = lastEventSnapshot;
+  const uint32_t fingerprint = settingsFingerprint();
+  if (fingerprint != last.settingsFingerprint || otaJob.pending != last.otaPending ||
+      otaJob.running != last.otaRunning || otaJob.phase != last.otaPhase || otaJob.lastError != last.otaLastError) {
+    fillStateJson(apiDocument.to<JsonObject>());
+    broadcastEvent("state", apiDocument);
+    captureEventSnapshot(fingerprint);
+    lastMotionEventMs = nowMs;
+    lastA0EventMs = nowMs;
+    return;
+  }
+
+  StaticJsonDocument<cfg::kEventPatchCapacity> patch;
+  JsonObject root = patch.to<JsonObject>();
+  long pos[cfg::kChannelCount];
+  long tgt[cfg::kChannelCount];
+  bool moving[cfg::kChannelCount];
+  bool motionEdge = false;
+  bool progressed = false;
+  for (const ShutterChannel& ch : channels) {
+    const uint8_t i = ch.id;
+    pos[i] = currentLogicalPosition(ch);
+    tgt[i] = clampLogicalPosition(ch, ch.targetPosition);
+    moving[i] = channelMoving(ch);
+    // Start, stop and retargeting go out at once; plain progress waits for the motion interval.
+    if (moving[i] != last.moving[i] || tgt[i] != last.targetSteps[i]) motionEdge = true;
+    if (pos[i] != last.positionSteps[i]) progressed = true;
+  }
+  if (motionEdge || (progressed && nowMs - lastMotionEventMs >= cfg::kEventMotionIntervalMs)) {
+    // Channel 0 keeps its top-level fields; other channels that changed go into "channels".
+    JsonArray changed;
+    for (const ShutterChannel& ch : channels) {
+      const uint8_t i = ch.id;
+      if (pos[i] == last.positionSteps[i] && tgt[i] == last.targetSteps[i] && moving[i] == last.moving[i]) continue;
+      if (i == 0) {
+        fillMotionPatch(root, ch, pos[i], tgt[i], moving[i]);
+        root["rawPosition"] = ch.stepper.currentPosition();
+      } else {
+        if (changed.isNull()) changed = root.createNestedArray("channels");
+        JsonObject entry = changed.createNestedObject();
+        entry["id"] = i;
+        fillMotionPatch(entry, ch, pos[i], tgt[i], moving[i]);
+      }
+      last.positionSteps[i] = pos[i];
+      last.targetSteps[i] = tgt[i];
+      last.moving[i] = moving[i];
+    }
+    lastMotionEventMs = nowMs;
+  }
+
+  const uint16_t a0 = adcWindow.mean();
+  const uint16_t a0Delta = a0 > last.a0Raw ? a0 - last.a0Raw : last.a0Raw - a0;
+  if (a0Delta >= cfg::kEventA0Deadband && nowMs - lastA0EventMs >= cfg::kEventA0IntervalMs) {
+    patch["a0Raw"] = a0;
+    patch["a0Min"] = adcWindow.min();
+    patch["a0Max"] = adcWindow.max();
+    last.a0Raw = a0;
+    lastA0EventMs = nowMs;
+  }
+
+  if (otaJob.bytesDone != last.otaBytes && nowMs - lastOtaEventMs >= cfg::kEventOtaIntervalMs) {
+    patch["otaBytes"] = otaJob.bytesDone;
+    patch["otaTotalBytes"] = otaJob.totalBytes;
+    patch["otaBytesPerSec"] = otaBytesPerSec();
+    last.otaBytes = otaJob.bytesDone;
+    lastOtaEventMs = nowMs;
+  }
+
+  if (patch.size() > 0) broadcastEvent("patch", patch);
+}
+
+void fillStepTraceJson(JsonObject root) {
+  const uint32_t cyclesPerUs = ESP.getCpuFreqMHz();
+  const shutter::motion::StepTraceSummary summary = stepTrace.summarize(cyclesPerUs);
+#if defined(SHUTTER_STEP_ENGINE_POLLED)
+  root["engine"] = "polled";
+#else
+  root["engine"] = "timer1";
+#endif
+  root["ok"] = true;
+  root["enabled"] = static_cast<bool>(stepTrace.enabled);
+  root["samples"] = summary.samples;
+  root["minUs"] = summary.minUs;
+  root["maxUs"] = summary.maxUs;
+  root["meanUs"] = summary.meanUs;
+  root["maxJitterUs"] = summary.maxJitterUs;
+  root["meanJitterUs"] = summary.meanJitterUs;
+
+  JsonArray recent = root.createNestedArray("recentUs");
+  const uint16_t size = stepTrace.size();
+  const uint16_t first = size > cfg::kStepTraceRecentCount ? size - cfg::kStepTraceRecentCount : 0;
+  for (uint16_t i = first; i < size; ++i) {
+    recent.add(stepTrace.intervalUs(i, cyclesPerUs));
+  }
+}
+
+void handleApiStepperTraceGet() {
+  StaticJsonDocument<1024> doc;
+  fillStepTraceJson(doc.to<JsonObject>());
+  sendJsonDocument(200, doc);
+}
+
+void handleApiStepperTracePost() {
+  StaticJsonDocument<128> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+
+  if (body["reset"] | false) {
+    noInterrupts();
+    stepTrace.reset();
+    interrupts();
+  }
+  if (body.containsKey("enabled")) {
+    stepTrace.enabled = body["enabled"].as<bool>();
+  }
+  handleApiStepperTraceGet();
+}
+
+struct MetricsSnapshot {
+  shutter::metrics::LatencySummary sections[kMetricSectionCount];
+  shutter::metrics::LatencySummary stepLateness;
+  uint32_t missedStepDeadlines = 0;
+  uint32_t windowSec = 0;
+};
+
+MetricsSnapshot takeMetricsSnapshot() {
+  MetricsSnapshot out;
+  // The step ISR writes its histograms concurrently; summarize copies taken with it held off.
+  noInterrupts();
+  const shutter::metrics::LatencyHistogram stepTick = sectionLatency[static_cast<uint8_t>(MetricSection::StepTick)];
+  const shutter::metrics::LatencyHistogram lateness = stepLateness;
+  out.missedStepDeadlines = missedStepDeadlines;
+  interrupts();
+  for (uint8_t i = 0; i < kMetricSectionCount; ++i) {
+    out.sections[i] = i == static_cast<uint8_t>(MetricSection::StepTick) ? stepTick.summarize() : sectionLatency[i].summarize();
+  }
+  out.stepLateness = lateness.summarize();
+  out.windowSec = (millis() - metricsResetAtMs) / 1000;
+  return out;
+}
+
+void fillLatencyJson(JsonObject dst, const shutter::metrics::LatencySummary& summary) {
+  dst["count"] = summary.count;
+  dst["minUs"] = summary.minUs;
+  dst["maxUs"] = summary.maxUs;
+  dst["meanUs"] = summary.meanUs;
+  dst["p50Us"] = summary.p50Us;
+  dst["p90Us"] = summary.p90Us;
+  dst["p99Us"] = summary.p99Us;
+}
+
+void fillMetricsJson(JsonObject root, const MetricsSnapshot& snapshot) {
+  root["ok"] = true;
+#if defined(SHUTTER_STEP_ENGINE_POLLED)
+  root["engine"] = "polled";
+#else
+  root["engine"] = "timer1";
+#endif
+  root["windowSec"] = snapshot.windowSec;
+  root["stepDeadlineSlackUs"] = cfg::kStepDeadlineSlackUs;
+  root["missedStepDeadlines"] = snapshot.missedStepDeadlines;
+  fillLatencyJson(root.createNestedObject("stepLateness"), snapshot.stepLateness);
+  JsonObject sections = root.createNestedObject("sections");
+  for (uint8_t i = 0; i < kMetricSectionCount; ++i) {
+    fillLatencyJson(sections.createNestedObject(kMetricSectionNames[i]), snapshot.sections[i]);
+  }
+}
+
+// Counts what a Prometheus text pass would write, for Content-Length.
+struct ByteCounter {
+  size_t bytes = 0;
+  size_t print(const char* text) {
+    const size_t size = strlen(text);
+    bytes += size;
+    return size;
+  }
+};
+
+// printf on the device has no 64-bit conversions.
+const char* formatUint64(uint64_t value, char* buffer, size_t size) {
+  char* out = buffer + size - 1;
+  *out = '\0';
+  do {
+    *--out = static_cast<char>('0' + value % 10);
+    value /= 10;
+  } while (value != 0 && out > buffer);
+  return out;
+}
+
+// One Prometheus summary: quantiles, _sum and _count, plus a _max gauge. |labels| is either
+// empty or a "name=\"value\"" pair.
+template <typename Out>
+void writeSummaryText(Out& out, const char* name, const char* labels, const shutter::metrics::LatencySummary& summary) {
+  const char* sep = labels[0] != '\0' ? "," : "";
+  char line[128];
+  const uint32_t quantileUs[3] = {summary.p50Us, summary.p90Us, summary.p99Us};
+  const char* const quantiles[3] = {"0.5", "0.9", "0.99"};
+  for (uint8_t q = 0; q < 3; ++q) {
+    snprintf(line, sizeof(line), "%s{%s%squantile=\"%s\"} %lu\n", name, labels, sep, quantiles[q],
+             static_cast<unsigned long>(quantileUs[q]));
+    out.print(line);
+  }
+  char sum[21];
+  snprintf(line, sizeof(line), "%s_sum{%s} %s\n", name, labels, formatUint64(summary.sumUs, sum, sizeof(sum)));
+  out.print(line);
+  snprintf(line, sizeof(line), "%s_count{%s} %lu\n", name, labels, static_cast<unsigned long>(summary.count));
+  out.print(line);
+  snprintf(line, sizeof(line), "%s_max{%s} %lu\n", name, labels, static_cast<unsigned long>(summary.maxUs));
+  out.print(line);
+}
+
+template <typename Out>
+void writeMetricsText(Out& out, const MetricsSnapshot& snapshot) {
+  out.print("# HELP shutter_section_duration_us Time spent in a firmware section.\n"
+            "# TYPE shutter_section_duration_us summary\n");
+  char labels[40];
+  for (uint8_t i = 0; i < kMetricSectionCount; ++i) {
+    snprintf(labels, sizeof(labels), "section=\"%s\"", kMetricSectionNames[i]);
+    writeSummaryText(out, "shutter_section_duration_us", labels, snapshot.sections[i]);
+  }
+  out.print("# HELP shutter_step_lateness_us Delay between a step deadline and the step.\n"
+            "# TYPE shutter_step_lateness_us summary\n");
+  writeSummaryText(out, "shutter_step_lateness_us", "", snapshot.stepLateness);
+  out.print("# HELP shutter_step_deadlines_missed_total Steps that ran later than the deadline slack.\n"
+            "# TYPE shutter_step_deadlines_missed_total counter\n");
+  char line[64];
+  snprintf(line, sizeof(line), "shutter_step_deadlines_missed_total %lu\n",
+           static_cast<unsigned long>(snapshot.missedStepDeadlines));
+  out.print(line);
+}
+
+// GET /api/metrics, or /api/metrics?format=prometheus for the text exposition format.
+void handleApiMetricsGet() {
+  const MetricsSnapshot snapshot = takeMetricsSnapshot();
+  if (server.arg("format") == "prometheus") {
+    ByteCounter counter;
+    writeMetricsText(counter, snapshot);
+    server.setContentLength(counter.bytes);
+    server.send(200, "text/plain; version=0.0.4", "");
+    WiFiClient client = server.client();
+    ClientWriter writer(client, httpWriteBuffer);
+    writeMetricsText(writer, snapshot);
+    writer.flush();
+    return;
+  }
+  StaticJsonDocument<1536> doc;
+  fillMetricsJson(doc.to<JsonObject>(), snapshot);
+  sendJsonDocument(200, doc);
+}
+
+void handleApiMetricsPost() {
+  StaticJsonDocument<64> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+  if (body["reset"] | false) {
+    noInterrupts();
+    for (shutter::metrics::LatencyHistogram& histogram : sectionLatency) histogram.reset();
+    stepLateness.reset();
+    missedStepDeadlines = 0;
+    interrupts();
+    metricsResetAtMs = millis();
+  }
+  handleApiMetricsGet();
+}
+
+const MovePreset* findMovePreset(const char* name) {
+  for (uint8_t i = 0; i < movePresetCount; ++i) {
+    if (strcmp(movePresets[i].name, name) == 0) return &movePresets[i];
+  }
+  return nullptr;
+}
+
+// Applies a move action (open, close, stop, set, jog, preset) to one channel. Returns the
+// error to report, or nullptr once the command is running.
+// "queue": true appends the move behind the planned ones instead of replacing them. A jog is
+// relative to the planned target, so quick repeated jogs add up. A preset runs on its own ramp
+// for this move only; the channel's settings stay as they are.
+const char* applyMoveCommand(ShutterChannel& ch, JsonVariantConst body) {
+  const char* action = body["action"] | "";
+  if (autoCalibrating(ch)) failAutoCalibration(ch, "aborted");
+
+  shutter::motion::MotionCommand command;
+  if (strcmp(action, "open") == 0) {
+    command.target = 0;
+    command.open = true;
+  } else if (strcmp(action, "close") == 0) {
+    command.target = ch.settings.travelSteps;
+  } else if (strcmp(action, "stop") == 0) {
+    stopMotor(ch);
+    return nullptr;
+  } else if (strcmp(action, "set") == 0) {
+    const float percent = body["percent"] | -1.0f;
+    if (percent < 0.0f || percent > 100.0f) return "percent must be between 0 and 100";
+    command.target = ch.travelScale.stepsAtPercent(percent);
+  } else if (strcmp(action, "jog") == 0) {
+    const long delta = body["steps"] | 0;
+    if (delta == 0) return "steps must be non-zero";
+    command.target = ch.targetPosition + delta;
+  } else if (strcmp(action, "preset") == 0) {
+    const MovePreset* preset = findMovePreset(body["name"] | "");
+    if (preset == nullptr) return "unknown preset";
+    command.target = ch.travelScale.stepsAtCentiPercent(preset->centiPercent);
+    command.open = preset->centiPercent == 0 && preset->topOverdrive != 0;
+    command.maxSpeed = preset->maxSpeed;
+    command.acceleration = preset->acceleration;
+  } else {
+    return "unknown action";
+  }
+  if (!commandMotion(ch, command, body["queue"] | false)) return "motion queue is full";
+  return nullptr;
+}
+
+// Applies a calibration action to one channel and persists it when the action requires.
+// Returns the error to report and its status code, or nullptr.
+const char* applyCalibrateCommand(ShutterChannel& ch, JsonVariantConst body, int* errorCode) {
+  const char* action = body["action"] | "";
+  *errorCode = 400;
+  if (strcmp(action, "auto") == 0) {
+    if (!state.stallDetection) return "stall detection is off";
+    for (const ShutterChannel& other : channels) {
+      if (other.id != ch.id && stepperMoving(other)) return "another channel is moving";
+    }
+    startAutoCalibration(ch);
+    return nullptr;
+  }
+  if (autoCalibrating(ch)) failAutoCalibration(ch, "aborted");
+  bool shouldPersist = false;
+  if (strcmp(action, "set_top") == 0) {
+    calibrateSetTop(ch);
+    shouldPersist = true;
+  } else if (strcmp(action, "set_bottom") == 0) {
+    if (!calibrateSetBottom(ch)) return "failed to set bottom";
+    shouldPersist = true;
+  } else if (strcmp(action, "jog") == 0) {
+    const long delta = body["steps"] | 0;
+    if (delta == 0) return "steps must be non-zero";
+    calibrateJog(ch, delta);
+  } else if (strcmp(action, "reset") == 0) {
+    ch.settings.calibrated = false;
+    markDirty();
+    shouldPersist = true;
+  } else {
+    return "unknown action";
+  }
+
+  if (shouldPersist) requestSettingsCommit();
+  return nullptr;
+}
+
+// Motor settings of one channel. The logical position and target survive travel and
+// direction changes; the caller persists.
+void applyChannelSettings(ShutterChannel& ch, JsonVariantConst body) {
+  ChannelSettings& settings = ch.settings;
+  // A move under way settles on the settings it was planned with.
+  const long logicalPosBefore = currentLogicalPosition(ch);
+  anchorLogicalPosition(ch, logicalPosBefore);
+  const long logicalTargetBefore = ch.targetPosition;
+
+  if (body.containsKey("reverseDirection")) {
+    settings.reverseDirection = body["reverseDirection"].as<bool>();
+  }
+  if (body.containsKey("topOverdriveEnabled")) {
+    settings.topOverdriveEnabled = body["topOverdriveEnabled"].as<bool>();
+  }
+  if (body.containsKey("maxSpeed")) {
+    settings.maxSpeed = shutter::math::clampFloat(body["maxSpeed"].as<float>(), cfg::kMinSpeed, cfg::kMaxSpeed);
+  }
+  if (body.containsKey("acceleration")) {
+    settings.acceleration = shutter::math::clampFloat(body["acceleration"].as<float>(), cfg::kMinAccel, cfg::kMaxAccel);
+  }
+  if (body.containsKey("jerk")) {
+    settings.jerk = clampJerk(body["jerk"].as<float>());
+  }
+  if (body.containsKey("topOverdrivePercent")) {
+    settings.topOverdrivePercent =
+        shutter::math::clampFloat(body["topOverdrivePercent"].as<float>(), cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
+  }
+  if (body.containsKey("coilHoldMs")) {
+    settings.coilHoldMs = static_cast<uint16_t>(shutter::math::clampLong(body["coilHoldMs"].as<long>(), 0, cfg::kMaxCoilHoldMs));
+  }
+  if (body.containsKey("holdDutyPercent")) {
+    settings.holdDutyPercent = clampHoldDuty(body["holdDutyPercent"].as<long>());
+  }
+  if (body.containsKey("idleHoldDutyPercent")) {
+    settings.idleHoldDutyPercent = clampIdleHoldDuty(body["idleHoldDutyPercent"].as<long>());
+  }
+  if (body.containsKey("travelSteps")) {
+    settings.travelSteps = shutter::math::clampLong(body["travelSteps"].as<long>(), cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+  }
+  if (body.containsKey("groupMask")) {
+    settings.groupMask = static_cast<uint16_t>(shutter::math::clampLong(body["groupMask"].as<long>(), 0, 0xFFFF));
+  }
+  const ChannelSettings before = settings;
+  if (body.containsKey("backlashSteps")) {
+    settings.backlashSteps = clampBacklash(body["backlashSteps"].as<long>());
+  }
+  if (body.containsKey("openStepScale")) {
+    settings.openStepScale = clampStepScale(body["openStepScale"].as<float>());
+  }
+  if (body.containsKey("closeStepScale")) {
+    settings.closeStepScale = clampStepScale(body["closeStepScale"].as<float>());
+  }
+  if (body.containsKey("driftAutoTune")) {
+    settings.driftAutoTune = body["driftAutoTune"].as<bool>();
+  }
+  // The tuner learned against the old model; its overdrive trim starts over. The form posts
+  // the scales back rounded, which is no change.
+  if (settings.backlashSteps != before.backlashSteps || settings.driftAutoTune != before.driftAutoTune ||
+      fabsf(settings.openStepScale - before.openStepScale) > 1e-3f ||
+      fabsf(settings.closeStepScale - before.closeStepScale) > 1e-3f) {
+    ch.driftTuner.reset();
+  }
+
+  applyStepperSettings(ch);
+
+  const long clampedPos = clampLogicalPosition(ch, logicalPosBefore);
+  ch.targetPosition = clampLogicalPosition(ch, logicalTargetBefore);
+
+  ch.motionQueue.clear();
+  anchorLogicalPosition(ch, clampedPos);
+  if (ch.targetPosition != clampedPos) {
+    enableMotorOutputs(ch);
+    moveStepperTo(ch, plannedRawTarget(ch, ch.targetPosition));
+  }
+  ch.resetTopReferenceWhenStopped = false;
+  markDirty();
+}
+
+void handleApiMove() {
+  StaticJsonDocument<384> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+  const char* error = applyMoveCommand(channels[0], body.as<JsonVariantConst>());
+  if (error) {
+    sendError(error);
+    return;
+  }
+  handleApiState();
+}
+
+void handleApiCalibrate() {
+  StaticJsonDocument<256> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
     return;
   }
+  int errorCode = 400;
+  const char* error = applyCalibrateCommand(channels[0], body.as<JsonVariantConst>(), &errorCode);
+  if (error) {
+    sendError(error, errorCode);
+    return;
+  }
+  handleApiState();
+}
 
-  const char* action = body["action"] | "";
-  bool shouldPersistNow = false;
-  if (strcmp(action, "set_top") == 0) {
-    calibrateSetTop();
-    shouldPersistNow = true;
-  } else if (strcmp(action, "set_bottom") == 0) {
-    if (!calibrateSetBottom()) {
-      sendError("failed to set bottom");
+// {"wifiStaticIp":"192.168.88.74","wifiGateway":"192.168.88.1"}: subnet defaults to /24 and
+// DNS to the gateway; an empty wifiStaticIp switches back to DHCP.
+bool parseWifiAddress(JsonVariantConst body, WifiAddress* out) {
+  const char* ipText = body["wifiStaticIp"] | "";
+  if (ipText[0] == '\0') {
+    *out = {};
+    return true;
+  }
+  IPAddress ip;
+  IPAddress gateway;
+  IPAddress subnet(255, 255, 255, 0);
+  if (!ip.fromString(ipText) || !gateway.fromString(body["wifiGateway"] | "")) return false;
+  const char* subnetText = body["wifiSubnet"] | "";
+  if (subnetText[0] != '\0' && !subnet.fromString(subnetText)) return false;
+  IPAddress dns = gateway;
+  const char* dnsText = body["wifiDns"] | "";
+  if (dnsText[0] != '\0' && !dns.fromString(dnsText)) return false;
+  out->ip = ip;
+  out->gateway = gateway;
+  out->subnet = subnet;
+  out->dns = dns;
+  return true;
+}
+
+// Applies a /api/settings body; returns an error message, or nullptr.
+const char* applySettings(JsonVariantConst body) {
+  // The address takes effect at the next boot; checked before anything else changes.
+  WifiAddress address = wifiStaticAddress;
+  if (body.containsKey("wifiStaticIp") && !parseWifiAddress(body, &address)) return "invalid static address";
+  wifiStaticAddress = address;
+  if (body.containsKey("wifiModemSleep")) {
+    state.wifiModemSleep = body["wifiModemSleep"].as<bool>();
+  }
+  if (body.containsKey("wifiFastConnect")) {
+    state.wifiFastConnect = body["wifiFastConnect"].as<bool>();
+  }
+  if (body.containsKey("idleLightSleep")) {
+    state.idleLightSleep = body["idleLightSleep"].as<bool>();
+  }
+  if (body.containsKey("wakeLatencyMs")) {
+    state.wakeLatencyMs = clampWakeLatency(body["wakeLatencyMs"].as<long>());
+  }
+  if (body.containsKey("stallDetection")) {
+    state.stallDetection = body["stallDetection"].as<bool>();
+  }
+  if (body.containsKey("stallThresholdPercent")) {
+    state.stallThresholdPercent = clampStallThreshold(body["stallThresholdPercent"].as<long>());
+  }
+  // A new power setting starts a new estimate window.
+  if (body.containsKey("wifiModemSleep") || body.containsKey("idleLightSleep") || body.containsKey("wakeLatencyMs")) {
+    resetPowerBudget();
+  }
+  if (body.containsKey("adcSampleIntervalMs")) {
+    state.adcSampleIntervalMs = static_cast<uint16_t>(shutter::math::clampLong(
+        body["adcSampleIntervalMs"].as<long>(), cfg::kMinAdcSampleIntervalMs, cfg::kMaxAdcSampleIntervalMs));
+  }
+  applyChannelSettings(channels[0], body);
+  applyWiFiPowerMode();
+  return nullptr;
+}
+
+void handleApiSettings() {
+  JsonDocument& body = apiDocument;
+  const char* error = parseJsonBody(body) ? applySettings(body.as<JsonVariantConst>()) : "invalid json";
+  if (error) {
+    sendError(error);
+    return;
+  }
+  requestSettingsCommit();
+  handleApiState();
+}
+
+// Channel named by the {} of a /api/channels/{}/... route; replies 404 and returns nullptr
+// when there is no such channel.
+ShutterChannel* channelFromPath() {
+  const String& id = server.pathArg(0);
+  char* end = nullptr;
+  const long index = strtol(id.c_str(), &end, 10);
+  if (id.length() == 0 || *end != '\0' || index < 0 || index >= cfg::kChannelCount) {
+    sendError("unknown channel", 404);
+    return nullptr;
+  }
+  return &channels[index];
+}
+
+void sendChannelJson(const ShutterChannel& ch) {
+  StaticJsonDocument<cfg::kChannelJsonCapacity> doc;
+  JsonObject root = doc.to<JsonObject>();
+  root["ok"] = true;
+  root["id"] = ch.id;
+  fillChannelJson(root, ch);
+  sendJsonDocument(200, doc);
+}
+
+void handleApiChannels() {
+  StaticJsonDocument<64 + 128 * cfg::kChannelCount> doc;
+  doc["ok"] = true;
+  doc["count"] = cfg::kChannelCount;
+  JsonArray list = doc.createNestedArray("channels");
+  for (const ShutterChannel& ch : channels) fillChannelSummaryJson(list.createNestedObject(), ch);
+  sendJsonDocument(200, doc);
+}
+
+void handleApiChannelGet() {
+  ShutterChannel* ch = channelFromPath();
+  if (ch) sendChannelJson(*ch);
+}
+
+void handleApiChannelMove() {
+  ShutterChannel* ch = channelFromPath();
+  if (!ch) return;
+  StaticJsonDocument<384> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+  const char* error = applyMoveCommand(*ch, body.as<JsonVariantConst>());
+  if (error) {
+    sendError(error);
+    return;
+  }
+  sendChannelJson(*ch);
+}
+
+void handleApiChannelCalibrate() {
+  ShutterChannel* ch = channelFromPath();
+  if (!ch) return;
+  StaticJsonDocument<256> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+  int errorCode = 400;
+  const char* error = applyCalibrateCommand(*ch, body.as<JsonVariantConst>(), &errorCode);
+  if (error) {
+    sendError(error, errorCode);
+    return;
+  }
+  sendChannelJson(*ch);
+}
+
+void handleApiChannelSettings() {
+  ShutterChannel* ch = channelFromPath();
+  if (!ch) return;
+  StaticJsonDocument<640> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+  applyChannelSettings(*ch, body.as<JsonVariantConst>());
+  requestSettingsCommit();
+  sendChannelJson(*ch);
+}
+
+// One move action for several channels: {"action":"set","percent":40,"channels":[0,2]}.
+// Without "channels" it applies to all of them; they start within the same loop() pass.
+void handleApiChannelsMove() {
+  StaticJsonDocument<384> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+
+  uint8_t selected = 0;
+  JsonArrayConst ids = body["channels"].as<JsonArrayConst>();
+  if (ids.isNull()) {
+    selected = static_cast<uint8_t>((1U << cfg::kChannelCount) - 1);
+  } else {
+    for (JsonVariantConst id : ids) {
+      const long index = id | -1L;
+      if (!id.is<long>() || index < 0 || index >= cfg::kChannelCount) {
+        sendError("unknown channel");
+        return;
+      }
+      selected |= static_cast<uint8_t>(1U << index);
+    }
+  }
+
+  // A queued move is all or nothing: with one full queue among the selected channels none of
+  // them gets the move, so a 400 never leaves the others half-commanded.
+  if ((body["queue"] | false) && strcmp(body["action"] | "", "stop") != 0) {
+    for (const ShutterChannel& ch : channels) {
+      if ((selected & (1U << ch.id)) && channelMoving(ch) && ch.motionQueue.full()) {
+        sendError("motion queue is full");
+        return;
+      }
+    }
+  }
+
+  for (ShutterChannel& ch : channels) {
+    if (!(selected & (1U << ch.id))) continue;
+    const char* error = applyMoveCommand(ch, body.as<JsonVariantConst>());
+    // The queues were checked above and the arguments do not depend on the channel, so an
+    // error can only come from the first channel, before any move has started.
+    if (error) {
+      sendError(error);
       return;
     }
-    shouldPersistNow = true;
-  } else if (strcmp(action, "jog") == 0) {
-    const long delta = body["steps"] | 0;
-    if (delta == 0) {
-      sendError("steps must be non-zero");
+  }
+  handleApiChannels();
+}
+
+// ---- Presets ------------------------------------------------------------------------------
+
+void fillMovePresetJson(JsonObject dst, const MovePreset& preset) {
+  dst["name"] = preset.name;
+  dst["percent"] = preset.centiPercent / 100.0f;
+  dst["maxSpeed"] = preset.maxSpeed;
+  dst["acceleration"] = preset.acceleration;
+  dst["topOverdrive"] = preset.topOverdrive != 0;
+}
+
+void handleApiPresetsGet() {
+  JsonDocument& doc = apiDocument;
+  doc.clear();
+  doc["ok"] = true;
+  doc["maxPresets"] = cfg::kMaxMovePresets;
+  JsonArray presets = doc.createNestedArray("presets");
+  for (uint8_t i = 0; i < movePresetCount; ++i) fillMovePresetJson(presets.createNestedObject(), movePresets[i]);
+  sendJsonDocument(200, doc);
+}
+
+// {"name":"evening","percent":60,"maxSpeed":300,"acceleration":150,"topOverdrive":false};
+// maxSpeed and acceleration default to 0, the channel's own. Returns the error.
+const char* parseMovePreset(JsonObjectConst src, MovePreset* preset) {
+  const char* name = src["name"] | "";
+  const size_t length = strlen(name);
+  if (length == 0 || length >= sizeof(preset->name)) return "preset name must be 1..15 characters";
+  memcpy(preset->name, name, length);
+
+  const float percent = src["percent"] | -1.0f;
+  if (percent < 0.0f || percent > 100.0f) return "preset percent must be between 0 and 100";
+  preset->centiPercent = static_cast<uint16_t>(lroundf(percent * 100.0f));
+
+  const float maxSpeed = src["maxSpeed"] | 0.0f;
+  if (maxSpeed != 0.0f && (maxSpeed < cfg::kMinSpeed || maxSpeed > cfg::kMaxSpeed)) {
+    return "preset maxSpeed must be 0 or 80..2500";
+  }
+  preset->maxSpeed = static_cast<uint16_t>(lroundf(maxSpeed));
+  const float acceleration = src["acceleration"] | 0.0f;
+  if (acceleration != 0.0f && (acceleration < cfg::kMinAccel || acceleration > cfg::kMaxAccel)) {
+    return "preset acceleration must be 0 or 40..6000";
+  }
+  preset->acceleration = static_cast<uint16_t>(lroundf(acceleration));
+  preset->topOverdrive = (src["topOverdrive"] | true) ? 1 : 0;
+  return nullptr;
+}
+
+// {"presets":[...]} replaces the whole list; this is the only place presets are written.
+void handleApiPresetsPost() {
+  JsonDocument& body = apiDocument;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+  JsonArrayConst list = body["presets"].as<JsonArrayConst>();
+  if (list.isNull() || list.size() > cfg::kMaxMovePresets) {
+    sendError("presets must be an array of up to 8 presets");
+    return;
+  }
+
+  MovePreset next[cfg::kMaxMovePresets] = {};
+  uint8_t count = 0;
+  for (JsonVariantConst src : list) {
+    const char* error = parseMovePreset(src.as<JsonObjectConst>(), &next[count]);
+    if (error != nullptr) {
+      sendError(error);
       return;
     }
-    calibrateJog(delta);
-  } else if (strcmp(action, "reset") == 0) {
-    state.calibrated = false;
-    markDirty();
-    shouldPersistNow = true;
+    for (uint8_t i = 0; i < count; ++i) {
+      if (strcmp(next[i].name, next[count].name) == 0) {
+        sendError("preset names must be unique");
+        return;
+      }
+    }
+    ++count;
+  }
+
+  memcpy(movePresets, next, sizeof(movePresets));
+  movePresetCount = count;
+  requestSettingsCommit();
+  handleApiPresetsGet();
+}
+
+// ---- Group control ------------------------------------------------------------------------
+
+IPAddress groupMulticastAddress() {
+  return IPAddress(cfg::kGroupMulticastIp[0], cfg::kGroupMulticastIp[1], cfg::kGroupMulticastIp[2],
+                   cfg::kGroupMulticastIp[3]);
+}
+
+bool inAnyGroup(uint16_t groups) {
+  for (const ShutterChannel& ch : channels) {
+    if ((ch.settings.groupMask & groups) != 0) return true;
+  }
+  return false;
+}
+
+// The shared start of a group command: every member channel takes it the same way as
+// POST /api/move.
+void runGroupCommand(const shutter::group::Command& command) {
+  using shutter::group::Action;
+  StaticJsonDocument<64> body;
+  switch (command.action) {
+    case Action::Open:
+      body["action"] = "open";
+      break;
+    case Action::Close:
+      body["action"] = "close";
+      break;
+    case Action::Stop:
+      body["action"] = "stop";
+      break;
+    case Action::Set:
+      body["action"] = "set";
+      body["percent"] = command.centiPercent / 100.0f;
+      break;
+  }
+  for (ShutterChannel& ch : channels) {
+    if ((ch.settings.groupMask & command.groups) != 0) applyMoveCommand(ch, body.as<JsonVariantConst>());
+  }
+  ++groupLink.started;
+}
+
+// A newer command replaces one still waiting for its start.
+void armGroupCommand(const shutter::group::Command& command, uint32_t startUs) {
+  groupLink.pending = command;
+  groupLink.pendingStartUs = startUs;
+  groupLink.pendingArmed = true;
+}
+
+// Each copy carries what is left of the lead when it leaves, so a node that only hears a
+// later copy still starts at the same moment.
+bool sendGroupCopy(uint32_t nowUs) {
+  shutter::group::Command copy = groupLink.outgoing;
+  const int32_t leftUs = static_cast<int32_t>(groupLink.outgoingStartUs - nowUs);
+  copy.startInUs = leftUs > 0 ? static_cast<uint32_t>(leftUs) : 0;
+  uint8_t packet[shutter::group::kPacketSize];
+  shutter::group::encode(copy, packet, sizeof(packet));
+  if (!groupLink.udp.beginPacketMulticast(groupMulticastAddress(), cfg::kGroupPort, WiFi.localIP())) return false;
+  groupLink.udp.write(packet, sizeof(packet));
+  return groupLink.udp.endPacket() == 1;
+}
+
+// Multicasts |command| with a start |leadMs| from now and takes it here as well.
+bool sendGroupCommand(shutter::group::Command command, uint16_t leadMs) {
+  if (!groupLink.joined) return false;
+  command.sender = ESP.getChipId();
+  command.sequence = groupLink.nextSequence++;
+  const uint32_t nowUs = micros();
+  groupLink.outgoing = command;
+  groupLink.outgoingStartUs = nowUs + leadMs * 1000UL;
+  if (!sendGroupCopy(nowUs)) return false;
+  ++groupLink.sent;
+  groupLink.copiesLeft = cfg::kGroupCopies - 1;
+  groupLink.nextCopyMs = millis() + cfg::kGroupCopyGapMs;
+  // Should the stack ever loop our own datagrams back, they are repeats.
+  groupLink.recent.accept(command.sender, command.sequence);
+  if (inAnyGroup(command.groups)) armGroupCommand(command, groupLink.outgoingStartUs);
+  return true;
+}
+
+// Called from loop(): joins the group once Wi-Fi is up, reads what arrived, sends the
+// remaining copies and fires a start that came due.
+void serviceGroupControl() {
+  if (WiFi.status() != WL_CONNECTED) {
+    if (groupLink.joined) groupLink.udp.stop();
+    groupLink.joined = false;
+    groupLink.copiesLeft = 0;
+  } else if (!groupLink.joined) {
+    groupLink.joined = groupLink.udp.beginMulticast(WiFi.localIP(), groupMulticastAddress(), cfg::kGroupPort) == 1;
+  }
+
+  if (groupLink.joined) {
+    int size;
+    while ((size = groupLink.udp.parsePacket()) > 0) {
+      const uint32_t heardUs = micros();
+      uint8_t packet[shutter::group::kPacketSize];
+      if (size != static_cast<int>(sizeof(packet))) continue;
+      groupLink.udp.read(packet, sizeof(packet));
+      shutter::group::Command command;
+      if (!shutter::group::decode(packet, sizeof(packet), &command)) continue;
+      if (!groupLink.recent.accept(command.sender, command.sequence)) continue;
+      ++groupLink.heard;
+      if (inAnyGroup(command.groups)) armGroupCommand(command, heardUs + command.startInUs);
+    }
+  }
+
+  const uint32_t nowUs = micros();
+  if (groupLink.copiesLeft > 0 && static_cast<int32_t>(millis() - groupLink.nextCopyMs) >= 0) {
+    // Past the start a copy could only start someone late.
+    if (static_cast<int32_t>(groupLink.outgoingStartUs - nowUs) <= 0 || !sendGroupCopy(nowUs)) {
+      groupLink.copiesLeft = 0;
+    } else {
+      --groupLink.copiesLeft;
+      groupLink.nextCopyMs += cfg::kGroupCopyGapMs;
+    }
+  }
+  if (groupLink.pendingArmed && static_cast<int32_t>(nowUs - groupLink.pendingStartUs) >= 0) {
+    groupLink.pendingArmed = false;
+    runGroupCommand(groupLink.pending);
+  }
+}
+
+// {"group":2,"action":"close"}: every node with a channel in group 2 starts closing at the
+// same moment, this one included. "set" takes "percent"; "leadMs" overrides the start lead.
+void handleApiGroupMove() {
+  StaticJsonDocument<256> body;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
+  }
+  const long group = body["group"] | 0L;
+  if (group < 1 || group > shutter::group::kGroupCount) {
+    sendError("group must be 1..16");
+    return;
+  }
+  shutter::group::Command command;
+  command.groups = static_cast<uint16_t>(1U << (group - 1));
+  const char* action = body["action"] | "";
+  if (strcmp(action, "open") == 0) {
+    command.action = shutter::group::Action::Open;
+  } else if (strcmp(action, "close") == 0) {
+    command.action = shutter::group::Action::Close;
+  } else if (strcmp(action, "stop") == 0) {
+    command.action = shutter::group::Action::Stop;
+  } else if (strcmp(action, "set") == 0) {
+    const float percent = body["percent"] | -1.0f;
+    if (percent < 0.0f || percent > 100.0f) {
+      sendError("percent must be between 0 and 100");
+      return;
+    }
+    command.action = shutter::group::Action::Set;
+    command.centiPercent = static_cast<uint16_t>(lroundf(percent * 100.0f));
   } else {
     sendError("unknown action");
     return;
   }
+  const uint16_t leadMs = static_cast<uint16_t>(
+      shutter::math::clampLong(body["leadMs"] | static_cast<long>(cfg::kDefaultGroupStartLeadMs), 0, cfg::kMaxGroupStartLeadMs));
+  if (!sendGroupCommand(command, leadMs)) {
+    sendError("multicast unavailable", 503);
+    return;
+  }
+
+  StaticJsonDocument<128> doc;
+  doc["ok"] = true;
+  doc["group"] = group;
+  doc["sequence"] = groupLink.outgoing.sequence;
+  doc["leadMs"] = leadMs;
+  doc["member"] = inAnyGroup(command.groups);
+  sendJsonDocument(200, doc);
+}
+
+// "<base>/<suffix>", or "<base>/<channel>/<suffix>" for channel >= 0.
+void mqttTopic(char* out, int channel, const char* suffix) {
+  if (channel < 0) {
+    snprintf(out, cfg::kMqttTopicCapacity, "%s/%s", mqttLink.baseTopic, suffix);
+  } else {
+    snprintf(out, cfg::kMqttTopicCapacity, "%s/%d/%s", mqttLink.baseTopic, channel, suffix);
+  }
+}
+
+void mqttDrop(const char* error) {
+  mqttLink.client.stop();
+  mqttLink.stage = MqttStage::Waiting;
+  mqttLink.dueMs = millis() + mqttLink.backoffMs;
+  Serial.printf("[MQTT] %s, retry in %lums\n", error, static_cast<unsigned long>(mqttLink.backoffMs));
+  mqttLink.backoffMs = std::min(mqttLink.backoffMs * 2, cfg::kMqttMaxBackoffMs);
+  mqttLink.lastError = error;
+}
+
+// Sends the first |length| bytes of mqttTx; a short write loses the session.
+bool mqttSend(size_t length) {
+  if (length == 0) {
+    mqttLink.lastError = "packet too large";
+    return false;
+  }
+  if (mqttLink.client.write(mqttTx, length) != length) {
+    mqttDrop("write failed");
+    return false;
+  }
+  mqttLink.lastSentMs = millis();
+  return true;
+}
+
+bool mqttPublish(const char* topic, const char* payload, bool retain) {
+  if (!mqttSend(shutter::mqtt::encodePublish(mqttTx, sizeof(mqttTx), topic, payload, retain))) return false;
+  ++mqttLink.published;
+  return true;
+}
+
+// Home Assistant cover states; HA counts position 100 as open, the controller 0.
+const char* mqttCoverState(const ShutterChannel& ch, bool moving, long pos) {
+  if (moving) return motionName(ch, true);
+  if (pos <= 0) return "open";
+  if (pos >= ch.settings.travelSteps) return "closed";
+  return "stopped";
+}
+
+int8_t mqttCoverPosition(const ShutterChannel& ch, long pos) {
+  return static_cast<int8_t>(100 - ch.travelScale.wholePercent(pos));
+}
+
+// One retained config per channel, in the abbreviated discovery form to stay well inside
+// the packet buffer.
+bool mqttPublishDiscovery(const ShutterChannel& ch) {
+  char uniqueId[32];
+  snprintf(uniqueId, sizeof(uniqueId), "%s_%u", mqttLink.nodeId, ch.id);
+  char commandTopic[16];
+  char stateTopic[16];
+  char positionTopic[24];
+  char setPositionTopic[32];
+  snprintf(commandTopic, sizeof(commandTopic), "~/%u/set", ch.id);
+  snprintf(stateTopic, sizeof(stateTopic), "~/%u/state", ch.id);
+  snprintf(positionTopic, sizeof(positionTopic), "~/%u/position", ch.id);
+  snprintf(setPositionTopic, sizeof(setPositionTopic), "~/%u/position/set", ch.id);
+  char channelName[16];
+  snprintf(channelName, sizeof(channelName), "Shutter %u", ch.id + 1);
+  const String url = "http://" + WiFi.localIP().toString();
+
+  StaticJsonDocument<768> doc;
+  doc["~"] = mqttLink.baseTopic;
+  // A single cover takes the device name.
+  if (cfg::kChannelCount > 1) {
+    doc["name"] = channelName;
+  } else {
+    doc["name"] = static_cast<const char*>(nullptr);  // serialized as null
+  }
+  doc["uniq_id"] = uniqueId;
+  doc["dev_cla"] = "shutter";
+  doc["cmd_t"] = commandTopic;
+  doc["stat_t"] = stateTopic;
+  doc["pos_t"] = positionTopic;
+  doc["set_pos_t"] = setPositionTopic;
+  doc["avty_t"] = "~/availability";
+  JsonObject device = doc.createNestedObject("dev");
+  device.createNestedArray("ids").add(mqttLink.nodeId);
+  device["name"] = mqttLink.nodeId;
+  device["mdl"] = "ESP8266 + 28BYJ-48";
+  device["sw"] = cfg::kFirmwareVersion;
+  device["cu"] = url.c_str();
+
+  char payload[cfg::kMqttPacketCapacity - cfg::kMqttTopicCapacity - 8];
+  if (serializeJson(doc, payload, sizeof(payload)) >= sizeof(payload) - 1) {
+    mqttLink.lastError = "discovery config too large";
+    return false;
+  }
+  char topic[cfg::kMqttTopicCapacity];
+  snprintf(topic, sizeof(topic), "%s/cover/%s/config", cfg::kMqttDiscoveryPrefix, uniqueId);
+  return mqttPublish(topic, payload, true);
+}
+
+// Event driven: a new cover state goes out at once, the position while moving at most every
+// kMqttPositionIntervalMs, and always where a move ends. Both are retained.
+void mqttPublishChannels() {
+  const uint32_t nowMs = millis();
+  char topic[cfg::kMqttTopicCapacity];
+  for (const ShutterChannel& ch : channels) {
+    const uint8_t i = ch.id;
+    const bool moving = channelMoving(ch);
+    const long pos = currentLogicalPosition(ch);
+    const char* coverState = mqttCoverState(ch, moving, pos);
+    const int8_t percent = mqttCoverPosition(ch, pos);
+    const bool stateChanged = mqttLink.publishedState[i] == nullptr || strcmp(coverState, mqttLink.publishedState[i]) != 0;
+    if (stateChanged) {
+      mqttTopic(topic, i, "state");
+      if (!mqttPublish(topic, coverState, true)) return;
+      mqttLink.publishedState[i] = coverState;
+    }
+    if (percent == mqttLink.publishedPercent[i]) continue;
+    if (moving && !stateChanged && nowMs - mqttLink.positionPublishedMs[i] < cfg::kMqttPositionIntervalMs) continue;
+    char payload[8];
+    snprintf(payload, sizeof(payload), "%d", percent);
+    mqttTopic(topic, i, "position");
+    if (!mqttPublish(topic, payload, true)) return;
+    mqttLink.publishedPercent[i] = percent;
+    mqttLink.positionPublishedMs[i] = nowMs;
+  }
+}
+
+void mqttOnline() {
+  mqttLink.stage = MqttStage::Online;
+  mqttLink.backoffMs = cfg::kMqttMinBackoffMs;
+  mqttLink.pingOutstanding = false;
+  mqttLink.lastError = "";
+  ++mqttLink.connects;
+  Serial.printf("[MQTT] connected as %s, topics under %s/\n", mqttLink.nodeId, mqttLink.baseTopic);
+
+  char setFilter[cfg::kMqttTopicCapacity];
+  char positionFilter[cfg::kMqttTopicCapacity];
+  mqttTopic(setFilter, -1, "+/set");
+  mqttTopic(positionFilter, -1, "+/position/set");
+  const char* const filters[] = {setFilter, positionFilter};
+  if (!mqttSend(shutter::mqtt::encodeSubscribe(mqttTx, sizeof(mqttTx), 1, filters, 2))) return;
+
+  char topic[cfg::kMqttTopicCapacity];
+  mqttTopic(topic, -1, "availability");
+  if (!mqttPublish(topic, "online", true)) return;
+  if (mqttConfig.discovery) {
+    for (const ShutterChannel& ch : channels) {
+      if (!mqttPublishDiscovery(ch) || mqttLink.stage != MqttStage::Online) return;
+    }
+  }
+  for (uint8_t i = 0; i < cfg::kChannelCount; ++i) {
+    mqttLink.publishedState[i] = nullptr;
+    mqttLink.publishedPercent[i] = -1;
+  }
+  mqttPublishChannels();
+}
+
+// "<base>/<id>/set" takes OPEN, CLOSE or STOP; "<base>/<id>/position/set" takes 0..100 in
+// Home Assistant's sense (100 open). Both go through the same path as POST /api/move.
+void mqttHandleCommand(const shutter::mqtt::Message& message) {
+  const size_t baseLength = strlen(mqttLink.baseTopic);
+  if (message.topicLength <= baseLength + 1 || memcmp(message.topic, mqttLink.baseTopic, baseLength) != 0 ||
+      message.topic[baseLength] != '/') {
+    return;
+  }
+  size_t at = baseLength + 1;
+  long id = 0;
+  const size_t idStart = at;
+  while (at < message.topicLength && isdigit(static_cast<unsigned char>(message.topic[at])) && at - idStart < 3) {
+    id = id * 10 + (message.topic[at++] - '0');
+  }
+  if (at == idStart || id >= cfg::kChannelCount) return;
+  const char* rest = message.topic + at;
+  const size_t restLength = message.topicLength - at;
+  const bool positionCommand = restLength == 13 && memcmp(rest, "/position/set", 13) == 0;
+  if (!positionCommand && !(restLength == 4 && memcmp(rest, "/set", 4) == 0)) return;
+
+  char payload[16];
+  const size_t length = std::min(message.payloadLength, sizeof(payload) - 1);
+  memcpy(payload, message.payload, length);
+  payload[length] = '\0';
+
+  StaticJsonDocument<64> command;
+  if (positionCommand) {
+    char* end = nullptr;
+    const long position = strtol(payload, &end, 10);
+    if (end == payload || position < 0 || position > 100) {
+      mqttLink.lastError = "position must be 0..100";
+      return;
+    }
+    command["action"] = "set";
+    command["percent"] = 100 - position;
+  } else if (strcasecmp(payload, "OPEN") == 0) {
+    command["action"] = "open";
+  } else if (strcasecmp(payload, "CLOSE") == 0) {
+    command["action"] = "close";
+  } else if (strcasecmp(payload, "STOP") == 0) {
+    command["action"] = "stop";
+  } else {
+    mqttLink.lastError = "unknown command";
+    return;
+  }
+  ++mqttLink.commands;
+  const char* error = applyMoveCommand(channels[id], command.as<JsonVariantConst>());
+  if (error) mqttLink.lastError = error;
+}
+
+void mqttHandlePacket() {
+  shutter::mqtt::PacketReader<cfg::kMqttInboundCapacity>& reader = mqttLink.reader;
+  switch (reader.type()) {
+    case shutter::mqtt::PacketType::Connack:
+      if (mqttLink.stage != MqttStage::AwaitConnack) return;
+      if (shutter::mqtt::connackCode(reader.body(), reader.length()) != 0) {
+        mqttDrop("connection refused");
+        return;
+      }
+      mqttOnline();
+      return;
+    case shutter::mqtt::PacketType::Publish: {
+      shutter::mqtt::Message message;
+      if (mqttLink.stage == MqttStage::Online &&
+          shutter::mqtt::parsePublish(reader.flags(), reader.body(), reader.length(), &message)) {
+        mqttHandleCommand(message);
+      }
+      return;
+    }
+    case shutter::mqtt::PacketType::Pingresp:
+      mqttLink.pingOutstanding = false;
+      return;
+    default:
+      return;
+  }
+}
+
+// Reads whatever the socket holds, never waiting for more.
+void mqttPump() {
+  uint8_t chunk[64];
+  const MqttStage stage = mqttLink.stage;
+  int available;
+  while (mqttLink.stage == stage && (available = mqttLink.client.available()) > 0) {
+    const int n = mqttLink.client.read(chunk, std::min<size_t>(static_cast<size_t>(available), sizeof(chunk)));
+    if (n <= 0) return;
+    for (int i = 0; i < n && mqttLink.stage == stage; ++i) {
+      if (mqttLink.reader.push(chunk[i])) mqttHandlePacket();
+    }
+  }
+}
+
+// The DNS lookup blocks like the TCP connect does, so the address is kept between attempts:
+// it is looked up again only after a failed connect, a new host or a lost Wi-Fi link.
+void mqttConnect() {
+  if (!mqttLink.brokerResolved) {
+    if (!WiFi.hostByName(mqttConfig.host.c_str(), mqttLink.brokerIp)) {
+      mqttDrop("dns lookup failed");
+      return;
+    }
+    mqttLink.brokerResolved = true;
+  }
+  mqttLink.client.setTimeout(cfg::kMqttSocketTimeoutMs);
+  if (!mqttLink.client.connect(mqttLink.brokerIp, mqttConfig.port)) {
+    mqttLink.brokerResolved = false;
+    mqttDrop("tcp connect failed");
+    return;
+  }
+  mqttLink.client.setNoDelay(true);
+  mqttLink.reader.reset();
+
+  char willTopic[cfg::kMqttTopicCapacity];
+  mqttTopic(willTopic, -1, "availability");
+  shutter::mqtt::ConnectOptions options;
+  options.clientId = mqttLink.nodeId;
+  options.username = mqttConfig.user.c_str();
+  options.password = mqttConfig.password.c_str();
+  options.willTopic = willTopic;
+  options.willPayload = "offline";
+  options.keepAliveSec = cfg::kMqttKeepAliveSec;
+  const size_t length = shutter::mqtt::encodeConnect(mqttTx, sizeof(mqttTx), options);
+  if (length == 0) {
+    mqttDrop("connect packet too large");
+    return;
+  }
+  if (!mqttSend(length)) return;
+  mqttLink.stage = MqttStage::AwaitConnack;
+  mqttLink.dueMs = millis() + cfg::kMqttConnackTimeoutMs;
+}
+
+// Ends the session (a clean one announces "offline" itself) and starts over with the current
+// settings.
+void restartMqtt() {
+  if (mqttLink.stage == MqttStage::Online) {
+    char topic[cfg::kMqttTopicCapacity];
+    mqttTopic(topic, -1, "availability");
+    if (mqttPublish(topic, "offline", true)) {
+      mqttSend(shutter::mqtt::encodeEmpty(mqttTx, sizeof(mqttTx), shutter::mqtt::PacketType::Disconnect));
+    }
+  }
+  mqttLink.client.stop();
+  mqttLink.stage = MqttStage::Off;
+  mqttLink.brokerResolved = false;
+  mqttLink.backoffMs = cfg::kMqttMinBackoffMs;
+  mqttLink.lastError = "";
+}
+
+// Called from loop(). Nothing here waits on the broker except mqttConnect(): the TCP connect
+// and, for a host not resolved yet, the DNS lookup. Both only run while no motor moves; steps
+// come from timer1 either way.
+void serviceMqtt() {
+  const uint32_t nowMs = millis();
+  if (!mqttConfig.enabled || mqttConfig.host.length() == 0 || WiFi.status() != WL_CONNECTED) {
+    if (mqttLink.stage != MqttStage::Off) {
+      mqttLink.client.stop();
+      mqttLink.stage = MqttStage::Off;
+      mqttLink.brokerResolved = false;
+    }
+    return;
+  }
+
+  switch (mqttLink.stage) {
+    case MqttStage::Off:
+      snprintf(mqttLink.nodeId, sizeof(mqttLink.nodeId), "shutter_%06lx", static_cast<unsigned long>(ESP.getChipId()));
+      copyStringField(mqttLink.baseTopic, sizeof(mqttLink.baseTopic),
+                      mqttConfig.baseTopic.length() > 0 ? mqttConfig.baseTopic : String(mqttLink.nodeId));
+      mqttLink.stage = MqttStage::Waiting;
+      mqttLink.dueMs = nowMs;
+      return;
+
+    case MqttStage::Waiting:
+      if (static_cast<int32_t>(nowMs - mqttLink.dueMs) < 0) return;
+      if (anyChannelMoving() || otaJob.running) return;
+      mqttConnect();
+      return;
+
+    case MqttStage::AwaitConnack:
+      mqttPump();
+      if (mqttLink.stage != MqttStage::AwaitConnack) return;
+      if (!mqttLink.client.connected()) {
+        mqttDrop("connection closed");
+      } else if (static_cast<int32_t>(nowMs - mqttLink.dueMs) >= 0) {
+        mqttDrop("no connack");
+      }
+      return;
+
+    case MqttStage::Online: {
+      mqttPump();
+      if (mqttLink.stage != MqttStage::Online) return;
+      if (!mqttLink.client.connected()) {
+        mqttDrop("connection closed");
+        return;
+      }
+      const uint32_t keepAliveMs = cfg::kMqttKeepAliveSec * 1000UL;
+      if (mqttLink.pingOutstanding && nowMs - mqttLink.pingSentMs >= keepAliveMs) {
+        mqttDrop("keepalive timeout");
+        return;
+      }
+      if (!mqttLink.pingOutstanding && nowMs - mqttLink.lastSentMs >= keepAliveMs / 2) {
+        if (!mqttSend(shutter::mqtt::encodeEmpty(mqttTx, sizeof(mqttTx), shutter::mqtt::PacketType::Pingreq))) return;
+        mqttLink.pingOutstanding = true;
+        mqttLink.pingSentMs = nowMs;
+      }
+      if (nowMs - mqttLink.lastCheckMs < cfg::kMqttCheckIntervalMs) return;
+      mqttLink.lastCheckMs = nowMs;
+      mqttPublishChannels();
+      return;
+    }
+  }
+}
 
-  if (shouldPersistNow && !saveState(true)) {
-    sendError("failed to persist state", 500);
-    return;
-  }
+void fillMqttConfig(JsonObject root) {
+  root["ok"] = true;
+  root["mqttEnabled"] = mqttConfig.enabled;
+  root["mqttHost"] = mqttConfig.host.c_str();
+  root["mqttPort"] = mqttConfig.port;
+  root["mqttUser"] = mqttConfig.user.c_str();
+  root["mqttPasswordSet"] = mqttConfig.password.length() > 0;
+  root["mqttBaseTopic"] = mqttConfig.baseTopic.c_str();
+  root["mqttDiscovery"] = mqttConfig.discovery;
+  root["mqttState"] = mqttStageName();
+  root["mqttLastError"] = mqttLink.lastError;
+}
 
-  handleApiState();
+void handleApiMqttConfigGet() {
+  StaticJsonDocument<384> doc;
+  fillMqttConfig(doc.to<JsonObject>());
+  sendJsonDocument(200, doc);
 }
 
-void handleApiSettings() {
+bool isValidMqttBaseTopic(const String& topic) {
+  if (topic.length() == 0) return true;
+  if (topic.indexOf('+') >= 0 || topic.indexOf('#') >= 0) return false;
+  return !topic.startsWith("/") && !topic.endsWith("/");
+}
+
+void handleApiMqttConfigPost() {
   StaticJsonDocument<512> body;
   if (!parseJsonBody(body)) {
     sendError("invalid json");
     return;
   }
 
-  const long logicalPosBefore = currentLogicalPosition();
-  const long logicalTargetBefore = targetPosition;
-
-  if (body.containsKey("reverseDirection")) {
-    state.reverseDirection = body["reverseDirection"].as<bool>();
-  }
-  if (body.containsKey("wifiModemSleep")) {
-    state.wifiModemSleep = body["wifiModemSleep"].as<bool>();
-  }
-  if (body.containsKey("topOverdriveEnabled")) {
-    state.topOverdriveEnabled = body["topOverdriveEnabled"].as<bool>();
-  }
-  if (body.containsKey("maxSpeed")) {
-    state.maxSpeed = shutter::math::clampFloat(body["maxSpeed"].as<float>(), cfg::kMinSpeed, cfg::kMaxSpeed);
-  }
-  if (body.containsKey("acceleration")) {
-    state.acceleration = shutter::math::clampFloat(body["acceleration"].as<float>(), cfg::kMinAccel, cfg::kMaxAccel);
+  MqttConfig next = mqttConfig;
+  next.enabled = body["mqttEnabled"] | next.enabled;
+  next.discovery = body["mqttDiscovery"] | next.discovery;
+  if (body.containsKey("mqttHost")) next.host = String(static_cast<const char*>(body["mqttHost"] | ""));
+  if (body.containsKey("mqttUser")) next.user = String(static_cast<const char*>(body["mqttUser"] | ""));
+  // Left out of the request: keep the stored password, which GET never returns.
+  if (body.containsKey("mqttPassword")) next.password = String(static_cast<const char*>(body["mqttPassword"] | ""));
+  if (body.containsKey("mqttBaseTopic")) next.baseTopic = String(static_cast<const char*>(body["mqttBaseTopic"] | ""));
+  const long port = body["mqttPort"] | static_cast<long>(next.port);
+  next.host.trim();
+  next.baseTopic.trim();
+
+  if (port < 1 || port > 65535) {
+    sendError("mqttPort must be 1..65535");
+    return;
   }
-  if (body.containsKey("topOverdrivePercent")) {
-    state.topOverdrivePercent =
-        shutter::math::clampFloat(body["topOverdrivePercent"].as<float>(), cfg::kMinTopOverdrivePercent, cfg::kMaxTopOverdrivePercent);
+  next.port = static_cast<uint16_t>(port);
+  if (next.enabled && next.host.length() == 0) {
+    sendError("mqttHost is required");
+    return;
   }
-  if (body.containsKey("coilHoldMs")) {
-    state.coilHoldMs = static_cast<uint16_t>(shutter::math::clampLong(body["coilHoldMs"].as<long>(), 0, cfg::kMaxCoilHoldMs));
+  if (next.host.length() > cfg::kMaxMqttHostLength || next.user.length() > cfg::kMaxMqttUserLength ||
+      next.password.length() > cfg::kMaxMqttPasswordLength || next.baseTopic.length() > cfg::kMaxMqttBaseTopicLength) {
+    sendError("mqtt setting too long");
+    return;
   }
-  if (body.containsKey("travelSteps")) {
-    state.travelSteps = shutter::math::clampLong(body["travelSteps"].as<long>(), cfg::kMinTravelSteps, cfg::kMaxTravelSteps);
+  if (!isValidMqttBaseTopic(next.baseTopic)) {
+    sendError("mqttBaseTopic must not contain wildcards or leading/trailing '/'");
+    return;
   }
 
-  applyStepperSettings();
-  applyWiFiPowerMode();
+  mqttConfig = next;
+  restartMqtt();
+  requestSettingsCommit();
+  handleApiMqttConfigGet();
+}
 
-  const long clampedPos = clampLogicalPosition(logicalPosBefore);
-  targetPosition = clampLogicalPosition(logicalTargetBefore);
+// ---- Schedule -----------------------------------------------------------------------------
 
-  stepper.setCurrentPosition(logicalToRaw(clampedPos));
-  stepper.moveTo(logicalToRaw(targetPosition));
-  resetTopReferenceWhenStopped = false;
+// SNTP with the configured zone. The SDK keeps the server name pointer, so it points into
+// scheduleConfig and this runs again whenever that changes.
+void startClock() { configTime(scheduleConfig.timezone.c_str(), scheduleConfig.ntpServer.c_str()); }
 
-  markDirty();
-  if (!saveState(true)) {
-    sendError("failed to persist state", 500);
-    return;
+bool clockSynced(time_t now) { return now >= cfg::kMinValidEpoch; }
+
+void runScheduleRule(uint8_t index) {
+  const shutter::schedule::Rule& rule = scheduleConfig.rules[index];
+  StaticJsonDocument<64> body;
+  body["action"] = shutter::schedule::actionName(rule.action);
+  if (rule.action == shutter::schedule::Action::Set) body["percent"] = rule.centiPercent / 100.0f;
+  for (ShutterChannel& ch : channels) {
+    if ((rule.channels & (1U << ch.id)) != 0) applyMoveCommand(ch, body.as<JsonVariantConst>());
   }
-  handleApiState();
+  ++scheduleRun.fired;
+  scheduleRun.lastRule = static_cast<int8_t>(index);
+  scheduleRun.lastFiredAt = time(nullptr);
 }
 
-void fillFirmwareConfig(JsonObject root) {
-  normalizeFirmwareConfig();
-  root["ok"] = true;
-  root["firmwareRepo"] = firmwareRepo;
-  root["firmwareAssetName"] = firmwareAssetName;
-  root["firmwareFsAssetName"] = firmwareFsAssetName;
+// Local minutes since 1970-01-01 and the zone's offset from UTC at |now|.
+int32_t localMinuteAt(time_t now, int16_t* utcOffsetMinutes) {
+  tm local;
+  localtime_r(&now, &local);
+  const int32_t day = shutter::schedule::daysFromCivil(local.tm_year + 1900, static_cast<uint8_t>(local.tm_mon + 1),
+                                                       static_cast<uint8_t>(local.tm_mday));
+  const int32_t minute = day * shutter::schedule::kMinutesPerDay + local.tm_hour * 60 + local.tm_min;
+  *utcOffsetMinutes = static_cast<int16_t>(minute - static_cast<int32_t>(now / 60));
+  return minute;
 }
 
-bool performHttpOta(const String& url, bool updateFilesystem, String* errorMessage) {
-  if (errorMessage) errorMessage->clear();
+// Called from loop(): once a second looks at the clock, and past a minute boundary lets the
+// scheduler fire what came due. Sun times are only worked out when the local day changes.
+void serviceSchedule() {
+  const uint32_t nowMs = millis();
+  if (nowMs - scheduleRun.lastCheckMs < cfg::kScheduleCheckIntervalMs) return;
+  scheduleRun.lastCheckMs = nowMs;
+  const time_t now = time(nullptr);
+  if (!clockSynced(now)) return;
+  const int32_t utcMinute = static_cast<int32_t>(now / 60);
+  if (utcMinute == scheduleRun.lastUtcMinute) return;
+  scheduleRun.lastUtcMinute = utcMinute;
+  if (!scheduleConfig.enabled || scheduleConfig.ruleCount == 0) return;
+
+  int16_t utcOffsetMinutes = 0;
+  const int32_t localMinute = localMinuteAt(now, &utcOffsetMinutes);
+  scheduleRun.scheduler.advance(localMinute, utcOffsetMinutes, scheduleConfig.rules, scheduleConfig.ruleCount,
+                                scheduleConfig.site, ESP.getChipId(), runScheduleRule);
+}
 
-  const bool isHttps = url.startsWith("https://");
-  const bool isHttp = url.startsWith("http://");
-  if (!isHttps && !isHttp) {
-    if (errorMessage) *errorMessage = "unsupported url scheme";
-    return false;
+void formatMinuteOfDay(char* out, size_t size, int32_t minute) {
+  snprintf(out, size, "%02d:%02d", static_cast<int>(minute / 60), static_cast<int>(minute % 60));
+}
+
+bool parseMinuteOfDay(const char* text, int16_t* minute) {
+  unsigned hours = 0;
+  unsigned minutes = 0;
+  char tail = 0;
+  if (sscanf(text, "%u:%u%c", &hours, &minutes, &tail) != 2 || hours > 23 || minutes > 59) return false;
+  *minute = static_cast<int16_t>(hours * 60 + minutes);
+  return true;
+}
+
+void fillScheduleRuleJson(JsonObject dst, const shutter::schedule::Rule& rule) {
+  dst["days"] = rule.days;
+  dst["trigger"] = shutter::schedule::triggerName(rule.trigger);
+  if (rule.trigger == shutter::schedule::Trigger::Time) {
+    char at[8];
+    formatMinuteOfDay(at, sizeof(at), rule.minute);
+    dst["time"] = at;
+  } else {
+    dst["offset"] = rule.minute;
   }
-  ESPhttpUpdate.rebootOnUpdate(false);
-  ESPhttpUpdate.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
-  const char* targetName = updateFilesystem ? "filesystem" : "firmware";
-  int lastErr = 0;
-  String lastErrText = "unknown";
-
-  for (uint8_t attempt = 1; attempt <= cfg::kOtaMaxAttempts; ++attempt) {
-    delay(1);
-    yield();
-    if (WiFi.status() != WL_CONNECTED) {
-      if (errorMessage) *errorMessage = "wifi disconnected before OTA";
-      Serial.printf("[OTA] %s attempt %u/%u skipped: wifi disconnected\n",
-                    targetName, attempt, cfg::kOtaMaxAttempts);
-      return false;
-    }
+  dst["channels"] = rule.channels;
+  dst["action"] = shutter::schedule::actionName(rule.action);
+  if (rule.action == shutter::schedule::Action::Set) dst["percent"] = rule.centiPercent / 100.0f;
+  dst["jitter"] = rule.jitterMinutes;
+}
 
-    Serial.printf("[OTA] %s attempt %u/%u, timeout=%ums, rssi=%d, heap=%u, url=%s\n",
-                  targetName, attempt, cfg::kOtaMaxAttempts, cfg::kOtaClientTimeoutMs,
-                  WiFi.RSSI(), ESP.getFreeHeap(), url.c_str());
-
-    t_httpUpdate_return result = HTTP_UPDATE_FAILED;
-    if (isHttps) {
-      std::unique_ptr<BearSSL::WiFiClientSecure> client(new BearSSL::WiFiClientSecure());
-      client->setInsecure();
-      client->setTimeout(cfg::kOtaClientTimeoutMs);
-      if (updateFilesystem) {
-        result = ESPhttpUpdate.updateFS(*client, url);
-      } else {
-        result = ESPhttpUpdate.update(*client, url);
-      }
-    } else {
-      WiFiClient client;
-      client.setTimeout(cfg::kOtaClientTimeoutMs);
-      if (updateFilesystem) {
-        result = ESPhttpUpdate.updateFS(client, url);
-      } else {
-        result = ESPhttpUpdate.update(client, url);
-      }
+void fillScheduleJson(JsonObject root) {
+  root["ok"] = true;
+  root["scheduleEnabled"] = scheduleConfig.enabled;
+  root["timezone"] = scheduleConfig.timezone.c_str();
+  root["ntpServer"] = scheduleConfig.ntpServer.c_str();
+  root["located"] = scheduleConfig.site.located;
+  root["latitude"] = scheduleConfig.site.latitude;
+  root["longitude"] = scheduleConfig.site.longitude;
+  const time_t now = time(nullptr);
+  root["clockSynced"] = clockSynced(now);
+  if (clockSynced(now)) {
+    int16_t utcOffsetMinutes = 0;
+    const int32_t localMinute = localMinuteAt(now, &utcOffsetMinutes);
+    const int32_t day = localMinute / shutter::schedule::kMinutesPerDay;
+    char text[8];
+    formatMinuteOfDay(text, sizeof(text), localMinute - day * shutter::schedule::kMinutesPerDay);
+    root["localTime"] = text;
+    root["utcOffsetMinutes"] = utcOffsetMinutes;
+    root["weekday"] = shutter::schedule::weekday(day);
+    const shutter::schedule::DayPlan today = shutter::schedule::planDay(day, utcOffsetMinutes, scheduleConfig.site);
+    if (today.sunValid) {
+      formatMinuteOfDay(text, sizeof(text), today.sunrise);
+      root["sunrise"] = text;
+      formatMinuteOfDay(text, sizeof(text), today.sunset);
+      root["sunset"] = text;
     }
+  }
+  root["scheduleFired"] = scheduleRun.fired;
+  root["lastRule"] = scheduleRun.lastRule;
+  root["lastFiredAt"] = static_cast<uint32_t>(scheduleRun.lastFiredAt);
+  JsonArray rules = root.createNestedArray("rules");
+  for (uint8_t i = 0; i < scheduleConfig.ruleCount; ++i) fillScheduleRuleJson(rules.createNestedObject(), scheduleConfig.rules[i]);
+}
+
+void handleApiScheduleGet() {
+  fillScheduleJson(apiDocument.to<JsonObject>());
+  sendJsonDocument(200, apiDocument);
+}
 
-    if (result == HTTP_UPDATE_OK) {
-      Serial.printf("[OTA] %s attempt %u/%u result=OK\n", targetName, attempt, cfg::kOtaMaxAttempts);
-      return true;
+// {"days":31,"trigger":"sunrise","offset":-15,"action":"open"} or
+// {"time":"22:30","action":"set","percent":60,"channels":1,"jitter":10}. Returns the error.
+const char* parseScheduleRule(JsonObjectConst src, shutter::schedule::Rule* rule) {
+  using shutter::schedule::Action;
+  using shutter::schedule::Trigger;
+  const long days = src["days"] | static_cast<long>(shutter::schedule::kAllDays);
+  if (days < 0 || days > shutter::schedule::kAllDays) return "rule days must be 0..127";
+  rule->days = static_cast<uint8_t>(days);
+
+  const char* trigger = src["trigger"] | "time";
+  if (strcmp(trigger, "time") == 0) {
+    rule->trigger = Trigger::Time;
+    if (!parseMinuteOfDay(src["time"] | "", &rule->minute)) return "rule time must be HH:MM";
+  } else if (strcmp(trigger, "sunrise") == 0 || strcmp(trigger, "sunset") == 0) {
+    rule->trigger = strcmp(trigger, "sunrise") == 0 ? Trigger::Sunrise : Trigger::Sunset;
+    const long offset = src["offset"] | 0L;
+    if (offset < -shutter::schedule::kMaxSunOffsetMinutes || offset > shutter::schedule::kMaxSunOffsetMinutes) {
+      return "rule offset must be -720..720";
     }
+    rule->minute = static_cast<int16_t>(offset);
+  } else {
+    return "rule trigger must be time, sunrise or sunset";
+  }
 
-    lastErr = ESPhttpUpdate.getLastError();
-    lastErrText = ESPhttpUpdate.getLastErrorString();
-    Serial.printf("[OTA] %s attempt %u/%u failed: code=%d msg=%s\n",
-                  targetName, attempt, cfg::kOtaMaxAttempts, lastErr, lastErrText.c_str());
+  const long allChannels = (1L << cfg::kChannelCount) - 1;
+  const long mask = src["channels"] | allChannels;
+  if (mask < 1 || mask > allChannels) return "rule channels must name channels of this board";
+  rule->channels = static_cast<uint8_t>(mask);
 
-    if (attempt < cfg::kOtaMaxAttempts) {
-      delay(cfg::kOtaRetryDelayMs);
-      yield();
-    }
+  const char* action = src["action"] | "";
+  if (strcmp(action, "open") == 0) {
+    rule->action = Action::Open;
+  } else if (strcmp(action, "close") == 0) {
+    rule->action = Action::Close;
+  } else if (strcmp(action, "set") == 0) {
+    const float percent = src["percent"] | -1.0f;
+    if (percent < 0.0f || percent > 100.0f) return "rule percent must be between 0 and 100";
+    rule->action = Action::Set;
+    rule->centiPercent = static_cast<uint16_t>(lroundf(percent * 100.0f));
+  } else {
+    return "rule action must be open, close or set";
+  }
+
+  const long jitter = src["jitter"] | 0L;
+  if (jitter < 0 || jitter > cfg::kMaxScheduleJitterMinutes) return "rule jitter must be 0..60";
+  rule->jitterMinutes = static_cast<uint8_t>(jitter);
+  return nullptr;
+}
+
+// Any subset of the GET fields; "rules" replaces the whole list, "latitude": null forgets the
+// location.
+void handleApiSchedulePost() {
+  JsonDocument& body = apiDocument;
+  if (!parseJsonBody(body)) {
+    sendError("invalid json");
+    return;
   }
 
-  if (errorMessage) {
-    *errorMessage = String(lastErr) + ": " + lastErrText + " (attempts=" + String(cfg::kOtaMaxAttempts) + ")";
+  ScheduleConfig next = scheduleConfig;
+  next.enabled = body["scheduleEnabled"] | next.enabled;
+  if (body.containsKey("timezone")) next.timezone = String(static_cast<const char*>(body["timezone"] | ""));
+  if (body.containsKey("ntpServer")) next.ntpServer = String(static_cast<const char*>(body["ntpServer"] | ""));
+  next.timezone.trim();
+  next.ntpServer.trim();
+  if (next.timezone.length() == 0 || next.timezone.length() > cfg::kMaxTimezoneLength) {
+    sendError("timezone must be a POSIX TZ string of up to 47 characters");
+    return;
   }
-  return false;
+  if (next.ntpServer.length() == 0 || next.ntpServer.length() > cfg::kMaxNtpServerLength) {
+    sendError("ntpServer must be 1..47 characters");
+    return;
+  }
+  if (body.containsKey("latitude") && body["latitude"].isNull()) {
+    next.site.located = false;
+  } else if (body.containsKey("latitude") || body.containsKey("longitude")) {
+    const float latitude = body["latitude"] | 1000.0f;
+    const float longitude = body["longitude"] | 1000.0f;
+    if (latitude < -90.0f || latitude > 90.0f || longitude < -180.0f || longitude > 180.0f) {
+      sendError("latitude and longitude must be given together, within -90..90 and -180..180");
+      return;
+    }
+    next.site.located = true;
+    next.site.latitude = latitude;
+    next.site.longitude = longitude;
+  }
+  if (body.containsKey("rules")) {
+    JsonArrayConst rules = body["rules"].as<JsonArrayConst>();
+    if (rules.isNull() || rules.size() > cfg::kMaxScheduleRules) {
+      sendError("rules must be an array of up to 12 rules");
+      return;
+    }
+    next.ruleCount = 0;
+    for (JsonVariantConst src : rules) {
+      shutter::schedule::Rule rule = {};
+      const char* error = parseScheduleRule(src.as<JsonObjectConst>(), &rule);
+      if (error != nullptr) {
+        sendError(error);
+        return;
+      }
+      next.rules[next.ruleCount++] = rule;
+    }
+    for (uint8_t i = next.ruleCount; i < cfg::kMaxScheduleRules; ++i) next.rules[i] = {};
+  }
+
+  const bool clockChanged = next.timezone != scheduleConfig.timezone || next.ntpServer != scheduleConfig.ntpServer;
+  scheduleConfig = next;
+  if (clockChanged) startClock();
+  // Start over from the current minute: a rule due right now fires, nothing before it replays.
+  scheduleRun.scheduler.reset();
+  scheduleRun.lastUtcMinute = -1;
+  scheduleRun.lastCheckMs = millis() - cfg::kScheduleCheckIntervalMs;
+  requestSettingsCommit();
+  handleApiScheduleGet();
+}
+
+void fillFirmwareConfig(JsonObject root) {
+  normalizeFirmwareConfig();
+  root["ok"] = true;
+  root["firmwareRepo"] = firmwareRepo;
+  root["firmwareAssetName"] = firmwareAssetName;
+  root["firmwareFsAssetName"] = firmwareFsAssetName;
 }
 
 bool probeGithubTcp(String* errorMessage) {
@@ -771,43 +4422,11 @@ void handleApiFirmwareConfigPost() {
     return;
   }
 
-  markDirty();
-  if (!saveState(true)) {
-    sendError("failed to persist state", 500);
-    return;
-  }
+  requestSettingsCommit();
   handleApiFirmwareConfigGet();
 }
 
 
-bool runOtaUpdate(const String& firmwareUrl, const String& filesystemUrl, bool includeFilesystem, String* errorMessage) {
-  if (firmwareUrl.length() == 0) {
-    if (errorMessage) *errorMessage = "firmware url missing";
-    return false;
-  }
-  if (includeFilesystem && filesystemUrl.length() == 0) {
-    if (errorMessage) *errorMessage = "filesystem url missing";
-    return false;
-  }
-
-  String otaErr;
-  const bool restoreModemSleep = state.wifiModemSleep;
-  WiFi.setSleepMode(WIFI_NONE_SLEEP);
-
-  bool ok = true;
-  if (includeFilesystem && !performHttpOta(filesystemUrl, true, &otaErr)) {
-    if (errorMessage) *errorMessage = String("filesystem update failed: ") + otaErr;
-    ok = false;
-  }
-  if (ok && !performHttpOta(firmwareUrl, false, &otaErr)) {
-    if (errorMessage) *errorMessage = String("firmware update failed: ") + otaErr;
-    ok = false;
-  }
-
-  WiFi.setSleepMode(restoreModemSleep ? WIFI_MODEM_SLEEP : WIFI_NONE_SLEEP);
-  return ok;
-}
-
 bool queueOtaJob(
     const String& firmwareUrl,
     const String& filesystemUrl,
@@ -844,50 +4463,228 @@ bool queueOtaJob(
   return true;
 }
 
-void processOtaJob() {
-  if (!otaJob.pending || otaJob.running || otaJob.rebootScheduled) return;
-  if (millis() - otaJob.queuedAtMs < cfg::kOtaQueueStartDelayMs) return;
-
-  otaJob.pending = false;
-  otaJob.running = true;
-  otaJob.startedAtMs = millis();
-  otaJob.phase = "starting";
-  otaJob.lastError = "";
+const char* otaStepName() { return otaJob.filesystemStep ? "filesystem" : "firmware"; }
 
-  // OTA blocks the main loop for a while; stop motion first to avoid leaving active drive.
-  targetPosition = currentLogicalPosition();
-  stepper.moveTo(logicalToRaw(targetPosition));
-  resetTopReferenceWhenStopped = false;
-  disableMotorOutputs();
-  saveState(true);
+// Drops the connection and, if an image is half written, discards it: Update.end(false) on an
+// unfinished image resets the updater without arming the bootloader.
+void releaseOtaTransfer() {
+  if (Update.isRunning()) Update.end(false);
+  otaHttp.end();
+  otaClient.reset();
+}
 
-  Serial.printf(
-      "[OTA] job start source=%s tag=%s includeFS=%u queuedFor=%lus fw=%s fs=%s\n",
-      otaJob.source.c_str(),
-      otaJob.tag.c_str(),
-      static_cast<unsigned>(otaJob.includeFilesystem),
-      static_cast<unsigned long>((millis() - otaJob.queuedAtMs) / 1000),
-      otaJob.firmwareUrl.c_str(),
-      otaJob.filesystemUrl.c_str());
-
-  otaJob.phase = "updating";
-  String err;
-  const bool ok = runOtaUpdate(otaJob.firmwareUrl, otaJob.filesystemUrl, otaJob.includeFilesystem, &err);
+void finishOtaJob(const char* phase, const String& error) {
+  releaseOtaTransfer();
+  otaChunk.reset();
   otaJob.running = false;
+  otaJob.phase = phase;
+  otaJob.lastError = error;
+  applyWiFiPowerMode();
+}
+
+bool beginOtaDownload(String* errorMessage) {
+  const String& url = otaJob.filesystemStep ? otaJob.filesystemUrl : otaJob.firmwareUrl;
+  if (url.startsWith("https://")) {
+    BearSSL::WiFiClientSecure* secure = new BearSSL::WiFiClientSecure();
+    secure->setInsecure();
+    otaClient.reset(secure);
+  } else if (url.startsWith("http://")) {
+    otaClient.reset(new WiFiClient());
+  } else {
+    *errorMessage = "unsupported url scheme";
+    return false;
+  }
+  otaClient->setTimeout(cfg::kOtaClientTimeoutMs);
+
+  static const char* kOtaHeaders[] = {"x-MD5"};
+  otaHttp.setFollowRedirects(HTTPC_FORCE_FOLLOW_REDIRECTS);
+  otaHttp.setTimeout(cfg::kOtaClientTimeoutMs);
+  otaHttp.collectHeaders(kOtaHeaders, 1);
+  if (!otaHttp.begin(*otaClient, url)) {
+    *errorMessage = "http begin failed";
+    return false;
+  }
+  const int code = otaHttp.GET();
+  if (code != HTTP_CODE_OK) {
+    *errorMessage = code < 0 ? HTTPClient::errorToString(code) : String("http status ") + code;
+    return false;
+  }
+  const int size = otaHttp.getSize();
+  if (size <= 0) {
+    *errorMessage = "missing content length";
+    return false;
+  }
+
+  // The filesystem image is written over the mounted partition.
+  if (otaJob.filesystemStep) LittleFS.end();
+  if (!Update.begin(static_cast<size_t>(size), otaJob.filesystemStep ? U_FS : U_FLASH)) {
+    *errorMessage = Update.getErrorString();
+    return false;
+  }
+  const String md5 = otaHttp.header("x-MD5");
+  if (md5.length() == 32) Update.setMD5(md5.c_str());
+
+  otaJob.totalBytes = static_cast<uint32_t>(size);
+  otaJob.bytesDone = 0;
+  otaJob.downloadStartedMs = millis();
+  otaJob.lastByteMs = otaJob.downloadStartedMs;
+  return true;
+}
+
+// Moves at most one chunk from the socket into the updater. Returns false on error; the image
+// is complete and verified once bytesDone reaches totalBytes.
+bool pumpOtaDownload(String* errorMessage) {
+  WiFiClient* stream = otaHttp.getStreamPtr();
+  const uint32_t nowMs = millis();
+  const size_t available = stream ? static_cast<size_t>(stream->available()) : 0;
+  if (available == 0) {
+    if (stream == nullptr || !stream->connected()) {
+      *errorMessage = String("connection closed at ") + otaJob.bytesDone + "/" + otaJob.totalBytes;
+      return false;
+    }
+    if (nowMs - otaJob.lastByteMs > cfg::kOtaClientTimeoutMs) {
+      *errorMessage = String("stalled at ") + otaJob.bytesDone + "/" + otaJob.totalBytes;
+      return false;
+    }
+    return true;
+  }
+
+  size_t want = available < cfg::kOtaChunkBytes ? available : cfg::kOtaChunkBytes;
+  const uint32_t remaining = otaJob.totalBytes - otaJob.bytesDone;
+  if (want > remaining) want = remaining;
+  const int got = stream->read(otaChunk.get(), want);
+  if (got <= 0) return true;
+  if (Update.write(otaChunk.get(), static_cast<size_t>(got)) != static_cast<size_t>(got)) {
+    *errorMessage = Update.getErrorString();
+    return false;
+  }
+  otaJob.bytesDone += static_cast<uint32_t>(got);
+  otaJob.lastByteMs = nowMs;
+
+  if (otaJob.bytesDone < otaJob.totalBytes) return true;
+  // end() checks the size, the MD5 when the server sent one and, for firmware, the image header.
+  if (!Update.end()) {
+    *errorMessage = String("verify failed: ") + Update.getErrorString();
+    return false;
+  }
+  return true;
+}
 
-  if (!ok) {
-    otaJob.phase = "failed";
-    otaJob.lastError = err;
-    Serial.printf("[OTA] job failed: %s\n", err.c_str());
+void failOtaAttempt(const String& error) {
+  releaseOtaTransfer();
+  Serial.printf("[OTA] %s attempt %u/%u failed: %s\n", otaStepName(), otaJob.attempt, cfg::kOtaMaxAttempts, error.c_str());
+
+  if (otaJob.attempt < cfg::kOtaMaxAttempts) {
+    otaJob.stage = OtaStage::RetryWait;
+    otaJob.stageDueMs = millis() + cfg::kOtaRetryDelayMs;
+    otaJob.phase = "retrying";
+    otaJob.lastError = error;
+    return;
+  }
+
+  otaJob.stage = OtaStage::Idle;
+  // A partly written filesystem image may not mount; the next boot formats it if so.
+  if (otaJob.filesystemStep) {
+    LittleFS.begin();
+    loadStaticAssets();
+  }
+  Serial.printf("[OTA] job failed: %s\n", error.c_str());
+  finishOtaJob("failed", String(otaStepName()) + " update failed: " + error + " (attempts=" + String(cfg::kOtaMaxAttempts) + ")");
+}
+
+void completeOtaStep() {
+  Serial.printf("[OTA] %s complete: %u bytes in %lums\n", otaStepName(), otaJob.bytesDone,
+                static_cast<unsigned long>(millis() - otaJob.downloadStartedMs));
+  releaseOtaTransfer();
+  if (otaJob.filesystemStep) {
+    LittleFS.begin();
+    loadStaticAssets();
+    otaJob.filesystemStep = false;
+    otaJob.attempt = 0;
+    otaJob.stage = OtaStage::Connect;
     return;
   }
 
+  otaJob.stage = OtaStage::Reboot;
+  otaJob.stageDueMs = millis() + cfg::kOtaRebootDelayMs;
   otaJob.rebootScheduled = true;
-  otaJob.phase = "completed";
-  otaJob.lastError = "";
-  Serial.println("[OTA] job complete, rebooting");
-  delay(300);
-  ESP.restart();
+  finishOtaJob("completed", "");
+  Serial.println("[OTA] job complete, rebooting when the motor is idle");
+}
+
+void processOtaJob() {
+  const uint32_t nowMs = millis();
+  if (otaJob.pending) {
+    if (nowMs - otaJob.queuedAtMs < cfg::kOtaQueueStartDelayMs) return;
+    otaJob.pending = false;
+    otaJob.running = true;
+    otaJob.startedAtMs = nowMs;
+    otaJob.lastError = "";
+    otaJob.filesystemStep = otaJob.includeFilesystem;
+    otaJob.attempt = 0;
+    otaJob.bytesDone = 0;
+    otaJob.totalBytes = 0;
+    otaJob.stage = OtaStage::Connect;
+    otaChunk.reset(new uint8_t[cfg::kOtaChunkBytes]);
+    applyWiFiPowerMode();
+    Serial.printf(
+        "[OTA] job start source=%s tag=%s includeFS=%u queuedFor=%lus fw=%s fs=%s\n",
+        otaJob.source.c_str(),
+        otaJob.tag.c_str(),
+        static_cast<unsigned>(otaJob.includeFilesystem),
+        static_cast<unsigned long>((nowMs - otaJob.queuedAtMs) / 1000),
+        otaJob.firmwareUrl.c_str(),
+        otaJob.filesystemUrl.c_str());
+    return;
+  }
+
+  switch (otaJob.stage) {
+    case OtaStage::Idle:
+      return;
+
+    case OtaStage::RetryWait:
+      if (static_cast<int32_t>(nowMs - otaJob.stageDueMs) < 0) return;
+      otaJob.stage = OtaStage::Connect;
+      return;
+
+    case OtaStage::Connect: {
+      ++otaJob.attempt;
+      otaJob.phase = "connecting";
+      if (WiFi.status() != WL_CONNECTED) {
+        failOtaAttempt("wifi disconnected");
+        return;
+      }
+      Serial.printf("[OTA] %s attempt %u/%u, timeout=%ums, rssi=%d, heap=%u\n", otaStepName(), otaJob.attempt,
+                    cfg::kOtaMaxAttempts, cfg::kOtaClientTimeoutMs, WiFi.RSSI(), ESP.getFreeHeap());
+      String err;
+      if (!beginOtaDownload(&err)) {
+        failOtaAttempt(err);
+        return;
+      }
+      otaJob.stage = OtaStage::Download;
+      otaJob.phase = "downloading";
+      return;
+    }
+
+    case OtaStage::Download: {
+      String err;
+      if (!pumpOtaDownload(&err)) {
+        failOtaAttempt(err);
+        return;
+      }
+      if (otaJob.bytesDone >= otaJob.totalBytes) completeOtaStep();
+      return;
+    }
+
+    case OtaStage::Reboot:
+      // The new image is armed; let a running move finish so the saved position is exact.
+      if (static_cast<int32_t>(nowMs - otaJob.stageDueMs) < 0 || anyChannelMoving()) return;
+      for (ShutterChannel& ch : channels) disableMotorOutputs(ch);
+      saveState(true);
+      delay(100);
+      ESP.restart();
+      return;
+  }
 }
 
 void handleApiFirmwareUpdateLatest() {
@@ -1036,6 +4833,7 @@ void handleApiWifiReset() {
   doc["ok"] = true;
   doc["message"] = "wifi settings cleared, rebooting";
   sendJsonDocument(200, doc);
+  flushSettingsCommit();
 
   delay(500);
   ESP.restart();
@@ -1046,39 +4844,46 @@ void handleApiReboot() {
   doc["ok"] = true;
   doc["message"] = "rebooting";
   sendJsonDocument(200, doc);
+  flushSettingsCommit();
   delay(300);
   ESP.restart();
 }
 
-void handleNotFound() {
-  if (!LittleFS.exists("/index.html")) {
-    server.send(404, "text/plain", "Not found");
-    return;
-  }
-  File file = LittleFS.open("/index.html", "r");
-  server.streamFile(file, "text/html");
-  file.close();
-}
+void handleNotFound() { serveStaticAsset(staticAssets[0]); }
 
 void setupWebServer() {
-  server.on("/", HTTP_GET, []() {
-    if (!LittleFS.exists("/index.html")) {
-      server.send(500, "text/plain", "index.html missing");
-      return;
-    }
-    File file = LittleFS.open("/index.html", "r");
-    server.streamFile(file, "text/html");
-    file.close();
-  });
-  server.serveStatic("/app.js", LittleFS, "/app.js");
-  server.serveStatic("/styles.css", LittleFS, "/styles.css");
+  static const char* kCollectedHeaders[] = {"If-None-Match"};
+  server.collectHeaders(kCollectedHeaders, 1);
+  for (const StaticAsset& asset : staticAssets) {
+    server.on(asset.uri, HTTP_GET, [&asset]() { serveStaticAsset(asset); });
+  }
 
   server.on("/api/state", HTTP_GET, handleApiState);
+  server.on("/api/state/lite", HTTP_GET, handleApiStateLite);
+  server.on("/api/adc", HTTP_GET, handleApiAdc);
+  server.on("/api/events", HTTP_GET, handleApiEvents);
   server.on("/api/move", HTTP_POST, handleApiMove);
   server.on("/api/calibrate", HTTP_POST, handleApiCalibrate);
   server.on("/api/settings", HTTP_POST, handleApiSettings);
+  server.on("/api/channels", HTTP_GET, handleApiChannels);
+  server.on("/api/channels/move", HTTP_POST, handleApiChannelsMove);
+  server.on("/api/group/move", HTTP_POST, handleApiGroupMove);
+  server.on(UriBraces("/api/channels/{}"), HTTP_GET, handleApiChannelGet);
+  server.on(UriBraces("/api/channels/{}/move"), HTTP_POST, handleApiChannelMove);
+  server.on(UriBraces("/api/channels/{}/calibrate"), HTTP_POST, handleApiChannelCalibrate);
+  server.on(UriBraces("/api/channels/{}/settings"), HTTP_POST, handleApiChannelSettings);
+  server.on("/api/stepper/trace", HTTP_GET, handleApiStepperTraceGet);
+  server.on("/api/stepper/trace", HTTP_POST, handleApiStepperTracePost);
+  server.on("/api/metrics", HTTP_GET, handleApiMetricsGet);
+  server.on("/api/metrics", HTTP_POST, handleApiMetricsPost);
   server.on("/api/wifi/reset", HTTP_POST, handleApiWifiReset);
   server.on("/api/system/reboot", HTTP_POST, handleApiReboot);
+  server.on("/api/mqtt/config", HTTP_GET, handleApiMqttConfigGet);
+  server.on("/api/mqtt/config", HTTP_POST, handleApiMqttConfigPost);
+  server.on("/api/presets", HTTP_GET, handleApiPresetsGet);
+  server.on("/api/presets", HTTP_POST, handleApiPresetsPost);
+  server.on("/api/schedule", HTTP_GET, handleApiScheduleGet);
+  server.on("/api/schedule", HTTP_POST, handleApiSchedulePost);
   server.on("/api/firmware/config", HTTP_GET, handleApiFirmwareConfigGet);
   server.on("/api/firmware/config", HTTP_POST, handleApiFirmwareConfigPost);
   server.on("/api/firmware/check/latest", HTTP_POST, handleApiFirmwareCheckLatest);
@@ -1090,7 +4895,66 @@ void setupWebServer() {
   server.begin();
 }
 
+// Static address when one is configured, else the cached lease when |useLease|, else DHCP.
+void configureWiFiAddress(bool useLease) {
+  WifiAddress address = wifiStaticAddress;
+  if (address.ip == 0 && useLease) address = wifiLink.lease;
+  if (address.ip != 0) {
+    WiFi.config(IPAddress(address.ip), IPAddress(address.gateway), IPAddress(address.subnet), IPAddress(address.dns));
+  } else {
+    const IPAddress none(static_cast<uint32_t>(0));
+    WiFi.config(none, none, none);
+  }
+}
+
+bool waitForWiFi(uint32_t timeoutMs) {
+  const uint32_t startMs = millis();
+  while (WiFi.status() != WL_CONNECTED && millis() - startMs < timeoutMs) {
+    delay(50);
+  }
+  return WiFi.status() == WL_CONNECTED;
+}
+
+// Joins the cached access point on its channel without a scan. Uses the credentials the SDK
+// keeps in flash (ours or the ones entered in WiFiManager).
+bool connectWiFiFast() {
+  if (!state.wifiFastConnect || wifiLink.channel == 0) return false;
+  configureWiFiAddress(true);
+  String ssid = WiFi.SSID();
+  String pass = WiFi.psk();
+  if (ssid.length() == 0) {
+    ssid = cfg::kDefaultWifiSsid;
+    pass = cfg::kDefaultWifiPass;
+  }
+  // Not persisted: the SDK must keep scanning for any BSSID when it reconnects on its own.
+  WiFi.persistent(false);
+  WiFi.begin(ssid.c_str(), pass.c_str(), wifiLink.channel, wifiLink.bssid);
+  WiFi.persistent(true);
+  return waitForWiFi(cfg::kFastWifiConnectTimeoutMs);
+}
+
+// Caches the access point and, when DHCP assigned the address, the lease; persisted with the
+// next saveState().
+void rememberWiFiLink(bool leaseFromDhcp) {
+  WifiLinkCache link = wifiLink;
+  memcpy(link.bssid, WiFi.BSSID(), sizeof(link.bssid));
+  link.channel = static_cast<uint8_t>(WiFi.channel());
+  if (leaseFromDhcp) {
+    link.lease.ip = WiFi.localIP();
+    link.lease.gateway = WiFi.gatewayIP();
+    link.lease.subnet = WiFi.subnetMask();
+    link.lease.dns = WiFi.dnsIP();
+  }
+  if (memcmp(link.bssid, wifiLink.bssid, sizeof(link.bssid)) == 0 && link.channel == wifiLink.channel &&
+      memcmp(&link.lease, &wifiLink.lease, sizeof(link.lease)) == 0) {
+    return;
+  }
+  wifiLink = link;
+  markDirty();
+}
+
 void setupWiFi() {
+  const uint32_t startMs = millis();
   WiFi.mode(WIFI_STA);
   WiFi.setSleepMode(WIFI_NONE_SLEEP);
   // ESP8266 core 3.x keeps persistence disabled by default.
@@ -1099,21 +4963,88 @@ void setupWiFi() {
   WiFi.setAutoConnect(true);
   WiFi.setAutoReconnect(true);
 
-  WiFi.begin(cfg::kDefaultWifiSsid, cfg::kDefaultWifiPass);
-  const uint32_t startMs = millis();
-  while (WiFi.status() != WL_CONNECTED && millis() - startMs < cfg::kDefaultWifiConnectTimeoutMs) {
-    delay(250);
+  if (connectWiFiFast()) {
+    wifiConnectPath = "fast";
+    // Joining proves nothing about the lease: the router may have expired it and handed the
+    // address to another host. Renewed over DHCP once up.
+    if (wifiStaticAddress.ip == 0 && wifiLink.lease.ip != 0) {
+      wifiLeaseRenewal = LeaseRenewal::Pending;
+      wifiLeaseRenewalDueMs = millis() + cfg::kWifiLeaseRenewDelayMs;
+    }
+  } else {
+    // A stale cache (the router changed channel, the access point was replaced) falls
+    // through to the full scan and a fresh DHCP lease.
+    configureWiFiAddress(false);
+    WiFi.begin(cfg::kDefaultWifiSsid, cfg::kDefaultWifiPass);
+    if (waitForWiFi(cfg::kDefaultWifiConnectTimeoutMs)) {
+      wifiConnectPath = "full";
+    } else {
+      wifiManager.setConfigPortalTimeout(cfg::kApPortalTimeoutSec);
+      const bool connected = wifiManager.autoConnect(cfg::kApSsid, cfg::kApPass);
+      if (!connected) {
+        delay(1000);
+        ESP.restart();
+      }
+      wifiConnectPath = "portal";
+    }
+  }
+  wifiConnectMs = millis() - startMs;
+  rememberWiFiLink(strcmp(wifiConnectPath, "fast") != 0 && wifiStaticAddress.ip == 0);
+
+  applyWiFiPowerMode();
+}
+
+// After a fast join: back to DHCP, so the router renews the lease or hands out another one,
+// then the cache takes whatever DHCP settled on.
+void serviceWiFiLease() {
+  if (wifiLeaseRenewal == LeaseRenewal::Idle || static_cast<int32_t>(millis() - wifiLeaseRenewalDueMs) < 0) return;
+  if (WiFi.status() != WL_CONNECTED) return;
+  if (wifiLeaseRenewal == LeaseRenewal::Pending) {
+    configureWiFiAddress(false);
+    wifiLeaseRenewal = LeaseRenewal::Renewing;
+    wifiLeaseRenewalDueMs = millis() + cfg::kWifiDhcpSettleMs;
+    return;
   }
-  if (WiFi.status() == WL_CONNECTED) return;
+  rememberWiFiLink(true);
+  wifiLeaseRenewal = LeaseRenewal::Idle;
+}
 
-  wifiManager.setConfigPortalTimeout(cfg::kApPortalTimeoutSec);
-  const bool connected = wifiManager.autoConnect(cfg::kApSsid, cfg::kApPass);
-  if (!connected) {
-    delay(1000);
-    ESP.restart();
+// End-of-move bookkeeping and coil release for one channel, from loop().
+void serviceChannelMotion(ShutterChannel& ch) {
+  const bool isMoving = stepperMoving(ch);
+
+  if (ch.motionActive && !isMoving) {
+    ch.motionActive = false;
+    ch.motionStoppedAtMs = millis();
+    settleMove(ch);
+    if (ch.resetTopReferenceWhenStopped) {
+      // The whole overdrive ran without the stall detector meeting the stop.
+      if (ch.settings.driftAutoTune && state.stallDetection) ch.driftTuner.missedWall();
+      anchorLogicalPosition(ch, 0);
+      ch.compensation.load(-1);
+      markTopReference(ch);
+      ch.resetTopReferenceWhenStopped = false;
+    }
+    if (!ch.motionQueue.empty()) {
+      // Braked for a reversal or reached a queued stop: the next move starts from here.
+      const shutter::motion::MotionCommand next = ch.motionQueue.front();
+      ch.motionQueue.pop();
+      dispatchMotion(ch, next);
+      return;
+    }
+    ch.targetPosition = currentLogicalPosition(ch);
+    saveState(true);
   }
 
-  applyWiFiPowerMode();
+  if (!isMoving) {
+    // A released channel stays released until the next move; an idle hold keeps chopping.
+    const bool holding = millis() - ch.motionStoppedAtMs < ch.settings.coilHoldMs;
+    if (holding && ch.coilDuty != 0) {
+      setCoilDuty(ch, ch.settings.holdDutyPercent);
+    } else if (!holding) {
+      setCoilDuty(ch, ch.settings.idleHoldDutyPercent);
+    }
+  }
 }
 
 void setup() {
@@ -1124,54 +5055,52 @@ void setup() {
     LittleFS.format();
     LittleFS.begin();
   }
+  loadStaticAssets();
 
-  EEPROM.begin(cfg::kEepromSize);
-  eepromReady = true;
-
+  for (uint8_t i = 0; i < cfg::kChannelCount; ++i) channels[i].id = i;
   loadState();
 
-  applyStepperSettings();
-  state.currentPosition = clampLogicalPosition(state.currentPosition);
-  targetPosition = state.currentPosition;
-  stepper.setCurrentPosition(logicalToRaw(state.currentPosition));
-  stepper.moveTo(logicalToRaw(targetPosition));
-  disableMotorOutputs();
+  metricsCyclesPerUs = ESP.getCpuFreqMHz();
+  setupStepEngine();
+  for (ShutterChannel& ch : channels) {
+    ch.settings.currentPosition = clampLogicalPosition(ch, ch.settings.currentPosition);
+    ch.targetPosition = ch.settings.currentPosition;
+    resetStepperPosition(ch, logicalToRaw(ch, ch.settings.currentPosition));
+    disableMotorOutputs(ch);
+  }
 
   setupWiFi();
+  startClock();
   setupWebServer();
+  // A rebooted sender must not start at the sequence its last command used.
+  groupLink.nextSequence = static_cast<uint16_t>(ESP.getCycleCount() ^ micros());
 
   saveState(true);
+  resetPowerBudget();
 }
 
 void loop() {
+  const uint32_t loopStartCycles = ESP.getCycleCount();
   server.handleClient();
+  recordSection(MetricSection::HandleClient, loopStartCycles);
   processOtaJob();
+  serviceAdcSampler();
+  serviceStallDetection();
+  serviceAutoCalibration();
+  serviceEventStreams();
+  serviceMqtt();
+  serviceGroupControl();
+  serviceSchedule();
+  serviceHeapStats();
+  serviceSettingsCommit();
+  serviceWiFiLease();
+#if defined(SHUTTER_STEP_ENGINE_POLLED)
+  pollStepEngine();
+#endif
 
-  const long rawBefore = stepper.currentPosition();
-  const bool wasMoving = stepper.distanceToGo() != 0;
-  stepper.run();
-  const bool isMoving = stepper.distanceToGo() != 0;
-
-  if (stepper.currentPosition() != rawBefore) {
-    markDirty();
-  }
-
-  if (wasMoving && !isMoving) {
-    motionStoppedAtMs = millis();
-    if (resetTopReferenceWhenStopped) {
-      stepper.setCurrentPosition(logicalToRaw(0));
-      stepper.moveTo(logicalToRaw(0));
-      resetTopReferenceWhenStopped = false;
-    }
-    targetPosition = currentLogicalPosition();
-    saveState(true);
-  }
-
-  if (!isMoving) {
-    if (millis() - motionStoppedAtMs >= state.coilHoldMs) {
-      disableMotorOutputs();
-    }
-  }
+  for (ShutterChannel& ch : channels) serviceChannelMotion(ch);
 
   saveState(false);
+  recordSection(MetricSection::Loop, loopStartCycles);
+  samplePowerBudget(servicePowerMode());
 }
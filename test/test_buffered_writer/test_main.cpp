@@ -0,0 +1,72 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "BufferedWriter.h"
+
+using shutter::net::BufferedWriter;
+
+// Socket model: records every write call and accepts at most `capacity` bytes in total.
+struct RecordingSink {
+  uint8_t bytes[256];
+  size_t size = 0;
+  size_t calls = 0;
+  size_t capacity = sizeof(bytes);
+
+  size_t write(const uint8_t* data, size_t length) {
+    ++calls;
+    size_t accepted = capacity - size < length ? capacity - size : length;
+    memcpy(bytes + size, data, accepted);
+    size += accepted;
+    return accepted;
+  }
+};
+
+uint8_t buffer8[8];
+uint8_t buffer4[4];
+
+void test_single_bytes_are_batched() {
+  RecordingSink sink;
+  {
+    BufferedWriter<RecordingSink, 8> writer(sink, buffer8);
+    const char* text = "0123456789abcdefXYZ";
+    for (size_t i = 0; i < strlen(text); ++i) writer.write(static_cast<uint8_t>(text[i]));
+    TEST_ASSERT_EQUAL_UINT32(2, sink.calls);
+    TEST_ASSERT_TRUE(writer.flush());
+    TEST_ASSERT_EQUAL_UINT32(19, writer.written());
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, sink.calls);
+  TEST_ASSERT_EQUAL_MEMORY("0123456789abcdefXYZ", sink.bytes, 19);
+}
+
+void test_large_block_bypasses_buffer() {
+  RecordingSink sink;
+  BufferedWriter<RecordingSink, 8> writer(sink, buffer8);
+  writer.print("ab");
+  writer.print("0123456789abcdef");  // fills the buffer, then the remaining 10 bytes go straight through
+  writer.flush();
+  TEST_ASSERT_EQUAL_UINT32(18, sink.size);
+  TEST_ASSERT_EQUAL_UINT32(2, sink.calls);
+  TEST_ASSERT_EQUAL_MEMORY("ab0123456789abcdef", sink.bytes, 18);
+}
+
+void test_short_write_latches_failure() {
+  RecordingSink sink;
+  sink.capacity = 5;
+  BufferedWriter<RecordingSink, 4> writer(sink, buffer4);
+  writer.print("abcd");
+  writer.print("efgh");
+  TEST_ASSERT_TRUE(writer.failed());
+  TEST_ASSERT_EQUAL_UINT32(0, writer.write('z'));
+  TEST_ASSERT_FALSE(writer.flush());
+  TEST_ASSERT_EQUAL_UINT32(2, sink.calls);
+  TEST_ASSERT_EQUAL_UINT32(5, writer.written());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_bytes_are_batched);
+  RUN_TEST(test_large_block_bypasses_buffer);
+  RUN_TEST(test_short_write_latches_failure);
+  return UNITY_END();
+}
@@ -0,0 +1,83 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "GroupCommand.h"
+
+using shutter::group::Action;
+using shutter::group::Command;
+using shutter::group::RecentSenders;
+
+void test_command_round_trips_in_network_order() {
+  Command command;
+  command.sender = 0x00ABCDEF;
+  command.sequence = 0x1234;
+  command.groups = 0x8001;
+  command.startInUs = 200000;
+  command.action = Action::Set;
+  command.centiPercent = 2500;
+  uint8_t out[32];
+  TEST_ASSERT_EQUAL(shutter::group::kPacketSize, shutter::group::encode(command, out, sizeof(out)));
+  const uint8_t expected[] = {'S', 'G', 1, 4, 0x00, 0xAB, 0xCD, 0xEF, 0x12, 0x34, 0x80, 0x01,
+                              0x00, 0x03, 0x0D, 0x40, 0x09, 0xC4};
+  TEST_ASSERT_EQUAL_MEMORY(expected, out, sizeof(expected));
+
+  Command decoded;
+  TEST_ASSERT_TRUE(shutter::group::decode(out, shutter::group::kPacketSize, &decoded));
+  TEST_ASSERT_EQUAL_UINT32(command.sender, decoded.sender);
+  TEST_ASSERT_EQUAL_UINT16(command.sequence, decoded.sequence);
+  TEST_ASSERT_EQUAL_UINT16(command.groups, decoded.groups);
+  TEST_ASSERT_EQUAL_UINT32(command.startInUs, decoded.startInUs);
+  TEST_ASSERT_TRUE(decoded.action == Action::Set);
+  TEST_ASSERT_EQUAL_UINT16(2500, decoded.centiPercent);
+  TEST_ASSERT_EQUAL(0, shutter::group::encode(command, out, shutter::group::kPacketSize - 1));
+}
+
+void test_malformed_datagrams_are_rejected() {
+  Command command;
+  command.groups = 1;
+  command.action = Action::Close;
+  uint8_t out[shutter::group::kPacketSize];
+  shutter::group::encode(command, out, sizeof(out));
+  Command decoded;
+  TEST_ASSERT_TRUE(shutter::group::decode(out, sizeof(out), &decoded));
+  TEST_ASSERT_FALSE(shutter::group::decode(out, sizeof(out) - 1, &decoded));
+
+  uint8_t bad[sizeof(out)];
+  memcpy(bad, out, sizeof(out));
+  bad[2] = 2;  // another protocol version
+  TEST_ASSERT_FALSE(shutter::group::decode(bad, sizeof(bad), &decoded));
+  memcpy(bad, out, sizeof(out));
+  bad[3] = 9;  // unknown action
+  TEST_ASSERT_FALSE(shutter::group::decode(bad, sizeof(bad), &decoded));
+  memcpy(bad, out, sizeof(out));
+  bad[10] = bad[11] = 0;  // no group
+  TEST_ASSERT_FALSE(shutter::group::decode(bad, sizeof(bad), &decoded));
+
+  command.action = Action::Set;
+  command.centiPercent = 10001;
+  shutter::group::encode(command, bad, sizeof(bad));
+  TEST_ASSERT_FALSE(shutter::group::decode(bad, sizeof(bad), &decoded));
+}
+
+void test_repeats_act_once_per_sender() {
+  RecentSenders<2> recent;
+  TEST_ASSERT_TRUE(recent.accept(1, 10));
+  TEST_ASSERT_FALSE(recent.accept(1, 10));
+  TEST_ASSERT_TRUE(recent.accept(2, 10));  // another node may use the same sequence
+  TEST_ASSERT_TRUE(recent.accept(1, 11));
+  TEST_ASSERT_FALSE(recent.accept(2, 10));
+
+  // A third sender takes the oldest slot; the forgotten sender's repeat acts again.
+  TEST_ASSERT_TRUE(recent.accept(3, 5));
+  TEST_ASSERT_FALSE(recent.accept(3, 5));
+  TEST_ASSERT_TRUE(recent.accept(1, 11));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_command_round_trips_in_network_order);
+  RUN_TEST(test_malformed_datagrams_are_rejected);
+  RUN_TEST(test_repeats_act_once_per_sender);
+  return UNITY_END();
+}
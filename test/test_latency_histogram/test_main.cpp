@@ -0,0 +1,81 @@
+#include <unity.h>
+
+#include "LatencyHistogram.h"
+
+using shutter::metrics::LatencyHistogram;
+using shutter::metrics::LatencySummary;
+
+void test_empty_histogram_reports_zero() {
+  LatencyHistogram histogram;
+  const LatencySummary summary = histogram.summarize();
+  TEST_ASSERT_EQUAL_UINT32(0, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.minUs);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.maxUs);
+  TEST_ASSERT_EQUAL_UINT32(0, histogram.percentileUs(990));
+}
+
+void test_min_max_mean_are_exact() {
+  LatencyHistogram histogram;
+  histogram.record(40);
+  histogram.record(7);
+  histogram.record(1300);
+  const LatencySummary summary = histogram.summarize();
+  TEST_ASSERT_EQUAL_UINT32(3, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(7, summary.minUs);
+  TEST_ASSERT_EQUAL_UINT32(1300, summary.maxUs);
+  TEST_ASSERT_EQUAL_UINT32(449, summary.meanUs);
+  TEST_ASSERT_EQUAL_UINT64(1347, summary.sumUs);
+}
+
+void test_percentiles_stay_within_their_bucket() {
+  LatencyHistogram histogram;
+  // 90 fast passes around 100 us, 10 slow ones around 5 ms.
+  for (int i = 0; i < 90; ++i) histogram.record(90 + i % 20);
+  for (int i = 0; i < 10; ++i) histogram.record(5000 + i * 10);
+
+  const uint32_t p50 = histogram.percentileUs(500);
+  TEST_ASSERT_TRUE(p50 >= 64 && p50 <= 127);
+  const uint32_t p90 = histogram.percentileUs(900);
+  TEST_ASSERT_TRUE(p90 >= 64 && p90 <= 127);
+  const uint32_t p99 = histogram.percentileUs(990);
+  TEST_ASSERT_TRUE(p99 >= 5000 && p99 <= 5090);
+  TEST_ASSERT_EQUAL_UINT32(5090, histogram.percentileUs(1000));
+}
+
+void test_single_value_percentiles_are_that_value() {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 5; ++i) histogram.record(300);
+  TEST_ASSERT_EQUAL_UINT32(300, histogram.percentileUs(10));
+  TEST_ASSERT_EQUAL_UINT32(300, histogram.percentileUs(500));
+  TEST_ASSERT_EQUAL_UINT32(300, histogram.percentileUs(990));
+}
+
+void test_huge_values_land_in_the_last_bucket() {
+  LatencyHistogram histogram;
+  histogram.record(0);
+  histogram.record(UINT32_MAX);
+  TEST_ASSERT_EQUAL_UINT32(0, histogram.percentileUs(500));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, histogram.percentileUs(1000));
+}
+
+void test_reset_clears_everything() {
+  LatencyHistogram histogram;
+  histogram.record(12);
+  histogram.reset();
+  histogram.record(900);
+  const LatencySummary summary = histogram.summarize();
+  TEST_ASSERT_EQUAL_UINT32(1, summary.count);
+  TEST_ASSERT_EQUAL_UINT32(900, summary.minUs);
+  TEST_ASSERT_EQUAL_UINT32(900, summary.p50Us);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_histogram_reports_zero);
+  RUN_TEST(test_min_max_mean_are_exact);
+  RUN_TEST(test_percentiles_stay_within_their_bucket);
+  RUN_TEST(test_single_value_percentiles_are_that_value);
+  RUN_TEST(test_huge_values_land_in_the_last_bucket);
+  RUN_TEST(test_reset_clears_everything);
+  return UNITY_END();
+}
@@ -0,0 +1,72 @@
+#include <unity.h>
+
+#include "MotionQueue.h"
+
+using shutter::motion::classifyRetarget;
+using shutter::motion::MotionCommand;
+using shutter::motion::MotionQueue;
+using shutter::motion::Retarget;
+
+static MotionCommand move(long target) {
+  MotionCommand command;
+  command.target = target;
+  return command;
+}
+
+void test_queue_is_fifo_and_bounded() {
+  MotionQueue<3> queue;
+  TEST_ASSERT_TRUE(queue.empty());
+  TEST_ASSERT_TRUE(queue.push(move(10)));
+  TEST_ASSERT_TRUE(queue.push(move(20)));
+  TEST_ASSERT_TRUE(queue.push(move(30)));
+  TEST_ASSERT_TRUE(queue.full());
+  TEST_ASSERT_FALSE(queue.push(move(40)));
+  TEST_ASSERT_EQUAL(3, queue.size());
+  TEST_ASSERT_EQUAL(10L, queue.front().target);
+  TEST_ASSERT_EQUAL(30L, queue.back().target);
+
+  queue.pop();
+  TEST_ASSERT_TRUE(queue.push(move(40)));  // wraps around
+  TEST_ASSERT_EQUAL(20L, queue.at(0).target);
+  TEST_ASSERT_EQUAL(30L, queue.at(1).target);
+  TEST_ASSERT_EQUAL(40L, queue.at(2).target);
+
+  queue.clear();
+  TEST_ASSERT_TRUE(queue.empty());
+  queue.pop();  // no-op when empty
+  TEST_ASSERT_EQUAL(0, queue.size());
+}
+
+void test_target_past_the_braking_distance_extends() {
+  long stopAt = -1;
+  TEST_ASSERT_TRUE(classifyRetarget(1000, 1, 300, 1300, &stopAt) == Retarget::Extend);
+  TEST_ASSERT_TRUE(classifyRetarget(1000, 1, 300, 9000, &stopAt) == Retarget::Extend);
+  TEST_ASSERT_TRUE(classifyRetarget(-1000, -1, 300, -1400, &stopAt) == Retarget::Extend);
+  TEST_ASSERT_EQUAL(-1L, stopAt);
+}
+
+void test_target_behind_or_too_close_brakes_first() {
+  long stopAt = 0;
+  TEST_ASSERT_TRUE(classifyRetarget(1000, 1, 300, 200, &stopAt) == Retarget::Reverse);
+  TEST_ASSERT_EQUAL(1300L, stopAt);
+  // Ahead, but closer than the motor can stop: it brakes past it and comes back.
+  TEST_ASSERT_TRUE(classifyRetarget(1000, 1, 300, 1100, &stopAt) == Retarget::Reverse);
+  TEST_ASSERT_EQUAL(1300L, stopAt);
+  TEST_ASSERT_TRUE(classifyRetarget(-1000, -1, 50, 0, &stopAt) == Retarget::Reverse);
+  TEST_ASSERT_EQUAL(-1050L, stopAt);
+}
+
+void test_at_rest_any_target_starts() {
+  long stopAt = 0;
+  TEST_ASSERT_TRUE(classifyRetarget(500, 1, 0, 0, &stopAt) == Retarget::Start);
+  TEST_ASSERT_TRUE(classifyRetarget(500, -1, 0, 900, &stopAt) == Retarget::Start);
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_queue_is_fifo_and_bounded);
+  RUN_TEST(test_target_past_the_braking_distance_extends);
+  RUN_TEST(test_target_behind_or_too_close_brakes_first);
+  RUN_TEST(test_at_rest_any_target_starts);
+  return UNITY_END();
+}
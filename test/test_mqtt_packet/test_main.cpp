@@ -0,0 +1,127 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "MqttPacket.h"
+
+using shutter::mqtt::ConnectOptions;
+using shutter::mqtt::Message;
+using shutter::mqtt::PacketReader;
+using shutter::mqtt::PacketType;
+
+void test_connect_matches_spec_example() {
+  ConnectOptions options;
+  options.clientId = "ab";
+  options.keepAliveSec = 60;
+  uint8_t out[32];
+  const size_t n = shutter::mqtt::encodeConnect(out, sizeof(out), options);
+  const uint8_t expected[] = {0x10, 14, 0, 4, 'M', 'Q', 'T', 'T', 4, 0x02, 0, 60, 0, 2, 'a', 'b'};
+  TEST_ASSERT_EQUAL(sizeof(expected), n);
+  TEST_ASSERT_EQUAL_MEMORY(expected, out, sizeof(expected));
+}
+
+void test_connect_carries_will_and_credentials() {
+  ConnectOptions options;
+  options.clientId = "c";
+  options.username = "u";
+  options.password = "pw";
+  options.willTopic = "t/a";
+  options.willPayload = "offline";
+  uint8_t out[64];
+  const size_t n = shutter::mqtt::encodeConnect(out, sizeof(out), options);
+  TEST_ASSERT_EQUAL(2 + 10 + 3 + 5 + 9 + 3 + 4, n);
+  TEST_ASSERT_EQUAL_HEX8(0x02 | 0x04 | 0x20 | 0x80 | 0x40, out[9]);
+  // A password without a user name is not allowed, so it is left out.
+  options.username = "";
+  shutter::mqtt::encodeConnect(out, sizeof(out), options);
+  TEST_ASSERT_EQUAL_HEX8(0x02 | 0x04 | 0x20, out[9]);
+}
+
+void test_long_publish_uses_multibyte_length() {
+  static uint8_t payload[200];
+  memset(payload, 'x', sizeof(payload));
+  uint8_t out[256];
+  const size_t n = shutter::mqtt::encodePublish(out, sizeof(out), "a/b", payload, sizeof(payload), true);
+  // 2 + 3 + 200 = 205 = 0xCD 0x01 as a variable length.
+  TEST_ASSERT_EQUAL(1 + 2 + 205, n);
+  TEST_ASSERT_EQUAL_HEX8(0x31, out[0]);
+  TEST_ASSERT_EQUAL_HEX8(0xCD, out[1]);
+  TEST_ASSERT_EQUAL_HEX8(0x01, out[2]);
+  TEST_ASSERT_EQUAL(0, shutter::mqtt::encodePublish(out, 100, "a/b", payload, sizeof(payload), true));
+}
+
+void test_subscribe_lists_every_filter() {
+  const char* const filters[] = {"s/+/set", "s/+/position/set"};
+  uint8_t out[64];
+  const size_t n = shutter::mqtt::encodeSubscribe(out, sizeof(out), 7, filters, 2);
+  TEST_ASSERT_EQUAL(2 + 2 + (2 + 7 + 1) + (2 + 16 + 1), n);
+  TEST_ASSERT_EQUAL_HEX8(0x82, out[0]);
+  TEST_ASSERT_EQUAL_HEX8(7, out[3]);
+}
+
+void test_reader_splits_a_stream_into_packets() {
+  uint8_t stream[128];
+  size_t n = 0;
+  const uint8_t connack[] = {0x20, 2, 0, 0};
+  memcpy(stream, connack, sizeof(connack));
+  n += sizeof(connack);
+  n += shutter::mqtt::encodePublish(stream + n, sizeof(stream) - n, "s/0/set", "STOP", false);
+  n += shutter::mqtt::encodeEmpty(stream + n, sizeof(stream) - n, PacketType::Pingresp);
+
+  PacketReader<64> reader;
+  int packets = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (!reader.push(stream[i])) continue;
+    ++packets;
+    if (packets == 1) {
+      TEST_ASSERT_TRUE(reader.type() == PacketType::Connack);
+      TEST_ASSERT_EQUAL(0, shutter::mqtt::connackCode(reader.body(), reader.length()));
+    } else if (packets == 2) {
+      TEST_ASSERT_TRUE(reader.type() == PacketType::Publish);
+      Message message;
+      TEST_ASSERT_TRUE(shutter::mqtt::parsePublish(reader.flags(), reader.body(), reader.length(), &message));
+      TEST_ASSERT_TRUE(message.topicIs("s/0/set"));
+      TEST_ASSERT_EQUAL(4, message.payloadLength);
+      TEST_ASSERT_EQUAL_MEMORY("STOP", message.payload, 4);
+    } else {
+      TEST_ASSERT_TRUE(reader.type() == PacketType::Pingresp);
+      TEST_ASSERT_EQUAL(0, reader.length());
+    }
+  }
+  TEST_ASSERT_EQUAL(3, packets);
+}
+
+void test_oversized_packet_is_skipped() {
+  uint8_t stream[128];
+  size_t n = shutter::mqtt::encodePublish(stream, sizeof(stream), "big", "0123456789abcdef0123", false);
+  n += shutter::mqtt::encodePublish(stream + n, sizeof(stream) - n, "s", "1", false);
+  PacketReader<16> reader;
+  int packets = 0;
+  for (size_t i = 0; i < n; ++i) packets += reader.push(stream[i]) ? 1 : 0;
+  TEST_ASSERT_EQUAL(1, packets);
+  TEST_ASSERT_EQUAL(1, reader.dropped());
+  Message message;
+  TEST_ASSERT_TRUE(shutter::mqtt::parsePublish(reader.flags(), reader.body(), reader.length(), &message));
+  TEST_ASSERT_TRUE(message.topicIs("s"));
+}
+
+void test_qos1_publish_has_packet_id() {
+  const uint8_t body[] = {0, 1, 't', 0x12, 0x34, 'o', 'k'};
+  Message message;
+  TEST_ASSERT_TRUE(shutter::mqtt::parsePublish(0x02, body, sizeof(body), &message));
+  TEST_ASSERT_EQUAL_UINT16(0x1234, message.packetId);
+  TEST_ASSERT_EQUAL(2, message.payloadLength);
+  TEST_ASSERT_FALSE(shutter::mqtt::parsePublish(0x00, body, 2, &message));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_connect_matches_spec_example);
+  RUN_TEST(test_connect_carries_will_and_credentials);
+  RUN_TEST(test_long_publish_uses_multibyte_length);
+  RUN_TEST(test_subscribe_lists_every_filter);
+  RUN_TEST(test_reader_splits_a_stream_into_packets);
+  RUN_TEST(test_oversized_packet_is_skipped);
+  RUN_TEST(test_qos1_publish_has_packet_id);
+  return UNITY_END();
+}
@@ -0,0 +1,146 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "PositionJournal.h"
+
+using shutter::storage::JournalRecord;
+using shutter::storage::PositionJournal;
+
+// NOR flash model: erase sets all bits, programming can only clear them.
+struct RamFlash {
+  uint8_t bytes[1024];
+  uint32_t writes = 0;
+
+  void erase() { memset(bytes, 0xFF, sizeof(bytes)); }
+  bool read(uint32_t offset, void* dst, size_t size) {
+    memcpy(dst, bytes + offset, size);
+    return true;
+  }
+  bool write(uint32_t offset, const void* src, size_t size) {
+    const uint8_t* in = static_cast<const uint8_t*>(src);
+    for (size_t i = 0; i < size; ++i) bytes[offset + i] &= in[i];
+    ++writes;
+    return true;
+  }
+};
+
+static RamFlash flash;
+
+void setUp() { flash.erase(); }
+
+void test_empty_region_has_no_position() {
+  PositionJournal<RamFlash> journal(flash, 64, 8);
+  journal.mount();
+  TEST_ASSERT_FALSE(journal.hasPosition());
+  TEST_ASSERT_EQUAL_UINT16(8, journal.freeSlots());
+}
+
+void test_mount_recovers_newest_record() {
+  {
+    PositionJournal<RamFlash> journal(flash, 64, 8);
+    journal.mount();
+    TEST_ASSERT_TRUE(journal.append(100));
+    TEST_ASSERT_TRUE(journal.append(250));
+    TEST_ASSERT_TRUE(journal.append(-30));
+  }
+  PositionJournal<RamFlash> journal(flash, 64, 8);
+  journal.mount();
+  TEST_ASSERT_TRUE(journal.hasPosition());
+  TEST_ASSERT_EQUAL(-30L, journal.position());
+  TEST_ASSERT_EQUAL_UINT32(3, journal.sequence());
+  TEST_ASSERT_EQUAL_UINT16(5, journal.freeSlots());
+  for (int i = 0; i < 64; ++i) TEST_ASSERT_EQUAL_HEX8(0xFF, flash.bytes[i]);
+}
+
+void test_torn_record_is_skipped() {
+  PositionJournal<RamFlash> writer(flash, 0, 8);
+  writer.mount();
+  writer.append(500);
+  writer.append(600);
+  // Corrupt the second record as if power failed mid-write.
+  flash.bytes[sizeof(JournalRecord) + 9] = 0x00;
+
+  PositionJournal<RamFlash> journal(flash, 0, 8);
+  journal.mount();
+  TEST_ASSERT_EQUAL(500L, journal.position());
+  TEST_ASSERT_EQUAL_UINT16(6, journal.freeSlots());
+  TEST_ASSERT_TRUE(journal.append(700));
+
+  PositionJournal<RamFlash> again(flash, 0, 8);
+  again.mount();
+  TEST_ASSERT_EQUAL(700L, again.position());
+}
+
+void test_full_region_rejects_append_until_reset() {
+  PositionJournal<RamFlash> journal(flash, 0, 4);
+  journal.mount();
+  for (long i = 0; i < 4; ++i) TEST_ASSERT_TRUE(journal.append(i));
+  TEST_ASSERT_FALSE(journal.append(99));
+  TEST_ASSERT_EQUAL(3L, journal.position());
+
+  flash.erase();
+  journal.resetAfterErase();
+  TEST_ASSERT_FALSE(journal.hasPosition());
+  TEST_ASSERT_TRUE(journal.append(99));
+  TEST_ASSERT_EQUAL(99L, journal.position());
+}
+
+void test_channels_keep_their_own_newest_position() {
+  {
+    PositionJournal<RamFlash, 3> journal(flash, 0, 16);
+    journal.mount();
+    TEST_ASSERT_TRUE(journal.append(100, 0));
+    TEST_ASSERT_TRUE(journal.append(-40, 2));
+    TEST_ASSERT_TRUE(journal.append(120, 0));
+    TEST_ASSERT_FALSE(journal.append(5, 3));
+  }
+  PositionJournal<RamFlash, 3> journal(flash, 0, 16);
+  journal.mount();
+  TEST_ASSERT_TRUE(journal.hasPosition(0));
+  TEST_ASSERT_FALSE(journal.hasPosition(1));
+  TEST_ASSERT_TRUE(journal.hasPosition(2));
+  TEST_ASSERT_EQUAL(120L, journal.position(0));
+  TEST_ASSERT_EQUAL(-40L, journal.position(2));
+  TEST_ASSERT_EQUAL_UINT32(3, journal.sequence());
+  TEST_ASSERT_EQUAL_UINT16(13, journal.freeSlots());
+}
+
+void test_legacy_records_belong_to_channel_zero() {
+  // Written by the single-channel layout, which stored 0xFFFF in the channel field.
+  JournalRecord record;
+  record.magic = shutter::storage::kJournalMagic;
+  record.channel = shutter::storage::kJournalLegacyChannel;
+  record.sequence = 7;
+  record.position = 4321;
+  record.checksum = shutter::storage::journalRecordChecksum(record);
+  flash.write(0, &record, sizeof(record));
+
+  PositionJournal<RamFlash, 2> journal(flash, 0, 8);
+  journal.mount();
+  TEST_ASSERT_TRUE(journal.hasPosition(0));
+  TEST_ASSERT_FALSE(journal.hasPosition(1));
+  TEST_ASSERT_EQUAL(4321L, journal.position(0));
+  TEST_ASSERT_TRUE(journal.append(10, 1));
+  TEST_ASSERT_EQUAL_UINT32(8, journal.sequence());
+}
+
+void test_fnv1a_continues_across_chunks() {
+  const uint8_t text[] = "foobar";
+  using shutter::storage::fnv1a;
+  // Reference value of 32-bit FNV-1a("foobar").
+  TEST_ASSERT_EQUAL_HEX32(0xBF9CF968UL, fnv1a(text, 6));
+  TEST_ASSERT_EQUAL_HEX32(fnv1a(text, 6), fnv1a(text + 2, 4, fnv1a(text, 2)));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_region_has_no_position);
+  RUN_TEST(test_mount_recovers_newest_record);
+  RUN_TEST(test_torn_record_is_skipped);
+  RUN_TEST(test_full_region_rejects_append_until_reset);
+  RUN_TEST(test_channels_keep_their_own_newest_position);
+  RUN_TEST(test_legacy_records_belong_to_channel_zero);
+  RUN_TEST(test_fnv1a_continues_across_chunks);
+  return UNITY_END();
+}
@@ -0,0 +1,62 @@
+#include <unity.h>
+
+#include "PowerBudget.h"
+
+using shutter::power::lightSleepMa;
+using shutter::power::listenIntervalFor;
+using shutter::power::PowerBudget;
+using shutter::power::RadioMode;
+
+void test_listen_interval_stays_within_budget() {
+  TEST_ASSERT_EQUAL_UINT8(1, listenIntervalFor(0));
+  TEST_ASSERT_EQUAL_UINT8(1, listenIntervalFor(150));
+  TEST_ASSERT_EQUAL_UINT8(2, listenIntervalFor(300));
+  TEST_ASSERT_EQUAL_UINT8(9, listenIntervalFor(1000));
+  TEST_ASSERT_EQUAL_UINT8(10, listenIntervalFor(5000));
+}
+
+void test_longer_listen_interval_draws_less() {
+  TEST_ASSERT_TRUE(lightSleepMa(3) < lightSleepMa(1));
+  TEST_ASSERT_TRUE(lightSleepMa(10) > shutter::power::kLightSleepMa);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, lightSleepMa(1), lightSleepMa(0));
+}
+
+void test_empty_budget_reports_zero() {
+  PowerBudget budget;
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, budget.dutyPercent(RadioMode::Awake));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, budget.averageEspMa(1));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, budget.averageCoilMa());
+}
+
+void test_average_weights_modes_by_time() {
+  PowerBudget budget;
+  budget.add(RadioMode::Awake, 100000);
+  budget.add(RadioMode::LightSleep, 900000);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 10.0f, budget.dutyPercent(RadioMode::Awake));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 90.0f, budget.dutyPercent(RadioMode::LightSleep));
+  const float expected = 0.1f * shutter::power::kAwakeMa + 0.9f * lightSleepMa(2);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, expected, budget.averageEspMa(2));
+}
+
+void test_coil_time_counts_per_motor() {
+  PowerBudget budget;
+  budget.add(RadioMode::ModemSleep, 1000000);
+  budget.addCoils(500000);
+  budget.addCoils(500000);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 100.0f, budget.coilDutyPercent());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, shutter::power::kCoilMa, budget.averageCoilMa());
+
+  budget.reset();
+  TEST_ASSERT_EQUAL_UINT64(0, budget.totalUs());
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 0.0f, budget.coilDutyPercent());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_listen_interval_stays_within_budget);
+  RUN_TEST(test_longer_listen_interval_draws_less);
+  RUN_TEST(test_empty_budget_reports_zero);
+  RUN_TEST(test_average_weights_modes_by_time);
+  RUN_TEST(test_coil_time_counts_per_motor);
+  return UNITY_END();
+}
@@ -0,0 +1,54 @@
+#include <unity.h>
+
+#include "SampleWindow.h"
+
+using shutter::sensing::SampleWindow;
+
+void test_empty_window_reports_zero() {
+  SampleWindow<4> window;
+  TEST_ASSERT_EQUAL_UINT16(0, window.size());
+  TEST_ASSERT_EQUAL_UINT16(0, window.mean());
+  TEST_ASSERT_EQUAL_UINT16(0, window.latest());
+}
+
+void test_mean_min_max_before_wrap() {
+  SampleWindow<4> window;
+  window.push(10);
+  window.push(30);
+  window.push(20);
+  TEST_ASSERT_EQUAL_UINT16(3, window.size());
+  TEST_ASSERT_EQUAL_UINT16(20, window.mean());
+  TEST_ASSERT_EQUAL_UINT16(10, window.min());
+  TEST_ASSERT_EQUAL_UINT16(30, window.max());
+  TEST_ASSERT_EQUAL_UINT16(20, window.latest());
+}
+
+void test_eviction_rescans_extremes() {
+  SampleWindow<3> window;
+  window.push(5);
+  window.push(100);
+  window.push(50);
+  window.push(60);  // evicts min 5
+  TEST_ASSERT_EQUAL_UINT16(50, window.min());
+  window.push(70);  // evicts max 100
+  TEST_ASSERT_EQUAL_UINT16(70, window.max());
+  TEST_ASSERT_EQUAL_UINT16(60, window.mean());
+  TEST_ASSERT_EQUAL_UINT16(50, window.at(0));
+  TEST_ASSERT_EQUAL_UINT16(70, window.at(2));
+}
+
+void test_mean_rounds_to_nearest() {
+  SampleWindow<2> window;
+  window.push(1023);
+  window.push(1022);
+  TEST_ASSERT_EQUAL_UINT16(1023, window.mean());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_window_reports_zero);
+  RUN_TEST(test_mean_min_max_before_wrap);
+  RUN_TEST(test_eviction_rescans_extremes);
+  RUN_TEST(test_mean_rounds_to_nearest);
+  return UNITY_END();
+}
@@ -0,0 +1,158 @@
+#include <unity.h>
+
+#include <vector>
+
+#include "Schedule.h"
+
+using shutter::schedule::Action;
+using shutter::schedule::DayPlan;
+using shutter::schedule::Rule;
+using shutter::schedule::Scheduler;
+using shutter::schedule::Site;
+using shutter::schedule::Trigger;
+
+namespace {
+
+constexpr int32_t kMinutesPerDay = 1440;
+constexpr int32_t kFriday20240621 = 19895;  // local day number of 2024-06-21
+
+Rule timeRule(uint8_t days, int16_t minute) {
+  Rule rule = {};
+  rule.days = days;
+  rule.trigger = Trigger::Time;
+  rule.minute = minute;
+  rule.channels = 1;
+  rule.action = Action::Close;
+  return rule;
+}
+
+// Every (local minute, rule) the scheduler fired while fed each minute in [from, to].
+std::vector<int32_t> walk(Scheduler& scheduler, const Rule* rules, uint8_t count, int32_t from, int32_t to,
+                          int32_t step = 1) {
+  std::vector<int32_t> fired;
+  for (int32_t minute = from; minute <= to; minute += step) {
+    scheduler.advance(minute, 0, rules, count, Site(), 0, [&fired, minute](uint8_t index) {
+      fired.push_back(minute * 16 + index);
+    });
+  }
+  return fired;
+}
+
+}  // namespace
+
+void test_civil_dates_and_weekdays() {
+  TEST_ASSERT_EQUAL_INT32(0, shutter::schedule::daysFromCivil(1970, 1, 1));
+  TEST_ASSERT_EQUAL_INT32(10957, shutter::schedule::daysFromCivil(2000, 1, 1));
+  TEST_ASSERT_EQUAL_INT32(19782, shutter::schedule::daysFromCivil(2024, 2, 29));
+  TEST_ASSERT_EQUAL_INT32(kFriday20240621, shutter::schedule::daysFromCivil(2024, 6, 21));
+  TEST_ASSERT_EQUAL_INT32(-1, shutter::schedule::daysFromCivil(1969, 12, 31));
+  TEST_ASSERT_EQUAL_UINT8(3, shutter::schedule::weekday(0));  // Thursday
+  TEST_ASSERT_EQUAL_UINT8(4, shutter::schedule::weekday(kFriday20240621));
+  TEST_ASSERT_EQUAL_UINT8(2, shutter::schedule::weekday(-1));  // Wednesday
+}
+
+void test_sun_events_match_almanac() {
+  int16_t sunrise = 0;
+  int16_t sunset = 0;
+  // Moscow, midsummer: 03:44 and 21:18 local (UTC+3).
+  TEST_ASSERT_TRUE(shutter::schedule::sunEventsUtc(kFriday20240621, 55.7558f, 37.6173f, &sunrise, &sunset));
+  TEST_ASSERT_INT_WITHIN(2, 44, sunrise);
+  TEST_ASSERT_INT_WITHIN(2, 18 * 60 + 18, sunset);
+  // London, midwinter: 08:04 and 15:53 UTC.
+  TEST_ASSERT_TRUE(shutter::schedule::sunEventsUtc(shutter::schedule::daysFromCivil(2024, 12, 21), 51.5074f, -0.1278f,
+                                                   &sunrise, &sunset));
+  TEST_ASSERT_INT_WITHIN(2, 8 * 60 + 4, sunrise);
+  TEST_ASSERT_INT_WITHIN(2, 15 * 60 + 53, sunset);
+  // Murmansk: the sun neither sets at midsummer nor rises at midwinter.
+  TEST_ASSERT_FALSE(shutter::schedule::sunEventsUtc(kFriday20240621, 68.97f, 33.09f, &sunrise, &sunset));
+  TEST_ASSERT_FALSE(
+      shutter::schedule::sunEventsUtc(shutter::schedule::daysFromCivil(2024, 12, 21), 68.97f, 33.09f, &sunrise, &sunset));
+}
+
+void test_sun_rules_follow_the_local_day() {
+  Site moscow;
+  moscow.located = true;
+  moscow.latitude = 55.7558f;
+  moscow.longitude = 37.6173f;
+  const DayPlan plan = shutter::schedule::planDay(kFriday20240621, 180, moscow);
+  TEST_ASSERT_TRUE(plan.sunValid);
+  TEST_ASSERT_EQUAL_UINT8(4, plan.weekday);
+  TEST_ASSERT_INT_WITHIN(2, 3 * 60 + 44, plan.sunrise);
+
+  Rule rule = timeRule(shutter::schedule::kAllDays, -30);
+  rule.trigger = Trigger::Sunset;
+  TEST_ASSERT_EQUAL_INT16(plan.sunset - 30, shutter::schedule::fireMinute(rule, 0, plan, 0));
+  rule.days = 1U << 5;  // Saturdays only
+  TEST_ASSERT_EQUAL_INT16(-1, shutter::schedule::fireMinute(rule, 0, plan, 0));
+  // No location, no sun.
+  rule.days = shutter::schedule::kAllDays;
+  TEST_ASSERT_EQUAL_INT16(-1, shutter::schedule::fireMinute(rule, 0, shutter::schedule::planDay(kFriday20240621, 180, Site()), 0));
+  // An offset past midnight holds at the end of the day.
+  rule.trigger = Trigger::Sunset;
+  rule.minute = shutter::schedule::kMaxSunOffsetMinutes;
+  TEST_ASSERT_EQUAL_INT16(kMinutesPerDay - 1, shutter::schedule::fireMinute(rule, 0, plan, 0));
+}
+
+void test_rules_fire_once_on_their_days() {
+  const int32_t monday = (kFriday20240621 + 3) * kMinutesPerDay;
+  Rule rules[2] = {timeRule(0x1F, 7 * 60 + 30), timeRule(1U << 6, 9 * 60)};  // weekdays 07:30, Sundays 09:00
+  Scheduler scheduler;
+  // Friday 00:00 through Monday 23:59, one call a minute.
+  std::vector<int32_t> fired = walk(scheduler, rules, 2, kFriday20240621 * kMinutesPerDay, monday + kMinutesPerDay - 1);
+  TEST_ASSERT_EQUAL(3, fired.size());
+  TEST_ASSERT_EQUAL_INT32((kFriday20240621 * kMinutesPerDay + 450) * 16 + 0, fired[0]);
+  TEST_ASSERT_EQUAL_INT32(((kFriday20240621 + 2) * kMinutesPerDay + 540) * 16 + 1, fired[1]);
+  TEST_ASSERT_EQUAL_INT32((monday + 450) * 16 + 0, fired[2]);
+  rules[1].days = 0;  // disabled
+  scheduler.reset();
+  fired = walk(scheduler, rules + 1, 1, monday + 7 * kMinutesPerDay, monday + 8 * kMinutesPerDay);
+  TEST_ASSERT_EQUAL(0, fired.size());
+}
+
+void test_clock_gaps_and_setbacks() {
+  const int32_t friday = kFriday20240621 * kMinutesPerDay;
+  const Rule rule = timeRule(shutter::schedule::kAllDays, 7 * 60 + 30);
+  Scheduler scheduler;
+  // A loop stalled for a few minutes still fires what it skipped, once.
+  std::vector<int32_t> fired = walk(scheduler, &rule, 1, friday + 7 * 60, friday + 8 * 60, 7);
+  TEST_ASSERT_EQUAL(1, fired.size());
+  TEST_ASSERT_EQUAL_INT32((friday + 7 * 60 + 35) * 16, fired[0]);  // seen at the first call past 07:30
+  // Set back by a few minutes (a correction, or the repeated hour in autumn): no second run.
+  TEST_ASSERT_EQUAL(0, walk(scheduler, &rule, 1, friday + 7 * 60 + 25, friday + 7 * 60 + 40).size());
+  // A jump over the rule by more than the catch-up window (the first sync of the day) skips it.
+  scheduler.reset();
+  fired = walk(scheduler, &rule, 1, friday + kMinutesPerDay, friday + kMinutesPerDay);
+  fired = walk(scheduler, &rule, 1, friday + kMinutesPerDay + 8 * 60, friday + kMinutesPerDay + 8 * 60);
+  TEST_ASSERT_EQUAL(0, fired.size());
+}
+
+void test_jitter_is_fixed_per_device_and_spread_across_devices() {
+  const uint8_t first = shutter::schedule::jitterFor(0x00ABCDEF, 0, 20);
+  TEST_ASSERT_EQUAL_UINT8(first, shutter::schedule::jitterFor(0x00ABCDEF, 0, 20));
+  TEST_ASSERT_EQUAL_UINT8(0, shutter::schedule::jitterFor(0x00ABCDEF, 0, 0));
+  bool seen[21] = {};
+  uint8_t distinct = 0;
+  for (uint32_t chip = 0; chip < 64; ++chip) {
+    const uint8_t jitter = shutter::schedule::jitterFor(0x00A00000 + chip * 7919, 0, 20);
+    TEST_ASSERT_LESS_OR_EQUAL(20, jitter);
+    if (!seen[jitter]) ++distinct;
+    seen[jitter] = true;
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(12, distinct);
+
+  Rule rule = timeRule(shutter::schedule::kAllDays, 7 * 60);
+  rule.jitterMinutes = 20;
+  const DayPlan plan = shutter::schedule::planDay(kFriday20240621, 0, Site());
+  TEST_ASSERT_EQUAL_INT16(7 * 60 + first, shutter::schedule::fireMinute(rule, 0, plan, 0x00ABCDEF));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_civil_dates_and_weekdays);
+  RUN_TEST(test_sun_events_match_almanac);
+  RUN_TEST(test_sun_rules_follow_the_local_day);
+  RUN_TEST(test_rules_fire_once_on_their_days);
+  RUN_TEST(test_clock_gaps_and_setbacks);
+  RUN_TEST(test_jitter_is_fixed_per_device_and_spread_across_devices);
+  return UNITY_END();
+}
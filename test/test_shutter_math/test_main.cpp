@@ -1,14 +1,23 @@
 #include <unity.h>
 
+#include <math.h>
+#include <stdio.h>
+
+#include <chrono>
+
 #include "ShutterMath.h"
 
 using shutter::math::clampFloat;
 using shutter::math::clampLong;
+using shutter::math::Direction;
 using shutter::math::directionSign;
 using shutter::math::logicalToRaw;
 using shutter::math::percentToSteps;
 using shutter::math::rawToLogical;
 using shutter::math::stepsToPercent;
+using shutter::math::TravelScale;
+
+constexpr long kMaxTravelSteps = 300000;  // cfg::kMaxTravelSteps
 
 void test_clamp_long_bounds() {
   TEST_ASSERT_EQUAL(10L, clampLong(10, 0, 100));
@@ -31,6 +40,10 @@ void test_direction_conversion() {
 
   TEST_ASSERT_EQUAL(250L, rawToLogical(250, false));
   TEST_ASSERT_EQUAL(250L, rawToLogical(-250, true));
+
+  static_assert(Direction<true>::toRaw(250) == -250, "a reversed motor negates");
+  static_assert(Direction<false>::toLogical(-7) == -7, "a forward motor copies");
+  TEST_ASSERT_EQUAL_INT(-1, Direction<true>::kSign);
 }
 
 void test_percent_step_conversion() {
@@ -43,11 +56,112 @@ void test_percent_step_conversion() {
   TEST_ASSERT_FLOAT_WITHIN(0.01f, 0.0f, stepsToPercent(0, 0));
 }
 
+void test_fixed_point_percent_basics() {
+  const TravelScale scale(12000);
+  TEST_ASSERT_EQUAL_INT32(0, scale.centiPercent(0));
+  TEST_ASSERT_EQUAL_INT32(5000, scale.centiPercent(6000));
+  TEST_ASSERT_EQUAL_INT32(10000, scale.centiPercent(12000));
+  TEST_ASSERT_EQUAL_INT32(3333, scale.centiPercent(4000));
+  TEST_ASSERT_EQUAL_INT32(-1000, scale.centiPercent(-1200));  // inside the top overdrive
+  TEST_ASSERT_EQUAL_INT32(33, scale.wholePercent(4000));
+  TEST_ASSERT_EQUAL_INT32(-10, scale.wholePercent(-1200));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 33.33f, scale.percent(4000));
+
+  TEST_ASSERT_EQUAL(6000L, scale.stepsAtPercent(50.0f));
+  TEST_ASSERT_EQUAL(12000L, scale.stepsAtPercent(170.0f));
+  TEST_ASSERT_EQUAL(0L, scale.stepsAtPercent(-5.0f));
+  TEST_ASSERT_EQUAL(4000L, scale.stepsAtCentiPercent(3333));
+
+  const TravelScale none(0);
+  TEST_ASSERT_EQUAL_INT32(0, none.centiPercent(500));
+  TEST_ASSERT_EQUAL(0L, none.stepsAtPercent(50.0f));
+}
+
+// Exact value, and how far the fixed and float versions are from it, in hundredths.
+static void checkStepsToPercent(const TravelScale& scale, long steps) {
+  const double exact = 10000.0 * static_cast<double>(steps) / static_cast<double>(scale.travel());
+  const int32_t fixed = scale.centiPercent(steps);
+  const double reference = 100.0 * static_cast<double>(stepsToPercent(steps, scale.travel()));
+  if (fabs(fixed - exact) > 0.5001 || fabs(fixed - reference) > 0.501) {
+    char message[96];
+    snprintf(message, sizeof(message), "travel %ld steps %ld: fixed %ld float %.4f", scale.travel(), steps,
+             static_cast<long>(fixed), reference);
+    TEST_FAIL_MESSAGE(message);
+  }
+}
+
+static void checkPercentToSteps(const TravelScale& scale, int32_t centi) {
+  const double exact = static_cast<double>(centi) * static_cast<double>(scale.travel()) / 10000.0;
+  const long fixed = scale.stepsAtCentiPercent(centi);
+  const long reference = percentToSteps(static_cast<float>(centi) / 100.0f, scale.travel());
+  if (fabs(fixed - exact) > 0.5001 || labs(fixed - reference) > 1) {
+    char message[96];
+    snprintf(message, sizeof(message), "travel %ld centi %ld: fixed %ld float %ld", scale.travel(),
+             static_cast<long>(centi), fixed, reference);
+    TEST_FAIL_MESSAGE(message);
+  }
+}
+
+void test_fixed_point_matches_float_over_every_travel() {
+  const int32_t centis[] = {1, 50, 3333, 5000, 6667, 9999, 10000};
+  for (long travel = 100; travel <= kMaxTravelSteps; ++travel) {
+    const TravelScale scale(travel);
+    const long steps[] = {1, travel / 7, travel / 3, travel / 2, travel - 1, travel, -travel / 10};
+    for (long s : steps) checkStepsToPercent(scale, s);
+    for (int32_t c : centis) checkPercentToSteps(scale, c);
+  }
+}
+
+void test_fixed_point_matches_float_at_every_position() {
+  const long travels[] = {100, 101, 4000, 12000, 65535, 65536, 99991, kMaxTravelSteps};
+  for (long travel : travels) {
+    const TravelScale scale(travel);
+    for (long s = -travel / 2; s <= travel; ++s) checkStepsToPercent(scale, s);
+    for (int32_t c = 0; c <= 10000; ++c) checkPercentToSteps(scale, c);
+  }
+}
+
+// Host timings only show the shape: the host has an FPU, the ESP8266 emulates every float
+// operation in software, so the gap on the device is far wider.
+void test_fixed_point_benchmark() {
+  constexpr long kTravel = 123457;
+  const TravelScale scale(kTravel);
+  volatile long sink = 0;
+  constexpr int kRounds = 2000000;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; ++i) sink = sink + lroundf(stepsToPercent(i % kTravel, kTravel) * 100.0f);
+  const auto floatNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; ++i) sink = sink + scale.centiPercent(i % kTravel);
+  const auto fixedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; ++i) sink = sink + percentToSteps(static_cast<float>(i % 10001) * 0.01f, kTravel);
+  const auto floatBackNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kRounds; ++i) sink = sink + scale.stepsAtCentiPercent(i % 10001);
+  const auto fixedBackNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+  char line[128];
+  snprintf(line, sizeof(line), "steps->percent: float %.2f ns, fixed %.2f ns; percent->steps: float %.2f ns, fixed %.2f ns (host)",
+           static_cast<double>(floatNs.count()) / kRounds, static_cast<double>(fixedNs.count()) / kRounds,
+           static_cast<double>(floatBackNs.count()) / kRounds, static_cast<double>(fixedBackNs.count()) / kRounds);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(sink != 0);
+}
+
 int main(int argc, char** argv) {
   UNITY_BEGIN();
   RUN_TEST(test_clamp_long_bounds);
   RUN_TEST(test_clamp_float_bounds);
   RUN_TEST(test_direction_conversion);
   RUN_TEST(test_percent_step_conversion);
+  RUN_TEST(test_fixed_point_percent_basics);
+  RUN_TEST(test_fixed_point_matches_float_over_every_travel);
+  RUN_TEST(test_fixed_point_matches_float_at_every_position);
+  RUN_TEST(test_fixed_point_benchmark);
   return UNITY_END();
 }
@@ -0,0 +1,1351 @@
+#include <unity.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "GroupCommand.h"
+#include "HostSim.h"
+#include "MqttPacket.h"
+#include "PositionJournal.h"
+#include "Schedule.h"
+#include "StateRecord.h"
+
+// Replays scripts/hw_regression_suite.sh against src/main.cpp on the host (env native_sim).
+// Each hostsim::boot() is a power cycle: fresh globals, same flash and motor shaft.
+
+namespace {
+
+// Coil pins IN1..IN4 of the board (cfg::kPinIn1..kPinIn4).
+constexpr uint8_t kIn1 = 5;
+constexpr uint8_t kIn2 = 4;
+constexpr uint8_t kIn3 = 14;
+constexpr uint8_t kIn4 = 12;
+
+const char* kFirmwareUrl = "http://192.168.88.10:18080/firmware.bin";
+const char* kFilesystemUrl = "http://192.168.88.10:18080/littlefs.bin";
+
+// Raw value of a top-level key in a flat JSON object, without quotes for strings.
+std::string field(const std::string& json, const char* key) {
+  const std::string needle = std::string("\"") + key + "\":";
+  const size_t at = json.find(needle);
+  if (at == std::string::npos) return "<missing>";
+  size_t start = at + needle.size();
+  size_t end;
+  if (json[start] == '"') {
+    ++start;
+    end = json.find('"', start);
+  } else {
+    end = json.find_first_of(",}", start);
+  }
+  return json.substr(start, end - start);
+}
+
+std::string getState() { return hostsim::request("GET", "/api/state").body; }
+
+bool idle() { return field(getState(), "moving") == "false"; }
+
+bool settingsCommitted() { return field(getState(), "settingsCommitPending") == "false"; }
+
+bool runBoot(void (*body)()) {
+  return hostsim::boot([body]() {
+    body();
+    return !Unity.CurrentTestFailed;
+  });
+}
+
+void bootAndServe() { TEST_ASSERT_TRUE(hostsim::runSetup()); }
+
+// ---- Boot bodies -------------------------------------------------------------------------
+
+void saveOtaDefaults() {
+  bootAndServe();
+  hostsim::Response r = hostsim::request(
+      "POST", "/api/firmware/config", R"({"firmwareRepo":"","firmwareAssetName":"","firmwareFsAssetName":""})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("dslimp/shutter", field(r.body, "firmwareRepo").c_str());
+  TEST_ASSERT_EQUAL_STRING("firmware.bin", field(r.body, "firmwareAssetName").c_str());
+  TEST_ASSERT_EQUAL_STRING("littlefs.bin", field(r.body, "firmwareFsAssetName").c_str());
+
+  r = hostsim::request("POST", "/api/firmware/check/latest", R"({"includeFilesystem":true})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "ok").c_str());
+}
+
+void latestCheckWithoutInternet() {
+  hostsim::setInternetReachable(false);
+  bootAndServe();
+  const hostsim::Response r = hostsim::request("POST", "/api/firmware/check/latest", "{}");
+  TEST_ASSERT_EQUAL(502, r.status);
+  TEST_ASSERT_EQUAL_STRING("dns lookup failed", field(r.body, "networkError").c_str());
+}
+
+void applySettingsAndCalibrate() {
+  bootAndServe();
+  hostsim::Response r = hostsim::request(
+      "POST", "/api/settings",
+      R"({"maxSpeed":1500,"acceleration":420,"travelSteps":12000,"coilHoldMs":650,"reverseDirection":true,)"
+      R"("wifiModemSleep":false,"topOverdriveEnabled":true,"topOverdrivePercent":10})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("1500", field(r.body, "maxSpeed").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "reverseDirection").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "settingsCommitPending").c_str());
+
+  const long shaftBefore = hostsim::motor().position;
+  hostsim::request("POST", "/api/calibrate", R"({"action":"reset"})");
+  hostsim::request("POST", "/api/calibrate", R"({"action":"set_top"})");
+  hostsim::request("POST", "/api/calibrate", R"({"action":"jog","steps":600})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+  r = hostsim::request("POST", "/api/calibrate", R"({"action":"set_bottom"})");
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "calibrated").c_str());
+  TEST_ASSERT_EQUAL_STRING("600", field(r.body, "travelSteps").c_str());
+
+  TEST_ASSERT_EQUAL(600, labs(hostsim::motor().position - shaftBefore));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+  TEST_ASSERT_TRUE(hostsim::runUntil(settingsCommitted, 10000));
+}
+
+// The UI saves a form field by field: each change is answered at once, the burst is committed
+// once after it, and a steady trickle still commits within the cap.
+void coalesceSettingsCommits() {
+  bootAndServe();
+  const int commitsBefore = atoi(field(getState(), "stateCommits").c_str());
+  for (int i = 0; i < 5; ++i) {
+    const std::string body = "{\"coilHoldMs\":" + std::to_string(600 + i) + "}";
+    const hostsim::Response r = hostsim::request("POST", "/api/settings", body.c_str());
+    TEST_ASSERT_EQUAL(200, r.status);
+    TEST_ASSERT_EQUAL_STRING("true", field(r.body, "settingsCommitPending").c_str());
+    hostsim::runFor(300);
+  }
+  std::string s = getState();
+  TEST_ASSERT_EQUAL(commitsBefore, atoi(field(s, "stateCommits").c_str()));
+  TEST_ASSERT_EQUAL_STRING("4", field(s, "settingsCommitsCoalesced").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(settingsCommitted, 2000));
+  TEST_ASSERT_EQUAL(commitsBefore + 1, atoi(field(getState(), "stateCommits").c_str()));
+
+  // One change every 800 ms: the first commit is due 5 s after the burst started.
+  for (int i = 0; i < 8; ++i) {
+    const std::string body = "{\"coilHoldMs\":" + std::to_string(700 + i) + "}";
+    TEST_ASSERT_EQUAL(200, hostsim::request("POST", "/api/settings", body.c_str()).status);
+    hostsim::runFor(800);
+  }
+  TEST_ASSERT_TRUE(hostsim::runUntil(settingsCommitted, 2000));
+  TEST_ASSERT_EQUAL(commitsBefore + 3, atoi(field(getState(), "stateCommits").c_str()));
+
+  // A reboot writes what is still pending before it goes.
+  TEST_ASSERT_EQUAL(200, hostsim::request("POST", "/api/settings", R"({"coilHoldMs":777})").status);
+  hostsim::request("POST", "/api/system/reboot");
+  TEST_ASSERT_TRUE(hostsim::restarted());
+}
+
+void assertCoalescedSettingsPersisted() {
+  bootAndServe();
+  TEST_ASSERT_EQUAL_STRING("777", field(getState(), "coilHoldMs").c_str());
+}
+
+void assertSettingsPersisted() {
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("1500", field(s, "maxSpeed").c_str());
+  TEST_ASSERT_EQUAL_STRING("420", field(s, "acceleration").c_str());
+  TEST_ASSERT_EQUAL_STRING("600", field(s, "travelSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("650", field(s, "coilHoldMs").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(s, "reverseDirection").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(s, "topOverdriveEnabled").c_str());
+  TEST_ASSERT_EQUAL_STRING("10", field(s, "topOverdrivePercent").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(s, "calibrated").c_str());
+}
+
+void moveHalfway() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"travelSteps":4000,"maxSpeed":900})");
+  const long shaftBefore = hostsim::motor().position;
+  const hostsim::Response r = hostsim::request("POST", "/api/move", R"({"action":"set","percent":50})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("2000", field(r.body, "targetSteps").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+
+  TEST_ASSERT_EQUAL_STRING("2000", field(getState(), "positionSteps").c_str());
+  TEST_ASSERT_EQUAL(2000, labs(hostsim::motor().position - shaftBefore));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+  // The ramp never exceeds maxSpeed (900 half steps/s -> 1.11 ms per step).
+  TEST_ASSERT_GREATER_OR_EQUAL(1100000, hostsim::motor().minStepIntervalNs);
+  // Outputs are released after coilHoldMs.
+  hostsim::runFor(1000);
+  TEST_ASSERT_FALSE(hostsim::motor().energized);
+}
+
+void resumeFromHalfway() {
+  bootAndServe();
+  TEST_ASSERT_EQUAL_STRING("2000", field(getState(), "positionSteps").c_str());
+  const long shaftBefore = hostsim::motor().position;
+  hostsim::request("POST", "/api/move", R"({"action":"open"})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL_STRING("0", field(getState(), "positionSteps").c_str());
+  // Opening from 2000 runs past the top by topOverdrivePercent of the travel, then re-anchors.
+  TEST_ASSERT_EQUAL(2400, labs(hostsim::motor().position - shaftBefore));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+}
+
+void stopDuringMotion() {
+  bootAndServe();
+  hostsim::request("POST", "/api/move", R"({"action":"close"})");
+  hostsim::runFor(2000);
+  TEST_ASSERT_EQUAL_STRING("true", field(getState(), "moving").c_str());
+  hostsim::request("POST", "/api/move", R"({"action":"stop"})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 5000));
+
+  const long position = atol(field(getState(), "positionSteps").c_str());
+  TEST_ASSERT_GREATER_THAN(0, position);
+  TEST_ASSERT_LESS_THAN(12000, position);
+  TEST_ASSERT_EQUAL(position, labs(hostsim::motor().position));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+}
+
+void eventStreamFollowsMotion() {
+  bootAndServe();
+  hostsim::EventStream events = hostsim::openStream("/api/events");
+  const std::string opening = events.take();
+  TEST_ASSERT_TRUE(opening.find("text/event-stream") != std::string::npos);
+  TEST_ASSERT_TRUE(opening.find("event: state") != std::string::npos);
+
+  hostsim::runFor(1000);
+  TEST_ASSERT_TRUE(events.take().empty());  // nothing is written while idle
+
+  hostsim::request("POST", "/api/move", R"({"action":"jog","steps":400})");
+  hostsim::runFor(1000);
+  const std::string moving = events.take();
+  TEST_ASSERT_TRUE(moving.find("event: patch") != std::string::npos);
+  TEST_ASSERT_TRUE(moving.find("\"moving\":true") != std::string::npos);
+
+  events.close();
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+  TEST_ASSERT_EQUAL(200, hostsim::request("GET", "/api/state").status);
+}
+
+void localOtaInstallsBothImages() {
+  bootAndServe();
+  const hostsim::Response r = hostsim::request(
+      "POST", "/api/firmware/update/url",
+      std::string(R"({"firmwareUrl":")") + kFirmwareUrl + R"(","filesystemUrl":")" + kFilesystemUrl +
+          R"(","includeFilesystem":true})");
+  TEST_ASSERT_EQUAL(202, r.status);
+  TEST_ASSERT_TRUE(hostsim::runUntil(hostsim::restarted, 120000));
+  TEST_ASSERT_TRUE(hostsim::serialOutput().find("[OTA] job complete") != std::string::npos);
+}
+
+void otaRejectsImageWithoutMagicByte() {
+  bootAndServe();
+  hostsim::request("POST", "/api/firmware/update/url",
+                   std::string(R"({"firmwareUrl":")") + kFirmwareUrl + R"(","includeFilesystem":false})");
+  TEST_ASSERT_TRUE(hostsim::runUntil([] { return field(getState(), "otaPhase") == "failed"; }, 120000));
+  TEST_ASSERT_TRUE(field(getState(), "otaLastError").find("Magic byte") != std::string::npos);
+  TEST_ASSERT_FALSE(hostsim::restarted());
+}
+
+void metricsCoverAMove() {
+  bootAndServe();
+  hostsim::request("POST", "/api/metrics", R"({"reset":true})");
+  hostsim::request("POST", "/api/move", R"({"action":"jog","steps":400})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+
+  const hostsim::Response r = hostsim::request("GET", "/api/metrics");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("0", field(r.body, "missedStepDeadlines").c_str());
+  // The first "count" is stepLateness: one per step interrupt.
+  TEST_ASSERT_TRUE(atol(field(r.body, "count").c_str()) >= 400);
+
+  const hostsim::Response text = hostsim::request("GET", "/api/metrics?format=prometheus");
+  TEST_ASSERT_EQUAL(200, text.status);
+  TEST_ASSERT_TRUE(text.header("Content-Type").find("text/plain") == 0);
+  TEST_ASSERT_EQUAL(text.body.size(), static_cast<size_t>(atol(text.header("Content-Length").c_str())));
+  TEST_ASSERT_TRUE(text.body.find("shutter_section_duration_us{section=\"loop\",quantile=\"0.99\"}") != std::string::npos);
+  TEST_ASSERT_TRUE(text.body.find("shutter_step_deadlines_missed_total 0\n") != std::string::npos);
+}
+
+// Set by the test process before a boot; the boot child checks against them.
+const char* expectedConnectPath = "";
+long maxConnectMs = 0;
+
+void assertWiFiConnect() {
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING(expectedConnectPath, field(s, "wifiConnectPath").c_str());
+  const long connectMs = atol(field(s, "wifiConnectMs").c_str());
+  TEST_ASSERT_TRUE(connectMs <= maxConnectMs);
+  // setup() adds its own fixed delays; the join dominates.
+  TEST_ASSERT_TRUE(atol(field(s, "bootToFirstResponseMs").c_str()) < connectMs + 500);
+}
+
+// The lease expired and the router gave the address to another host; the fast join cannot
+// tell, so it goes back to DHCP once up and caches the new lease.
+void renewLeaseAfterFastJoin() {
+  bootAndServe();
+  std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("fast", field(s, "wifiConnectPath").c_str());
+  TEST_ASSERT_EQUAL_STRING("192.168.88.74", field(s, "ip").c_str());
+  hostsim::runFor(20000);
+  TEST_ASSERT_EQUAL_STRING("192.168.88.75", field(getState(), "ip").c_str());
+}
+
+void assertRenewedLeaseCached() {
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("fast", field(s, "wifiConnectPath").c_str());
+  TEST_ASSERT_EQUAL_STRING("192.168.88.75", field(s, "ip").c_str());
+}
+
+void setStaticAddress() {
+  bootAndServe();
+  const hostsim::Response r = hostsim::request(
+      "POST", "/api/settings", R"({"wifiStaticIp":"192.168.88.50","wifiGateway":"192.168.88.1"})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("192.168.88.50", field(r.body, "wifiStaticIp").c_str());
+  TEST_ASSERT_EQUAL(400, hostsim::request("POST", "/api/settings", R"({"wifiStaticIp":"192.168.88"})").status);
+  TEST_ASSERT_TRUE(hostsim::runUntil(settingsCommitted, 10000));
+}
+
+void assertStaticAddressUsed() {
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("192.168.88.50", field(s, "ip").c_str());
+  TEST_ASSERT_EQUAL_STRING("fast", field(s, "wifiConnectPath").c_str());
+}
+
+void lightSleepWhileIdle() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"travelSteps":4000,"idleLightSleep":true,"wakeLatencyMs":300})");
+  hostsim::runFor(5000);
+  std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("light_sleep", field(s, "powerMode").c_str());
+  TEST_ASSERT_EQUAL_STRING("2", field(s, "listenInterval").c_str());
+  TEST_ASSERT_TRUE(atof(field(s, "lightSleepPercent").c_str()) > 80.0);
+  TEST_ASSERT_TRUE(atof(field(s, "estimatedCurrentMa").c_str()) < 15.0);
+  TEST_ASSERT_TRUE(hostsim::lightSleepCount() > 0);
+
+  // A move wakes everything up: the step timer would stall in light sleep.
+  const long shaftBefore = hostsim::motor().position;
+  hostsim::request("POST", "/api/move", R"({"action":"jog","steps":1500})");
+  hostsim::runFor(200);
+  TEST_ASSERT_EQUAL_STRING("awake", field(getState(), "powerMode").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL(1500, labs(hostsim::motor().position - shaftBefore));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+  TEST_ASSERT_EQUAL_STRING("0", field(hostsim::request("GET", "/api/metrics").body, "missedStepDeadlines").c_str());
+
+  // Back to sleep once the coils are released.
+  hostsim::runFor(1000);
+  s = getState();
+  TEST_ASSERT_EQUAL_STRING("light_sleep", field(s, "powerMode").c_str());
+  TEST_ASSERT_TRUE(atof(field(s, "coilPercent").c_str()) > 0.0);
+}
+
+// ETag of a stored file: FNV-1a of its bytes and its size.
+std::string assetTag(const std::string& stored) {
+  char tag[24];
+  snprintf(tag, sizeof(tag), "\"%08lx-%lx\"",
+           static_cast<unsigned long>(shutter::storage::fnv1a(reinterpret_cast<const uint8_t*>(stored.data()), stored.size())),
+           static_cast<unsigned long>(stored.size()));
+  return tag;
+}
+
+const std::string kPageV1("\x1f\x8b page v1", 10);
+const std::string kPageV2("\x1f\x8b page v2", 10);
+
+void staticAssetsRevalidate() {
+  // As the build stores them: gzipped, and the page links the script by content hash.
+  hostsim::writeFile("/index.html.gz", kPageV1);
+  hostsim::writeFile("/app.js.gz", std::string("\x1f\x8b script", 8));
+  bootAndServe();
+
+  hostsim::Response r = hostsim::request("GET", "/");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("gzip", r.header("Content-Encoding").c_str());
+  TEST_ASSERT_EQUAL_STRING("no-cache", r.header("Cache-Control").c_str());
+  TEST_ASSERT_EQUAL_STRING("text/html", r.header("Content-Type").c_str());
+  TEST_ASSERT_EQUAL(10, r.body.size());
+  const std::string etag = r.header("ETag");
+  TEST_ASSERT_EQUAL_STRING(assetTag(kPageV1).c_str(), etag.c_str());
+
+  // A warm cache costs a header-only reply.
+  r = hostsim::request("GET", "/", "", {{"If-None-Match", etag}});
+  TEST_ASSERT_EQUAL(304, r.status);
+  TEST_ASSERT_TRUE(r.body.empty());
+  TEST_ASSERT_EQUAL_STRING(etag.c_str(), r.header("ETag").c_str());
+
+  r = hostsim::request("GET", "/app.js?v=0123abcd");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("public, max-age=31536000, immutable", r.header("Cache-Control").c_str());
+  TEST_ASSERT_EQUAL_STRING("application/javascript", r.header("Content-Type").c_str());
+  TEST_ASSERT_TRUE(r.header("ETag") != etag);
+  TEST_ASSERT_EQUAL(404, hostsim::request("GET", "/styles.css").status);
+  // Unknown paths get the page (captive portal style), with the same validators.
+  TEST_ASSERT_EQUAL(304, hostsim::request("GET", "/setup", "", {{"If-None-Match", etag}}).status);
+
+  // A new filesystem image changes the tag.
+  hostsim::writeFile("/index.html.gz", kPageV2);
+}
+
+void staticAssetsChangedImage() {
+  bootAndServe();
+  const hostsim::Response r = hostsim::request("GET", "/", "", {{"If-None-Match", assetTag(kPageV1)}});
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING(assetTag(kPageV2).c_str(), r.header("ETag").c_str());
+  TEST_ASSERT_TRUE(r.body == kPageV2);
+}
+
+void liteStatePolling() {
+  bootAndServe();
+  hostsim::Response r = hostsim::request("GET", "/api/state/lite");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("application/json", r.header("Content-Type").c_str());
+  TEST_ASSERT_EQUAL_STRING("no-cache", r.header("Cache-Control").c_str());
+  TEST_ASSERT_EQUAL_STRING("false", field(r.body, "moving").c_str());
+  TEST_ASSERT_EQUAL_STRING("idle", field(r.body, "motion").c_str());
+  TEST_ASSERT_TRUE(field(r.body, "travelSteps") == "<missing>");  // settings stay in /api/state
+  const std::string allTag = r.header("ETag");
+
+  // Nothing moved: a header-only reply.
+  r = hostsim::request("GET", "/api/state/lite", "", {{"If-None-Match", allTag}});
+  TEST_ASSERT_EQUAL(304, r.status);
+  TEST_ASSERT_TRUE(r.body.empty());
+
+  const std::string pos = field(getState(), "positionSteps");
+  r = hostsim::request("GET", "/api/state/lite?fields=positionSteps,moving");
+  TEST_ASSERT_TRUE(r.body == "[{\"positionSteps\":" + pos + ",\"moving\":false}]");
+  const std::string posTag = r.header("ETag");
+  TEST_ASSERT_TRUE(posTag != allTag);
+  TEST_ASSERT_EQUAL(400, hostsim::request("GET", "/api/state/lite?fields=positionSteps,coilDutyPercent").status);
+
+  // The same selection in MessagePack: [{"positionSteps": <uint>}] under its own tag.
+  r = hostsim::request("GET", "/api/state/lite?fields=positionSteps&format=msgpack");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("application/msgpack", r.header("Content-Type").c_str());
+  TEST_ASSERT_TRUE(r.body.compare(0, 16, "\x91\x81\xadpositionSteps") == 0);
+  TEST_ASSERT_TRUE(r.header("ETag") != posTag);
+
+  hostsim::request("POST", "/api/move", R"({"action":"jog","steps":400})");
+  hostsim::runFor(300);
+  r = hostsim::request("GET", "/api/state/lite?fields=positionSteps,moving", "", {{"If-None-Match", posTag}});
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "moving").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+
+  // At rest again the tag stays put for as long as the shutter does.
+  const std::string restTag = hostsim::request("GET", "/api/state/lite").header("ETag");
+  TEST_ASSERT_TRUE(restTag != allTag);
+  hostsim::runFor(1000);
+  TEST_ASSERT_EQUAL(304, hostsim::request("GET", "/api/state/lite", "", {{"If-None-Match", restTag}}).status);
+}
+
+// ---- Group control: each boot plays one node on the LAN -------------------------------------
+
+const char* kGroupAddress = "239.255.83.72";
+constexpr uint16_t kGroupPort = 4219;
+// Node A's first step, counted from its first datagram; A's boot leaves it for B's in a file.
+const char* kGroupStartNote = "/sim_group_start_ns";
+
+bool decodeGroupDatagram(const hostsim::Datagram& datagram, shutter::group::Command* command) {
+  return shutter::group::decode(reinterpret_cast<const uint8_t*>(datagram.bytes.data()), datagram.bytes.size(), command);
+}
+
+bool motorStepped(uint32_t stepsBefore) { return hostsim::motor().steps > stepsBefore; }
+
+void groupSenderNode() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"groupMask":2})");
+  TEST_ASSERT_EQUAL_STRING("2", field(getState(), "groupMask").c_str());
+  TEST_ASSERT_EQUAL(400, hostsim::request("POST", "/api/group/move", R"({"group":17,"action":"close"})").status);
+
+  const uint32_t stepsBefore = hostsim::motor().steps;
+  const hostsim::Response r = hostsim::request("POST", "/api/group/move", R"({"group":2,"action":"set","percent":10})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "member").c_str());
+  TEST_ASSERT_EQUAL_STRING("200", field(r.body, "leadMs").c_str());
+  TEST_ASSERT_EQUAL(1, hostsim::multicastLog().size());
+  const uint64_t firstSentNs = hostsim::multicastLog()[0].sentNs;
+
+  // Nothing moves before the shared start, even though this node sent the command.
+  hostsim::runFor(150);
+  TEST_ASSERT_EQUAL(stepsBefore, hostsim::motor().steps);
+  TEST_ASSERT_TRUE(hostsim::runUntil([stepsBefore]() { return motorStepped(stepsBefore); }, 1000));
+  const uint64_t startNs = hostsim::nowNanos() - firstSentNs;
+  TEST_ASSERT_GREATER_OR_EQUAL(200000000ULL, startNs);
+  hostsim::writeFile(kGroupStartNote, std::to_string(startNs));
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+  TEST_ASSERT_EQUAL_STRING("1200", field(getState(), "positionSteps").c_str());
+
+  // Three copies of one command, each counting down to the same start.
+  const std::vector<hostsim::Datagram>& log = hostsim::multicastLog();
+  TEST_ASSERT_EQUAL(3, log.size());
+  shutter::group::Command first;
+  TEST_ASSERT_TRUE(decodeGroupDatagram(log[0], &first));
+  TEST_ASSERT_EQUAL_UINT16(2, first.groups);
+  TEST_ASSERT_TRUE(first.action == shutter::group::Action::Set);
+  TEST_ASSERT_EQUAL_UINT16(1000, first.centiPercent);
+  TEST_ASSERT_EQUAL_UINT32(200000, first.startInUs);
+  for (const hostsim::Datagram& datagram : log) {
+    TEST_ASSERT_EQUAL_STRING(kGroupAddress, datagram.group.c_str());
+    TEST_ASSERT_EQUAL(kGroupPort, datagram.port);
+    shutter::group::Command copy;
+    TEST_ASSERT_TRUE(decodeGroupDatagram(datagram, &copy));
+    TEST_ASSERT_EQUAL_UINT16(first.sequence, copy.sequence);
+    const uint64_t startAtUs = datagram.sentNs / 1000 + copy.startInUs;
+    TEST_ASSERT_UINT32_WITHIN(1, firstSentNs / 1000 + 200000, static_cast<uint32_t>(startAtUs));
+  }
+  TEST_ASSERT_UINT32_WITHIN(2000000, 40000000, static_cast<uint32_t>(log[1].sentNs - log[0].sentNs));
+}
+
+void groupMemberNode() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"groupMask":6})");  // groups 2 and 3
+  hostsim::request("POST", "/api/move", R"({"action":"open"})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL_STRING("0", field(getState(), "positionSteps").c_str());
+
+  // Node A's datagrams at the times A sent them; the first copy is lost on the air.
+  std::string noted;
+  TEST_ASSERT_TRUE(hostsim::readFile(kGroupStartNote, &noted));
+  const uint64_t senderStartNs = strtoull(noted.c_str(), nullptr, 10);
+  const std::vector<hostsim::Datagram> log = hostsim::multicastLog();
+  TEST_ASSERT_EQUAL(3, log.size());
+  const uint32_t stepsBefore = hostsim::motor().steps;
+  const uint64_t baseNs = hostsim::nowNanos();
+  for (size_t i = 1; i < log.size(); ++i) {
+    const uint64_t dueNs = baseNs + (log[i].sentNs - log[0].sentNs);
+    TEST_ASSERT_TRUE(hostsim::runUntil([dueNs]() { return hostsim::nowNanos() >= dueNs; }, 1000));
+    hostsim::multicast(log[i].group, log[i].port, log[i].bytes);
+  }
+  TEST_ASSERT_TRUE(hostsim::runUntil([stepsBefore]() { return motorStepped(stepsBefore); }, 1000));
+  const uint64_t startNs = hostsim::nowNanos() - baseNs;
+  // Both nodes take the first step on the same schedule, within a loop() pass each.
+  TEST_ASSERT_UINT32_WITHIN(1000000, static_cast<uint32_t>(senderStartNs), static_cast<uint32_t>(startNs));
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+  std::string state = getState();
+  TEST_ASSERT_EQUAL_STRING("1200", field(state, "positionSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("1", field(state, "groupHeard").c_str());  // the repeat acted once
+  TEST_ASSERT_EQUAL_STRING("1", field(state, "groupStarted").c_str());
+
+  // Another node's command for group 1, which this node is not in, is heard and ignored;
+  // one for group 3 runs.
+  shutter::group::Command command;
+  command.sender = 0x42;
+  command.groups = 1;
+  command.action = shutter::group::Action::Close;
+  uint8_t packet[shutter::group::kPacketSize];
+  shutter::group::encode(command, packet, sizeof(packet));
+  hostsim::multicast(kGroupAddress, kGroupPort, std::string(reinterpret_cast<const char*>(packet), sizeof(packet)));
+  hostsim::runFor(300);
+  state = getState();
+  TEST_ASSERT_EQUAL_STRING("2", field(state, "groupHeard").c_str());
+  TEST_ASSERT_EQUAL_STRING("false", field(state, "moving").c_str());
+
+  command.sequence = 1;
+  command.groups = 4;
+  shutter::group::encode(command, packet, sizeof(packet));
+  hostsim::multicast(kGroupAddress, kGroupPort, std::string(reinterpret_cast<const char*>(packet), sizeof(packet)));
+  hostsim::runFor(100);
+  TEST_ASSERT_EQUAL_STRING("true", field(getState(), "moving").c_str());
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+}
+
+// ---- MQTT broker played by the test ---------------------------------------------------------
+
+const char* kBrokerIp = "192.168.88.20";
+
+struct MqttPacket {
+  shutter::mqtt::PacketType type;
+  std::string topic;  // PUBLISH only
+  std::string payload;
+  bool retained = false;
+  std::string body;
+};
+
+std::vector<MqttPacket> mqttPackets(const std::string& bytes) {
+  static shutter::mqtt::PacketReader<1024> reader;
+  std::vector<MqttPacket> packets;
+  for (const char c : bytes) {
+    if (!reader.push(static_cast<uint8_t>(c))) continue;
+    MqttPacket packet;
+    packet.type = reader.type();
+    packet.body.assign(reinterpret_cast<const char*>(reader.body()), reader.length());
+    shutter::mqtt::Message message;
+    if (packet.type == shutter::mqtt::PacketType::Publish &&
+        shutter::mqtt::parsePublish(reader.flags(), reader.body(), reader.length(), &message)) {
+      packet.topic.assign(message.topic, message.topicLength);
+      packet.payload.assign(reinterpret_cast<const char*>(message.payload), message.payloadLength);
+      packet.retained = reader.flags() & 0x01;
+    }
+    packets.push_back(packet);
+  }
+  return packets;
+}
+
+// Payload of the last PUBLISH to |topic|, or "<none>".
+std::string lastPublish(const std::vector<MqttPacket>& packets, const std::string& topic) {
+  std::string payload = "<none>";
+  for (const MqttPacket& packet : packets) {
+    if (packet.type == shutter::mqtt::PacketType::Publish && packet.topic == topic) payload = packet.payload;
+  }
+  return payload;
+}
+
+void mqttPublishTo(hostsim::Peer& peer, const char* topic, const char* payload) {
+  uint8_t packet[128];
+  const size_t n = shutter::mqtt::encodePublish(packet, sizeof(packet), topic, payload, false);
+  peer.send(std::string(reinterpret_cast<const char*>(packet), n));
+}
+
+// Accepts the sketch's connection and answers its CONNECT.
+void acceptMqttSession(hostsim::Peer* session, std::vector<MqttPacket>* received) {
+  hostsim::runFor(100);
+  hostsim::Peer& peer = *session;
+  peer = hostsim::accept(kBrokerIp, 1883);
+  TEST_ASSERT_TRUE(peer.valid());
+  std::vector<MqttPacket> connect = mqttPackets(peer.take());
+  TEST_ASSERT_EQUAL(1, connect.size());
+  TEST_ASSERT_TRUE(connect[0].type == shutter::mqtt::PacketType::Connect);
+  // Last will on the availability topic.
+  TEST_ASSERT_TRUE(connect[0].body.find("home/blind/availability") != std::string::npos);
+  TEST_ASSERT_TRUE(connect[0].body.find("offline") != std::string::npos);
+  peer.send(std::string("\x20\x02\x00\x00", 4));
+  hostsim::runFor(200);
+  *received = mqttPackets(peer.take());
+}
+
+void mqttControlsAndReports() {
+  hostsim::listen(kBrokerIp, 1883);
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"travelSteps":4000})");
+  hostsim::Response r = hostsim::request(
+      "POST", "/api/mqtt/config",
+      R"({"mqttEnabled":true,"mqttHost":"192.168.88.20","mqttUser":"ha","mqttPassword":"secret","mqttBaseTopic":"home/blind"})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "mqttPasswordSet").c_str());
+  TEST_ASSERT_TRUE(r.body.find("secret") == std::string::npos);
+
+  std::vector<MqttPacket> received;
+  hostsim::Peer peer;
+  acceptMqttSession(&peer, &received);
+  TEST_ASSERT_TRUE(received.size() >= 4);
+  TEST_ASSERT_TRUE(received[0].type == shutter::mqtt::PacketType::Subscribe);
+  TEST_ASSERT_TRUE(received[0].body.find("home/blind/+/position/set") != std::string::npos);
+  TEST_ASSERT_EQUAL_STRING("online", lastPublish(received, "home/blind/availability").c_str());
+  const std::string discovery = lastPublish(received, "homeassistant/cover/shutter_abcdef_0/config");
+  TEST_ASSERT_TRUE(discovery.find(R"("~":"home/blind")") != std::string::npos);
+  TEST_ASSERT_TRUE(discovery.find(R"("set_pos_t":"~/0/position/set")") != std::string::npos);
+  TEST_ASSERT_EQUAL_STRING("open", lastPublish(received, "home/blind/0/state").c_str());
+  TEST_ASSERT_EQUAL_STRING("100", lastPublish(received, "home/blind/0/position").c_str());
+  for (const MqttPacket& packet : received) {
+    if (packet.type == shutter::mqtt::PacketType::Publish) TEST_ASSERT_TRUE(packet.retained);
+  }
+  TEST_ASSERT_EQUAL_STRING("connected", field(getState(), "mqttState").c_str());
+
+  // Idle: nothing but keepalive pings.
+  hostsim::runFor(20000);
+  for (const MqttPacket& packet : mqttPackets(peer.take())) {
+    TEST_ASSERT_TRUE(packet.type == shutter::mqtt::PacketType::Pingreq);
+    peer.send(std::string("\xd0\x00", 2));
+  }
+
+  // Home Assistant's 25 (% open) is 75 % closed here.
+  mqttPublishTo(peer, "home/blind/0/position/set", "25");
+  hostsim::runFor(200);
+  received = mqttPackets(peer.take());
+  TEST_ASSERT_EQUAL_STRING("closing", lastPublish(received, "home/blind/0/state").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  hostsim::runFor(200);
+  const std::vector<MqttPacket> moved = mqttPackets(peer.take());
+  received.insert(received.end(), moved.begin(), moved.end());
+  TEST_ASSERT_EQUAL_STRING("stopped", lastPublish(received, "home/blind/0/state").c_str());
+  TEST_ASSERT_EQUAL_STRING("25", lastPublish(received, "home/blind/0/position").c_str());
+  TEST_ASSERT_EQUAL_STRING("3000", field(getState(), "positionSteps").c_str());
+  // Progress goes out about once a second, not on every step.
+  int positions = 0;
+  for (const MqttPacket& packet : received) positions += packet.topic == "home/blind/0/position" ? 1 : 0;
+  TEST_ASSERT_TRUE(positions >= 2 && positions <= 12);
+
+  // Broker gone during a move: no reconnect until every motor rests.
+  mqttPublishTo(peer, "home/blind/0/set", "OPEN");
+  hostsim::runFor(100);
+  peer.close();
+  hostsim::runFor(3000);
+  TEST_ASSERT_TRUE(field(getState(), "moving") == "true");
+  TEST_ASSERT_FALSE(hostsim::accept(kBrokerIp, 1883).valid());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+  hostsim::runFor(2000);
+  hostsim::Peer again = hostsim::accept(kBrokerIp, 1883);
+  TEST_ASSERT_TRUE(again.valid());
+  TEST_ASSERT_EQUAL_STRING("0", field(getState(), "positionSteps").c_str());
+}
+
+void mqttConfigPersisted() {
+  hostsim::listen(kBrokerIp, 1883, false);
+  bootAndServe();
+  const hostsim::Response r = hostsim::request("GET", "/api/mqtt/config");
+  TEST_ASSERT_EQUAL_STRING("192.168.88.20", field(r.body, "mqttHost").c_str());
+  TEST_ASSERT_EQUAL_STRING("home/blind", field(r.body, "mqttBaseTopic").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "mqttPasswordSet").c_str());
+  // A refused broker backs off instead of retrying every pass.
+  hostsim::runFor(10000);
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("waiting", field(s, "mqttState").c_str());
+  TEST_ASSERT_EQUAL_STRING("tcp connect failed", field(s, "mqttLastError").c_str());
+  TEST_ASSERT_TRUE(hostsim::serialOutput().find("[MQTT] tcp connect failed, retry in 8000ms") != std::string::npos);
+}
+
+// Share of the next |ms| with any coil of the motor on.
+double energizedShare(uint32_t ms) {
+  const uint64_t before = hostsim::motor().energizedNs;
+  hostsim::runFor(ms);
+  return static_cast<double>(hostsim::motor().energizedNs - before) / (ms * 1e6);
+}
+
+void holdCoilsChopped() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings",
+                   R"({"travelSteps":4000,"coilHoldMs":2000,"holdDutyPercent":30,"idleHoldDutyPercent":10})");
+  hostsim::request("POST", "/api/move", R"({"action":"jog","steps":1000})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+
+  TEST_ASSERT_EQUAL_STRING("30", field(getState(), "coilDutyPercent").c_str());
+  TEST_ASSERT_TRUE(fabs(energizedShare(1000) - 0.30) < 0.02);
+  hostsim::runFor(1200);
+  TEST_ASSERT_EQUAL_STRING("10", field(getState(), "coilDutyPercent").c_str());
+  const long coilOnMs = atol(field(getState(), "coilOnMs").c_str());
+  TEST_ASSERT_TRUE(fabs(energizedShare(1000) - 0.10) < 0.02);
+  // The firmware's own account agrees: 10% of a second is 100 ms.
+  TEST_ASSERT_INT_WITHIN(5, 100, atol(field(getState(), "coilOnMs").c_str()) - coilOnMs);
+
+  // Chopping holds the phase: the shaft does not move, and the next move starts cleanly.
+  TEST_ASSERT_EQUAL(1000, labs(hostsim::motor().position));
+  hostsim::request("POST", "/api/move", R"({"action":"jog","steps":-400})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 10000));
+  TEST_ASSERT_EQUAL(600, labs(hostsim::motor().position));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+  TEST_ASSERT_EQUAL_STRING("0", field(hostsim::request("GET", "/api/metrics").body, "missedStepDeadlines").c_str());
+}
+
+// A slider drag: a burst of targets further along the same way.
+void blendSuccessiveTargets() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"travelSteps":8000})");
+  hostsim::recordStepIntervals(true);
+  for (int percent = 10; percent <= 60; percent += 10) {
+    const std::string body = "{\"action\":\"set\",\"percent\":" + std::to_string(percent) + "}";
+    const hostsim::Response r = hostsim::request("POST", "/api/move", body.c_str());
+    TEST_ASSERT_EQUAL(200, r.status);
+    TEST_ASSERT_EQUAL_STRING("0", field(r.body, "queueDepth").c_str());
+    hostsim::runFor(150);
+  }
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL_STRING("4800", field(getState(), "positionSteps").c_str());
+  TEST_ASSERT_EQUAL(4800, labs(hostsim::motor().position));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+
+  // Once at cruise speed (700 half steps/s) it stays there until the final braking ramp
+  // (~750 steps): the later targets extended the move instead of braking it.
+  const std::vector<uint32_t>& intervals = hostsim::stepIntervalsNs();
+  const uint32_t cruiseNs = 1000000000UL / 700;
+  size_t first = 0;
+  while (first < intervals.size() && intervals[first] > cruiseNs + cruiseNs / 50) ++first;
+  TEST_ASSERT_LESS_THAN(1500, first);
+  for (size_t i = first; i + 800 < intervals.size(); ++i) {
+    TEST_ASSERT_LESS_OR_EQUAL(cruiseNs + cruiseNs / 20, intervals[i]);
+  }
+}
+
+void reverseAndQueueMoves() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"travelSteps":8000})");
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":90})");
+  hostsim::runFor(3000);
+
+  // Reversal: the channel brakes where it can and then heads back without a new command.
+  hostsim::Response r = hostsim::request("POST", "/api/move", R"({"action":"set","percent":20})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("1", field(r.body, "queueDepth").c_str());
+  TEST_ASSERT_EQUAL_STRING("1600", field(r.body, "targetSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(r.body, "moving").c_str());
+  const long arrivalMs = atol(field(r.body, "arrivalMs").c_str());
+  const uint64_t startNs = hostsim::nowNanos();
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  const long tookMs = static_cast<long>((hostsim::nowNanos() - startNs) / 1000000ULL);
+  TEST_ASSERT_INT_WITHIN(tookMs / 10 + 50, tookMs, arrivalMs);
+  TEST_ASSERT_EQUAL_STRING("1600", field(getState(), "positionSteps").c_str());
+  TEST_ASSERT_EQUAL(1600, labs(hostsim::motor().position));
+
+  // "queue": true waits for the moves before it; a plain command replaces what is queued.
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":40})");
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":30,"queue":true})");
+  r = hostsim::request("POST", "/api/move", R"({"action":"jog","steps":200,"queue":true})");
+  TEST_ASSERT_EQUAL_STRING("2", field(r.body, "queueDepth").c_str());
+  TEST_ASSERT_EQUAL_STRING("2600", field(r.body, "targetSteps").c_str());
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":10,"queue":true})");
+  r = hostsim::request("POST", "/api/move", R"({"action":"set","percent":20,"queue":true})");
+  TEST_ASSERT_EQUAL_STRING("4", field(r.body, "queueDepth").c_str());
+  r = hostsim::request("POST", "/api/move", R"({"action":"set","percent":50,"queue":true})");
+  TEST_ASSERT_EQUAL(400, r.status);
+  TEST_ASSERT_EQUAL_STRING("motion queue is full", field(r.body, "error").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 30000));
+  TEST_ASSERT_EQUAL_STRING("1600", field(getState(), "positionSteps").c_str());
+  TEST_ASSERT_EQUAL(1600, labs(hostsim::motor().position));
+
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":60})");
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":70,"queue":true})");
+  r = hostsim::request("POST", "/api/move", R"({"action":"set","percent":50})");
+  TEST_ASSERT_EQUAL_STRING("0", field(r.body, "queueDepth").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL_STRING("4000", field(getState(), "positionSteps").c_str());
+  TEST_ASSERT_EQUAL(4000, labs(hostsim::motor().position));
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+}
+
+// Motor supply current through the shunt on A0: a blocked rotor has no back-EMF and draws
+// more than a turning one.
+uint16_t shuntReading() {
+  static uint32_t seed = 1;
+  seed = seed * 1103515245UL + 12345UL;
+  const hostsim::Motor& m = hostsim::motor();
+  const int base = !m.energized ? 12 : m.stalled ? 720 : 450;
+  return static_cast<uint16_t>(base + static_cast<int>((seed >> 16) % 21) - 10);
+}
+
+bool autoCalibrationDone() {
+  const std::string phase = field(getState(), "autoCalibration");
+  return phase != "seek_top" && phase != "seek_bottom";
+}
+
+void calibrateAndFollowEndStops() {
+  bootAndServe();
+  hostsim::setMotorStops(-300, 5000);
+  hostsim::setAnalogSource(shuntReading);
+  TEST_ASSERT_EQUAL(400, hostsim::request("POST", "/api/calibrate", R"({"action":"auto"})").status);
+  hostsim::request("POST", "/api/settings", R"({"stallDetection":true})");
+  TEST_ASSERT_EQUAL(200, hostsim::request("POST", "/api/calibrate", R"({"action":"auto"})").status);
+  TEST_ASSERT_TRUE(hostsim::runUntil(autoCalibrationDone, 60000));
+
+  std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("done", field(s, "autoCalibration").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(s, "calibrated").c_str());
+  TEST_ASSERT_INT_WITHIN(10, 5300, atol(field(s, "travelSteps").c_str()));
+  TEST_ASSERT_EQUAL_STRING("bottom", field(s, "lastStall").c_str());
+  TEST_ASSERT_EQUAL(5000, hostsim::motor().position);
+  // Each stop is found within a few samples of hitting it.
+  TEST_ASSERT_TRUE(hostsim::motor().blockedSteps < 60);
+
+  // The blind slides while released; opening finds the top stop past logical 0 and re-zeroes
+  // there instead of running the whole fixed overdrive into it.
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":50})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  hostsim::runFor(1000);
+  hostsim::slipShaft(200);
+  const uint32_t blockedBefore = hostsim::motor().blockedSteps;
+  hostsim::request("POST", "/api/move", R"({"action":"open"})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  s = getState();
+  TEST_ASSERT_EQUAL_STRING("top", field(s, "lastStall").c_str());
+  TEST_ASSERT_EQUAL_STRING("0", field(s, "positionSteps").c_str());
+  TEST_ASSERT_EQUAL(-300, hostsim::motor().position);
+  TEST_ASSERT_TRUE(hostsim::motor().blockedSteps - blockedBefore < 30);
+
+  // Something in the way halfway down: stop there, keep the position.
+  hostsim::setMotorStops(-300, 2000);
+  hostsim::request("POST", "/api/move", R"({"action":"close"})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  s = getState();
+  TEST_ASSERT_EQUAL_STRING("obstruction", field(s, "lastStall").c_str());
+  TEST_ASSERT_INT_WITHIN(10, 2300, atol(field(s, "positionSteps").c_str()));
+
+  // The counter was put back where the rotor stopped: once cleared, closing lands on the
+  // bottom stop.
+  hostsim::setMotorStops(-300, 5000);
+  hostsim::request("POST", "/api/move", R"({"action":"close"})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_INT_WITHIN(10, 5000, hostsim::motor().position);
+}
+
+// A blind that slides down while released takes more steps to open than the counter says:
+// with the drift tuned, the top stall raises the open step scale. After that stop a close
+// first turns through the configured backlash.
+void tuneDriftAtTopStop() {
+  bootAndServe();
+  hostsim::setMotorStops(-300, 5000);
+  hostsim::setAnalogSource(shuntReading);
+  hostsim::request("POST", "/api/settings", R"({"stallDetection":true,"driftAutoTune":true})");
+  TEST_ASSERT_EQUAL(200, hostsim::request("POST", "/api/calibrate", R"({"action":"auto"})").status);
+  TEST_ASSERT_TRUE(hostsim::runUntil(autoCalibrationDone, 60000));
+
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":50})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  hostsim::runFor(1000);
+  hostsim::slipShaft(200);
+  hostsim::request("POST", "/api/move", R"({"action":"open"})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("top", field(s, "lastStall").c_str());
+  TEST_ASSERT_EQUAL_STRING("1", field(s, "driftCycles").c_str());
+  TEST_ASSERT_INT_WITHIN(10, -200, atol(field(s, "driftResidualSteps").c_str()));
+  const long scale = lround(atof(field(s, "openStepScale").c_str()) * 1000.0);
+  TEST_ASSERT_INT_WITHIN(5, 1018, scale);
+  TEST_ASSERT_EQUAL(-300, hostsim::motor().position);
+
+  hostsim::request("POST", "/api/settings", R"({"backlashSteps":40})");
+  hostsim::request("POST", "/api/move", R"({"action":"set","percent":50})");
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  s = getState();
+  const long target = atol(field(s, "targetSteps").c_str());
+  TEST_ASSERT_EQUAL(target, atol(field(s, "positionSteps").c_str()));
+  const long shaft = hostsim::motor().position;
+  TEST_ASSERT_INT_WITHIN(2, target - 300 + 40, shaft);
+}
+
+// 2024-06-21 00:40 UTC, a Friday: 03:40 in Moscow, a few minutes before sunrise.
+constexpr uint64_t kMidsummerMorningUtc = 1718930400ULL;
+
+int minuteOfDay(const std::string& text) { return atoi(text.c_str()) * 60 + atoi(text.c_str() + 3); }
+
+std::string getSchedule() { return hostsim::request("GET", "/api/schedule").body; }
+
+bool scheduleFired(const char* count) { return field(getState(), "scheduleFired") == count; }
+
+void scheduleOnDeviceClock() {
+  hostsim::setWallClock(kMidsummerMorningUtc);
+  bootAndServe();
+  hostsim::setLoopCostMicros(5000);  // minutes of idle loop() passes
+  TEST_ASSERT_EQUAL_STRING("true", field(getState(), "clockSynced").c_str());
+  hostsim::Response r = hostsim::request("POST", "/api/schedule", R"({"rules":[{"time":"24:00","action":"open"}]})");
+  TEST_ASSERT_EQUAL(400, r.status);
+  TEST_ASSERT_EQUAL(400, hostsim::request("POST", "/api/schedule", R"({"latitude":55.7})").status);
+
+  // Sunrise opens to 10%; 03:50 plus this device's share of 5 minutes of jitter closes; the
+  // Saturday rule stays quiet on a Friday.
+  r = hostsim::request("POST", "/api/schedule", R"({"timezone":"MSK-3","latitude":55.7558,"longitude":37.6173,"rules":[
+      {"trigger":"sunrise","action":"set","percent":10},
+      {"days":16,"time":"03:50","action":"close","jitter":5},
+      {"days":32,"time":"03:45","action":"open"}]})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("03:40", field(r.body, "localTime").c_str());
+  TEST_ASSERT_EQUAL_STRING("180", field(r.body, "utcOffsetMinutes").c_str());
+  TEST_ASSERT_EQUAL_STRING("4", field(r.body, "weekday").c_str());
+  const int sunrise = minuteOfDay(field(r.body, "sunrise"));
+  TEST_ASSERT_INT_WITHIN(2, 3 * 60 + 44, sunrise);
+
+  TEST_ASSERT_TRUE(hostsim::runUntil([]() { return scheduleFired("1"); }, 10 * 60 * 1000));
+  TEST_ASSERT_EQUAL(sunrise, minuteOfDay(field(getSchedule(), "localTime")));
+  TEST_ASSERT_EQUAL_STRING("0", field(getSchedule(), "lastRule").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL_STRING("1200", field(getState(), "positionSteps").c_str());
+
+  TEST_ASSERT_TRUE(hostsim::runUntil([]() { return scheduleFired("2"); }, 15 * 60 * 1000));
+  const int closeAt = 3 * 60 + 50 + shutter::schedule::jitterFor(0x00ABCDEF, 1, 5);
+  TEST_ASSERT_EQUAL(closeAt, minuteOfDay(field(getSchedule(), "localTime")));
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 20000));
+  TEST_ASSERT_EQUAL_STRING("12000", field(getState(), "positionSteps").c_str());
+  hostsim::runFor(3 * 60 * 1000);
+  TEST_ASSERT_EQUAL_STRING("2", field(getState(), "scheduleFired").c_str());
+}
+
+void scheduleWithoutTime() {
+  hostsim::setInternetReachable(false);  // no SNTP answer
+  hostsim::setWallClock(kMidsummerMorningUtc);
+  bootAndServe();
+  const std::string schedule = getSchedule();
+  TEST_ASSERT_EQUAL_STRING("false", field(schedule, "clockSynced").c_str());
+  TEST_ASSERT_EQUAL_STRING("MSK-3", field(schedule, "timezone").c_str());
+  TEST_ASSERT_TRUE(schedule.find(R"({"days":16,"trigger":"time","time":"03:50","channels":1,"action":"close")") !=
+                   std::string::npos);
+  hostsim::setLoopCostMicros(5000);
+  hostsim::runFor(2 * 60 * 1000);
+  TEST_ASSERT_EQUAL_STRING("0", field(getState(), "scheduleFired").c_str());
+}
+
+void recallPresets() {
+  bootAndServe();
+  hostsim::request("POST", "/api/settings", R"({"travelSteps":4000,"maxSpeed":900})");
+  hostsim::Response r = hostsim::request("POST", "/api/presets", R"({"presets":[{"name":"a","percent":10},{"name":"a","percent":20}]})");
+  TEST_ASSERT_EQUAL(400, r.status);
+  r = hostsim::request("POST", "/api/presets", R"({"presets":[{"name":"slow","percent":50,"maxSpeed":5}]})");
+  TEST_ASSERT_EQUAL(400, r.status);
+  r = hostsim::request("POST", "/api/presets", R"({"presets":[
+      {"name":"evening","percent":50,"maxSpeed":300,"acceleration":150},
+      {"name":"night","percent":90,"maxSpeed":300},
+      {"name":"up","percent":0,"topOverdrive":false}]})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL(400, hostsim::request("POST", "/api/move", R"({"action":"preset","name":"morning"})").status);
+  TEST_ASSERT_TRUE(hostsim::runUntil(settingsCommitted, 10000));
+
+  // A recall moves on the preset's ramp and writes nothing: the settings keep their speed and
+  // the settings blob is not committed again.
+  const std::string commitsBefore = field(getState(), "stateCommits");
+  r = hostsim::request("POST", "/api/move", R"({"action":"preset","name":"evening"})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("2000", field(r.body, "targetSteps").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 30000));
+  TEST_ASSERT_EQUAL(2000, labs(hostsim::motor().position));
+  TEST_ASSERT_GREATER_OR_EQUAL(1000000000UL / 300 - 20000, hostsim::motor().minStepIntervalNs);
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("900", field(s, "maxSpeed").c_str());
+  TEST_ASSERT_EQUAL_STRING(commitsBefore.c_str(), field(s, "stateCommits").c_str());
+
+  // A preset arriving mid-move brakes the running move on its ramp, then starts on its own.
+  hostsim::request("POST", "/api/move", R"({"action":"close"})");
+  hostsim::runFor(600);
+  r = hostsim::request("POST", "/api/move", R"({"action":"preset","name":"night"})");
+  TEST_ASSERT_EQUAL(200, r.status);
+  TEST_ASSERT_EQUAL_STRING("1", field(r.body, "queueDepth").c_str());
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 30000));
+  TEST_ASSERT_EQUAL(3600, labs(hostsim::motor().position));
+
+  TEST_ASSERT_EQUAL(200, hostsim::request("POST", "/api/move", R"({"action":"preset","name":"up"})").status);
+  TEST_ASSERT_TRUE(hostsim::runUntil(idle, 30000));
+  TEST_ASSERT_EQUAL_STRING("0", field(getState(), "positionSteps").c_str());
+  TEST_ASSERT_EQUAL(0, hostsim::motor().position);  // no overdrive past the top
+  TEST_ASSERT_EQUAL(0, hostsim::motor().missedSteps);
+}
+
+void assertPresetsPersisted() {
+  bootAndServe();
+  const std::string presets = hostsim::request("GET", "/api/presets").body;
+  TEST_ASSERT_TRUE(presets.find(R"({"name":"evening","percent":50,"maxSpeed":300,"acceleration":150,"topOverdrive":true})") !=
+                   std::string::npos);
+  TEST_ASSERT_TRUE(presets.find(R"("name":"up")") != std::string::npos);
+}
+
+template <typename T>
+void putBytes(std::string* bytes, size_t offset, const T& value) {
+  bytes->replace(offset, sizeof(value), reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+// Flash as a schema 1 build left it: the 168-byte fixed blob, then a journaled position.
+void flashSchemaOneBlob() {
+  std::string blob(168, '\0');
+  putBytes<uint32_t>(&blob, 0, 0x53485452);  // "SHTR"
+  putBytes<uint16_t>(&blob, 4, 1);
+  putBytes<uint16_t>(&blob, 6, 168);
+  putBytes<int32_t>(&blob, 8, 9000);   // travelSteps
+  putBytes<int32_t>(&blob, 12, 1000);  // currentPosition, superseded by the journal
+  blob[16] = 1;                        // calibrated
+  putBytes<float>(&blob, 20, 900.0f);  // maxSpeed
+  putBytes<float>(&blob, 24, 450.0f);  // acceleration
+  putBytes<float>(&blob, 28, 5.0f);    // topOverdrivePercent
+  putBytes<uint16_t>(&blob, 32, 700);  // coilHoldMs
+  blob.replace(34, 12, "owner/blinds");
+  blob.replace(98, 12, "firmware.bin");
+  blob.replace(130, 12, "littlefs.bin");
+  putBytes(&blob, 164, shutter::storage::fnv1a(reinterpret_cast<const uint8_t*>(blob.data()), 164));
+  hostsim::writeEepromSector(0, blob);
+
+  shutter::storage::JournalRecord record;
+  record.magic = shutter::storage::kJournalMagic;
+  record.channel = shutter::storage::kJournalLegacyChannel;
+  record.sequence = 1;
+  record.position = 4500;
+  record.checksum = shutter::storage::journalRecordChecksum(record);
+  hostsim::writeEepromSector(1024, std::string(reinterpret_cast<const char*>(&record), sizeof(record)));
+}
+
+void assertSchemaOneSettings() {
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("9000", field(s, "travelSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("4500", field(s, "positionSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(s, "calibrated").c_str());
+  TEST_ASSERT_EQUAL_STRING("900", field(s, "maxSpeed").c_str());
+  TEST_ASSERT_EQUAL_STRING("700", field(s, "coilHoldMs").c_str());
+  const std::string config = hostsim::request("GET", "/api/firmware/config").body;
+  TEST_ASSERT_EQUAL_STRING("owner/blinds", field(config, "firmwareRepo").c_str());
+}
+
+// The first boot of this build reads the old blob and its journal and commits them as a record.
+void migrateSchemaOneBlob() {
+  flashSchemaOneBlob();
+  bootAndServe();
+  assertSchemaOneSettings();
+  // Committed at once; the first Wi-Fi link cached on the way may add a commit of its own.
+  const std::string s = getState();
+  TEST_ASSERT_GREATER_OR_EQUAL(1, atoi(field(s, "stateCommits").c_str()));
+  const int recordBytes = atoi(field(s, "stateRecordBytes").c_str());
+  TEST_ASSERT_GREATER_THAN(0, recordBytes);
+  TEST_ASSERT_LESS_THAN(1024, recordBytes);  // the fixed blob always programmed a full 1 KB
+}
+
+void assertSchemaOneMigrated() {
+  bootAndServe();
+  assertSchemaOneSettings();
+  TEST_ASSERT_EQUAL_STRING("0", field(getState(), "stateCommits").c_str());
+}
+
+// The JSON mirror of the oldest builds is imported once and then deleted.
+void importLegacyJson() {
+  hostsim::writeFile("/state.json", R"({"travelSteps":8000,"currentPosition":2000,"calibrated":true,)"
+                                    R"("maxSpeed":1100,"mqttHost":"192.168.88.2"})");
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("8000", field(s, "travelSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("2000", field(s, "positionSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("1100", field(s, "maxSpeed").c_str());
+  TEST_ASSERT_EQUAL_STRING("192.168.88.2", field(s, "mqttHost").c_str());
+  std::string contents;
+  TEST_ASSERT_FALSE(hostsim::readFile("/state.json", &contents));
+
+  // Settings changes only ever program the record now.
+  TEST_ASSERT_EQUAL(200, hostsim::request("POST", "/api/settings", R"({"maxSpeed":1200})").status);
+  TEST_ASSERT_TRUE(hostsim::runUntil(settingsCommitted, 10000));
+  TEST_ASSERT_FALSE(hostsim::readFile("/state.json", &contents));
+}
+
+void assertLegacyJsonImported() {
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("8000", field(s, "travelSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("2000", field(s, "positionSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("1200", field(s, "maxSpeed").c_str());
+  TEST_ASSERT_EQUAL_STRING("192.168.88.2", field(s, "mqttHost").c_str());
+}
+
+// Flash as the first tagged-record build left it: a record that does not name its area, and
+// the journal behind the 1280 bytes that area had, newest position in its first slots.
+void flashUnnamedAreaRecord() {
+  uint8_t bytes[64];
+  shutter::storage::RecordWriter record(bytes, sizeof(bytes));
+  record.putValue<uint8_t>(64, 0);     // Channel
+  record.putValue<int32_t>(65, 9000);  // TravelSteps
+  record.putValue<int32_t>(66, 1000);  // Position, superseded by the journal
+  record.putValue<uint8_t>(67, 1);     // Calibrated
+  const size_t size = record.finish();
+  hostsim::writeEepromSector(0, std::string(reinterpret_cast<const char*>(bytes), size));
+
+  for (uint32_t sequence = 1; sequence <= 2; ++sequence) {
+    shutter::storage::JournalRecord entry;
+    entry.magic = shutter::storage::kJournalMagic;
+    entry.channel = 0;
+    entry.sequence = sequence;
+    entry.position = sequence == 1 ? 3000 : 4500;
+    entry.checksum = shutter::storage::journalRecordChecksum(entry);
+    hostsim::writeEepromSector(1280 + (sequence - 1) * sizeof(entry),
+                               std::string(reinterpret_cast<const char*>(&entry), sizeof(entry)));
+  }
+}
+
+// The first boot reads the journal where the old area ended and commits in this layout.
+void migrateUnnamedArea() {
+  flashUnnamedAreaRecord();
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("9000", field(s, "travelSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("4500", field(s, "positionSteps").c_str());
+  TEST_ASSERT_GREATER_OR_EQUAL(1, atoi(field(s, "stateCommits").c_str()));
+}
+
+void assertUnnamedAreaMigrated() {
+  bootAndServe();
+  const std::string s = getState();
+  TEST_ASSERT_EQUAL_STRING("4500", field(s, "positionSteps").c_str());
+  TEST_ASSERT_EQUAL_STRING("true", field(s, "calibrated").c_str());
+  TEST_ASSERT_EQUAL_STRING("0", field(s, "stateCommits").c_str());
+}
+
+void reportLoopCost(const char* label, uint32_t passes) {
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < passes; ++i) hostsim::runLoop();
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+  char line[96];
+  snprintf(line, sizeof(line), "loop() %s: %lld ns per pass (host)", label,
+           static_cast<long long>(elapsed.count() / passes));
+  TEST_MESSAGE(line);
+}
+
+void benchmarkLoopCost() {
+  bootAndServe();
+  hostsim::runFor(500);
+  reportLoopCost("idle", 20000);
+
+  hostsim::request("POST", "/api/move", R"({"action":"close"})");
+  reportLoopCost("moving", 2000);
+
+  hostsim::EventStream events = hostsim::openStream("/api/events");
+  reportLoopCost("moving + event stream", 2000);
+  TEST_ASSERT_TRUE(events.open());
+}
+
+}  // namespace
+
+void setUp() {
+  hostsim::eraseFlash();
+  hostsim::clearMulticastLog();
+  hostsim::attachMotor(kIn1, kIn2, kIn3, kIn4);
+  hostsim::setInternetReachable(true);
+  hostsim::setWiFiTiming(700, 200, 300);
+  hostsim::setAccessPointChannel(6);
+}
+
+void tearDown() { hostsim::abandonBoot(); }
+
+// ---- Tests -------------------------------------------------------------------------------
+
+void test_ota_config_falls_back_to_defaults() { TEST_ASSERT_TRUE(runBoot(saveOtaDefaults)); }
+
+void test_latest_check_reports_missing_network() { TEST_ASSERT_TRUE(runBoot(latestCheckWithoutInternet)); }
+
+void test_settings_and_calibration_survive_reboot() {
+  TEST_ASSERT_TRUE(runBoot(applySettingsAndCalibrate));
+  TEST_ASSERT_TRUE(runBoot(assertSettingsPersisted));
+}
+
+void test_settings_commits_coalesce_and_flush_on_reboot() {
+  TEST_ASSERT_TRUE(runBoot(coalesceSettingsCommits));
+  TEST_ASSERT_TRUE(runBoot(assertCoalescedSettingsPersisted));
+}
+
+void test_move_lands_on_target_and_survives_reboot() {
+  TEST_ASSERT_TRUE(runBoot(moveHalfway));
+  TEST_ASSERT_TRUE(runBoot(resumeFromHalfway));
+}
+
+void test_stop_during_motion_keeps_shaft_and_counter_in_step() { TEST_ASSERT_TRUE(runBoot(stopDuringMotion)); }
+
+void test_event_stream_follows_motion() { TEST_ASSERT_TRUE(runBoot(eventStreamFollowsMotion)); }
+
+void test_local_ota_installs_both_images_and_keeps_settings() {
+  std::string firmware(300 * 1024, '\x5A');
+  firmware[0] = '\xE9';
+  hostsim::serveUrl(kFirmwareUrl, firmware, 400 * 1024);
+  hostsim::serveUrl(kFilesystemUrl, std::string(96 * 1024, '\x00'), 400 * 1024);
+
+  TEST_ASSERT_TRUE(runBoot(applySettingsAndCalibrate));
+  TEST_ASSERT_TRUE(runBoot(localOtaInstallsBothImages));
+  TEST_ASSERT_EQUAL(1, hostsim::installedImages().firmwareUpdates);
+  TEST_ASSERT_EQUAL(1, hostsim::installedImages().filesystemUpdates);
+  TEST_ASSERT_EQUAL(firmware.size(), hostsim::installedImages().firmwareBytes);
+  TEST_ASSERT_TRUE(runBoot(assertSettingsPersisted));
+}
+
+void test_ota_rejects_image_without_magic_byte() {
+  hostsim::serveUrl(kFirmwareUrl, std::string(64 * 1024, '\x00'));
+  TEST_ASSERT_TRUE(runBoot(otaRejectsImageWithoutMagicByte));
+  TEST_ASSERT_EQUAL(0, hostsim::installedImages().firmwareUpdates);
+}
+
+void test_metrics_report_sections_and_step_deadlines() { TEST_ASSERT_TRUE(runBoot(metricsCoverAMove)); }
+
+void expectWiFiConnect(const char* path, long maxMs) {
+  expectedConnectPath = path;
+  maxConnectMs = maxMs;
+  TEST_ASSERT_TRUE(runBoot(assertWiFiConnect));
+}
+
+void test_wifi_fast_connect_after_first_boot() {
+  hostsim::setWiFiTiming(2500, 300, 800);
+  expectWiFiConnect("full", 3700);
+  // Cached channel, BSSID and lease: no scan, no DHCP.
+  expectWiFiConnect("fast", 400);
+
+  // The router moved to another channel: the direct join times out, the full path recovers
+  // and the cache follows.
+  hostsim::setAccessPointChannel(11);
+  expectWiFiConnect("full", 6700);
+  expectWiFiConnect("fast", 400);
+
+  hostsim::setDhcpAddress(75);
+  TEST_ASSERT_TRUE(runBoot(renewLeaseAfterFastJoin));
+  TEST_ASSERT_TRUE(runBoot(assertRenewedLeaseCached));
+}
+
+void test_wifi_static_address_applies_at_boot() {
+  TEST_ASSERT_TRUE(runBoot(setStaticAddress));
+  TEST_ASSERT_TRUE(runBoot(assertStaticAddressUsed));
+}
+
+void test_light_sleep_between_moves() { TEST_ASSERT_TRUE(runBoot(lightSleepWhileIdle)); }
+
+void test_hold_chops_coils_at_duty() { TEST_ASSERT_TRUE(runBoot(holdCoilsChopped)); }
+
+void test_successive_targets_blend_and_reversals_queue() {
+  TEST_ASSERT_TRUE(runBoot(blendSuccessiveTargets));
+  TEST_ASSERT_TRUE(runBoot(reverseAndQueueMoves));
+}
+
+void test_stall_detection_calibrates_and_rezeroes() { TEST_ASSERT_TRUE(runBoot(calibrateAndFollowEndStops)); }
+
+void test_static_assets_are_gzipped_and_revalidated() {
+  TEST_ASSERT_TRUE(runBoot(staticAssetsRevalidate));
+  TEST_ASSERT_TRUE(runBoot(staticAssetsChangedImage));
+}
+
+void test_lite_state_answers_304_until_motion() { TEST_ASSERT_TRUE(runBoot(liteStatePolling)); }
+
+void test_group_nodes_start_together() {
+  TEST_ASSERT_TRUE(runBoot(groupSenderNode));
+  TEST_ASSERT_TRUE(runBoot(groupMemberNode));
+}
+
+void test_mqtt_publishes_changes_and_takes_commands() {
+  TEST_ASSERT_TRUE(runBoot(mqttControlsAndReports));
+  TEST_ASSERT_TRUE(runBoot(mqttConfigPersisted));
+}
+
+void test_drift_tuner_learns_at_the_top_stop() { TEST_ASSERT_TRUE(runBoot(tuneDriftAtTopStop)); }
+
+void test_schedule_runs_on_device_clock() {
+  TEST_ASSERT_TRUE(runBoot(scheduleOnDeviceClock));
+  TEST_ASSERT_TRUE(runBoot(scheduleWithoutTime));
+}
+
+void test_presets_recall_without_writing_settings() {
+  TEST_ASSERT_TRUE(runBoot(recallPresets));
+  TEST_ASSERT_TRUE(runBoot(assertPresetsPersisted));
+}
+
+void test_schema_one_blob_migrates_to_record() {
+  TEST_ASSERT_TRUE(runBoot(migrateSchemaOneBlob));
+  TEST_ASSERT_TRUE(runBoot(assertSchemaOneMigrated));
+}
+
+void test_legacy_json_state_is_imported_once() {
+  TEST_ASSERT_TRUE(runBoot(importLegacyJson));
+  TEST_ASSERT_TRUE(runBoot(assertLegacyJsonImported));
+}
+
+void test_resized_settings_area_keeps_the_journal() {
+  TEST_ASSERT_TRUE(runBoot(migrateUnnamedArea));
+  TEST_ASSERT_TRUE(runBoot(assertUnnamedAreaMigrated));
+}
+
+void test_loop_cost_benchmark() { TEST_ASSERT_TRUE(runBoot(benchmarkLoopCost)); }
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_ota_config_falls_back_to_defaults);
+  RUN_TEST(test_latest_check_reports_missing_network);
+  RUN_TEST(test_settings_and_calibration_survive_reboot);
+  RUN_TEST(test_settings_commits_coalesce_and_flush_on_reboot);
+  RUN_TEST(test_move_lands_on_target_and_survives_reboot);
+  RUN_TEST(test_stop_during_motion_keeps_shaft_and_counter_in_step);
+  RUN_TEST(test_event_stream_follows_motion);
+  RUN_TEST(test_local_ota_installs_both_images_and_keeps_settings);
+  RUN_TEST(test_ota_rejects_image_without_magic_byte);
+  RUN_TEST(test_metrics_report_sections_and_step_deadlines);
+  RUN_TEST(test_wifi_fast_connect_after_first_boot);
+  RUN_TEST(test_wifi_static_address_applies_at_boot);
+  RUN_TEST(test_light_sleep_between_moves);
+  RUN_TEST(test_hold_chops_coils_at_duty);
+  RUN_TEST(test_successive_targets_blend_and_reversals_queue);
+  RUN_TEST(test_stall_detection_calibrates_and_rezeroes);
+  RUN_TEST(test_static_assets_are_gzipped_and_revalidated);
+  RUN_TEST(test_lite_state_answers_304_until_motion);
+  RUN_TEST(test_group_nodes_start_together);
+  RUN_TEST(test_mqtt_publishes_changes_and_takes_commands);
+  RUN_TEST(test_drift_tuner_learns_at_the_top_stop);
+  RUN_TEST(test_schedule_runs_on_device_clock);
+  RUN_TEST(test_presets_recall_without_writing_settings);
+  RUN_TEST(test_schema_one_blob_migrates_to_record);
+  RUN_TEST(test_legacy_json_state_is_imported_once);
+  RUN_TEST(test_resized_settings_area_keeps_the_journal);
+  RUN_TEST(test_loop_cost_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,76 @@
+#include <unity.h>
+
+#include "StallDetector.h"
+
+using shutter::sensing::StallConfig;
+using shutter::sensing::StallDetector;
+
+// Deterministic +-|amplitude| jitter around |base|.
+uint16_t noisy(uint16_t base, uint16_t amplitude, uint32_t* seed) {
+  *seed = *seed * 1103515245UL + 12345UL;
+  const int32_t spread = static_cast<int32_t>((*seed >> 16) % (2U * amplitude + 1U)) - amplitude;
+  return static_cast<uint16_t>(base + spread);
+}
+
+void test_steady_current_never_stalls() {
+  StallDetector detector;
+  uint32_t seed = 1;
+  for (int i = 0; i < 2000; ++i) TEST_ASSERT_FALSE(detector.push(noisy(450, 15, &seed)));
+  TEST_ASSERT_UINT32_WITHIN(10, 450, detector.baseline());
+}
+
+void test_step_rise_is_confirmed_within_a_few_samples() {
+  StallDetector detector;
+  uint32_t seed = 7;
+  for (int i = 0; i < 100; ++i) detector.push(noisy(450, 10, &seed));
+  TEST_ASSERT_FALSE(detector.climbing());
+  detector.push(720);
+  TEST_ASSERT_TRUE(detector.climbing());
+  int samples = 1;
+  while (!detector.push(noisy(720, 10, &seed)) && samples < 50) ++samples;
+  TEST_ASSERT_TRUE(detector.stalled());
+  TEST_ASSERT_TRUE(samples <= 8);
+  // Latched until reset.
+  TEST_ASSERT_TRUE(detector.push(450));
+  detector.reset();
+  TEST_ASSERT_FALSE(detector.stalled());
+}
+
+void test_falling_current_while_accelerating_is_followed() {
+  StallDetector detector;
+  // Start-up draw falls from 700 to 450 as the motor speeds up; no stall, and the baseline
+  // ends close to the cruise level so a later rise is caught.
+  for (int i = 0; i < 200; ++i) TEST_ASSERT_FALSE(detector.push(static_cast<uint16_t>(i < 100 ? 700 - i * 5 / 2 : 450)));
+  TEST_ASSERT_UINT32_WITHIN(15, 450, detector.baseline());
+  bool stalled = false;
+  for (int i = 0; i < 10 && !stalled; ++i) stalled = detector.push(700);
+  TEST_ASSERT_TRUE(stalled);
+}
+
+void test_blanking_ignores_the_start() {
+  StallConfig config;
+  config.blankingSamples = 10;
+  StallDetector detector;
+  detector.configure(config);
+  for (int i = 0; i < 5; ++i) TEST_ASSERT_FALSE(detector.push(300));
+  for (int i = 0; i < 5; ++i) TEST_ASSERT_FALSE(detector.push(900));
+  TEST_ASSERT_FALSE(detector.learning());
+  for (int i = 0; i < 20; ++i) TEST_ASSERT_FALSE(detector.push(900));
+}
+
+void test_small_absolute_rise_is_noise() {
+  StallDetector detector;
+  for (int i = 0; i < 50; ++i) detector.push(10);
+  // +60% but only 6 counts: below minDelta.
+  for (int i = 0; i < 50; ++i) TEST_ASSERT_FALSE(detector.push(16));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_steady_current_never_stalls);
+  RUN_TEST(test_step_rise_is_confirmed_within_a_few_samples);
+  RUN_TEST(test_falling_current_while_accelerating_is_followed);
+  RUN_TEST(test_blanking_ignores_the_start);
+  RUN_TEST(test_small_absolute_rise_is_noise);
+  return UNITY_END();
+}
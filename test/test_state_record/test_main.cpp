@@ -0,0 +1,148 @@
+#include <unity.h>
+
+#include <string.h>
+
+#include "StateRecord.h"
+
+using shutter::storage::RecordField;
+using shutter::storage::RecordReader;
+using shutter::storage::RecordWriter;
+
+namespace {
+
+struct RuleV1 {
+  uint8_t days;
+  uint8_t channels;
+};
+
+struct RuleV2 {
+  uint8_t days;
+  uint8_t channels;
+  uint8_t jitter;  // added later
+};
+
+alignas(4) uint8_t buffer[128];
+
+const uint8_t* check(size_t size, size_t* payloadLength) {
+  return shutter::storage::checkRecord(buffer, size, payloadLength);
+}
+
+}  // namespace
+
+void setUp() { memset(buffer, 0xFF, sizeof(buffer)); }
+
+void test_fields_round_trip_in_order() {
+  RecordWriter writer(buffer, sizeof(buffer));
+  TEST_ASSERT_TRUE(writer.putValue<int32_t>(1, -12000));
+  TEST_ASSERT_TRUE(writer.putValue<float>(2, 700.5f));
+  TEST_ASSERT_TRUE(writer.putString(3, "pool.ntp.org", 47));
+  const size_t size = writer.finish();
+  const size_t padding = size % 4;
+  TEST_ASSERT_EQUAL(0, padding);
+  TEST_ASSERT_EQUAL(shutter::storage::recordSize(6 + 4 + 6 + 12), size);
+
+  size_t length = 0;
+  const uint8_t* payload = check(size, &length);
+  TEST_ASSERT_TRUE(payload != nullptr);
+  RecordReader reader(payload, length);
+  RecordField field;
+  int32_t travel = 0;
+  int16_t narrow = 0;
+  float speed = 0.0f;
+  TEST_ASSERT_TRUE(reader.next(&field));
+  TEST_ASSERT_TRUE(field.read(&travel));
+  TEST_ASSERT_EQUAL_INT32(-12000, travel);
+  TEST_ASSERT_TRUE(reader.next(&field));
+  TEST_ASSERT_FALSE(field.read(&narrow));  // only the exact size reads
+  TEST_ASSERT_TRUE(field.read(&speed));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 700.5f, speed);
+  TEST_ASSERT_TRUE(reader.next(&field));
+  TEST_ASSERT_EQUAL_UINT8(3, field.tag);
+  TEST_ASSERT_EQUAL_UINT8(12, field.length);
+  TEST_ASSERT_EQUAL_MEMORY("pool.ntp.org", field.value, 12);
+  TEST_ASSERT_FALSE(reader.next(&field));
+}
+
+void test_structs_grow_at_the_end() {
+  RecordWriter writer(buffer, sizeof(buffer));
+  const RuleV2 newer = {31, 1, 10};
+  const RuleV1 older = {127, 3};
+  writer.putValue(1, newer);
+  writer.putValue(1, older);
+  size_t length = 0;
+  const uint8_t* payload = check(writer.finish(), &length);
+  RecordReader reader(payload, length);
+  RecordField field;
+  RuleV1 cut = {};
+  TEST_ASSERT_TRUE(reader.next(&field));
+  field.readPrefix(&cut);
+  TEST_ASSERT_EQUAL_UINT8(31, cut.days);
+  TEST_ASSERT_EQUAL_UINT8(1, cut.channels);
+  RuleV2 padded = {0, 0, 99};
+  TEST_ASSERT_TRUE(reader.next(&field));
+  field.readPrefix(&padded);
+  TEST_ASSERT_EQUAL_UINT8(127, padded.days);
+  TEST_ASSERT_EQUAL_UINT8(0, padded.jitter);
+}
+
+void test_damaged_records_are_refused() {
+  RecordWriter writer(buffer, sizeof(buffer));
+  writer.putValue<uint16_t>(7, 500);
+  const size_t size = writer.finish();
+  size_t length = 0;
+  TEST_ASSERT_TRUE(check(size, &length) != nullptr);
+  TEST_ASSERT_TRUE(check(size - 4, &length) == nullptr);  // checksum cut off
+
+  buffer[10] ^= 0x01;  // a flipped bit in a value
+  TEST_ASSERT_TRUE(check(size, &length) == nullptr);
+  buffer[10] ^= 0x01;
+  buffer[4] = shutter::storage::kRecordVersion + 1;  // framing this build does not know
+  TEST_ASSERT_TRUE(check(size, &length) == nullptr);
+
+  memset(buffer, 0xFF, sizeof(buffer));  // erased flash
+  TEST_ASSERT_TRUE(check(sizeof(buffer), &length) == nullptr);
+
+  // An entry claiming more than the payload holds ends the walk.
+  const uint8_t truncated[] = {1, 2, 0xAA, 0xBB, 2, 9, 0xCC};
+  RecordReader reader(truncated, sizeof(truncated));
+  RecordField field;
+  TEST_ASSERT_TRUE(reader.next(&field));
+  TEST_ASSERT_FALSE(reader.next(&field));
+}
+
+void test_overflow_refuses_the_whole_record() {
+  RecordWriter writer(buffer, 32);
+  TEST_ASSERT_TRUE(writer.putString(1, "owner/repo", 63));
+  TEST_ASSERT_FALSE(writer.putString(2, "a-longer-asset-name.bin", 31));
+  TEST_ASSERT_FALSE(writer.putValue<uint8_t>(3, 1));  // would fit, but the record is lost already
+  TEST_ASSERT_TRUE(writer.overflowed());
+  TEST_ASSERT_EQUAL(0, writer.finish());
+
+  uint8_t big[300] = {};
+  RecordWriter roomy(buffer, sizeof(buffer));
+  TEST_ASSERT_FALSE(roomy.put(1, big, sizeof(big)));  // longer than a length byte can say
+}
+
+void test_header_names_the_area() {
+  RecordWriter unnamed(buffer, sizeof(buffer));
+  unnamed.putValue<uint8_t>(1, 1);
+  size_t length = 0;
+  TEST_ASSERT_TRUE(check(unnamed.finish(), &length) != nullptr);
+  TEST_ASSERT_EQUAL(0, shutter::storage::recordAreaSize(buffer));
+
+  RecordWriter named(buffer, sizeof(buffer));
+  named.setAreaSize(1536);
+  named.putValue<uint8_t>(1, 1);
+  TEST_ASSERT_TRUE(check(named.finish(), &length) != nullptr);
+  TEST_ASSERT_EQUAL(1536, shutter::storage::recordAreaSize(buffer));
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fields_round_trip_in_order);
+  RUN_TEST(test_structs_grow_at_the_end);
+  RUN_TEST(test_damaged_records_are_refused);
+  RUN_TEST(test_overflow_refuses_the_whole_record);
+  RUN_TEST(test_header_names_the_area);
+  return UNITY_END();
+}
@@ -0,0 +1,121 @@
+#include <unity.h>
+
+#include <math.h>
+
+#include "StepCompensation.h"
+
+using shutter::math::CompensationParams;
+using shutter::math::DriftTuner;
+using shutter::math::StepCompensation;
+
+namespace {
+
+constexpr long kTravel = 12000;
+
+// A shade whose opening really takes |trueOpenScale| motor steps per step: closes the whole
+// travel, then opens until it meets the top stop. Returns where the model stands then.
+long runTopToTopCycle(const CompensationParams& model, float trueOpenScale, long* openedSteps) {
+  StepCompensation compensation;
+  compensation.configure(model);
+  compensation.load(-1);
+  const long closeSteps = compensation.motorSteps(kTravel);
+  compensation.settle(1, closeSteps);
+  const long toWall = lroundf(kTravel * trueOpenScale);
+  *openedSteps = compensation.logicalSteps(toWall, -1);
+  return kTravel - *openedSteps;
+}
+
+}  // namespace
+
+void test_default_is_one_to_one() {
+  StepCompensation compensation;
+  TEST_ASSERT_EQUAL_INT32(1000, compensation.motorSteps(1000));
+  TEST_ASSERT_EQUAL_INT32(1000, compensation.motorSteps(-1000));
+  compensation.settle(1, 1000);
+  TEST_ASSERT_EQUAL_INT32(700, compensation.motorSteps(-700));
+  TEST_ASSERT_EQUAL_INT32(700, compensation.logicalSteps(700, -1));
+  TEST_ASSERT_EQUAL_INT32(0, compensation.motorSteps(0));
+}
+
+void test_reversals_take_up_the_backlash() {
+  StepCompensation compensation;
+  CompensationParams params;
+  params.backlashSteps = 40;
+  compensation.configure(params);
+  // Nothing known after boot: no take-up until the gear has been loaded once.
+  TEST_ASSERT_EQUAL_INT32(1000, compensation.motorSteps(1000));
+  compensation.load(-1);  // pressed against the top stop
+  TEST_ASSERT_EQUAL_INT32(1040, compensation.motorSteps(1000));
+  TEST_ASSERT_EQUAL_INT32(1000, compensation.logicalSteps(1040, 1));
+  TEST_ASSERT_EQUAL_INT32(0, compensation.logicalSteps(30, 1));  // still in the slack
+  compensation.settle(1, 1040);
+  TEST_ASSERT_EQUAL_INT32(500, compensation.motorSteps(500));
+  TEST_ASSERT_EQUAL_INT32(540, compensation.motorSteps(-500));
+
+  // A reversal cut short leaves the rest of the slack for either direction.
+  compensation.settle(-1, 25);
+  TEST_ASSERT_EQUAL_INT32(-1, compensation.loadedDirection());
+  TEST_ASSERT_EQUAL_INT32(15, compensation.takeUpSteps(-1));
+  TEST_ASSERT_EQUAL_INT32(25, compensation.takeUpSteps(1));
+}
+
+void test_directions_scale_separately() {
+  StepCompensation compensation;
+  CompensationParams params;
+  params.openScale = 1.05f;
+  params.closeScale = 0.98f;
+  compensation.configure(params);
+  compensation.load(-1);
+  TEST_ASSERT_EQUAL_INT32(1050, compensation.motorSteps(-1000));
+  TEST_ASSERT_EQUAL_INT32(1000, compensation.logicalSteps(1050, -1));
+  TEST_ASSERT_EQUAL_INT32(980, compensation.motorSteps(1000));
+  TEST_ASSERT_EQUAL_INT32(1000, compensation.logicalSteps(980, 1));
+}
+
+void test_tuner_learns_the_open_scale() {
+  CompensationParams model;
+  DriftTuner tuner;
+  long opened = 0;
+  const long first = runTopToTopCycle(model, 1.04f, &opened);
+  TEST_ASSERT_EQUAL_INT32(-480, first);  // met the stop 480 steps past where the model put the top
+  TEST_ASSERT_TRUE(tuner.learn(first, opened, kTravel, &model));
+  TEST_ASSERT_GREATER_THAN(1000, lroundf(model.openScale * 1000.0f));
+  for (int cycle = 0; cycle < 10; ++cycle) {
+    const long residual = runTopToTopCycle(model, 1.04f, &opened);
+    tuner.learn(residual, opened, kTravel, &model);
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.002f, 1.04f, model.openScale);
+  const long last = runTopToTopCycle(model, 1.04f, &opened);
+  TEST_ASSERT_INT32_WITHIN(20, 0, last);
+
+  // Settled: the overdrive shrinks to braking distance plus margin.
+  TEST_ASSERT_TRUE(tuner.settled());
+  const long overdrive = tuner.overdriveSteps(1200, 700);
+  TEST_ASSERT_LESS_THAN(1200, overdrive);
+  TEST_ASSERT_GREATER_OR_EQUAL(700 + DriftTuner::kOverdriveMargin, overdrive);
+  tuner.missedWall();
+  TEST_ASSERT_EQUAL_INT32(1200, tuner.overdriveSteps(1200, 700));
+}
+
+void test_tuner_ignores_short_cycles_and_clamps() {
+  CompensationParams model;
+  DriftTuner tuner;
+  TEST_ASSERT_FALSE(tuner.learn(-200, kTravel / 10, kTravel, &model));  // opened too little to tell
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, 1.0f, model.openScale);
+  TEST_ASSERT_EQUAL_INT32(200, tuner.envelope());
+  TEST_ASSERT_EQUAL_INT32(1200, tuner.overdriveSteps(1200, 700));  // not settled yet
+
+  for (int i = 0; i < 20; ++i) tuner.learn(-6000, kTravel, kTravel, &model);
+  TEST_ASSERT_FLOAT_WITHIN(1e-6f, shutter::math::kMaxStepScale, model.openScale);
+  TEST_ASSERT_EQUAL_INT32(1200, tuner.overdriveSteps(1200, 700));  // residuals too large to trim
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_default_is_one_to_one);
+  RUN_TEST(test_reversals_take_up_the_backlash);
+  RUN_TEST(test_directions_scale_separately);
+  RUN_TEST(test_tuner_learns_the_open_scale);
+  RUN_TEST(test_tuner_ignores_short_cycles_and_clamps);
+  return UNITY_END();
+}
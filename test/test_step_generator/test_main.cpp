@@ -0,0 +1,257 @@
+#include <unity.h>
+
+#include "StepGenerator.h"
+
+using shutter::motion::buildSCurveRamp;
+using shutter::motion::buildTrapezoidRamp;
+using shutter::motion::halfStepMask;
+using shutter::motion::kRampTableSize;
+using shutter::motion::kTimerTicksPerUs;
+using shutter::motion::RampTable;
+using shutter::motion::SCurveRamp;
+using shutter::motion::StepGenerator;
+using shutter::motion::StepTrace;
+using shutter::motion::StepTraceSummary;
+using shutter::motion::ticksToRest;
+
+static RampTable ramp;
+
+// Runs the generator like the timer ISR does until it rests; returns the number of steps.
+static long runToRest(StepGenerator& gen, long maxSteps, uint32_t* minTicks = nullptr) {
+  long steps = 0;
+  if (minTicks) *minTicks = UINT32_MAX;
+  while (steps < maxSteps) {
+    const long before = gen.currentPosition();
+    const uint32_t ticks = gen.step();
+    if (gen.currentPosition() != before) ++steps;
+    if (ticks == 0) break;
+    if (minTicks && ticks < *minTicks) *minTicks = ticks;
+  }
+  return steps;
+}
+
+void test_half_step_sequence_wraps_for_negative_positions() {
+  TEST_ASSERT_EQUAL_UINT8(0b0001, halfStepMask(0));
+  TEST_ASSERT_EQUAL_UINT8(0b1001, halfStepMask(7));
+  TEST_ASSERT_EQUAL_UINT8(0b0001, halfStepMask(8));
+  TEST_ASSERT_EQUAL_UINT8(0b1001, halfStepMask(-1));
+}
+
+void test_ramp_is_monotonic_and_ends_at_cruise() {
+  buildTrapezoidRamp(500.0f, 600.0f, &ramp);
+  TEST_ASSERT_GREATER_THAN(1, ramp.length);
+  TEST_ASSERT_EQUAL_UINT16(1, ramp.stride);
+  for (uint16_t i = 1; i < ramp.length; ++i) {
+    TEST_ASSERT_TRUE(ramp.ticks[i] <= ramp.ticks[i - 1]);
+  }
+  const uint32_t cruiseTicks = 1000000UL * kTimerTicksPerUs / 500UL;
+  TEST_ASSERT_UINT32_WITHIN(2, cruiseTicks, ramp.ticks[ramp.length - 1]);
+}
+
+void test_long_ramp_is_strided_into_fixed_table() {
+  buildTrapezoidRamp(2500.0f, 40.0f, &ramp);
+  TEST_ASSERT_EQUAL_UINT16(kRampTableSize, ramp.length);
+  TEST_ASSERT_GREATER_THAN(1, ramp.stride);
+}
+
+void test_move_reaches_target_and_stops() {
+  buildTrapezoidRamp(700.0f, 350.0f, &ramp);
+  StepGenerator gen;
+  gen.setRampTable(&ramp);
+  gen.moveTo(5000);
+  TEST_ASSERT_TRUE(gen.isRunning());
+
+  uint32_t minTicks = 0;
+  TEST_ASSERT_EQUAL(5000L, runToRest(gen, 10000, &minTicks));
+  TEST_ASSERT_EQUAL(5000L, gen.currentPosition());
+  TEST_ASSERT_FALSE(gen.isRunning());
+  TEST_ASSERT_EQUAL(0L, static_cast<long>(gen.rampSteps()));
+  TEST_ASSERT_EQUAL_UINT32(ramp.ticks[ramp.length - 1], minTicks);
+}
+
+void test_short_move_never_reaches_cruise() {
+  buildTrapezoidRamp(2500.0f, 350.0f, &ramp);
+  StepGenerator gen;
+  gen.setRampTable(&ramp);
+  gen.moveTo(-40);
+
+  uint32_t minTicks = 0;
+  TEST_ASSERT_EQUAL(40L, runToRest(gen, 1000, &minTicks));
+  TEST_ASSERT_EQUAL(-40L, gen.currentPosition());
+  TEST_ASSERT_TRUE(minTicks > ramp.ticks[ramp.length - 1]);
+}
+
+void test_reversal_decelerates_then_returns() {
+  buildTrapezoidRamp(700.0f, 350.0f, &ramp);
+  StepGenerator gen;
+  gen.setRampTable(&ramp);
+  gen.moveTo(3000);
+  for (int i = 0; i < 1500; ++i) gen.step();
+  TEST_ASSERT_EQUAL(1500L, gen.currentPosition());
+
+  gen.moveTo(0);
+  long peak = gen.currentPosition();
+  for (int i = 0; i < 10000 && gen.isRunning(); ++i) {
+    gen.step();
+    if (gen.currentPosition() > peak) peak = gen.currentPosition();
+  }
+  TEST_ASSERT_TRUE(peak > 1500L);
+  TEST_ASSERT_EQUAL(0L, gen.currentPosition());
+  TEST_ASSERT_FALSE(gen.isRunning());
+}
+
+void test_set_current_position_halts_immediately() {
+  buildTrapezoidRamp(700.0f, 350.0f, &ramp);
+  StepGenerator gen;
+  gen.setRampTable(&ramp);
+  gen.moveTo(3000);
+  for (int i = 0; i < 500; ++i) gen.step();
+
+  gen.setCurrentPosition(gen.currentPosition());
+  const long pos = gen.currentPosition();
+  TEST_ASSERT_EQUAL_UINT32(0, gen.step());
+  TEST_ASSERT_EQUAL(pos, gen.currentPosition());
+  TEST_ASSERT_FALSE(gen.isRunning());
+}
+
+void test_scurve_position_curve_is_continuous() {
+  const SCurveRamp curve(700.0f, 350.0f, 2500.0f);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 350.0f, curve.peakAccel);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 2.14f, curve.totalSec);  // V/A + A/J
+  TEST_ASSERT_FLOAT_WITHIN(0.5f, 749.0f, curve.steps);
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, curve.jerkSec, curve.timeAt(curve.jerkSteps));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, curve.totalSec, curve.timeAt(curve.steps));
+  float previous = 0.0f;
+  for (float s = 1.0f; s < curve.steps; s += 1.0f) {
+    const float t = curve.timeAt(s);
+    TEST_ASSERT_TRUE(t > previous);
+    previous = t;
+  }
+}
+
+void test_scurve_starts_softer_and_ends_at_cruise() {
+  RampTable trapezoid;
+  buildTrapezoidRamp(700.0f, 350.0f, &trapezoid);
+  buildSCurveRamp(700.0f, 350.0f, 2500.0f, 0, &ramp);
+  TEST_ASSERT_GREATER_THAN(trapezoid.ticks[0], ramp.ticks[0]);
+  for (uint16_t i = 1; i < ramp.length; ++i) {
+    TEST_ASSERT_TRUE(ramp.ticks[i] <= ramp.ticks[i - 1]);
+  }
+  const uint32_t cruiseTicks = 1000000UL * kTimerTicksPerUs / 700UL;
+  TEST_ASSERT_UINT32_WITHIN(2, cruiseTicks, ramp.ticks[ramp.length - 1]);
+  // Near the top the jerk phase flattens the approach to cruise speed.
+  TEST_ASSERT_UINT32_WITHIN(cruiseTicks / 50, cruiseTicks, ramp.ticks[ramp.length - 2]);
+}
+
+void test_short_move_scurve_fits_ramp_in_half_the_move() {
+  buildSCurveRamp(700.0f, 350.0f, 2500.0f, 200, &ramp);
+  const uint32_t rampSteps = static_cast<uint32_t>(ramp.length - 1) * ramp.stride;
+  TEST_ASSERT_LESS_OR_EQUAL(101, rampSteps);
+
+  StepGenerator gen;
+  gen.setRampTable(&ramp);
+  gen.moveTo(200);
+  uint32_t minTicks = 0;
+  TEST_ASSERT_EQUAL(200L, runToRest(gen, 1000, &minTicks));
+  TEST_ASSERT_EQUAL(200L, gen.currentPosition());
+  TEST_ASSERT_EQUAL_UINT32(ramp.ticks[ramp.length - 1], minTicks);
+  TEST_ASSERT_GREATER_THAN(1000000UL * kTimerTicksPerUs / 700UL, minTicks);
+}
+
+void test_rebase_keeps_speed_and_reaches_faster_cruise() {
+  static RampTable shortRamp;
+  buildSCurveRamp(700.0f, 350.0f, 2500.0f, 400, &shortRamp);
+  buildSCurveRamp(700.0f, 350.0f, 2500.0f, 0, &ramp);
+  StepGenerator gen;
+  gen.setRampTable(&shortRamp);
+  gen.moveTo(400);
+  uint32_t ticks = 0;
+  for (int i = 0; i < 150; ++i) ticks = gen.step();
+
+  gen.rebaseRamp(&ramp);
+  gen.moveTo(5000);
+  const uint32_t next = gen.step();
+  // The speed carries over: no jump back to the start of the ramp, no leap ahead.
+  TEST_ASSERT_TRUE(next <= ticks);
+  TEST_ASSERT_TRUE(next * 11 >= ticks * 10);
+
+  uint32_t minTicks = 0;
+  runToRest(gen, 10000, &minTicks);
+  TEST_ASSERT_EQUAL(5000L, gen.currentPosition());
+  TEST_ASSERT_EQUAL_UINT32(ramp.ticks[ramp.length - 1], minTicks);
+}
+
+// Sum of the intervals a generator actually waits, from where it is until it rests.
+static uint64_t measureTicksToRest(StepGenerator& gen) {
+  uint64_t total = 0;
+  for (int i = 0; i < 100000; ++i) {
+    const uint32_t ticks = gen.step();
+    if (ticks == 0) break;
+    total += ticks;
+  }
+  return total;
+}
+
+void test_ticks_to_rest_matches_the_generator() {
+  buildSCurveRamp(700.0f, 350.0f, 2500.0f, 0, &ramp);
+  const long moves[] = {60, 700, 6000};
+  for (long move : moves) {
+    StepGenerator gen;
+    gen.setRampTable(&ramp);
+    gen.moveTo(move);
+    const uint64_t measured = measureTicksToRest(gen);
+    const uint64_t planned = ticksToRest(ramp, 0, static_cast<uint32_t>(move));
+    TEST_ASSERT_UINT32_WITHIN(static_cast<uint32_t>(measured / 20), static_cast<uint32_t>(measured),
+                              static_cast<uint32_t>(planned));
+  }
+
+  // Mid-move: part of the ramp already behind.
+  buildTrapezoidRamp(700.0f, 350.0f, &ramp);
+  StepGenerator gen;
+  gen.setRampTable(&ramp);
+  gen.moveTo(3000);
+  for (int i = 0; i < 300; ++i) gen.step();
+  const uint64_t planned = ticksToRest(ramp, gen.rampSteps(), static_cast<uint32_t>(gen.distanceToGo()));
+  const uint64_t measured = measureTicksToRest(gen);
+  TEST_ASSERT_UINT32_WITHIN(static_cast<uint32_t>(measured / 20), static_cast<uint32_t>(measured),
+                            static_cast<uint32_t>(planned));
+  TEST_ASSERT_EQUAL(0, static_cast<int>(ticksToRest(ramp, 0, 0)));
+}
+
+void test_trace_reports_jitter_against_schedule() {
+  StepTrace<8> trace;
+  const uint32_t cyclesPerUs = 80;
+  trace.record(0, 500 * kTimerTicksPerUs);
+  trace.record(500 * cyclesPerUs, 500 * kTimerTicksPerUs);
+  trace.record(1530 * cyclesPerUs, 500 * kTimerTicksPerUs);
+  trace.record(2030 * cyclesPerUs, 0);
+
+  TEST_ASSERT_EQUAL_UINT16(3, trace.size());
+  const StepTraceSummary summary = trace.summarize(cyclesPerUs);
+  TEST_ASSERT_EQUAL_UINT32(500, summary.minUs);
+  TEST_ASSERT_EQUAL_UINT32(1030, summary.maxUs);
+  TEST_ASSERT_EQUAL_UINT32(530, summary.maxJitterUs);
+  TEST_ASSERT_EQUAL_UINT32(1030, trace.intervalUs(1, cyclesPerUs));
+
+  // A stop clears the pending schedule, so idle time is never counted as an interval.
+  trace.record(900000 * cyclesPerUs, 500 * kTimerTicksPerUs);
+  TEST_ASSERT_EQUAL_UINT16(3, trace.size());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_half_step_sequence_wraps_for_negative_positions);
+  RUN_TEST(test_ramp_is_monotonic_and_ends_at_cruise);
+  RUN_TEST(test_long_ramp_is_strided_into_fixed_table);
+  RUN_TEST(test_move_reaches_target_and_stops);
+  RUN_TEST(test_short_move_never_reaches_cruise);
+  RUN_TEST(test_reversal_decelerates_then_returns);
+  RUN_TEST(test_set_current_position_halts_immediately);
+  RUN_TEST(test_scurve_position_curve_is_continuous);
+  RUN_TEST(test_scurve_starts_softer_and_ends_at_cruise);
+  RUN_TEST(test_short_move_scurve_fits_ramp_in_half_the_move);
+  RUN_TEST(test_rebase_keeps_speed_and_reaches_faster_cruise);
+  RUN_TEST(test_ticks_to_rest_matches_the_generator);
+  RUN_TEST(test_trace_reports_jitter_against_schedule);
+  return UNITY_END();
+}
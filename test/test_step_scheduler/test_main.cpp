@@ -0,0 +1,168 @@
+#include <unity.h>
+
+#include <vector>
+
+#include "StepScheduler.h"
+
+using shutter::motion::buildTrapezoidRamp;
+using shutter::motion::kStepCoalesceTicks;
+using shutter::motion::RampTable;
+using shutter::motion::StepGenerator;
+using shutter::motion::StepScheduler;
+
+static RampTable fastRamp;
+static RampTable slowRamp;
+
+// Timer model: the scheduler's delay is programmed at |now| and expires after that many ticks.
+struct TimerRig {
+  StepScheduler<3> scheduler;
+  StepGenerator gens[3];
+  std::vector<uint64_t> stepTimes[3];
+  uint64_t now = 0;
+  uint64_t expiresAt = 0;
+  bool armed = false;
+
+  void program(uint32_t ticks) {
+    if (ticks == 0) return;
+    expiresAt = now + ticks;
+    armed = true;
+  }
+
+  void start(uint8_t channel, long target, uint32_t kick) {
+    gens[channel].moveTo(target);
+    const uint32_t remaining = armed ? static_cast<uint32_t>(expiresAt - now) : 0;
+    program(scheduler.start(channel, kick, remaining));
+  }
+
+  // Runs expiries until no channel is left or |until| is reached.
+  void runUntil(uint64_t until) {
+    while (armed && expiresAt <= until) {
+      now = expiresAt;
+      armed = false;
+      program(scheduler.run([this](uint8_t i) {
+        stepTimes[i].push_back(now);
+        return gens[i].step();
+      }));
+    }
+    if (now < until) now = until;
+  }
+};
+
+// Step times of one generator on its own timer.
+static std::vector<uint64_t> soloStepTimes(const RampTable* table, long target, uint32_t kick) {
+  StepGenerator gen;
+  gen.setRampTable(table);
+  gen.moveTo(target);
+  std::vector<uint64_t> times;
+  uint64_t t = kick;
+  for (;;) {
+    times.push_back(t);
+    const uint32_t next = gen.step();
+    if (next == 0) break;
+    t += next;
+  }
+  return times;
+}
+
+void setUp() {
+  buildTrapezoidRamp(900.0f, 600.0f, &fastRamp);
+  buildTrapezoidRamp(400.0f, 200.0f, &slowRamp);
+}
+
+void test_single_channel_matches_solo_timing() {
+  TimerRig rig;
+  rig.gens[0].setRampTable(&fastRamp);
+  rig.start(0, 800, 50);
+  rig.runUntil(UINT64_MAX);
+
+  const std::vector<uint64_t> solo = soloStepTimes(&fastRamp, 800, 50);
+  TEST_ASSERT_EQUAL(solo.size(), rig.stepTimes[0].size());
+  for (size_t i = 0; i < solo.size(); ++i) TEST_ASSERT_EQUAL_UINT64(solo[i], rig.stepTimes[0][i]);
+  TEST_ASSERT_EQUAL(800L, rig.gens[0].currentPosition());
+  TEST_ASSERT_FALSE(rig.scheduler.anyActive());
+}
+
+void test_two_channels_interleave_on_one_timer() {
+  TimerRig rig;
+  rig.gens[0].setRampTable(&fastRamp);
+  rig.gens[1].setRampTable(&slowRamp);
+  rig.start(0, 1200, 50);
+  rig.start(1, -700, 50);
+  rig.runUntil(UINT64_MAX);
+
+  TEST_ASSERT_EQUAL(1200L, rig.gens[0].currentPosition());
+  TEST_ASSERT_EQUAL(-700L, rig.gens[1].currentPosition());
+  const std::vector<uint64_t> fast = soloStepTimes(&fastRamp, 1200, 50);
+  const std::vector<uint64_t> slow = soloStepTimes(&slowRamp, -700, 50);
+  TEST_ASSERT_EQUAL(fast.size(), rig.stepTimes[0].size());
+  TEST_ASSERT_EQUAL(slow.size(), rig.stepTimes[1].size());
+  // Coalescing may pull a step forward by at most the window; it never accumulates.
+  for (size_t i = 0; i < fast.size(); ++i) {
+    TEST_ASSERT_TRUE(rig.stepTimes[0][i] <= fast[i]);
+    TEST_ASSERT_TRUE(fast[i] - rig.stepTimes[0][i] <= kStepCoalesceTicks);
+  }
+  for (size_t i = 0; i < slow.size(); ++i) {
+    TEST_ASSERT_TRUE(rig.stepTimes[1][i] <= slow[i]);
+    TEST_ASSERT_TRUE(slow[i] - rig.stepTimes[1][i] <= kStepCoalesceTicks);
+  }
+}
+
+void test_late_start_reprograms_a_long_pending_delay() {
+  TimerRig rig;
+  rig.gens[0].setRampTable(&slowRamp);
+  rig.gens[2].setRampTable(&fastRamp);
+  rig.start(0, 50, 50);
+  rig.runUntil(100);  // first step done; the next one is milliseconds away
+  const uint64_t channel0Next = rig.expiresAt;
+  TEST_ASSERT_TRUE(channel0Next > 10000);
+
+  rig.start(2, 40, 50);
+  TEST_ASSERT_EQUAL_UINT64(rig.now + 50, rig.expiresAt);
+  rig.runUntil(rig.now + 50);
+  TEST_ASSERT_EQUAL(1U, rig.stepTimes[2].size());
+  // Channel 0 keeps its original deadline.
+  rig.runUntil(channel0Next);
+  TEST_ASSERT_EQUAL(2U, rig.stepTimes[0].size());
+  TEST_ASSERT_EQUAL_UINT64(channel0Next, rig.stepTimes[0][1]);
+}
+
+void test_start_joins_an_imminent_expiry() {
+  TimerRig rig;
+  rig.gens[0].setRampTable(&fastRamp);
+  rig.gens[1].setRampTable(&fastRamp);
+  rig.start(0, 100, 50);
+  rig.runUntil(rig.expiresAt - 20);
+
+  const uint64_t pending = rig.expiresAt;
+  rig.start(1, 100, 50);
+  TEST_ASSERT_EQUAL_UINT64(pending, rig.expiresAt);
+  rig.runUntil(pending);
+  TEST_ASSERT_EQUAL(1U, rig.stepTimes[1].size());
+  TEST_ASSERT_EQUAL_UINT64(pending, rig.stepTimes[1][0]);
+}
+
+void test_stopped_channel_leaves_the_schedule() {
+  TimerRig rig;
+  rig.gens[0].setRampTable(&fastRamp);
+  rig.gens[1].setRampTable(&fastRamp);
+  rig.start(0, 5000, 50);
+  rig.start(1, 5000, 50);
+  rig.runUntil(200000);
+  // Immediate stop, as stopMotor() does: the generator rests on its next call.
+  rig.gens[1].setCurrentPosition(rig.gens[1].currentPosition());
+  const size_t stepsAtStop = rig.stepTimes[1].size();
+  rig.runUntil(400000);
+  TEST_ASSERT_FALSE(rig.scheduler.isActive(1));
+  TEST_ASSERT_TRUE(rig.scheduler.isActive(0));
+  TEST_ASSERT_EQUAL(stepsAtStop + 1, rig.stepTimes[1].size());
+}
+
+int main(int argc, char** argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_single_channel_matches_solo_timing);
+  RUN_TEST(test_two_channels_interleave_on_one_timer);
+  RUN_TEST(test_late_start_reprograms_a_long_pending_delay);
+  RUN_TEST(test_start_joins_an_imminent_expiry);
+  RUN_TEST(test_stopped_channel_leaves_the_schedule);
+  return UNITY_END();
+}